@@ -365,7 +365,8 @@ namespace AXIOME {
 		public HashMap<string, string> vars { get; private set; }
 		Set<string> pcoa;
 		Set<int> rareified;
-		Set<string> summarized_otus;
+		HashMap<string, Set<int>> summarized_otus;
+		HashMap<string, Set<string>> distance_matrices;
 		StringBuilder targets = new StringBuilder();
 		ArrayList<Xml.Doc*> doc_list;
 		internal bool verbose;
@@ -378,11 +379,12 @@ namespace AXIOME {
 			makerules = new StringBuilder();
 			samples = new ArrayList<Sample>();
 			seqrule = new StringBuilder();
-			seqrule.printf("\t@echo Building sequence set...\n\t@test -d logs || mkdir logs\n\t@test ! -f seq.fasta || rm seq.fasta\n\t@test ! -f seq.group || rm seq.group\n");
+			seqrule.printf("\t@echo Building sequence set...\n\t@test -d logs || mkdir logs\n\t@rm -f logs/seq_*.failed\n\t@test ! -f seq.fasta || rm seq.fasta\n\t@test ! -f seq.group || rm seq.group\n");
 			seqsources = new StringBuilder();
 			pcoa = new HashSet<string>();
 			rareified = new HashSet<int>();
-			summarized_otus = new HashSet<string>();
+			summarized_otus = new HashMap<string, Set<int>>();
+			distance_matrices = new HashMap<string, Set<string>>();
 			targets = new StringBuilder();
 			vars = new HashMap<string, string>();
 			doc_list = new ArrayList<Xml.Doc*>();
@@ -552,6 +554,9 @@ namespace AXIOME {
 			//Print out the stats for the sample file
 			makefile.printf("\t$(V)awk '{ if (NR == 1) { print \"Sample\\tBarcode\\tSequences Contributed\\n\" } if (min == \"\") { min = max = $$3 }; if ( $$3 > max ) { max = $$3 }; if ( $$3 < min ) { min = $$3 }; total += $$3; count += 1; print; } END { print \"\\nAverage Sequences Contributed: \" total/count \"\\nSmallest Sequences Contributed: \" min \"\\nLargest Sequences Contributed: \" max }' sample_reads_temp.log > sample_reads.log\n\n");
 			makefile.printf("\t$(V)rm sample_reads_temp.log\n\n");
+			make_rarefied_rules();
+			make_summarized_rules();
+			make_distance_rules();
 			makefile.printf("%s.PHONY: all\n\ninclude %s/aq-base\n", makerules.str, BINDIR);
 			makefile.printf("include %s/aq-qiime-base\n", BINDIR);
 			makefile.printf("include %s/aq-mothur-base\n", BINDIR);
@@ -560,35 +565,165 @@ namespace AXIOME {
 			return true;
 		}
 
+		/**
+		 * Add a rule that makes several files from an OTU table with one command.
+		 *
+		 * Make runs a pattern rule with several targets once for all of them, so each target is written as a pattern, with % in place of the dot before its extension.
+		 *
+		 * The command reads the binary copy of the OTU table, which aq-base makes from the text one, so that it is mapped rather than parsed.
+		 *
+		 * @param table the OTU table, without its extension.
+		 * @param command the command, which is given the OTU table followed by //key//://target// for each target.
+		 * @param keys what the command is to make of the OTU table for each target.
+		 * @param message what to print when the rule runs.
+		 */
+		void add_grouped_rule(string table, string command, string[] keys, string[] targets, string message) {
+			var patterns = new StringBuilder();
+			var outputs = new StringBuilder();
+			for (var it = 0; it < targets.length; it++) {
+				var dot = targets[it].last_index_of(".");
+				patterns.append_printf("%s%%%s ", targets[it].substring(0, dot), targets[it].substring(dot + 1));
+				outputs.append_printf(" %s:%s", keys[it], targets[it]);
+			}
+			makerules.append_printf("%s: %s%%aqotu\n\t@echo %s\n\t$(V)%s %s.aqotu%s\n\n", patterns.str.strip(), table, message, command, table, outputs.str);
+		}
+
 		/**
 		 * Generate a summarized OTU table
 		 *
+		 * The rules are written with the Makefile, so that every level is made from one reading of the OTU table.
+		 *
 		 * @param level the taxonomic level at which to summarise.
 		 * @param flavour an optional part of the filename if you have some extra information to convey (e.g., rarefication depth).
 		 */
 		public void make_summarized_otu(TaxonomicLevel level, string flavour) {
-			var taxname = level.to_string();
-			var taxindex = (int) level;
-			var type = @"$(taxname)$(flavour)";
-			if (!(type in summarized_otus)) {
-				summarized_otus.add(type);
-				if (is_version_at_least(1, 3)) {
-					makerules.append(@"otu_table_summarized_$(taxname)$(flavour).txt: otu_table$(flavour).txt\n\t@echo Summarizing OTU table $(flavour) to $(taxname)-level...\n\t$$(V)$$(QIIME_PREFIX)summarize_taxa.py -i otu_table$(flavour).txt -L $(taxindex) -o . -a\n\t@mv otu_table$(flavour)_L$(taxindex).txt otu_table_summarized_$(taxname)$(flavour).txt\n\n");
-				} else {
-					makerules.append(@"otu_table_summarized_$(taxname)$(flavour).txt: otu_table$(flavour).txt\n\t@echo Summarizing OTU table $(flavour) to $(taxname)-level...\n\t$$(V)$$(QIIME_PREFIX)summarize_taxa.py -i otu_table$(flavour).txt -L $(taxindex) -o otu_table_summarized_$(taxname)$(flavour).txt -a\n\n");
+			if (!summarized_otus.has_key(flavour)) {
+				summarized_otus[flavour] = new HashSet<int>();
+			}
+			summarized_otus[flavour].add((int) level);
+		}
+
+		void make_summarized_rules() {
+			foreach (var entry in summarized_otus.entries) {
+				var flavour = entry.key;
+				string[] levels = {};
+				string[] targets = {};
+				var names = new StringBuilder();
+				foreach (var level in sort_numbers(entry.value)) {
+					var taxname = ((TaxonomicLevel) level).to_string();
+					levels += level.to_string();
+					targets += @"otu_table_summarized_$(taxname)$(flavour).txt";
+					names.append(@" $(taxname)");
 				}
+				add_grouped_rule(@"otu_table$(flavour)", "aq-summarize", levels, targets, @"Summarizing OTU table $(flavour) to$(names.str)-level...");
 			}
 		}
 
 		/**
 		 * Generate rareified OTU tables
+		 *
+		 * The rules are written with the Makefile, so that every size is made from one reading of the OTU table.
 		 */
 		public void make_rarefied(int size) {
-			if (size in rareified) {
+			rareified.add(size);
+		}
+
+		static int[] sort_numbers(Collection<int> numbers) {
+			int[] sorted = {};
+			foreach (var number in numbers) {
+				var it = sorted.length;
+				sorted += number;
+				while (it > 0 && sorted[it - 1] > number) {
+					sorted[it] = sorted[it - 1];
+					it--;
+				}
+				sorted[it] = number;
+			}
+			return sorted;
+		}
+
+		void make_rarefied_rules() {
+			if (rareified.size == 0) {
 				return;
 			}
-			rareified.add(size);
-			makerules.append(@"otu_table_$(size).txt: otu_table.txt\n\tRareifying OTU table to $(size) sequences...\n\t$$(V)$$(QIIME_PREFIX)single_rarefaction.py -i otu_table.txt -o otu_table_auto.txt -d $(size) $(is_version_at_least(1, 3) ? "" : "--lineages_included")\n\n");
+			var sizes = sort_numbers(rareified);
+			/* QIIME 1.5 and later need a BIOM table, which is converted from the tab-delimited one. */
+			var extension = is_version_at_least(1, 5) ? "tab" : "txt";
+			string[] depths = {};
+			string[] targets = {};
+			foreach (var size in sizes) {
+				depths += size.to_string();
+				targets += @"otu_table_$(size).$(extension)";
+			}
+			var names = string.joinv(" ", depths);
+			add_grouped_rule("otu_table", "aq-rarefy -t $(NUM_CORES)", depths, targets, @"Rareifying OTU table to $(names) sequences...");
+			if (!is_version_at_least(1, 5)) {
+				return;
+			}
+			foreach (var size in sizes) {
+				if (is_version_at_least(1, 8)) {
+					makerules.append(@"otu_table_$(size).txt: otu_table_$(size).tab\n\t@echo Creating BIOM OTU table rareified to $(size) sequences...\n\t@if [ -f otu_table_$(size).txt ]; then rm otu_table_$(size).txt; fi\n\t$$(V)$$(QIIME_PREFIX)biom convert -i otu_table_$(size).tab -o otu_table_$(size).txt --table-type=\"otu table\" --process-obs-metadata=taxonomy\n\n");
+				} else {
+					makerules.append(@"otu_table_$(size).txt: otu_table_$(size).tab\n\t@echo Creating BIOM OTU table rareified to $(size) sequences...\n\t$$(V)$$(QIIME_PREFIX)convert_biom.py -i otu_table_$(size).tab -o otu_table_$(size).txt --biom_table_type=\"otu table\" --process_obs_metadata=taxonomy\n\n");
+				}
+			}
+		}
+
+		/**
+		 * The distance methods aq-distmatrix can compute, by their names in vegan.
+		 */
+		const string[] NATIVE_DISTANCES = { "bray", "canberra", "euclidean", "hellinger", "jaccard", "kulczynski" };
+
+		/**
+		 * Generate a matrix of the distances between samples
+		 *
+		 * The rules are written with the Makefile, so that every method is computed from one reading of the OTU table. The matrix is called distance//flavour//_//method//.txt.
+		 *
+		 * @param method the name of the distance method in vegan.
+		 * @param flavour an optional part of the filename if you have some extra information to convey (e.g., rarefication depth).
+		 * @return false if the method cannot be computed outside of R.
+		 */
+		public bool make_distance_matrix(string method, string flavour) {
+			if (!(method in NATIVE_DISTANCES)) {
+				return false;
+			}
+			if (!distance_matrices.has_key(flavour)) {
+				distance_matrices[flavour] = new TreeSet<string>();
+			}
+			distance_matrices[flavour].add(method);
+			return true;
+		}
+
+		/**
+		 * Use a natively computed distance matrix in an R script, if the method allows it.
+		 *
+		 * The matrix is made from the OTU table of the given flavour.
+		 *
+		 * @param method the name of the distance method in vegan.
+		 * @param prerequisite set to the matrix, with a leading space, to add to the rule's prerequisites, or to the empty string.
+		 * @return the option, with a leading space, telling the script to read the matrix, or the empty string if R must compute the distances itself.
+		 */
+		public string distance_matrix_option(string method, string flavour, out string prerequisite) {
+			if (!make_distance_matrix(method, flavour)) {
+				prerequisite = "";
+				return "";
+			}
+			prerequisite = @" distance$(flavour)_$(method).txt";
+			return @" -D distance$(flavour)_$(method).txt";
+		}
+
+		void make_distance_rules() {
+			foreach (var entry in distance_matrices.entries) {
+				var flavour = entry.key;
+				string[] methods = {};
+				string[] targets = {};
+				foreach (var method in entry.value) {
+					methods += method;
+					targets += @"distance$(flavour)_$(method).txt";
+				}
+				var names = string.joinv(" ", methods);
+				add_grouped_rule(@"otu_table$(flavour)", "aq-distmatrix -t $(NUM_CORES)", methods, targets, @"Computing $(names) distances between samples $(flavour)...");
+			}
 		}
 
 		/**
@@ -684,7 +819,10 @@ namespace AXIOME {
 				awkcheck.append_printf(" if (count%d == 0) { print \"Library defined in %s:%d contributed no sequences. This is probably not what you want.\" > \"/dev/stderr\"; print \"%d\\tWarning: %s contributed no sequences to library\" >> \"sample_reads_temp.log\" } else { ", sample.id, sample.xml-> doc-> url, sample.xml-> line, sample.id, sample.tag);
 				awkcheck.append_printf("print \"%d\\t%s\\t\" count%d >> \"sample_reads_temp.log\" }", sample.id, sample.tag, sample.id);
 			}
-			seqrule.append_printf("\t$(V)(%s | awk '/^>/ { if (seq) {%s } name = substr($$0, 2); seq = \"\"; } $$0 !~ /^>/ { seq = seq $$0; } END { if (seq) {%s }%s }' >> seq.fasta) 2>&1 | bzip2 > logs/seq_%d.log.bz2\n\n", prep, awkprint.str, awkprint.str, awkcheck.str, sequence_preparations++);
+			/* Only the last command in a pipeline decides whether the recipe fails, so a failing preparation is noted in a file and checked afterward. */
+			var id = sequence_preparations++;
+			seqrule.append_printf("\t$(V)( ( (%s) || touch logs/seq_%d.failed) | awk '/^>/ { if (seq) {%s } name = substr($$0, 2); seq = \"\"; } $$0 !~ /^>/ { seq = seq $$0; } END { if (seq) {%s }%s }' >> seq.fasta) 2>&1 | bzip2 > logs/seq_%d.log.bz2\n", prep, id, awkprint.str, awkprint.str, awkcheck.str, id);
+			seqrule.append_printf("\t@if test -f logs/seq_%d.failed; then rm logs/seq_%d.failed; echo Preparing sequences failed. See logs/seq_%d.log.bz2 for details.; exit 1; fi\n\n", id, id, id);
 		}
 
 		/**
@@ -0,0 +1,231 @@
+/* Constant-time assignment of index tags to samples, tolerating mismatches */
+#include<errno.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include "barcode.h"
+
+/* Packing codes; zero is never used, so the length of a tag is implicit in its key. */
+#define CODE_INVALID 0
+#define CODE_JOIN 6
+static const char bases[] = "ACGTN";
+
+/* When several samples are equally close, sample is the first of them. */
+typedef struct {
+	uint64_t key;
+	int32_t sample;
+	int16_t distance;
+	bool ambiguous;
+} barcodeentry;
+
+struct barcodeindex {
+	barcodeentry *entries;
+	size_t mask;
+	int bits;
+};
+
+static int base_code(char c)
+{
+	switch (c) {
+	case 'A':
+		return 1;
+	case 'C':
+		return 2;
+	case 'G':
+		return 3;
+	case 'T':
+		return 4;
+	case 'N':
+		return 5;
+	case '+':
+		return CODE_JOIN;
+	default:
+		return CODE_INVALID;
+	}
+}
+
+/* Pack a tag into a key. Returns 0 if it cannot be packed. */
+static uint64_t barcode_pack(const char *tag, size_t len)
+{
+	uint64_t key = 0;
+	size_t i;
+	if (len == 0 || len > BARCODE_MAX_LENGTH) {
+		return 0;
+	}
+	for (i = 0; i < len; i++) {
+		int code = base_code(tag[i]);
+		if (code == CODE_INVALID) {
+			return 0;
+		}
+		key = (key << 3) | code;
+	}
+	return key;
+}
+
+static barcodeentry *barcode_slot(const barcodeindex *index, uint64_t key)
+{
+	size_t slot = (key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - index->bits);
+	while (index->entries[slot].key != 0 && index->entries[slot].key != key) {
+		slot = (slot + 1) & index->mask;
+	}
+	return &index->entries[slot];
+}
+
+static void barcode_insert(barcodeindex *index, uint64_t key, int sample,
+			   int distance)
+{
+	barcodeentry *entry = barcode_slot(index, key);
+	if (entry->key == 0 || distance < entry->distance) {
+		entry->key = key;
+		entry->sample = sample;
+		entry->distance = distance;
+		entry->ambiguous = false;
+	} else if (distance == entry->distance && sample != entry->sample) {
+		entry->ambiguous = true;
+	}
+}
+
+/* Insert a tag and, recursively, every substitution of it at or after the given position. */
+static void barcode_neighbours(barcodeindex *index, char *tag, size_t len,
+			       size_t start, int sample, int distance,
+			       int mismatches)
+{
+	size_t i;
+	barcode_insert(index, barcode_pack(tag, len), sample, distance);
+	if (distance == mismatches) {
+		return;
+	}
+	for (i = start; i < len; i++) {
+		char original = tag[i];
+		const char *base;
+		if (original == '+') {
+			continue;
+		}
+		for (base = bases; *base != '\0'; base++) {
+			if (*base == original) {
+				continue;
+			}
+			tag[i] = *base;
+			barcode_neighbours(index, tag, len, i + 1, sample,
+					   distance + 1, mismatches);
+		}
+		tag[i] = original;
+	}
+}
+
+static int hamming(const char *a, const char *b, size_t len)
+{
+	int distance = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		distance += a[i] != b[i];
+	}
+	return distance;
+}
+
+barcodeindex *barcode_new(const char *const *tags, size_t count,
+			  int mismatches, barcodecollision collision,
+			  void *context)
+{
+	barcodeindex *index;
+	size_t entries = 0;
+	size_t i, j;
+	if (mismatches < 0 || mismatches > 2) {
+		errno = EINVAL;
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		size_t len = strlen(tags[i]);
+		if (barcode_pack(tags[i], len) == 0) {
+			errno = EINVAL;
+			return NULL;
+		}
+		entries += 1;
+		if (mismatches > 0) {
+			entries += len * 4;
+		}
+		if (mismatches > 1) {
+			entries += len * (len - 1) / 2 * 16;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		for (j = i + 1; j < count; j++) {
+			size_t len = strlen(tags[i]);
+			int distance;
+			if (strlen(tags[j]) != len || collision == NULL) {
+				continue;
+			}
+			distance = hamming(tags[i], tags[j], len);
+			if (distance <= 2 * mismatches) {
+				collision(i, j, distance, context);
+			}
+		}
+	}
+
+	index = calloc(1, sizeof(barcodeindex));
+	if (index == NULL) {
+		return NULL;
+	}
+	/* Keep the table at most half full so probe sequences stay short. */
+	for (index->bits = 4; ((size_t)1 << index->bits) < 2 * entries;
+	     index->bits++) ;
+	index->mask = ((size_t)1 << index->bits) - 1;
+	index->entries = calloc(index->mask + 1, sizeof(barcodeentry));
+	if (index->entries == NULL) {
+		free(index);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		char tag[BARCODE_MAX_LENGTH + 1];
+		strcpy(tag, tags[i]);
+		barcode_neighbours(index, tag, strlen(tag), 0, i, 0,
+				   mismatches);
+	}
+	return index;
+}
+
+/* Find a tag's entry, or NULL if it is not within range of any sample. */
+static const barcodeentry *barcode_find(const barcodeindex *index,
+					const char *tag, size_t len)
+{
+	uint64_t key = barcode_pack(tag, len);
+	const barcodeentry *entry;
+	if (key == 0) {
+		return NULL;
+	}
+	entry = barcode_slot(index, key);
+	return entry->key == 0 ? NULL : entry;
+}
+
+int barcode_lookup(const barcodeindex *index, const char *tag, size_t len,
+		   int *distance)
+{
+	const barcodeentry *entry = barcode_find(index, tag, len);
+	if (entry == NULL) {
+		return BARCODE_UNKNOWN;
+	}
+	if (distance != NULL) {
+		*distance = entry->distance;
+	}
+	return entry->ambiguous ? BARCODE_AMBIGUOUS : entry->sample;
+}
+
+int barcode_nearest(const barcodeindex *index, const char *tag, size_t len,
+		    int *distance)
+{
+	const barcodeentry *entry = barcode_find(index, tag, len);
+	if (entry == NULL) {
+		return BARCODE_UNKNOWN;
+	}
+	if (distance != NULL) {
+		*distance = entry->distance;
+	}
+	return entry->sample;
+}
+
+void barcode_free(barcodeindex *index)
+{
+	free(index->entries);
+	free(index);
+}
@@ -0,0 +1,33 @@
+/* Constant-time assignment of index tags to samples, tolerating mismatches */
+#ifndef AXIOME_BARCODE_H
+#define AXIOME_BARCODE_H
+#include<stddef.h>
+
+/* Tags are packed three bits to a base, so they can be at most this long. */
+#define BARCODE_MAX_LENGTH 21
+
+#define BARCODE_UNKNOWN -1
+#define BARCODE_AMBIGUOUS -2
+
+typedef struct barcodeindex barcodeindex;
+
+/* Called for each pair of tags within 2 * mismatches of one another. Reads equally close to both cannot be assigned. */
+typedef void (*barcodecollision) (size_t first, size_t second, int distance,
+				  void *context);
+
+/*
+ * Build an index of every sequence within the given Hamming distance (0, 1 or 2) of each tag. Tags may contain A, C, G, T and N, and the + that joins dual indices; a read's tag may differ from a sample's only at bases.
+ *
+ * Returns NULL and sets errno if a tag is too long, contains other characters, or memory runs out.
+ */
+barcodeindex *barcode_new(const char *const *tags, size_t count,
+			  int mismatches, barcodecollision collision,
+			  void *context);
+/* Find the sample a tag belongs to. Returns its index, BARCODE_UNKNOWN or BARCODE_AMBIGUOUS. Unless unknown, distance is set to the number of mismatches. */
+int barcode_lookup(const barcodeindex *index, const char *tag, size_t len,
+		   int *distance);
+/* As barcode_lookup, but when several samples are equally close, return the first of them rather than BARCODE_AMBIGUOUS. */
+int barcode_nearest(const barcodeindex *index, const char *tag, size_t len,
+		    int *distance);
+void barcode_free(barcodeindex *index);
+#endif
@@ -0,0 +1,260 @@
+/* Vectorised scans over the bases and qualities of a read */
+#include<pthread.h>
+#include<string.h>
+#include "bases.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASES_X86 1
+#include<immintrin.h>
+#endif
+
+/* Plain C versions; these also finish off whatever is left after the last full vector. */
+static uint64_t scalar_mask(const char *seq, size_t len, char c)
+{
+	uint64_t mask = 0;
+	size_t i;
+	if (len > 64) {
+		len = 64;
+	}
+	for (i = 0; i < len; i++) {
+		mask |= (uint64_t) (seq[i] == c) << i;
+	}
+	return mask;
+}
+
+static size_t scalar_count(const char *seq, size_t len, char c)
+{
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		count += seq[i] == c;
+	}
+	return count;
+}
+
+static void scalar_composition(const char *seq, size_t len,
+			       basecounts *counts)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		switch (seq[i]) {
+		case 'A':
+			counts->a++;
+			break;
+		case 'C':
+			counts->c++;
+			break;
+		case 'G':
+			counts->g++;
+			break;
+		case 'T':
+			counts->t++;
+			break;
+		case 'N':
+			counts->n++;
+			break;
+		default:
+			counts->other++;
+			break;
+		}
+	}
+}
+
+static size_t scalar_count_gc(const char *seq, size_t len)
+{
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		count += seq[i] == 'C' || seq[i] == 'G';
+	}
+	return count;
+}
+
+static size_t scalar_count_below(const char *qual, size_t len,
+				 unsigned char threshold)
+{
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		count += (unsigned char)qual[i] < threshold;
+	}
+	return count;
+}
+
+typedef struct {
+	uint64_t (*mask) (const char *, size_t, char);
+	size_t (*count) (const char *, size_t, char);
+	void (*composition) (const char *, size_t, basecounts *);
+	size_t (*count_gc) (const char *, size_t);
+	size_t (*count_below) (const char *, size_t, unsigned char);
+} basekernels;
+
+static basekernels kernels = {
+	scalar_mask,
+	scalar_count,
+	scalar_composition,
+	scalar_count_gc,
+	scalar_count_below
+};
+
+#ifdef BASES_X86
+/*
+ * Each kernel compares a vector of bytes at a time and turns the result into a bit mask with movemask, so counting is just a population count. The quality comparison is unsigned: v < t exactly when min(v, t - 1) == v.
+ */
+#define DEFINE_KERNELS(isa, name, vec, width, load, set1, cmpeq, or, min, movemask) \
+__attribute__ ((target(name))) \
+static uint64_t isa##_mask(const char *seq, size_t len, char c) \
+{ \
+	uint64_t mask = 0; \
+	size_t i; \
+	vec needle = set1(c); \
+	if (len > 64) { \
+		len = 64; \
+	} \
+	for (i = 0; i + width <= len; i += width) { \
+		mask |= (uint64_t) (uint32_t) movemask(cmpeq(load((const vec *)(seq + i)), needle)) << i; \
+	} \
+	/* Shifting by 64 is undefined, so only finish off a partial vector. */ \
+	if (i < len) { \
+		mask |= scalar_mask(seq + i, len - i, c) << i; \
+	} \
+	return mask; \
+} \
+__attribute__ ((target(name))) \
+static size_t isa##_count(const char *seq, size_t len, char c) \
+{ \
+	size_t count = 0; \
+	size_t i; \
+	vec needle = set1(c); \
+	for (i = 0; i + width <= len; i += width) { \
+		count += __builtin_popcount((uint32_t) movemask(cmpeq(load((const vec *)(seq + i)), needle))); \
+	} \
+	return count + scalar_count(seq + i, len - i, c); \
+} \
+__attribute__ ((target(name))) \
+static void isa##_composition(const char *seq, size_t len, basecounts *counts) \
+{ \
+	size_t i; \
+	size_t total = 0; \
+	vec a = set1('A'); \
+	vec c = set1('C'); \
+	vec g = set1('G'); \
+	vec t = set1('T'); \
+	vec n = set1('N'); \
+	for (i = 0; i + width <= len; i += width) { \
+		vec v = load((const vec *)(seq + i)); \
+		size_t ca = __builtin_popcount((uint32_t) movemask(cmpeq(v, a))); \
+		size_t cc = __builtin_popcount((uint32_t) movemask(cmpeq(v, c))); \
+		size_t cg = __builtin_popcount((uint32_t) movemask(cmpeq(v, g))); \
+		size_t ct = __builtin_popcount((uint32_t) movemask(cmpeq(v, t))); \
+		size_t cn = __builtin_popcount((uint32_t) movemask(cmpeq(v, n))); \
+		counts->a += ca; \
+		counts->c += cc; \
+		counts->g += cg; \
+		counts->t += ct; \
+		counts->n += cn; \
+		total += ca + cc + cg + ct + cn; \
+	} \
+	counts->other += i - total; \
+	scalar_composition(seq + i, len - i, counts); \
+} \
+__attribute__ ((target(name))) \
+static size_t isa##_count_gc(const char *seq, size_t len) \
+{ \
+	size_t count = 0; \
+	size_t i; \
+	vec c = set1('C'); \
+	vec g = set1('G'); \
+	for (i = 0; i + width <= len; i += width) { \
+		vec v = load((const vec *)(seq + i)); \
+		count += __builtin_popcount((uint32_t) movemask(or(cmpeq(v, c), cmpeq(v, g)))); \
+	} \
+	return count + scalar_count_gc(seq + i, len - i); \
+} \
+__attribute__ ((target(name))) \
+static size_t isa##_count_below(const char *qual, size_t len, unsigned char threshold) \
+{ \
+	size_t count = 0; \
+	size_t i = 0; \
+	if (threshold > 0) { \
+		vec limit = set1((char) (threshold - 1)); \
+		for (; i + width <= len; i += width) { \
+			vec v = load((const vec *)(qual + i)); \
+			count += __builtin_popcount((uint32_t) movemask(cmpeq(min(v, limit), v))); \
+		} \
+	} \
+	return count + scalar_count_below(qual + i, len - i, threshold); \
+}
+
+DEFINE_KERNELS(sse2, "sse2", __m128i, 16, _mm_loadu_si128, _mm_set1_epi8,
+	       _mm_cmpeq_epi8, _mm_or_si128, _mm_min_epu8, _mm_movemask_epi8)
+DEFINE_KERNELS(avx2, "avx2", __m256i, 32, _mm256_loadu_si256,
+	       _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_or_si256,
+	       _mm256_min_epu8, _mm256_movemask_epi8)
+#endif
+
+static pthread_once_t kernels_chosen = PTHREAD_ONCE_INIT;
+
+static void choose_kernels(void)
+{
+#ifdef BASES_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernels.mask = avx2_mask;
+		kernels.count = avx2_count;
+		kernels.composition = avx2_composition;
+		kernels.count_gc = avx2_count_gc;
+		kernels.count_below = avx2_count_below;
+	} else if (__builtin_cpu_supports("sse2")) {
+		kernels.mask = sse2_mask;
+		kernels.count = sse2_count;
+		kernels.composition = sse2_composition;
+		kernels.count_gc = sse2_count_gc;
+		kernels.count_below = sse2_count_below;
+	}
+#endif
+}
+
+uint64_t bases_mask(const char *seq, size_t len, char c)
+{
+	pthread_once(&kernels_chosen, choose_kernels);
+	return kernels.mask(seq, len, c);
+}
+
+size_t bases_count(const char *seq, size_t len, char c)
+{
+	pthread_once(&kernels_chosen, choose_kernels);
+	return kernels.count(seq, len, c);
+}
+
+bool bases_contains(const char *seq, size_t len, char c)
+{
+	size_t i;
+	pthread_once(&kernels_chosen, choose_kernels);
+	for (i = 0; i < len; i += 64) {
+		if (kernels.mask(seq + i, len - i, c) != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void bases_composition(const char *seq, size_t len, basecounts *counts)
+{
+	memset(counts, 0, sizeof(basecounts));
+	pthread_once(&kernels_chosen, choose_kernels);
+	kernels.composition(seq, len, counts);
+}
+
+size_t bases_count_gc(const char *seq, size_t len)
+{
+	pthread_once(&kernels_chosen, choose_kernels);
+	return kernels.count_gc(seq, len);
+}
+
+size_t bases_count_below(const char *qual, size_t len,
+			 unsigned char threshold)
+{
+	pthread_once(&kernels_chosen, choose_kernels);
+	return kernels.count_below(qual, len, threshold);
+}
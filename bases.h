@@ -0,0 +1,35 @@
+/* Vectorised scans over the bases and qualities of a read */
+#ifndef AXIOME_BASES_H
+#define AXIOME_BASES_H
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+
+/*
+ * On x86, each of these uses AVX2 or SSE2, whichever the processor supports, chosen the first time any is called; elsewhere, plain C is used. The results are identical either way.
+ */
+
+typedef struct {
+	size_t a;
+	size_t c;
+	size_t g;
+	size_t t;
+	size_t n;
+	/* Anything else, including lower case. */
+	size_t other;
+} basecounts;
+
+/* A bit mask of the positions in the first 64 (or len, if fewer) bytes that are equal to c. */
+uint64_t bases_mask(const char *seq, size_t len, char c);
+/* The number of bytes equal to c. */
+size_t bases_count(const char *seq, size_t len, char c);
+/* Whether any byte is equal to c, stopping at the first. */
+bool bases_contains(const char *seq, size_t len, char c);
+/* The number of each base. */
+void bases_composition(const char *seq, size_t len, basecounts *counts);
+/* The number of C and G bases. */
+size_t bases_count_gc(const char *seq, size_t len);
+/* The number of quality characters strictly below threshold. */
+size_t bases_count_below(const char *qual, size_t len,
+			 unsigned char threshold);
+#endif
@@ -0,0 +1,203 @@
+/* Check every vectorised base scan against the plain C version */
+#include<ctype.h>
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+/* The kernels are static, so they are compiled in here to be called directly. */
+#include "bases.c"
+
+/* Reads are made up in a buffer this long, at every start up to MAXSHIFT past an aligned address. */
+#define MAXLEN 300
+#define MAXSHIFT 64
+
+typedef struct {
+	const char *name;
+	uint64_t (*mask) (const char *, size_t, char);
+	size_t (*count) (const char *, size_t, char);
+	void (*composition) (const char *, size_t, basecounts *);
+	size_t (*count_gc) (const char *, size_t);
+	size_t (*count_below) (const char *, size_t, unsigned char);
+} kernelset;
+
+/* Mostly bases, with the odd byte of anything, including above 127. The same reads stand in for qualities. */
+static void fill(char *seq, size_t len)
+{
+	static const char bases[] = "ACGTN";
+	size_t i;
+	for (i = 0; i < len; i++) {
+		seq[i] = rand() % 8 == 0 ? (char)(rand() % 256) : bases[rand() % 5];
+	}
+}
+
+static size_t check(const kernelset *set, const char *seq, size_t len,
+		    char c, unsigned char threshold, size_t shift)
+{
+	size_t failures = 0;
+	size_t i;
+	size_t count = scalar_count(seq, len, c);
+	basecounts expected;
+	basecounts counts;
+	if (set->count(seq, len, c) != count) {
+		fprintf(stderr,
+			"%s count of `\\x%x' in %zu bytes at offset %zu: %zu, not %zu.\n",
+			set->name, (unsigned int)(unsigned char)c, len, shift,
+			set->count(seq, len, c), count);
+		failures++;
+	}
+	for (i = 0; i <= len; i += 64) {
+		uint64_t mask = scalar_mask(seq + i, len - i, c);
+		if (set->mask(seq + i, len - i, c) != mask) {
+			fprintf(stderr,
+				"%s mask of `\\x%x' in %zu bytes at offset %zu: %016llx, not %016llx.\n",
+				set->name, (unsigned int)(unsigned char)c,
+				len - i, shift + i,
+				(unsigned long long)set->mask(seq + i, len - i,
+							      c),
+				(unsigned long long)mask);
+			failures++;
+		}
+	}
+	if (bases_contains(seq, len, c) != (count > 0)) {
+		fprintf(stderr,
+			"Search for `\\x%x' in %zu bytes at offset %zu: %s, but there are %zu.\n",
+			(unsigned int)(unsigned char)c, len, shift,
+			count > 0 ? "not found" : "found", count);
+		failures++;
+	}
+	memset(&expected, 0, sizeof(expected));
+	memset(&counts, 0, sizeof(counts));
+	scalar_composition(seq, len, &expected);
+	set->composition(seq, len, &counts);
+	if (memcmp(&counts, &expected, sizeof(basecounts)) != 0) {
+		fprintf(stderr,
+			"%s composition of %zu bytes at offset %zu: %zu %zu %zu %zu %zu %zu, not %zu %zu %zu %zu %zu %zu.\n",
+			set->name, len, shift, counts.a, counts.c, counts.g,
+			counts.t, counts.n, counts.other, expected.a,
+			expected.c, expected.g, expected.t, expected.n,
+			expected.other);
+		failures++;
+	}
+	count = scalar_count_gc(seq, len);
+	if (set->count_gc(seq, len) != count) {
+		fprintf(stderr,
+			"%s GC count of %zu bytes at offset %zu: %zu, not %zu.\n",
+			set->name, len, shift, set->count_gc(seq, len), count);
+		failures++;
+	}
+	count = scalar_count_below(seq, len, threshold);
+	if (set->count_below(seq, len, threshold) != count) {
+		fprintf(stderr,
+			"%s count below %u of %zu bytes at offset %zu: %zu, not %zu.\n",
+			set->name, (unsigned int)threshold, len, shift,
+			set->count_below(seq, len, threshold), count);
+		failures++;
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int rounds = 10;
+	unsigned int seed = 1;
+	kernelset sets[3];
+	size_t set_count = 0;
+	char *buffer;
+	size_t failures = 0;
+	size_t len;
+	size_t shift;
+	size_t s;
+	int r;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "r:s:")) != -1) {
+		switch (c) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		case '?':
+			if (optopt == (int)'r' || optopt == (int)'s') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			fprintf(stderr,
+				"Usage: %s [-r rounds] [-s seed]\n\t-r\tNumber of random reads of each length and offset.\n\t-s\tSeed for the random reads.\n",
+				argv[0]);
+			return 1;
+		default:
+			abort();
+		}
+	}
+	srand(seed);
+
+	/* The dispatched versions are checked along with whatever this processor can run. */
+	pthread_once(&kernels_chosen, choose_kernels);
+	sets[set_count].name = "dispatched";
+	sets[set_count].mask = kernels.mask;
+	sets[set_count].count = kernels.count;
+	sets[set_count].composition = kernels.composition;
+	sets[set_count].count_gc = kernels.count_gc;
+	sets[set_count].count_below = kernels.count_below;
+	set_count++;
+#ifdef BASES_X86
+	if (__builtin_cpu_supports("sse2")) {
+		sets[set_count].name = "SSE2";
+		sets[set_count].mask = sse2_mask;
+		sets[set_count].count = sse2_count;
+		sets[set_count].composition = sse2_composition;
+		sets[set_count].count_gc = sse2_count_gc;
+		sets[set_count].count_below = sse2_count_below;
+		set_count++;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		sets[set_count].name = "AVX2";
+		sets[set_count].mask = avx2_mask;
+		sets[set_count].count = avx2_count;
+		sets[set_count].composition = avx2_composition;
+		sets[set_count].count_gc = avx2_count_gc;
+		sets[set_count].count_below = avx2_count_below;
+		set_count++;
+	}
+#endif
+
+	/* Every length up to MAXLEN covers the empty read, one byte, and one short of, exactly and just past each vector width and the 64-byte mask. */
+	if (posix_memalign((void **)&buffer, 64, MAXLEN + MAXSHIFT) != 0) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (r = 0; r < rounds; r++) {
+		for (len = 0; len <= MAXLEN; len++) {
+			for (shift = 0; shift < MAXSHIFT; shift++) {
+				char *seq = buffer + shift;
+				char needle = rand() % 2 == 0 ? 'N' : (char)(rand() % 256);
+				unsigned char threshold = rand() % 256;
+				fill(seq, len);
+				for (s = 0; s < set_count; s++) {
+					failures += check(&sets[s], seq, len, needle, threshold, shift);
+				}
+			}
+		}
+	}
+	free(buffer);
+	for (s = 0; s < set_count; s++) {
+		printf("Checked %s kernels.\n", sets[s].name);
+	}
+	if (failures > 0) {
+		fprintf(stderr, "%zu checks failed.\n", failures);
+		return 1;
+	}
+	return 0;
+}
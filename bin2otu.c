@@ -0,0 +1,40 @@
+/* Convert a binary OTU table to text */
+#include<errno.h>
+#include<stdio.h>
+#include<string.h>
+#include "otutable.h"
+
+int main(int argc, char **argv)
+{
+	otutable *table;
+	FILE *output;
+	bool ok;
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s otu_table.aqotu [otu_table.tab]\n",
+			argv[0]);
+		return 1;
+	}
+	table = otutable_open(argv[1]);
+	if (table == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (argc < 3 || strcmp(argv[2], "-") == 0) {
+		output = stdout;
+	} else {
+		output = fopen(argv[2], "w");
+		if (output == NULL) {
+			perror(argv[2]);
+			otutable_free(table);
+			return 1;
+		}
+	}
+	ok = otutable_write_text(table, output);
+	ok = (output == stdout ? fflush(output) : fclose(output)) == 0 && ok;
+	otutable_free(table);
+	if (!ok) {
+		perror(argv[0]);
+		return 1;
+	}
+	return 0;
+}
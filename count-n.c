@@ -1,5 +1,4 @@
 /* Count Ns in an Illumina FASTQ read */
-#include<bzlib.h>
 #include<ctype.h>
 #include<errno.h>
 #if !defined(__APPLE__)
@@ -11,28 +10,9 @@
 #include<sys/stat.h>
 #include<time.h>
 #include<unistd.h>
-#include<zlib.h>
-#include "kseq.h"
+#include "bases.h"
+#include "fastq.h"
 
-/* Function pointers for file I/O such that we can deal with compressed files. */
-void *(*fileopen) (char *, char *) = (void *(*)(char *, char *))gzopen;
-int (*fileread) (void *, void *, int) = (int (*)(void *, void *, int))gzread;
-int (*fileclose) (void *) = (int (*)(void *))gzclose;
-
-/* Compatibility function to make BZ2_bzRead look like gzread. */
-int bzread(BZFILE * file, void *buf, int len)
-{
-	int bzerror = BZ_OK;
-	int retval = BZ2_bzRead(&bzerror, file, buf, len);
-	if (bzerror == BZ_OK || bzerror == BZ_STREAM_END) {
-		return retval;
-	} else {
-		fprintf(stderr, "bzip error %d\n", bzerror);
-		return -1;
-	}
-}
-
-KSEQ_INIT(void *, fileread)
 #define MAXNT 512
 int n[MAXNT];
 
@@ -40,27 +20,28 @@ int main(int argc, char **argv)
 {
 	int c;
 	int bzip = 0;
+	int threads = 1;
 	char *filename = NULL;
-	void *file;
-	kseq_t *seq;
+	inputfile *file;
+	fastqrecord seq;
 	int len;
 	int i;
 	int max;
 
 	/* Process command line arguments. */
-	while ((c = getopt(argc, argv, "jf:")) != -1) {
+	while ((c = getopt(argc, argv, "jf:t:")) != -1) {
 		switch (c) {
 		case 'j':
-			fileopen = (void *(*)(char *, char *))BZ2_bzopen;
-			fileread = (int (*)(void *, void *, int))bzread;
-			fileclose = (int (*)(void *))BZ2_bzclose;
 			bzip = 1;
 			break;
 		case 'f':
 			filename = optarg;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
 		case '?':
-			if (optopt == (int)'f') {
+			if (optopt == (int)'f' || optopt == (int)'t') {
 				fprintf(stderr,
 					"Option -%c requires an argument.\n",
 					optopt);
@@ -80,35 +61,30 @@ int main(int argc, char **argv)
 
 	if (filename == NULL) {
 		fprintf(stderr,
-			"Usage: %s [-j] -f file.fastq\n\t-j\tInput files are bzipped.\n",
+			"Usage: %s [-j] [-t threads] -f file.fastq\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use for decompression.\n",
 			argv[0]);
 		return 1;
 	}
 
 	/* Open files and initialise FASTQ reader. */
-	file = fileopen(filename, "r");
+	file = input_open(filename, bzip, threads);
 	if (file == NULL) {
 		perror(filename);
 		return 1;
 	}
-	seq = kseq_init(file);
 
-	while ((len = kseq_read(seq)) >= 0) {
-		int count = 0;
-		for (i = 0; i < seq->qual.l && i < MAXNT; i++) {
-			if (seq->seq.s[i] == 'N') {
-				count++;
-			}
-		}
+	while ((len = fastq_read(file, &seq)) >= 0) {
+		size_t count = bases_count(seq.seq,
+					   seq.qual_len < MAXNT ? seq.qual_len : MAXNT,
+					   'N');
 		n[count]++;
 	}
-	kseq_destroy(seq);
 
 	for (max = MAXNT - 1; max >= 0 && n[max] == 0; max--) ;
 	for (i = 0; i <= max; i++) {
 		printf("%d	%d\n", i, n[i]);
 	}
-	if (fileclose(file) != Z_OK && bzip == 0) {
+	if (!input_close(file)) {
 		perror(filename);
 	}
 	return 0;
@@ -0,0 +1,694 @@
+/* Block-parallel decompression of bzip2 and gzip files */
+#include<bzlib.h>
+#include<pthread.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include<zlib.h>
+#include "decompress.h"
+#include "pool.h"
+
+#define BLOCK_PENDING 0
+#define BLOCK_DONE 1
+#define BLOCK_FAILED 2
+/* Merged into the block before it after a bad split. */
+#define BLOCK_SKIP 3
+/* Too large to decode speculatively; the reader inflates it itself. */
+#define BLOCK_SERIAL 4
+
+/* gzip members with more compressed data than this are inflated serially, so a single-member file does not get decompressed into memory all at once. */
+#define GZIP_MAX_SPECULATIVE (16 * 1024 * 1024)
+/* Give up on a speculative gzip member producing more than this. */
+#define GZIP_MAX_OUTPUT (256 * 1024 * 1024)
+
+#define BZIP_BLOCK_MAGIC 0x314159265359ULL
+#define BZIP_EOS_MAGIC 0x177245385090ULL
+
+typedef struct pdecoder pdecoder;
+
+/*
+ * A piece of the compressed file and its decompressed output.
+ *
+ * For bzip2, start and end are bit offsets; for gzip, byte offsets.
+ */
+typedef struct {
+	size_t start;
+	size_t end;
+	int level;
+	char *out;
+	size_t out_len;
+	size_t out_pos;
+	size_t out_size;
+	int state;
+	pdecoder *decoder;
+} pblock;
+
+struct pdecoder {
+	pool *pool;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	const unsigned char *data;
+	size_t size;
+	/* Blocks in flight, in file order, starting at head. */
+	pblock *ring;
+	int ring_size;
+	int head;
+	int count;
+	bool exhausted;
+	bool error;
+	/* Where the scanner will look for the next block. */
+	size_t scan;
+	/* bzip2: block size of the current stream, or 0 if a stream header is expected. */
+	int level;
+	/* gzip: the next member the reader expects and, when serial, the member being inflated. */
+	size_t offset;
+	bool serial;
+	z_stream z;
+
+	bool (*next) (pdecoder *, pblock *);
+	int (*decode) (pblock *);
+	int (*read) (pdecoder *, char *, int);
+};
+
+static void decode_job(void *data)
+{
+	pblock *block = data;
+	pdecoder *decoder = block->decoder;
+	int state = decoder->decode(block);
+	pthread_mutex_lock(&decoder->lock);
+	block->state = state;
+	pthread_cond_broadcast(&decoder->done);
+	pthread_mutex_unlock(&decoder->lock);
+}
+
+static void decoder_wait(pdecoder *decoder, pblock *block)
+{
+	pthread_mutex_lock(&decoder->lock);
+	while (block->state == BLOCK_PENDING) {
+		pthread_cond_wait(&decoder->done, &decoder->lock);
+	}
+	pthread_mutex_unlock(&decoder->lock);
+}
+
+/* Find new blocks and hand them to the workers until the ring is full. */
+static void decoder_fill(pdecoder *decoder)
+{
+	while (!decoder->exhausted && decoder->count < decoder->ring_size) {
+		pblock *block =
+		    &decoder->ring[(decoder->head + decoder->count) %
+				   decoder->ring_size];
+		block->out_len = 0;
+		block->out_pos = 0;
+		block->state = BLOCK_PENDING;
+		block->decoder = decoder;
+		if (!decoder->next(decoder, block)) {
+			decoder->exhausted = true;
+			break;
+		}
+		decoder->count++;
+		if (block->state == BLOCK_PENDING) {
+			pool_submit(decoder->pool, decode_job, block);
+		}
+	}
+}
+
+static pblock *decoder_head(pdecoder *decoder)
+{
+	return decoder->count == 0 ? NULL : &decoder->ring[decoder->head];
+}
+
+static void decoder_pop(pdecoder *decoder)
+{
+	decoder->head = (decoder->head + 1) % decoder->ring_size;
+	decoder->count--;
+}
+
+/* Make sure a block's output buffer has room for more data. */
+static bool block_grow(pblock *block, size_t needed)
+{
+	if (block->out_size - block->out_len < needed) {
+		size_t size = block->out_size == 0 ? needed : block->out_size;
+		char *bigger;
+		while (size - block->out_len < needed) {
+			size *= 2;
+		}
+		bigger = realloc(block->out, size);
+		if (bigger == NULL) {
+			return false;
+		}
+		block->out = bigger;
+		block->out_size = size;
+	}
+	return true;
+}
+
+/* Copy as much of a decoded block as fits. */
+static int block_copy(pblock *block, char *buf, int len)
+{
+	size_t available = block->out_len - block->out_pos;
+	if (available > (size_t)len) {
+		available = len;
+	}
+	memcpy(buf, block->out + block->out_pos, available);
+	block->out_pos += available;
+	return available;
+}
+
+/*
+ * bzip2
+ *
+ * A bzip2 file is one or more streams, each a byte-aligned "BZh" header followed by blocks which start with a 48-bit magic number at any bit position. Each block is decoded by wrapping it in a stream of its own: a header, the block's bits shifted to a byte boundary and an end-of-stream marker whose combined CRC is the block's CRC.
+ */
+
+/* For every byte value, which patterns (bit 0-7 for the block magic at shift 0-7, bits 8-15 for the end-of-stream magic) have that value as their third byte. */
+static uint16_t bzip_filter[256];
+static pthread_once_t bzip_filter_once = PTHREAD_ONCE_INIT;
+
+static void bzip_filter_init(void)
+{
+	int shift;
+	for (shift = 0; shift < 8; shift++) {
+		bzip_filter[(BZIP_BLOCK_MAGIC >> (24 + shift)) & 0xFF] |=
+		    1 << shift;
+		bzip_filter[(BZIP_EOS_MAGIC >> (24 + shift)) & 0xFF] |=
+		    1 << (8 + shift);
+	}
+}
+
+/* Read up to 57 bits starting at an arbitrary bit position. */
+static uint64_t bzip_bits(const unsigned char *data, size_t size, size_t bit,
+			  int count)
+{
+	uint64_t value = 0;
+	size_t byte = bit / 8;
+	int i;
+	if (count == 0) {
+		return 0;
+	}
+	for (i = 0; i < 8; i++) {
+		value = (value << 8) | (byte + i < size ? data[byte + i] : 0);
+	}
+	return (value >> (64 - (bit % 8) - count)) & ((1ULL << count) - 1);
+}
+
+/* The bitstream of a block can contain the end-of-stream magic by chance. A real one, with its CRC and padding, ends at the end of the file or at the header of another stream. */
+static bool bzip_stream_ends(pdecoder *decoder, size_t bit)
+{
+	size_t byte = (bit + 80 + 7) / 8;
+	if (byte == decoder->size) {
+		return true;
+	}
+	return byte + 4 <= decoder->size
+	    && memcmp(decoder->data + byte, "BZh", 3) == 0
+	    && decoder->data[byte + 3] >= '1' && decoder->data[byte + 3] <= '9';
+}
+
+/* Find the first block or end-of-stream magic at or after a bit position. Returns 1 for a block, 2 for end of stream and 0 if there are none. */
+static int bzip_find(pdecoder *decoder, size_t from, size_t *found)
+{
+	size_t j;
+	for (j = from / 8 + 2; j < decoder->size; j++) {
+		uint16_t candidates = bzip_filter[decoder->data[j]];
+		int shift;
+		if (candidates == 0) {
+			continue;
+		}
+		for (shift = 0; shift < 8; shift++) {
+			size_t bit = (j - 2) * 8 + shift;
+			uint64_t value;
+			if ((candidates & (0x101 << shift)) == 0 || bit < from
+			    || bit + 48 > decoder->size * 8) {
+				continue;
+			}
+			value = bzip_bits(decoder->data, decoder->size, bit, 48);
+			if (value == BZIP_BLOCK_MAGIC) {
+				*found = bit;
+				return 1;
+			} else if (value == BZIP_EOS_MAGIC
+				   && bzip_stream_ends(decoder, bit)) {
+				*found = bit;
+				return 2;
+			}
+		}
+	}
+	return 0;
+}
+
+static bool bzip_next(pdecoder *decoder, pblock *block)
+{
+	size_t at;
+	int kind;
+	for (;;) {
+		if (decoder->level == 0) {
+			size_t byte = decoder->scan / 8;
+			if (byte + 4 > decoder->size) {
+				return false;
+			}
+			if (memcmp(decoder->data + byte, "BZh", 3) != 0
+			    || decoder->data[byte + 3] < '1'
+			    || decoder->data[byte + 3] > '9') {
+				/* Trailing garbage. BZ2_bzRead would complain too. */
+				decoder->error = true;
+				return false;
+			}
+			decoder->level = decoder->data[byte + 3] - '0';
+			decoder->scan += 32;
+		}
+		kind = bzip_find(decoder, decoder->scan, &at);
+		if (kind == 0 || at != decoder->scan) {
+			decoder->error = true;
+			return false;
+		}
+		if (kind == 1) {
+			break;
+		}
+		/* An empty stream; move on to the next one. */
+		decoder->scan = (at + 80 + 7) / 8 * 8;
+		decoder->level = 0;
+	}
+	block->start = at;
+	block->level = decoder->level;
+	kind = bzip_find(decoder, at + 48, &block->end);
+	if (kind == 0) {
+		/* Truncated. Let the decoder discover it. */
+		block->end = decoder->size * 8;
+		decoder->scan = block->end;
+		decoder->level = 0;
+	} else if (kind == 1) {
+		decoder->scan = block->end;
+	} else {
+		decoder->scan = (block->end + 80 + 7) / 8 * 8;
+		decoder->level = 0;
+	}
+	return true;
+}
+
+typedef struct {
+	unsigned char *buf;
+	size_t len;
+	uint64_t acc;
+	int bits;
+} bitwriter;
+
+static void bits_put(bitwriter *writer, uint64_t value, int count)
+{
+	while (count > 0) {
+		int take = count > 8 ? 8 : count;
+		count -= take;
+		writer->acc =
+		    (writer->acc << take) | ((value >> count) & ((1 << take) - 1));
+		writer->bits += take;
+		if (writer->bits >= 8) {
+			writer->bits -= 8;
+			writer->buf[writer->len++] = writer->acc >> writer->bits;
+		}
+	}
+}
+
+static int bzip_decode(pblock *block)
+{
+	pdecoder *decoder = block->decoder;
+	size_t nbits = block->end - block->start;
+	size_t whole = nbits / 8;
+	size_t first = block->start / 8;
+	int shift = block->start % 8;
+	size_t i;
+	bitwriter writer;
+	bz_stream bz;
+	int result;
+
+	writer.buf = malloc(whole + 32);
+	if (writer.buf == NULL) {
+		return BLOCK_FAILED;
+	}
+	memcpy(writer.buf, "BZh", 3);
+	writer.buf[3] = '0' + block->level;
+	writer.len = 4;
+	writer.acc = 0;
+	writer.bits = 0;
+	if (shift == 0) {
+		memcpy(writer.buf + 4, decoder->data + first, whole);
+	} else {
+		for (i = 0; i < whole; i++) {
+			writer.buf[4 + i] =
+			    (decoder->data[first + i] << shift) |
+			    (decoder->data[first + i + 1] >> (8 - shift));
+		}
+	}
+	writer.len += whole;
+	bits_put(&writer,
+		 bzip_bits(decoder->data, decoder->size,
+			   block->start + whole * 8, nbits % 8), nbits % 8);
+	bits_put(&writer, BZIP_EOS_MAGIC, 48);
+	bits_put(&writer,
+		 bzip_bits(decoder->data, decoder->size, block->start + 48, 32),
+		 32);
+	if (writer.bits > 0) {
+		bits_put(&writer, 0, 8 - writer.bits);
+	}
+
+	memset(&bz, 0, sizeof(bz));
+	if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK) {
+		free(writer.buf);
+		return BLOCK_FAILED;
+	}
+	bz.next_in = (char *)writer.buf;
+	bz.avail_in = writer.len;
+	do {
+		if (!block_grow(block, block->level * 100000 + 1024)) {
+			result = BZ_MEM_ERROR;
+			break;
+		}
+		bz.next_out = block->out + block->out_len;
+		bz.avail_out = block->out_size - block->out_len;
+		result = BZ2_bzDecompress(&bz);
+		block->out_len = block->out_size - bz.avail_out;
+	} while (result == BZ_OK && (bz.avail_in > 0 || bz.avail_out == 0));
+	BZ2_bzDecompressEnd(&bz);
+	free(writer.buf);
+	return result == BZ_STREAM_END ? BLOCK_DONE : BLOCK_FAILED;
+}
+
+/* A block failed, presumably because the scanner split it at something that looked like a magic number. Glue the following blocks back on until it decodes. */
+static bool bzip_recover(pdecoder *decoder)
+{
+	pblock *head = decoder_head(decoder);
+	int i;
+	for (i = 1; i < decoder->ring_size; i++) {
+		pblock *next;
+		if (i >= decoder->count) {
+			decoder_fill(decoder);
+			if (i >= decoder->count) {
+				return false;
+			}
+		}
+		next = &decoder->ring[(decoder->head + i) % decoder->ring_size];
+		decoder_wait(decoder, next);
+		if (next->state == BLOCK_SKIP) {
+			continue;
+		}
+		next->state = BLOCK_SKIP;
+		head->end = next->end;
+		head->out_len = 0;
+		if (bzip_decode(head) == BLOCK_DONE) {
+			head->state = BLOCK_DONE;
+			return true;
+		}
+	}
+	return false;
+}
+
+static int bzip_read(pdecoder *decoder, char *buf, int len)
+{
+	int copied = 0;
+	while (copied < len) {
+		pblock *block;
+		decoder_fill(decoder);
+		block = decoder_head(decoder);
+		if (block == NULL) {
+			break;
+		}
+		decoder_wait(decoder, block);
+		if (block->state == BLOCK_FAILED && !bzip_recover(decoder)) {
+			fprintf(stderr, "bzip error in block at bit %zu\n",
+				block->start);
+			decoder->error = true;
+			return -1;
+		}
+		if (block->state == BLOCK_DONE) {
+			copied += block_copy(block, buf + copied, len - copied);
+			if (block->out_pos < block->out_len) {
+				continue;
+			}
+		}
+		decoder_pop(decoder);
+	}
+	if (copied == 0 && decoder->error) {
+		fprintf(stderr, "bzip error: stream is corrupt\n");
+		return -1;
+	}
+	return copied;
+}
+
+/*
+ * gzip
+ *
+ * A gzip file is one or more members. BGZF members record their own length, so the next member's position is known exactly. Otherwise, anything that looks like a member header is a candidate. A candidate block is only used if it starts where the previous member ended and inflates to exactly its end, so a bad guess only costs wasted work.
+ */
+
+static bool gzip_header(const unsigned char *data, size_t size)
+{
+	return size >= 18 && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8
+	    && (data[3] & 0xE0) == 0 && (data[8] == 0 || data[8] == 2
+					  || data[8] == 4) && (data[9] <= 13
+							       || data[9] ==
+							       255);
+}
+
+/* The length of a BGZF member, or 0 if this is not one. */
+static size_t gzip_bgzf_size(const unsigned char *data, size_t size)
+{
+	if ((data[3] & 4) == 0 || size < 18 || data[12] != 'B'
+	    || data[13] != 'C' || data[14] != 2 || data[15] != 0) {
+		return 0;
+	}
+	return (data[16] | (data[17] << 8)) + 1;
+}
+
+static bool gzip_next(pdecoder *decoder, pblock *block)
+{
+	size_t start = decoder->scan;
+	size_t end;
+	size_t bsize;
+	if (start >= decoder->size
+	    || !gzip_header(decoder->data + start, decoder->size - start)) {
+		return false;
+	}
+	bsize = gzip_bgzf_size(decoder->data + start, decoder->size - start);
+	if (bsize > 0 && start + bsize <= decoder->size) {
+		end = start + bsize;
+	} else {
+		const unsigned char *candidate = decoder->data + start + 18;
+		end = decoder->size;
+		while (candidate < decoder->data + decoder->size
+		       && (candidate =
+			   memchr(candidate, 0x1f,
+				  decoder->data + decoder->size - candidate)) !=
+		       NULL) {
+			if (gzip_header
+			    (candidate,
+			     decoder->data + decoder->size - candidate)) {
+				end = candidate - decoder->data;
+				break;
+			}
+			candidate++;
+		}
+	}
+	block->start = start;
+	block->end = end;
+	if (end - start > GZIP_MAX_SPECULATIVE) {
+		block->state = BLOCK_SERIAL;
+	}
+	decoder->scan = end;
+	return true;
+}
+
+static int gzip_decode(pblock *block)
+{
+	pdecoder *decoder = block->decoder;
+	z_stream z;
+	int result;
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 31) != Z_OK) {
+		return BLOCK_FAILED;
+	}
+	z.next_in = (unsigned char *)decoder->data + block->start;
+	z.avail_in = block->end - block->start;
+	do {
+		if (block->out_len > GZIP_MAX_OUTPUT
+		    || !block_grow(block, 4 * z.avail_in + 65536)) {
+			result = Z_MEM_ERROR;
+			break;
+		}
+		z.next_out = (unsigned char *)block->out + block->out_len;
+		z.avail_out = block->out_size - block->out_len;
+		result = inflate(&z, Z_NO_FLUSH);
+		block->out_len = block->out_size - z.avail_out;
+	} while (result == Z_OK);
+	inflateEnd(&z);
+	return result == Z_STREAM_END
+	    && z.avail_in == 0 ? BLOCK_DONE : BLOCK_FAILED;
+}
+
+static bool gzip_serial_start(pdecoder *decoder)
+{
+	memset(&decoder->z, 0, sizeof(decoder->z));
+	if (inflateInit2(&decoder->z, 31) != Z_OK) {
+		return false;
+	}
+	decoder->z.next_in = (unsigned char *)decoder->data + decoder->offset;
+	decoder->z.avail_in = decoder->size - decoder->offset;
+	decoder->serial = true;
+	return true;
+}
+
+static int gzip_read(pdecoder *decoder, char *buf, int len)
+{
+	int copied = 0;
+	while (copied < len) {
+		pblock *block;
+		if (decoder->serial) {
+			int result;
+			decoder->z.next_out = (unsigned char *)buf + copied;
+			decoder->z.avail_out = len - copied;
+			result = inflate(&decoder->z, Z_NO_FLUSH);
+			copied = len - decoder->z.avail_out;
+			if (result == Z_STREAM_END) {
+				decoder->offset =
+				    decoder->size - decoder->z.avail_in;
+				inflateEnd(&decoder->z);
+				decoder->serial = false;
+			} else if (result != Z_OK) {
+				fprintf(stderr, "gzip error %d at byte %zu\n",
+					result,
+					decoder->size - decoder->z.avail_in);
+				inflateEnd(&decoder->z);
+				decoder->serial = false;
+				decoder->error = true;
+				return -1;
+			}
+			continue;
+		}
+		decoder_fill(decoder);
+		/* Throw away guesses that were inside the last member. */
+		while ((block = decoder_head(decoder)) != NULL
+		       && block->start < decoder->offset) {
+			decoder_wait(decoder, block);
+			decoder_pop(decoder);
+			decoder_fill(decoder);
+		}
+		if (block == NULL || block->start > decoder->offset) {
+			if (decoder->offset + 18 > decoder->size
+			    || !gzip_header(decoder->data + decoder->offset,
+					    decoder->size - decoder->offset)) {
+				/* Like gzread, ignore anything after the last member. */
+				break;
+			}
+			if (!gzip_serial_start(decoder)) {
+				decoder->error = true;
+				return -1;
+			}
+			continue;
+		}
+		decoder_wait(decoder, block);
+		if (block->state != BLOCK_DONE) {
+			if (!gzip_serial_start(decoder)) {
+				decoder->error = true;
+				return -1;
+			}
+			continue;
+		}
+		copied += block_copy(block, buf + copied, len - copied);
+		if (block->out_pos == block->out_len) {
+			decoder->offset = block->end;
+			decoder_pop(decoder);
+		}
+	}
+	return copied;
+}
+
+static pdecoder *decoder_open(int fd, int threads)
+{
+	struct stat info;
+	pdecoder *decoder;
+	void *map;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+		return NULL;
+	}
+	map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	decoder = calloc(1, sizeof(pdecoder));
+	if (decoder == NULL) {
+		munmap(map, info.st_size);
+		return NULL;
+	}
+	decoder->ring_size = 4 * threads;
+	decoder->ring = calloc(decoder->ring_size, sizeof(pblock));
+	decoder->pool = pool_new(threads);
+	if (decoder->ring == NULL || decoder->pool == NULL) {
+		if (decoder->pool != NULL) {
+			pool_free(decoder->pool);
+		}
+		free(decoder->ring);
+		free(decoder);
+		munmap(map, info.st_size);
+		return NULL;
+	}
+	madvise(map, info.st_size, MADV_SEQUENTIAL);
+	decoder->data = map;
+	decoder->size = info.st_size;
+	pthread_mutex_init(&decoder->lock, NULL);
+	pthread_cond_init(&decoder->done, NULL);
+	close(fd);
+	return decoder;
+}
+
+void *decompress_bzip_open(int fd, int threads)
+{
+	pdecoder *decoder;
+	pthread_once(&bzip_filter_once, bzip_filter_init);
+	decoder = decoder_open(fd, threads);
+	if (decoder != NULL) {
+		decoder->next = bzip_next;
+		decoder->decode = bzip_decode;
+		decoder->read = bzip_read;
+	}
+	return decoder;
+}
+
+void *decompress_gzip_open(int fd, int threads)
+{
+	pdecoder *decoder = decoder_open(fd, threads);
+	if (decoder != NULL) {
+		decoder->next = gzip_next;
+		decoder->decode = gzip_decode;
+		decoder->read = gzip_read;
+	}
+	return decoder;
+}
+
+int decompress_read(void *decoder, void *buf, int len)
+{
+	return ((pdecoder *) decoder)->read(decoder, buf, len);
+}
+
+int decompress_close(void *data)
+{
+	pdecoder *decoder = data;
+	bool error = decoder->error;
+	int i;
+	while (decoder->count > 0) {
+		decoder_wait(decoder, decoder_head(decoder));
+		decoder_pop(decoder);
+	}
+	pool_free(decoder->pool);
+	if (decoder->serial) {
+		inflateEnd(&decoder->z);
+	}
+	for (i = 0; i < decoder->ring_size; i++) {
+		free(decoder->ring[i].out);
+	}
+	free(decoder->ring);
+	pthread_mutex_destroy(&decoder->lock);
+	pthread_cond_destroy(&decoder->done);
+	munmap((void *)decoder->data, decoder->size);
+	free(decoder);
+	return error ? Z_DATA_ERROR : Z_OK;
+}
@@ -0,0 +1,18 @@
+/* Block-parallel decompression of bzip2 and gzip files */
+#ifndef AXIOME_DECOMPRESS_H
+#define AXIOME_DECOMPRESS_H
+
+/*
+ * Each opener maps the compressed file, splits it into independently decodable pieces and decodes them on a pool of worker threads. Output is always delivered in file order.
+ *
+ * bzip2 files are split at block boundaries. gzip files are split at member boundaries, which are exact for BGZF files and found by scanning for member headers otherwise; a member too large to decode speculatively is inflated in the reading thread.
+ *
+ * The openers return NULL, leaving the descriptor open, if the file cannot be mapped (e.g., it is a pipe), in which case the caller should decompress serially. On success, the descriptor is consumed.
+ */
+void *decompress_bzip_open(int fd, int threads);
+void *decompress_gzip_open(int fd, int threads);
+/* Same contract as gzread. */
+int decompress_read(void *decoder, void *buf, int len);
+/* Returns 0 (Z_OK) if no error was encountered. */
+int decompress_close(void *decoder);
+#endif
@@ -1,5 +1,4 @@
 /* Separate Illumina FASTQ reads by index tag and discard any degenerate sequences */
-#include<bzlib.h>
 #include<ctype.h>
 #include<errno.h>
 #if !defined(__APPLE__)
@@ -9,67 +8,224 @@
 #include<stdbool.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<sys/resource.h>
 #include<sys/stat.h>
 #include<time.h>
 #include<unistd.h>
-#include<zlib.h>
-#include<glib.h>
-#include<glib-object.h>
-#include "fmap.h"
+#include<string.h>
 #include "config.h"
-#include "kseq.h"
+#include "barcode.h"
+#include "bases.h"
+#include "fastq.h"
+#include "output.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "textbuf.h"
 
-/* Function pointers for file I/O such that we can deal with compressed files. */
-void *(*fileopen) (char *, char *) = (void *(*)(char *, char *))gzopen;
-int (*fileread) (void *, void *, int) = (int (*)(void *, void *, int))gzread;
-int (*fileclose) (void *) = (int (*)(void *))gzclose;
+typedef struct {
+	const char *tag;
+	char *filename;
+	outputfile *file;
+} sample;
 
-/* Compatibility function to make BZ2_bzRead look like gzread. */
-int bzread(BZFILE * file, void *buf, int len)
+typedef struct {
+	sample *samples;
+	size_t sample_count;
+	barcodeindex *index;
+	outputset *outputs;
+	bool no_n;
+	bool write_error;
+} demuxer;
+
+/* The output of one batch: a chunk of each sample's file and the messages for standard error. */
+typedef struct {
+	textbuf *output;
+	size_t output_count;
+	textbuf log;
+	seqheader *headers;
+	seqiderror *errors;
+	size_t header_size;
+	bool out_of_memory;
+} demuxbatch;
+
+static void demux_collision(size_t first, size_t second, int distance,
+			    void *context)
+{
+	demuxer *d = context;
+	fprintf(stderr,
+		"Tags %s and %s are only %d mismatches apart. Reads equally close to both will be discarded.\n",
+		d->samples[first].tag, d->samples[second].tag, distance);
+}
+
+static void demux_release(void *state)
 {
-	int bzerror = BZ_OK;
-	int retval = BZ2_bzRead(&bzerror, file, buf, len);
-	if (bzerror == BZ_OK || bzerror == BZ_STREAM_END) {
-		return retval;
-	} else {
-		fprintf(stderr, "bzip error %d\n", bzerror);
-		return -1;
+	demuxbatch *output = state;
+	size_t i;
+	for (i = 0; i < output->output_count; i++) {
+		textbuf_free(&output->output[i]);
 	}
+	free(output->output);
+	free(output->headers);
+	free(output->errors);
+	textbuf_free(&output->log);
+	free(output);
 }
 
-KSEQ_INIT(void *, fileread)
+/* Runs on a worker thread: sort the batch's reads into per-sample chunks. */
+static void demux_work(fastqbatch *batch, void *context)
+{
+	demuxer *d = context;
+	demuxbatch *output = batch->state;
+	size_t i;
+	if (output == NULL) {
+		output = calloc(1, sizeof(demuxbatch));
+		if (output == NULL
+		    || (output->output =
+			calloc(d->sample_count, sizeof(textbuf))) == NULL) {
+			free(output);
+			return;
+		}
+		output->output_count = d->sample_count;
+		batch->state = output;
+	}
+	output->log.len = 0;
+	for (i = 0; i < d->sample_count; i++) {
+		output->output[i].len = 0;
+	}
+	output->out_of_memory = false;
+	if (output->header_size < batch->count) {
+		free(output->headers);
+		free(output->errors);
+		output->headers = calloc(batch->count, sizeof(seqheader));
+		output->errors = calloc(batch->count, sizeof(seqiderror));
+		output->header_size = batch->count;
+		if (output->headers == NULL || output->errors == NULL) {
+			output->header_size = 0;
+			output->out_of_memory = true;
+			return;
+		}
+	}
+	seqheader_parse_batch(batch->records, batch->count, output->headers,
+			      output->errors);
+
+	for (i = 0; i < batch->count; i++) {
+		fastqrecord *seq = &batch->records[i];
+		seqheader *id = &output->headers[i];
+		const char *tag = seq->name + id->tag.offset;
+		int s;
+		textbuf *buf;
+		bool ok = true;
+		if (d->no_n && bases_contains(seq->seq, seq->seq_len, 'N')) {
+			ok = textbuf_printf(&output->log, "SKIP %s\n",
+					    seq->name);
+		} else if (output->errors[i] != SEQID_OK) {
+			ok = textbuf_printf(&output->log, "BAD HEADER %s\n",
+					    seq->name);
+		} else if ((s =
+			    barcode_lookup(d->index, tag, id->tag.length,
+					   NULL)) == BARCODE_UNKNOWN) {
+			ok = textbuf_printf(&output->log, "EBADF %.*s\n",
+					    (int)id->tag.length, tag);
+		} else if (s == BARCODE_AMBIGUOUS) {
+			ok = textbuf_printf(&output->log, "AMBIGUOUS %.*s\n",
+					    (int)id->tag.length, tag);
+		} else {
+			tag = d->samples[s].tag;
+			buf = &output->output[s];
+			ok = textbuf_putc(buf, '>')
+			    && textbuf_append(buf, tag, strlen(tag))
+			    && textbuf_putc(buf, '_')
+			    && textbuf_ulong(buf, batch->first + i + 1)
+			    && textbuf_putc(buf, '\n')
+			    && textbuf_append(buf, seq->seq, seq->seq_len)
+			    && textbuf_putc(buf, '\n');
+		}
+		if (!ok) {
+			output->out_of_memory = true;
+			break;
+		}
+	}
+}
+
+/* Runs on the writer thread, in input order: append each chunk to its file, which compresses it in the background if needed. */
+static void demux_commit(fastqbatch *batch, void *context)
+{
+	demuxer *d = context;
+	demuxbatch *output = batch->state;
+	size_t i;
+	if (output == NULL || output->out_of_memory) {
+		fprintf(stderr, "Out of memory.\n");
+		d->write_error = true;
+		if (output == NULL) {
+			return;
+		}
+	}
+	fwrite(output->log.data, 1, output->log.len, stderr);
+	for (i = 0; i < d->sample_count; i++) {
+		if (output->output[i].len > 0
+		    && !output_write(d->samples[i].file, output->output[i].data,
+				     output->output[i].len)) {
+			if (!d->write_error) {
+				perror(d->samples[i].filename);
+			}
+			d->write_error = true;
+		}
+	}
+}
 
 int main(int argc, char **argv)
 {
 	int c;
 	bool bzip = false;
+	int threads = 1;
 	char *filename = NULL;
-	void *file;
-	kseq_t *seq;
-	int len;
-	int n = 0;
-	bool no_n = false;
-	seqidentifier id;
-	g_type_init();
-	files_init();
+	inputfile *file;
+	demuxer d = { NULL, 0, NULL, NULL, false, false };
+	const char **tags;
+	int mismatches = 0;
+	outputformat format = OUTPUT_PLAIN;
+	long max_open = 0;
+	struct rlimit limit;
+	pipelinestages stages = { demux_work, demux_commit, demux_release };
+	size_t i;
+	bool ok;
 	/* Process command line arguments. */
-	while ((c = getopt(argc, argv, "jf:n")) != -1) {
+	while ((c = getopt(argc, argv, "jc:f:m:no:t:")) != -1) {
 		switch (c) {
 		case 'j':
-			fileopen = (void *(*)(char *, char *))BZ2_bzopen;
-			fileread = (int (*)(void *, void *, int))bzread;
-			fileclose = (int (*)(void *))BZ2_bzclose;
 			bzip = true;
 			break;
+		case 'c':
+			if (strcmp(optarg, "gzip") == 0) {
+				format = OUTPUT_GZIP;
+			} else if (strcmp(optarg, "bzip2") == 0) {
+				format = OUTPUT_BZIP;
+			} else {
+				fprintf(stderr,
+					"Unknown compression `%s'.\n",
+					optarg);
+				return 1;
+			}
+			break;
 		case 'f':
 			filename = optarg;
 			break;
+		case 'o':
+			max_open = atol(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'm':
+			mismatches = atoi(optarg);
+			break;
 		case 'n':
-			no_n = true;
+			d.no_n = true;
 			break;
 		case '?':
-			if (optopt == (int)'f') {
+			if (optopt == (int)'c' || optopt == (int)'f'
+			    || optopt == (int)'m' || optopt == (int)'o'
+			    || optopt == (int)'t') {
 				fprintf(stderr,
 					"Option -%c requires an argument.\n",
 					optopt);
@@ -87,65 +243,109 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (filename == NULL) {
+	if (filename == NULL || mismatches < 0 || mismatches > 2) {
 		fprintf(stderr,
-			"Usage: %s [-j] [-n] -f file.fastq tag1 tag2 ...\n\t-j\tInput files are bzipped.\n\t-n\tDiscard sequences with Ns.\n",
+			"Usage: %s [-j] [-t threads] [-m mismatches] [-n] [-c gzip|bzip2] [-o max-open] -f file.fastq tag1 tag2 ...\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use.\n\t-m\tAccept tags with up to 2 mismatches.\n\t-n\tDiscard sequences with Ns.\n\t-c\tCompress the output files.\n\t-o\tMaximum number of output files to hold open.\n",
 			argv[0]);
 		return 1;
 	}
 
 	/* Open files and initialise FASTQ reader. */
-	file = fileopen(filename, "r");
+	file = input_open(filename, bzip, threads);
 	if (file == NULL) {
 		perror(filename);
 		return 1;
 	}
-	seq = kseq_init(file);
-
-	for (c = optind; c < argc; c++){
-				FILE *f;
-				char buffer[FILENAME_MAX];
-				snprintf(buffer, FILENAME_MAX, "%s.%s",
-					 filename, argv[c]);
-				f = fopen(buffer, "w");
-				if (f == NULL) {
-					perror(buffer);
-					return 1;
-				}
-				files_put(argv[c], f);
-				fprintf(stderr, "FOPN %s\n", buffer);
-	}
-	while ((len = kseq_read(seq)) >= 0) {
-		unsigned long hash;
-		int index;
-		int ncount = 0;
-		FILE *f;
 
-		n++;
-		if (no_n) {
-			for (index = 0; index < seq->seq.l; index++) {
-				if (seq->seq.s[index] == 'N') {
-					ncount++;
-					break;
-				}
-			}
-			if (ncount > 0) {
-				fprintf(stderr, "SKIP %s\n", seq->name.s);
-				continue;
+	d.samples = calloc(argc - optind + 1, sizeof(sample));
+	if (d.samples == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (c = optind; c < argc; c++) {
+		for (i = 0; i < d.sample_count; i++) {
+			if (strcmp(d.samples[i].tag, argv[c]) == 0) {
+				break;
 			}
 		}
-		if (seqid_parse(&id, seq->name.s) == 0) {
-			fprintf(stderr, "BAD HEADER %s\n", seq->name.s);
-			continue;
+		if (i == d.sample_count) {
+			d.samples[d.sample_count++].tag = argv[c];
+		}
+	}
+
+	tags = calloc(d.sample_count + 1, sizeof(char *));
+	if (tags == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (i = 0; i < d.sample_count; i++) {
+		tags[i] = d.samples[i].tag;
+	}
+	d.index =
+	    barcode_new(tags, d.sample_count, mismatches, demux_collision, &d);
+	free(tags);
+	if (d.index == NULL && errno != EINVAL) {
+		perror(argv[0]);
+		return 1;
+	} else if (d.index == NULL) {
+		fprintf(stderr,
+			"Tags must be at most %d bases of A, C, G, T or N, optionally joined by +.\n",
+			BARCODE_MAX_LENGTH);
+		return 1;
+	}
+
+	/* Leave some descriptors for the input and standard streams. */
+	if (max_open < 1) {
+		max_open = 1000;
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0
+		    && limit.rlim_cur != RLIM_INFINITY) {
+			max_open = (long)limit.rlim_cur - 16;
+		}
+		if (max_open < 1) {
+			max_open = 1;
+		}
+	}
+	d.outputs = output_set_new(format, threads, max_open);
+	if (d.outputs == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (i = 0; i < d.sample_count; i++) {
+		sample *s = &d.samples[i];
+		size_t len =
+		    strlen(filename) + strlen(s->tag) +
+		    strlen(output_suffix(format)) + 2;
+		s->filename = malloc(len);
+		if (s->filename == NULL) {
+			perror(argv[0]);
+			return 1;
 		}
-		if (!files_write(id.tag, ">%s_%d\n%s\n", id.tag, n, seq->seq.s)) {
-			fprintf(stderr, "EBADF %s\n", id.tag);
+		snprintf(s->filename, len, "%s.%s%s", filename, s->tag,
+			 output_suffix(format));
+		s->file = output_open(d.outputs, s->filename);
+		if (s->file == NULL) {
+			perror(s->filename);
+			return 1;
 		}
+		fprintf(stderr, "FOPN %s\n", s->filename);
 	}
-	kseq_destroy(seq);
-	files_finish();
-	if (fileclose(file) != Z_OK && bzip == 0) {
+
+	ok = pipeline_run(file, threads, &stages, &d);
+	if (!input_close(file)) {
 		perror(filename);
+		ok = false;
+	} else if (!ok) {
+		fprintf(stderr, "%s: Malformed FASTQ record.\n", filename);
+	}
+	for (i = 0; i < d.sample_count; i++) {
+		if (!output_close(d.samples[i].file)) {
+			perror(d.samples[i].filename);
+			d.write_error = true;
+		}
+		free(d.samples[i].filename);
 	}
-	return 0;
+	output_set_free(d.outputs);
+	barcode_free(d.index);
+	free(d.samples);
+	return ok && !d.write_error ? 0 : 1;
 }
@@ -0,0 +1,392 @@
+/* Ecological distances between the samples of a community table */
+#include<math.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include "distance.h"
+#include "pool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DISTANCE_X86 1
+#include<immintrin.h>
+#endif
+
+/* The number of rows on each side of a block. */
+#define TILE 32
+/* The number of columns of a block compared at a time, so that both sets of rows stay in cache. */
+#define SLICE 512
+/* The running sums for a pair of rows: a sum per column lane, and, for Canberra, a count of the columns used per lane. */
+#define SUMS (2 * DISTANCE_PAD)
+
+/* The number of rows each kernel compares one row against at once, so that the sums for different pairs can be worked on together rather than each waiting on the last addition. */
+#define GROUP 4
+
+/*
+ * Each kernel adds the terms for len columns of row x paired with each of the GROUP rows in y to the SUMS for that pair, where column i goes to sum i % DISTANCE_PAD. The vector kernels keep the same lanes, so the sums come out the same.
+ */
+typedef void (*distancekernel) (const double *x, const double *const *y,
+				size_t len, double *sums);
+
+/* Plain C versions. */
+static void scalar_absdiff(const double *x, const double *const *y,
+			   size_t len, double *sums)
+{
+	size_t i;
+	size_t p;
+	for (p = 0; p < GROUP; p++) {
+		for (i = 0; i < len; i++) {
+			sums[p * SUMS + i % DISTANCE_PAD] += fabs(x[i] - y[p][i]);
+		}
+	}
+}
+
+static void scalar_sqdiff(const double *x, const double *const *y,
+			  size_t len, double *sums)
+{
+	size_t i;
+	size_t p;
+	for (p = 0; p < GROUP; p++) {
+		for (i = 0; i < len; i++) {
+			double d = x[i] - y[p][i];
+			sums[p * SUMS + i % DISTANCE_PAD] += d * d;
+		}
+	}
+}
+
+static void scalar_canberra(const double *x, const double *const *y,
+			    size_t len, double *sums)
+{
+	size_t i;
+	size_t p;
+	for (p = 0; p < GROUP; p++) {
+		for (i = 0; i < len; i++) {
+			double total = x[i] + y[p][i];
+			if (total > 0) {
+				sums[p * SUMS + i % DISTANCE_PAD] +=
+				    fabs(x[i] - y[p][i]) / total;
+				sums[p * SUMS + DISTANCE_PAD + i % DISTANCE_PAD] += 1;
+			}
+		}
+	}
+}
+
+static void scalar_lesser(const double *x, const double *const *y, size_t len,
+		       double *sums)
+{
+	size_t i;
+	size_t p;
+	for (p = 0; p < GROUP; p++) {
+		for (i = 0; i < len; i++) {
+			sums[p * SUMS + i % DISTANCE_PAD] +=
+			    x[i] < y[p][i] ? x[i] : y[p][i];
+		}
+	}
+}
+
+typedef struct {
+	distancekernel absdiff;
+	distancekernel sqdiff;
+	distancekernel canberra;
+	distancekernel lesser;
+} distancekernels;
+
+static distancekernels kernels = {
+	scalar_absdiff,
+	scalar_sqdiff,
+	scalar_canberra,
+	scalar_lesser
+};
+
+#ifdef DISTANCE_X86
+/*
+ * Each lane of a vector is one of the sums, so a vector of width doubles covers DISTANCE_PAD / width of them. The loops over the lanes and the group are unrolled so every sum stays in a register. Absolute values are taken by clearing the sign bit, and Canberra's empty columns, which divide zero by zero, are masked out after the division.
+ */
+#define LANES(width) (DISTANCE_PAD / (width))
+#define DEFINE_KERNEL(isa, name, vec, width, loadu, storeu, kind, setup, step) \
+__attribute__ ((target(name))) \
+static void isa##_##kind(const double *x, const double *const *y, size_t len, double *sums) \
+{ \
+	vec acc[GROUP][LANES(width)]; \
+	vec used[GROUP][LANES(width)]; \
+	size_t i; \
+	size_t l; \
+	size_t p; \
+	setup \
+	for (p = 0; p < GROUP; p++) { \
+		for (l = 0; l < LANES(width); l++) { \
+			acc[p][l] = loadu(sums + p * SUMS + l * width); \
+			used[p][l] = loadu(sums + p * SUMS + DISTANCE_PAD + l * width); \
+		} \
+	} \
+	for (i = 0; i < len; i += DISTANCE_PAD) { \
+		_Pragma("GCC unroll 4") \
+		for (l = 0; l < LANES(width); l++) { \
+			vec a = loadu(x + i + l * width); \
+			_Pragma("GCC unroll 4") \
+			for (p = 0; p < GROUP; p++) { \
+				vec b = loadu(y[p] + i + l * width); \
+				step \
+			} \
+		} \
+	} \
+	for (p = 0; p < GROUP; p++) { \
+		for (l = 0; l < LANES(width); l++) { \
+			storeu(sums + p * SUMS + l * width, acc[p][l]); \
+			storeu(sums + p * SUMS + DISTANCE_PAD + l * width, used[p][l]); \
+		} \
+	} \
+}
+#define DEFINE_KERNELS(isa, name, vec, width, loadu, storeu, set1, add, sub, mul, div, min, and, andnot, cmpgt) \
+DEFINE_KERNEL(isa, name, vec, width, loadu, storeu, absdiff, \
+	vec sign = set1(-0.0);, \
+	acc[p][l] = add(acc[p][l], andnot(sign, sub(a, b)));) \
+DEFINE_KERNEL(isa, name, vec, width, loadu, storeu, sqdiff, , \
+	vec d = sub(a, b); \
+	acc[p][l] = add(acc[p][l], mul(d, d));) \
+DEFINE_KERNEL(isa, name, vec, width, loadu, storeu, canberra, \
+	vec sign = set1(-0.0); \
+	vec zero = set1(0.0); \
+	vec one = set1(1.0);, \
+	vec total = add(a, b); \
+	vec mask = cmpgt(total, zero); \
+	acc[p][l] = add(acc[p][l], and(mask, div(andnot(sign, sub(a, b)), total))); \
+	used[p][l] = add(used[p][l], and(mask, one));) \
+DEFINE_KERNEL(isa, name, vec, width, loadu, storeu, lesser, , \
+	acc[p][l] = add(acc[p][l], min(a, b));)
+
+#define sse2_cmpgt(a, b) _mm_cmpgt_pd(a, b)
+#define avx2_cmpgt(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+DEFINE_KERNELS(sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+	       _mm_set1_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_div_pd,
+	       _mm_min_pd, _mm_and_pd, _mm_andnot_pd, sse2_cmpgt)
+DEFINE_KERNELS(avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,
+	       _mm256_set1_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd,
+	       _mm256_div_pd, _mm256_min_pd, _mm256_and_pd, _mm256_andnot_pd,
+	       avx2_cmpgt)
+#endif
+
+static pthread_once_t kernels_chosen = PTHREAD_ONCE_INIT;
+
+static void choose_kernels(void)
+{
+#ifdef DISTANCE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernels.absdiff = avx2_absdiff;
+		kernels.sqdiff = avx2_sqdiff;
+		kernels.canberra = avx2_canberra;
+		kernels.lesser = avx2_lesser;
+	} else if (__builtin_cpu_supports("sse2")) {
+		kernels.absdiff = sse2_absdiff;
+		kernels.sqdiff = sse2_sqdiff;
+		kernels.canberra = sse2_canberra;
+		kernels.lesser = sse2_lesser;
+	}
+#endif
+}
+
+static const struct {
+	const char *name;
+	distancemethod method;
+} method_names[] = {
+	{"bray", DISTANCE_BRAY},
+	{"canberra", DISTANCE_CANBERRA},
+	{"euclidean", DISTANCE_EUCLIDEAN},
+	{"hellinger", DISTANCE_HELLINGER},
+	{"jaccard", DISTANCE_JACCARD},
+	{"kulczynski", DISTANCE_KULCZYNSKI}
+};
+
+bool distance_parse(const char *name, distancemethod *method)
+{
+	size_t i;
+	for (i = 0; i < sizeof(method_names) / sizeof(method_names[0]); i++) {
+		if (strcmp(name, method_names[i].name) == 0) {
+			*method = method_names[i].method;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* What every block needs to know. */
+typedef struct {
+	const double *rows;
+	size_t count;
+	size_t stride;
+	distancemethod method;
+	distancekernel kernel;
+	/* The sum of each row, for the methods that scale by them. */
+	const double *totals;
+	/* A row of zeros, to fill out a group of rows. */
+	const double *zeros;
+	double *distances;
+} distancework;
+
+/* The pairs between one block of rows and another, or within one block when both are the same. */
+typedef struct {
+	const distancework *work;
+	size_t first;
+	size_t second;
+} distancetile;
+
+static double finish(const distancework *work, const double *sums, size_t i,
+		     size_t j)
+{
+	double sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	double used;
+	double bray;
+	switch (work->method) {
+	case DISTANCE_BRAY:
+		return sum / (work->totals[i] + work->totals[j]);
+	case DISTANCE_CANBERRA:
+		used = (sums[4] + sums[5]) + (sums[6] + sums[7]);
+		return used == 0 ? NAN : sum / used;
+	case DISTANCE_EUCLIDEAN:
+	case DISTANCE_HELLINGER:
+		return sqrt(sum);
+	case DISTANCE_JACCARD:
+		bray = sum / (work->totals[i] + work->totals[j]);
+		return 2 * bray / (1 + bray);
+	case DISTANCE_KULCZYNSKI:
+		return 1 - sum / work->totals[i] / 2 - sum / work->totals[j] / 2;
+	}
+	return NAN;
+}
+
+static void tile_work(void *data)
+{
+	const distancetile *tile = data;
+	const distancework *work = tile->work;
+	/* Kernels always fill GROUP pairs, so there is room for the extras at the end of each row. */
+	double sums[TILE][TILE + GROUP - 1][SUMS];
+	size_t first_end = tile->first + TILE;
+	size_t second_end = tile->second + TILE;
+	size_t column;
+	size_t i;
+	size_t j;
+	size_t p;
+
+	if (first_end > work->count) {
+		first_end = work->count;
+	}
+	if (second_end > work->count) {
+		second_end = work->count;
+	}
+	memset(sums, 0, sizeof(sums));
+	for (column = 0; column < work->stride; column += SLICE) {
+		size_t len = work->stride - column < SLICE ? work->stride - column : SLICE;
+		for (i = tile->first; i < first_end; i++) {
+			const double *x = work->rows + i * work->stride + column;
+			size_t limit = second_end < i ? second_end : i;
+			for (j = tile->second; j < limit; j += GROUP) {
+				const double *y[GROUP];
+				for (p = 0; p < GROUP; p++) {
+					y[p] = (j + p < limit ?
+						work->rows + (j + p) * work->stride :
+						work->zeros) + column;
+				}
+				work->kernel(x, y, len,
+					     sums[i - tile->first][j - tile->second]);
+			}
+		}
+	}
+	for (i = tile->first; i < first_end; i++) {
+		for (j = tile->second; j < second_end && j < i; j++) {
+			work->distances[DISTANCE_INDEX(i, j)] =
+			    finish(work, sums[i - tile->first][j - tile->second], i, j);
+		}
+	}
+}
+
+bool distance_compute(const double *rows, size_t count, size_t stride,
+		      distancemethod method, int threads, double *distances)
+{
+	distancework work;
+	distancetile *tiles;
+	double *totals = NULL;
+	double *transformed = NULL;
+	double *zeros;
+	size_t tile_count = 0;
+	size_t blocks = (count + TILE - 1) / TILE;
+	size_t i;
+	size_t j;
+	pool *workers;
+
+	pthread_once(&kernels_chosen, choose_kernels);
+	work.rows = rows;
+	work.count = count;
+	work.stride = stride;
+	work.method = method;
+	work.distances = distances;
+	switch (method) {
+	case DISTANCE_BRAY:
+	case DISTANCE_JACCARD:
+		work.kernel = kernels.absdiff;
+		break;
+	case DISTANCE_CANBERRA:
+		work.kernel = kernels.canberra;
+		break;
+	case DISTANCE_KULCZYNSKI:
+		work.kernel = kernels.lesser;
+		break;
+	default:
+		work.kernel = kernels.sqdiff;
+		break;
+	}
+	if (method == DISTANCE_BRAY || method == DISTANCE_JACCARD
+	    || method == DISTANCE_KULCZYNSKI || method == DISTANCE_HELLINGER) {
+		totals = calloc(count + 1, sizeof(double));
+		if (totals == NULL) {
+			return false;
+		}
+		for (i = 0; i < count; i++) {
+			for (j = 0; j < stride; j++) {
+				totals[i] += rows[i * stride + j];
+			}
+		}
+	}
+	/* Hellinger is Euclidean on the square roots of the proportions, so the rows are transformed first. */
+	if (method == DISTANCE_HELLINGER) {
+		transformed = malloc((count * stride + 1) * sizeof(double));
+		if (transformed == NULL) {
+			free(totals);
+			return false;
+		}
+		for (i = 0; i < count; i++) {
+			for (j = 0; j < stride; j++) {
+				transformed[i * stride + j] =
+				    sqrt(rows[i * stride + j] / totals[i]);
+			}
+		}
+		work.rows = transformed;
+	}
+	work.totals = totals;
+
+	zeros = calloc(stride + 1, sizeof(double));
+	work.zeros = zeros;
+	tiles = malloc((blocks * (blocks + 1) / 2 + 1) * sizeof(distancetile));
+	workers = tiles == NULL || zeros == NULL ? NULL : pool_new(threads);
+	if (workers == NULL) {
+		free(tiles);
+		free(zeros);
+		free(totals);
+		free(transformed);
+		return false;
+	}
+	for (i = 0; i < blocks; i++) {
+		for (j = 0; j <= i; j++) {
+			tiles[tile_count].work = &work;
+			tiles[tile_count].first = i * TILE;
+			tiles[tile_count].second = j * TILE;
+			pool_submit(workers, tile_work, &tiles[tile_count++]);
+		}
+	}
+	pool_free(workers);
+	free(tiles);
+	free(zeros);
+	free(totals);
+	free(transformed);
+	return true;
+}
@@ -0,0 +1,34 @@
+/* Ecological distances between the samples of a community table */
+#ifndef AXIOME_DISTANCE_H
+#define AXIOME_DISTANCE_H
+#include<stdbool.h>
+#include<stddef.h>
+
+/*
+ * These are computed as vegan's vegdist does; Jaccard is the quantitative form (vegdist without binary), which is 2B / (1 + B) for Bray-Curtis B, and Hellinger is the Euclidean distance between the square roots of each sample's proportions.
+ */
+typedef enum {
+	DISTANCE_BRAY,
+	DISTANCE_CANBERRA,
+	DISTANCE_EUCLIDEAN,
+	DISTANCE_HELLINGER,
+	DISTANCE_JACCARD,
+	DISTANCE_KULCZYNSKI
+} distancemethod;
+
+/* Find a method by its vegdist name. Returns false if there is no such method. */
+bool distance_parse(const char *name, distancemethod *method);
+
+/* Rows must be padded with zeros to a multiple of this many columns. */
+#define DISTANCE_PAD 4
+/* Where the distance between rows i and j, for j < i, is kept. */
+#define DISTANCE_INDEX(i, j) ((i) * ((i) - 1) / 2 + (j))
+
+/*
+ * Compute the distance between every pair of rows, which are stride doubles apart and must not be negative. The distances, count * (count - 1) / 2 of them, are stored as DISTANCE_INDEX says. A pair with nothing to compare, such as two empty rows, has a distance of NaN.
+ *
+ * Blocks of rows are compared a slice of columns at a time, so they stay in cache, and the blocks are shared out over the threads. On x86, the columns are compared using AVX2 or SSE2, whichever the processor supports; elsewhere, plain C is used. Every pair is added up in the same order either way, so the results do not depend on the number of threads. Returns false if memory could not be allocated.
+ */
+bool distance_compute(const double *rows, size_t count, size_t stride,
+		      distancemethod method, int threads, double *distances);
+#endif
@@ -0,0 +1,196 @@
+/* Compute distance matrices between the samples of an OTU table */
+#include<ctype.h>
+#include<errno.h>
+#include<math.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "distance.h"
+#include "otutable.h"
+
+/* A matrix to write: how to measure the distances and where to put them. */
+typedef struct {
+	distancemethod method;
+	const char *output;
+} distancetarget;
+
+/* Write a matrix as QIIME does, with the sample names across the top and down the side. Distances that cannot be computed are written as R's NA. */
+static bool write_matrix(const otutable *table, const double *distances,
+			 size_t count, FILE *file)
+{
+	size_t i;
+	size_t j;
+	for (i = 0; i < count; i++) {
+		fprintf(file, "\t%s", otutable_sample(table, i));
+	}
+	fputc('\n', file);
+	for (i = 0; i < count; i++) {
+		fputs(otutable_sample(table, i), file);
+		for (j = 0; j < count; j++) {
+			double d = i == j ? 0 : distances[i > j ? DISTANCE_INDEX(i, j) :
+							  DISTANCE_INDEX(j, i)];
+			if (isnan(d)) {
+				fputs("\tNA", file);
+			} else {
+				fprintf(file, "\t%.15g", d);
+			}
+		}
+		fputc('\n', file);
+	}
+	return !ferror(file);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int threads = 1;
+	const char *input;
+	otutable *table;
+	unsigned long line;
+	distancetarget *targets;
+	size_t target_count;
+	size_t sample_count;
+	size_t otu_count;
+	size_t column_count = 0;
+	size_t stride;
+	uint32_t *columns;
+	double *rows;
+	double *distances;
+	int result = 0;
+	size_t otu;
+	size_t s;
+	size_t t;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "t:")) != -1) {
+		switch (c) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case '?':
+			if (optopt == (int)'t') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+	if (argc - optind < 2 || threads < 1) {
+		fprintf(stderr,
+			"Usage: %s [-t threads] otu_table method:output [method:output ...]\n\t-t\tThe number of threads to use.\n\tThe method is one of bray, canberra, euclidean, hellinger, jaccard or kulczynski.\n",
+			argv[0]);
+		return 1;
+	}
+	input = argv[optind];
+	target_count = argc - optind - 1;
+	targets = calloc(target_count, sizeof(distancetarget));
+	if (targets == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (t = 0; t < target_count; t++) {
+		char *arg = argv[optind + 1 + t];
+		char *colon = strchr(arg, ':');
+		if (colon == NULL || colon[1] == '\0') {
+			fprintf(stderr, "Bad target `%s'. It must be method:output.\n",
+				arg);
+			return 1;
+		}
+		*colon = '\0';
+		if (!distance_parse(arg, &targets[t].method)) {
+			fprintf(stderr, "Unknown distance method `%s'.\n", arg);
+			return 1;
+		}
+		targets[t].output = colon + 1;
+	}
+
+	table = otutable_load(input, &line);
+	if (table == NULL) {
+		if (errno == EINVAL && line > 0) {
+			fprintf(stderr, "%s:%lu: Malformed OTU table.\n", input,
+				line);
+		} else {
+			perror(input);
+		}
+		return 1;
+	}
+	sample_count = otutable_sample_count(table);
+	otu_count = otutable_otu_count(table);
+
+	/* Lay the samples out as rows, leaving out OTUs with no sequences, since they add nothing to any distance. */
+	columns = malloc((otu_count + 1) * sizeof(uint32_t));
+	if (columns == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (otu = 0; otu < otu_count; otu++) {
+		const uint32_t *samples;
+		const double *counts;
+		columns[otu] = column_count;
+		if (otutable_row(table, otu, &samples, &counts) > 0) {
+			column_count++;
+		}
+	}
+	stride = (column_count + DISTANCE_PAD - 1) / DISTANCE_PAD * DISTANCE_PAD;
+	rows = calloc(sample_count * stride + 1, sizeof(double));
+	distances =
+	    malloc((sample_count * (sample_count - (sample_count > 0)) / 2 + 1) *
+		   sizeof(double));
+	if (rows == NULL || distances == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (s = 0; s < sample_count; s++) {
+		const uint32_t *otus;
+		const double *counts;
+		size_t entries = otutable_column(table, s, &otus, &counts);
+		size_t i;
+		for (i = 0; i < entries; i++) {
+			if (counts[i] < 0) {
+				fprintf(stderr, "%s: OTU %s has a negative count in sample %s.\n",
+					input, otutable_otu(table, otus[i]),
+					otutable_sample(table, s));
+				return 1;
+			}
+			rows[s * stride + columns[otus[i]]] = counts[i];
+		}
+	}
+	free(columns);
+
+	for (t = 0; t < target_count; t++) {
+		const char *name = targets[t].output;
+		FILE *file;
+		if (!distance_compute(rows, sample_count, stride,
+				      targets[t].method, threads, distances)) {
+			perror(argv[0]);
+			return 1;
+		}
+		file = strcmp(name, "-") == 0 ? stdout : fopen(name, "w");
+		if (file == NULL) {
+			perror(name);
+			result = 1;
+		} else if (!write_matrix(table, distances, sample_count, file)
+			   | ((file == stdout ? fflush(file) : fclose(file)) != 0)) {
+			perror(name);
+			result = 1;
+		}
+	}
+	free(rows);
+	free(distances);
+	otutable_free(table);
+	free(targets);
+	return result;
+}
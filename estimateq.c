@@ -1,67 +1,142 @@
 /* Estimate error probability from tags an Illumina FASTQ read */
-#include<bzlib.h>
 #include<ctype.h>
 #include<errno.h>
 #if !defined(__APPLE__)
 #include<error.h>
 #endif
 #include<fcntl.h>
+#include<stdbool.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 #include<sys/stat.h>
 #include<time.h>
 #include<unistd.h>
-#include<zlib.h>
-#include "kseq.h"
+#include "fastq.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "tagerror.h"
+#include "textbuf.h"
 
-/* Function pointers for file I/O such that we can deal with compressed files. */
-void *(*fileopen) (char *, char *) = (void *(*)(char *, char *))gzopen;
-int (*fileread) (void *, void *, int) = (int (*)(void *, void *, int))gzread;
-int (*fileclose) (void *) = (int (*)(void *))gzclose;
+typedef struct {
+	tagmatcher *matcher;
+	tagerrors total;
+	bool failed;
+} estimateq;
 
-/* Compatibility function to make BZ2_bzRead look like gzread. */
-int bzread(BZFILE * file, void *buf, int len)
+/* Each batch counts its own mismatches, which are folded into the total in input order. */
+typedef struct {
+	tagerrors errors;
+	textbuf log;
+	bool failed;
+} estimatebatch;
+
+static void estimateq_release(void *state)
+{
+	estimatebatch *output = state;
+	tagerrors_free(&output->errors);
+	textbuf_free(&output->log);
+	free(output);
+}
+
+static void estimateq_work(fastqbatch *batch, void *context)
+{
+	estimateq *e = context;
+	estimatebatch *output = batch->state;
+	size_t taglen = tagmatcher_length(e->matcher);
+	size_t tag_count = tagmatcher_count(e->matcher);
+	size_t i;
+	size_t t;
+	if (output == NULL) {
+		output = calloc(1, sizeof(estimatebatch));
+		if (output == NULL) {
+			return;
+		}
+		batch->state = output;
+	}
+	tagerrors_clear(&output->errors);
+	output->log.len = 0;
+	output->failed = false;
+	for (i = 0; i < batch->count; i++) {
+		fastqrecord *seq = &batch->records[i];
+		seqheader id;
+		if (seqheader_parse(&id, seq->name, seq->name_len) != SEQID_OK)
+			continue;
+		/* As before, a tag of the wrong length is reported once for each tag it is compared against. */
+		for (t = 0; id.tag.length != taglen && t < tag_count; t++) {
+			if (!textbuf_printf(&output->log,
+					    "Tags specified are of length %d, but tag in file has length %d. Skipping.\n",
+					    (int)taglen, (int)id.tag.length)) {
+				output->failed = true;
+				return;
+			}
+		}
+		if (!tagerrors_add(&output->errors, e->matcher, &id, seq->name)) {
+			output->failed = true;
+			return;
+		}
+	}
+}
+
+static void estimateq_commit(fastqbatch *batch, void *context)
 {
-	int bzerror = BZ_OK;
-	int retval = BZ2_bzRead(&bzerror, file, buf, len);
-	if (bzerror == BZ_OK || bzerror == BZ_STREAM_END) {
-		return retval;
-	} else {
-		fprintf(stderr, "bzip error %d\n", bzerror);
-		return -1;
+	estimateq *e = context;
+	estimatebatch *output = batch->state;
+	if (output == NULL || output->failed
+	    || !tagerrors_merge(&e->total, &output->errors)) {
+		e->failed = true;
+		return;
 	}
+	fwrite(output->log.data, 1, output->log.len, stdout);
 }
 
-KSEQ_INIT(void *, fileread)
+/* Open an output file, or exit. */
+static FILE *estimateq_open(const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		perror(filename);
+		exit(1);
+	}
+	return f;
+}
 
 int main(int argc, char **argv)
 {
 	int c;
 	int bzip = 0;
+	int threads = 1;
 	char *filename = NULL;
-	void *file;
-	kseq_t *seq;
-	int len;
-	int taglen;
-	int i, j;
-	int count = 0;
-	int totalmismatches = 0;
+	FILE *cycles = NULL;
+	FILE *tiles = NULL;
+	inputfile *file;
+	estimateq e;
+	pipelinestages stages =
+	    { estimateq_work, estimateq_commit, estimateq_release };
+	bool ok;
 
+	memset(&e, 0, sizeof(e));
 	/* Process command line arguments. */
-	while ((c = getopt(argc, argv, "jf:")) != -1) {
+	while ((c = getopt(argc, argv, "c:jf:l:t:")) != -1) {
 		switch (c) {
+		case 'c':
+			cycles = estimateq_open(optarg);
+			break;
 		case 'j':
-			fileopen = (void *(*)(char *, char *))BZ2_bzopen;
-			fileread = (int (*)(void *, void *, int))bzread;
-			fileclose = (int (*)(void *))BZ2_bzclose;
 			bzip = 1;
 			break;
 		case 'f':
 			filename = optarg;
 			break;
+		case 'l':
+			tiles = estimateq_open(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
 		case '?':
-			if (optopt == (int)'f') {
+			if (optopt == (int)'c' || optopt == (int)'f'
+			    || optopt == (int)'l' || optopt == (int)'t') {
 				fprintf(stderr,
 					"Option -%c requires an argument.\n",
 					optopt);
@@ -79,62 +154,71 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (filename == NULL) {
+	if (filename == NULL || optind == argc) {
 		fprintf(stderr,
-			"Usage: %s [-j] -f file.fastq\n\t-j\tInput files are bzipped.\n",
+			"Usage: %s [-j] [-t threads] [-c cycles] [-l tiles] -f file.fastq tag1 tag2 ...\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use.\n\t-c\tWrite the error rate at each position in the tag to a file.\n\t-l\tWrite the error rate of each tile to a file.\n",
 			argv[0]);
 		return 1;
 	}
 
-	taglen = strlen(argv[optind]);
-	for (i = optind + 1; i < argc; i++) {
-		if (strlen(argv[i]) != taglen) {
+	for (c = optind + 1; c < argc; c++) {
+		if (strlen(argv[c]) != strlen(argv[optind])) {
 			fprintf(stderr,
 				"Primer %s is not of the same length.\n",
-				argv[i]);
+				argv[c]);
 			return 1;
 		}
 	}
-	printf("PRIMERS = %d\nTAGLEN = %d\n", argc - optind, taglen);
+	e.matcher =
+	    tagmatcher_new((const char *const *)argv + optind, argc - optind);
+	if (e.matcher == NULL) {
+		if (errno == EINVAL) {
+			fprintf(stderr, "Tags must be at most %d long.\n",
+				TAGMATCH_MAX_LENGTH);
+		} else {
+			perror(argv[0]);
+		}
+		return 1;
+	}
+	printf("PRIMERS = %d\nTAGLEN = %d\n", argc - optind,
+	       (int)tagmatcher_length(e.matcher));
 
 	/* Open files and initialise FASTQ reader. */
-	file = fileopen(filename, "r");
+	file = input_open(filename, bzip, threads);
 	if (file == NULL) {
 		perror(filename);
 		return 1;
 	}
-	seq = kseq_init(file);
-
-	while ((len = kseq_read(seq)) >= 0) {
-		int bestmismatches = taglen;
-		seqidentifier id;
-		if (seqid_parse(&id, seq->name.s) == 0)
-			continue;
-
-		for (i = optind; i < argc; i++) {
-			int mismatches = 0;
-			int k;
-			if (strlen(id.tag) != taglen) {
-				printf("Tags specified are of length %d, but tag in file has length %d. Skipping.\n", taglen, (int)strlen(id.tag));
-				continue;
-			}
-			for (k = 0; k < taglen; k++) {
-				if (id.tag[k] != argv[i][k]) {
-					mismatches++;
-				}
-			}
-			if (mismatches < bestmismatches) {
-				bestmismatches = mismatches;
-			}
+	ok = pipeline_run(file, threads, &stages, &e);
+	if (!input_close(file)) {
+		perror(filename);
+		ok = false;
+	} else if (!ok) {
+		fprintf(stderr, "%s: Malformed FASTQ record.\n", filename);
+	}
+	if (e.failed) {
+		fprintf(stderr, "Out of memory.\n");
+		ok = false;
+	}
+	tagerrors_print(&e.total, e.matcher, stdout);
+	if (cycles != NULL) {
+		tagerrors_print_cycles(&e.total, e.matcher, cycles);
+		if (fclose(cycles) != 0) {
+			perror(argv[0]);
+			ok = false;
 		}
-		count++;
-		totalmismatches += bestmismatches;
 	}
-	kseq_destroy(seq);
-	printf("TOTAL = %d\nMISMATCHES = %d\nQ = %f\n", count * taglen,
-	       totalmismatches, (1.0 * totalmismatches) / (count * taglen));
-	if (fileclose(file) != Z_OK && bzip == 0) {
-		perror(filename);
+	if (tiles != NULL) {
+		if (!tagerrors_print_tiles(&e.total, e.matcher, tiles)) {
+			fprintf(stderr, "Out of memory.\n");
+			ok = false;
+		}
+		if (fclose(tiles) != 0) {
+			perror(argv[0]);
+			ok = false;
+		}
 	}
-	return 0;
+	tagerrors_free(&e.total);
+	tagmatcher_free(e.matcher);
+	return ok ? 0 : 1;
 }
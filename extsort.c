@@ -0,0 +1,383 @@
+/* Sort fixed-size records that may not fit in memory */
+#include<errno.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/types.h>
+#include<unistd.h>
+#include "extsort.h"
+
+/* The buffer for each run while writing or merging. */
+#define RUN_BUFFER 65536
+
+/* A sorted run, counted in records from the start of the file. */
+typedef struct {
+	size_t start;
+	size_t count;
+} extrun;
+
+/* A run being merged, read through a buffer of its own. */
+typedef struct {
+	char *buffer;
+	size_t pos;
+	size_t len;
+	/* What is not yet in the buffer. */
+	size_t next;
+	size_t left;
+} extreader;
+
+struct extsort {
+	size_t record_size;
+	extsortcompare compare;
+	const char *directory;
+	char *records;
+	size_t count;
+	size_t capacity;
+	/* Where reading is up to, if everything fit in memory. */
+	size_t next;
+	/* The runs, one after the other in a single temporary file. */
+	FILE *file;
+	size_t written;
+	extrun *runs;
+	size_t run_count;
+	size_t run_size;
+	/* How many runs are merged at once, each with a buffer, and how many records each buffer holds. */
+	size_t fan_in;
+	size_t reader_size;
+	/* While merging, the runs being read and a heap of them ordered by their first unread record. */
+	extreader *readers;
+	size_t *heap;
+	size_t heap_count;
+};
+
+extsort *extsort_new(size_t record_size, extsortcompare compare,
+		     size_t budget, const char *directory)
+{
+	extsort *sort = calloc(1, sizeof(extsort));
+	if (sort == NULL) {
+		return NULL;
+	}
+	sort->record_size = record_size;
+	sort->compare = compare;
+	sort->directory = directory;
+	/* Half the budget holds records before they are written as a run; the other half holds the buffers of the runs being merged. */
+	sort->capacity = budget / 2 / record_size;
+	if (sort->capacity < 1024) {
+		sort->capacity = 1024;
+	}
+	sort->reader_size = RUN_BUFFER / record_size;
+	if (sort->reader_size < 1) {
+		sort->reader_size = 1;
+	}
+	sort->fan_in = budget / 2 / (sort->reader_size * record_size);
+	if (sort->fan_in < 2) {
+		sort->fan_in = 2;
+	}
+	sort->records = malloc(sort->capacity * record_size);
+	if (sort->records == NULL) {
+		free(sort);
+		return NULL;
+	}
+	return sort;
+}
+
+/* Make a new temporary file for runs. */
+static FILE *extsort_create(extsort *sort)
+{
+	size_t len = strlen(sort->directory);
+	char *filename = malloc(len + sizeof("/aq-sort.XXXXXX"));
+	FILE *file;
+	int fd;
+	if (filename == NULL) {
+		return NULL;
+	}
+	memcpy(filename, sort->directory, len);
+	strcpy(filename + len, "/aq-sort.XXXXXX");
+	fd = mkstemp(filename);
+	if (fd == -1) {
+		free(filename);
+		return NULL;
+	}
+	unlink(filename);
+	free(filename);
+	file = fdopen(fd, "w+");
+	if (file == NULL) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return NULL;
+	}
+	setvbuf(file, NULL, _IOFBF, RUN_BUFFER);
+	return file;
+}
+
+/* Note a run that has just been written. */
+static bool extsort_run(extsort *sort, size_t start, size_t count)
+{
+	if (sort->run_count == sort->run_size) {
+		size_t size = sort->run_size == 0 ? 16 : 2 * sort->run_size;
+		extrun *bigger = realloc(sort->runs, size * sizeof(extrun));
+		if (bigger == NULL) {
+			return false;
+		}
+		sort->runs = bigger;
+		sort->run_size = size;
+	}
+	sort->runs[sort->run_count].start = start;
+	sort->runs[sort->run_count].count = count;
+	sort->run_count++;
+	return true;
+}
+
+/* Sort what is in memory and add it to the file as a new run. */
+static bool extsort_spill(extsort *sort)
+{
+	if (sort->file == NULL
+	    && (sort->file = extsort_create(sort)) == NULL) {
+		return false;
+	}
+	qsort(sort->records, sort->count, sort->record_size, sort->compare);
+	if (fwrite(sort->records, sort->record_size, sort->count, sort->file)
+	    != sort->count
+	    || !extsort_run(sort, sort->written, sort->count)) {
+		return false;
+	}
+	sort->written += sort->count;
+	sort->count = 0;
+	return true;
+}
+
+bool extsort_add(extsort *sort, const void *record)
+{
+	if (sort->count == sort->capacity && !extsort_spill(sort)) {
+		return false;
+	}
+	memcpy(sort->records + sort->count * sort->record_size, record,
+	       sort->record_size);
+	sort->count++;
+	return true;
+}
+
+static const char *reader_head(const extsort *sort, size_t reader)
+{
+	return sort->readers[reader].buffer +
+	    sort->readers[reader].pos * sort->record_size;
+}
+
+static bool heap_less(const extsort *sort, size_t a, size_t b)
+{
+	return sort->compare(reader_head(sort, a), reader_head(sort, b)) < 0;
+}
+
+static void heap_down(extsort *sort, size_t i)
+{
+	for (;;) {
+		size_t smallest = i;
+		size_t child = 2 * i + 1;
+		size_t swap;
+		if (child < sort->heap_count
+		    && heap_less(sort, sort->heap[child], sort->heap[smallest])) {
+			smallest = child;
+		}
+		if (child + 1 < sort->heap_count
+		    && heap_less(sort, sort->heap[child + 1],
+				 sort->heap[smallest])) {
+			smallest = child + 1;
+		}
+		if (smallest == i) {
+			return;
+		}
+		swap = sort->heap[i];
+		sort->heap[i] = sort->heap[smallest];
+		sort->heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+/* Read the next part of a run into its buffer. Returns 1, 0 at the end of the run, or -1 on error. */
+static int reader_fill(extsort *sort, size_t reader)
+{
+	extreader *r = &sort->readers[reader];
+	size_t count = r->left < sort->reader_size ? r->left : sort->reader_size;
+	size_t bytes = count * sort->record_size;
+	size_t done = 0;
+	r->pos = 0;
+	r->len = count;
+	if (count == 0) {
+		return 0;
+	}
+	while (done < bytes) {
+		ssize_t got = pread(fileno(sort->file), r->buffer + done,
+				    bytes - done,
+				    (off_t)(r->next * sort->record_size + done));
+		if (got < 0 && errno == EINTR) {
+			continue;
+		} else if (got <= 0) {
+			if (got == 0) {
+				errno = EIO;
+			}
+			return -1;
+		}
+		done += got;
+	}
+	r->next += count;
+	r->left -= count;
+	return 1;
+}
+
+/* Start merging count runs from first, with the smallest first record at the top of the heap. */
+static bool merge_start(extsort *sort, size_t first, size_t count)
+{
+	size_t i;
+	sort->heap_count = 0;
+	for (i = 0; i < count; i++) {
+		int result;
+		sort->readers[i].next = sort->runs[first + i].start;
+		sort->readers[i].left = sort->runs[first + i].count;
+		result = reader_fill(sort, i);
+		if (result < 0) {
+			return false;
+		} else if (result > 0) {
+			sort->heap[sort->heap_count++] = i;
+		}
+	}
+	for (i = sort->heap_count; i-- > 0;) {
+		heap_down(sort, i);
+	}
+	return true;
+}
+
+/* Move past the record at the top of the heap, once it has been used. */
+static bool merge_advance(extsort *sort)
+{
+	extreader *r = &sort->readers[sort->heap[0]];
+	if (++r->pos == r->len) {
+		int result = reader_fill(sort, sort->heap[0]);
+		if (result < 0) {
+			return false;
+		} else if (result == 0) {
+			sort->heap[0] = sort->heap[--sort->heap_count];
+		}
+	}
+	heap_down(sort, 0);
+	return true;
+}
+
+/* Merge the runs a batch at a time into fewer, longer runs in a new file. */
+static bool merge_pass(extsort *sort)
+{
+	FILE *merged = extsort_create(sort);
+	size_t written = 0;
+	size_t count = 0;
+	size_t i;
+	if (merged == NULL) {
+		return false;
+	}
+	for (i = 0; i < sort->run_count; i += sort->fan_in) {
+		size_t batch = sort->run_count - i < sort->fan_in ?
+		    sort->run_count - i : sort->fan_in;
+		size_t start = written;
+		bool ok = merge_start(sort, i, batch);
+		while (ok && sort->heap_count > 0) {
+			ok = fwrite(reader_head(sort, sort->heap[0]),
+				    sort->record_size, 1, merged) == 1
+			    && merge_advance(sort);
+			written++;
+		}
+		if (!ok) {
+			int error = errno;
+			fclose(merged);
+			errno = error;
+			return false;
+		}
+		/* The batch has been read, so its place can be reused. */
+		sort->runs[count].start = start;
+		sort->runs[count].count = written - start;
+		count++;
+	}
+	if (fflush(merged) != 0) {
+		int error = errno;
+		fclose(merged);
+		errno = error;
+		return false;
+	}
+	fclose(sort->file);
+	sort->file = merged;
+	sort->written = written;
+	sort->run_count = count;
+	return true;
+}
+
+bool extsort_finish(extsort *sort)
+{
+	size_t i;
+	if (sort->run_count == 0) {
+		qsort(sort->records, sort->count, sort->record_size,
+		      sort->compare);
+		return true;
+	}
+	if (sort->count > 0 && !extsort_spill(sort)) {
+		return false;
+	}
+	if (fflush(sort->file) != 0) {
+		return false;
+	}
+	/* The runs are on disk, so the memory can go to reading them. */
+	free(sort->records);
+	sort->records = NULL;
+	sort->readers = calloc(sort->fan_in, sizeof(extreader));
+	sort->heap = malloc(sort->fan_in * sizeof(size_t));
+	if (sort->readers == NULL || sort->heap == NULL) {
+		return false;
+	}
+	for (i = 0; i < sort->fan_in; i++) {
+		sort->readers[i].buffer =
+		    malloc(sort->reader_size * sort->record_size);
+		if (sort->readers[i].buffer == NULL) {
+			return false;
+		}
+	}
+	/* Until the runs can all be merged at once, merge them into longer ones. */
+	while (sort->run_count > sort->fan_in) {
+		if (!merge_pass(sort)) {
+			return false;
+		}
+	}
+	return merge_start(sort, 0, sort->run_count);
+}
+
+int extsort_next(extsort *sort, void *record)
+{
+	if (sort->run_count == 0) {
+		if (sort->next == sort->count) {
+			return 0;
+		}
+		memcpy(record, sort->records + sort->next * sort->record_size,
+		       sort->record_size);
+		sort->next++;
+		return 1;
+	}
+	if (sort->heap_count == 0) {
+		return 0;
+	}
+	memcpy(record, reader_head(sort, sort->heap[0]), sort->record_size);
+	return merge_advance(sort) ? 1 : -1;
+}
+
+void extsort_free(extsort *sort)
+{
+	size_t i;
+	if (sort->file != NULL) {
+		fclose(sort->file);
+	}
+	if (sort->readers != NULL) {
+		for (i = 0; i < sort->fan_in; i++) {
+			free(sort->readers[i].buffer);
+		}
+	}
+	free(sort->readers);
+	free(sort->runs);
+	free(sort->records);
+	free(sort->heap);
+	free(sort);
+}
@@ -0,0 +1,24 @@
+/* Sort fixed-size records that may not fit in memory */
+#ifndef AXIOME_EXTSORT_H
+#define AXIOME_EXTSORT_H
+#include<stdbool.h>
+#include<stddef.h>
+
+typedef int (*extsortcompare) (const void *a, const void *b);
+
+/*
+ * Records are gathered in memory until half the budget is used, then sorted and written as a run to a temporary file. Once all are added, the runs are merged as they are read back. The other half of the budget holds a buffer for each run being merged, so if there are more runs than buffers, batches of them are first merged into longer runs in a new file until one pass is left. All the runs share one file, so a sort holds at most two descriptors however many runs there are. The temporary files are unlinked as soon as they are made, so nothing is left behind.
+ */
+typedef struct extsort extsort;
+
+/* Start a sort using about budget bytes of memory and putting runs in directory. Returns NULL if memory runs out. */
+extsort *extsort_new(size_t record_size, extsortcompare compare,
+		     size_t budget, const char *directory);
+/* Add a record. Returns false and sets errno if a run could not be written. */
+bool extsort_add(extsort *sort, const void *record);
+/* Stop adding records and start reading them back. Returns false and sets errno on failure. */
+bool extsort_finish(extsort *sort);
+/* Copy out the next record in order. Returns 1 if there was one, 0 at the end, or -1, setting errno, if a run could not be read. */
+int extsort_next(extsort *sort, void *record);
+void extsort_free(extsort *sort);
+#endif
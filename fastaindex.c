@@ -0,0 +1,987 @@
+/* Random access to the sequences in a FASTA file by identifier */
+#include<ctype.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include "fastaindex.h"
+#include "textbuf.h"
+
+#define FASTAINDEX_MAGIC "AQFAIDX3"
+/* Set in an entry's length if the bases are not all together on one line, because the sequence is split across lines or has whitespace in it. */
+#define SCATTERED 0x80000000u
+#define LENGTH_MASK 0x7FFFFFFFu
+
+/*
+ * The saved index is this header, the entries, the prefixes, the hash table, then the names, each NUL-terminated.
+ */
+typedef struct {
+	char magic[8];
+	uint64_t fasta_size;
+	int64_t fasta_mtime;
+	int64_t fasta_mtime_nsec;
+	/* Distinct identifiers. */
+	uint64_t count;
+	/* Entries, including any hidden by a later duplicate. */
+	uint64_t entry_count;
+	/* The entries before this one are looked up by name. */
+	uint64_t named_count;
+	uint64_t prefix_count;
+	uint64_t slot_count;
+	uint64_t names_size;
+} indexheader;
+
+typedef struct {
+	/* The first byte after the header line. */
+	uint64_t offset;
+	/* The bases, not counting whitespace, and SCATTERED. */
+	uint32_t length;
+	/* Where the identifier starts in the names, or, for an identifier <prefix>_<number>, the number. */
+	uint32_t key;
+} indexentry;
+
+/*
+ * The identifiers made by prepare_sequences are <sample>_<number>, so rather than storing each one, the entries sharing a prefix are kept together and only the number is stored. The prefixes are sorted by name.
+ */
+typedef struct {
+	/* Where the prefix starts in the names. */
+	uint32_t name;
+	/* The first of this prefix's entries; they run up to the next prefix's. */
+	uint32_t first;
+} indexprefix;
+
+/* What is being looked up: a whole identifier, or a prefix and number. */
+typedef struct {
+	uint64_t hash;
+	const char *id;
+	bool numbered;
+	uint32_t prefix;
+	uint32_t number;
+} indexkey;
+
+struct fastaindex {
+	const char *data;
+	size_t data_size;
+	const indexentry *entries;
+	size_t entry_count;
+	size_t named_count;
+	const indexprefix *prefixes;
+	size_t prefix_count;
+	/* An open-addressed hash table of one more than an entry's position, or 0 if empty. */
+	const uint32_t *slots;
+	size_t slot_count;
+	const char *names;
+	size_t names_size;
+	size_t count;
+	/* Either the saved index holds everything, or these do. */
+	char *saved;
+	size_t saved_size;
+	indexentry *built_entries;
+	indexprefix *built_prefixes;
+	uint32_t *built_slots;
+	char *built_names;
+};
+
+static int64_t modification_nsec(const struct stat *info)
+{
+#if defined(__APPLE__)
+	return info->st_mtimespec.tv_nsec;
+#else
+	return info->st_mtim.tv_nsec;
+#endif
+}
+
+static uint64_t hash_name(const char *id, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)id[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint64_t hash_number(uint32_t prefix, uint32_t number)
+{
+	uint64_t hash = ((uint64_t) prefix << 32 | number) + 0x9E3779B97F4A7C15ULL;
+	hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+	return hash ^ (hash >> 31);
+}
+
+/* If an identifier is <prefix>_<number>, with the number written as printf would, split it. */
+static bool split_numbered(const char *id, size_t len, size_t *prefix_len,
+			   uint32_t *number)
+{
+	size_t start = len;
+	uint64_t value = 0;
+	size_t i;
+	while (start > 0 && isdigit((unsigned char)id[start - 1])) {
+		start--;
+	}
+	if (start == len || start == 0 || id[start - 1] != '_'
+	    || len - start > 10 || (id[start] == '0' && len - start > 1)) {
+		return false;
+	}
+	for (i = start; i < len; i++) {
+		value = value * 10 + (id[i] - '0');
+	}
+	if (value > UINT32_MAX) {
+		return false;
+	}
+	*prefix_len = start - 1;
+	*number = value;
+	return true;
+}
+
+/* Compare a NUL-terminated name to one that is not. */
+static int compare_name(const char *name, const char *id, size_t len)
+{
+	int result = strncmp(name, id, len);
+	if (result != 0) {
+		return result;
+	}
+	return name[len] != '\0';
+}
+
+static size_t prefix_end(const fastaindex *index, size_t prefix)
+{
+	return prefix + 1 < index->prefix_count ? index->prefixes[prefix +
+								   1].first :
+	    index->entry_count;
+}
+
+/* Find the slot holding a key, or the empty one where it belongs. */
+static size_t index_probe(const fastaindex *index, const indexkey *key)
+{
+	size_t mask = index->slot_count - 1;
+	size_t slot = key->hash & mask;
+	size_t first = key->numbered ? index->prefixes[key->prefix].first : 0;
+	size_t end =
+	    key->numbered ? prefix_end(index, key->prefix) : index->named_count;
+	for (;; slot = (slot + 1) & mask) {
+		size_t position;
+		const indexentry *entry;
+		if (index->slots[slot] == 0) {
+			return slot;
+		}
+		position = index->slots[slot] - 1;
+		if (position < first || position >= end) {
+			continue;
+		}
+		entry = &index->entries[position];
+		if (key->numbered ? entry->key == key->number :
+		    strcmp(index->names + entry->key, key->id) == 0) {
+			return slot;
+		}
+	}
+}
+
+static const indexentry *fastaindex_find(const fastaindex *index,
+					 const char *id)
+{
+	indexkey key;
+	size_t len = strlen(id);
+	size_t prefix_len;
+	size_t slot;
+	key.id = id;
+	key.numbered = split_numbered(id, len, &prefix_len, &key.number);
+	if (key.numbered) {
+		size_t low = 0;
+		size_t high = index->prefix_count;
+		key.numbered = false;
+		while (low < high) {
+			size_t mid = low + (high - low) / 2;
+			int result = compare_name(index->names +
+						  index->prefixes[mid].name, id,
+						  prefix_len);
+			if (result == 0) {
+				key.numbered = true;
+				key.prefix = mid;
+				break;
+			} else if (result > 0) {
+				high = mid;
+			} else {
+				low = mid + 1;
+			}
+		}
+		if (!key.numbered) {
+			/* Numbered identifiers are never stored by name. */
+			return NULL;
+		}
+		key.hash = hash_number(key.prefix, key.number);
+	} else {
+		key.hash = hash_name(id, len);
+	}
+	slot = index_probe(index, &key);
+	return index->slots[slot] ==
+	    0 ? NULL : &index->entries[index->slots[slot] - 1];
+}
+
+/* Check everything a lookup follows in a saved index, so a damaged one is rebuilt rather than read out of bounds. */
+static bool index_check(const fastaindex *index)
+{
+	bool empty_slot = false;
+	size_t i;
+	if (index->names_size > 0
+	    && index->names[index->names_size - 1] != '\0') {
+		return false;
+	}
+	for (i = 0; i < index->entry_count; i++) {
+		const indexentry *entry = &index->entries[i];
+		if (entry->offset > index->data_size
+		    || (entry->length & LENGTH_MASK) >
+		    index->data_size - entry->offset
+		    || (i < index->named_count
+			&& entry->key >= index->names_size)) {
+			return false;
+		}
+	}
+	for (i = 0; i < index->prefix_count; i++) {
+		if (index->prefixes[i].name >= index->names_size
+		    || index->prefixes[i].first >
+		    (i + 1 < index->prefix_count ? index->prefixes[i + 1].first :
+		     index->entry_count)
+		    || index->prefixes[i].first <
+		    (i == 0 ? index->named_count : index->prefixes[i - 1].first)) {
+			return false;
+		}
+	}
+	if (index->prefix_count == 0 ? index->named_count != index->entry_count
+	    : index->prefixes[0].first != index->named_count) {
+		return false;
+	}
+	/* A probe stops at an empty slot, so there must be one. */
+	for (i = 0; i < index->slot_count; i++) {
+		if (index->slots[i] > index->entry_count) {
+			return false;
+		}
+		empty_slot = empty_slot || index->slots[i] == 0;
+	}
+	return empty_slot;
+}
+
+/* Map the saved index, if it exists and matches the FASTA file. */
+static bool index_load(fastaindex *index, const char *filename,
+		       const struct stat *fasta)
+{
+	struct stat info;
+	const indexheader *header;
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	if (fstat(fd, &info) != 0
+	    || (size_t)info.st_size < sizeof(indexheader)) {
+		close(fd);
+		return false;
+	}
+	index->saved = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (index->saved == MAP_FAILED) {
+		index->saved = NULL;
+		return false;
+	}
+	index->saved_size = info.st_size;
+	header = (const indexheader *)index->saved;
+	/* The bounds on each part keep the sum of their sizes from overflowing. */
+	if (memcmp(header->magic, FASTAINDEX_MAGIC, sizeof(header->magic)) != 0
+	    || header->fasta_size != (uint64_t) fasta->st_size
+	    || header->fasta_mtime != (int64_t) fasta->st_mtime
+	    || header->fasta_mtime_nsec != modification_nsec(fasta)
+	    || header->entry_count >= UINT32_MAX
+	    || header->named_count > header->entry_count
+	    || header->prefix_count > UINT32_MAX
+	    || header->slot_count == 0
+	    || header->slot_count > ((uint64_t) 1 << 34)
+	    || (header->slot_count & (header->slot_count - 1)) != 0
+	    || header->names_size > UINT32_MAX
+	    || sizeof(indexheader) + header->entry_count * sizeof(indexentry) +
+	    header->prefix_count * sizeof(indexprefix) +
+	    header->slot_count * sizeof(uint32_t) + header->names_size !=
+	    (uint64_t) info.st_size) {
+		munmap(index->saved, index->saved_size);
+		index->saved = NULL;
+		return false;
+	}
+	index->count = header->count;
+	index->entries = (const indexentry *)(header + 1);
+	index->entry_count = header->entry_count;
+	index->named_count = header->named_count;
+	index->prefixes =
+	    (const indexprefix *)(index->entries + index->entry_count);
+	index->prefix_count = header->prefix_count;
+	index->slots = (const uint32_t *)(index->prefixes + index->prefix_count);
+	index->slot_count = header->slot_count;
+	index->names = (const char *)(index->slots + index->slot_count);
+	index->names_size = header->names_size;
+	if (!index_check(index)) {
+		munmap(index->saved, index->saved_size);
+		index->saved = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* The state of a scan. Each entry's group is 0 if it is looked up by name, or one more than its prefix. */
+typedef struct {
+	textbuf names;
+	indexentry *entries;
+	uint32_t *groups;
+	size_t count;
+	size_t size;
+	indexprefix *prefixes;
+	size_t prefix_count;
+	size_t prefix_size;
+	/* Finds prefixes while scanning, like the main table. */
+	uint32_t *prefix_slots;
+	size_t prefix_slot_count;
+} indexbuilder;
+
+static bool builder_rehash(indexbuilder *builder)
+{
+	size_t slot_count =
+	    builder->prefix_slot_count == 0 ? 16 : 2 * builder->prefix_slot_count;
+	uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+	size_t i;
+	if (slots == NULL) {
+		return false;
+	}
+	for (i = 0; i < builder->prefix_count; i++) {
+		const char *name = builder->names.data + builder->prefixes[i].name;
+		size_t slot = hash_name(name, strlen(name)) & (slot_count - 1);
+		while (slots[slot] != 0) {
+			slot = (slot + 1) & (slot_count - 1);
+		}
+		slots[slot] = i + 1;
+	}
+	free(builder->prefix_slots);
+	builder->prefix_slots = slots;
+	builder->prefix_slot_count = slot_count;
+	return true;
+}
+
+/* Find a prefix, adding it if it is new. Until the prefixes are sorted, each one's first holds its own number. */
+static bool builder_prefix(indexbuilder *builder, const char *prefix,
+			   size_t len, uint32_t *number)
+{
+	size_t mask;
+	size_t slot;
+	if (2 * (builder->prefix_count + 1) > builder->prefix_slot_count
+	    && !builder_rehash(builder)) {
+		return false;
+	}
+	mask = builder->prefix_slot_count - 1;
+	for (slot = hash_name(prefix, len) & mask;
+	     builder->prefix_slots[slot] != 0; slot = (slot + 1) & mask) {
+		uint32_t candidate = builder->prefix_slots[slot] - 1;
+		if (compare_name
+		    (builder->names.data + builder->prefixes[candidate].name,
+		     prefix, len) == 0) {
+			*number = candidate;
+			return true;
+		}
+	}
+	if (builder->prefix_count == builder->prefix_size) {
+		size_t size =
+		    builder->prefix_size == 0 ? 64 : 2 * builder->prefix_size;
+		indexprefix *bigger =
+		    realloc(builder->prefixes, size * sizeof(indexprefix));
+		if (bigger == NULL) {
+			return false;
+		}
+		builder->prefixes = bigger;
+		builder->prefix_size = size;
+	}
+	if (builder->names.len + len >= UINT32_MAX) {
+		errno = EFBIG;
+		return false;
+	}
+	builder->prefixes[builder->prefix_count].name = builder->names.len;
+	builder->prefixes[builder->prefix_count].first = builder->prefix_count;
+	if (!textbuf_append(&builder->names, prefix, len)
+	    || !textbuf_putc(&builder->names, '\0')) {
+		errno = ENOMEM;
+		return false;
+	}
+	builder->prefix_slots[slot] = builder->prefix_count + 1;
+	*number = builder->prefix_count++;
+	return true;
+}
+
+/* Start an entry for a header line. */
+static indexentry *builder_add(indexbuilder *builder, const char *id,
+			       size_t len, uint64_t offset)
+{
+	indexentry *entry;
+	size_t prefix_len;
+	uint32_t number;
+	uint32_t prefix;
+	if (builder->count == builder->size) {
+		size_t size = builder->size == 0 ? 1024 : 2 * builder->size;
+		indexentry *bigger =
+		    realloc(builder->entries, size * sizeof(indexentry));
+		uint32_t *groups;
+		if (bigger == NULL) {
+			return NULL;
+		}
+		builder->entries = bigger;
+		groups = realloc(builder->groups, size * sizeof(uint32_t));
+		if (groups == NULL) {
+			return NULL;
+		}
+		builder->groups = groups;
+		builder->size = size;
+	}
+	if (builder->count == UINT32_MAX - 1) {
+		errno = EFBIG;
+		return NULL;
+	}
+	entry = &builder->entries[builder->count];
+	entry->offset = offset;
+	entry->length = 0;
+	if (split_numbered(id, len, &prefix_len, &number)) {
+		if (!builder_prefix(builder, id, prefix_len, &prefix)) {
+			return NULL;
+		}
+		entry->key = number;
+		builder->groups[builder->count] = prefix + 1;
+	} else {
+		if (builder->names.len + len >= UINT32_MAX) {
+			errno = EFBIG;
+			return NULL;
+		}
+		entry->key = builder->names.len;
+		builder->groups[builder->count] = 0;
+		if (!textbuf_append(&builder->names, id, len)
+		    || !textbuf_putc(&builder->names, '\0')) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	builder->count++;
+	return entry;
+}
+
+static const char *sort_names;
+
+static int compare_prefixes(const void *a, const void *b)
+{
+	const indexprefix *x = a;
+	const indexprefix *y = b;
+	return strcmp(sort_names + x->name, sort_names + y->name);
+}
+
+/* Sort the prefixes by name, and put the entries in order of prefix, keeping file order within each. */
+static bool builder_group(indexbuilder *builder, fastaindex *index)
+{
+	size_t *starts = calloc(builder->prefix_count + 2, sizeof(size_t));
+	uint32_t *ranks = malloc((builder->prefix_count + 1) * sizeof(uint32_t));
+	indexentry *grouped =
+	    malloc((builder->count + 1) * sizeof(indexentry));
+	size_t i;
+	if (starts == NULL || ranks == NULL || grouped == NULL) {
+		free(starts);
+		free(ranks);
+		free(grouped);
+		return false;
+	}
+	sort_names = builder->names.data;
+	if (builder->prefix_count > 0) {
+		qsort(builder->prefixes, builder->prefix_count,
+		      sizeof(indexprefix), compare_prefixes);
+	}
+	for (i = 0; i < builder->prefix_count; i++) {
+		ranks[builder->prefixes[i].first] = i;
+	}
+	for (i = 0; i < builder->count; i++) {
+		if (builder->groups[i] != 0) {
+			builder->groups[i] = ranks[builder->groups[i] - 1] + 1;
+		}
+		starts[builder->groups[i] + 1]++;
+	}
+	for (i = 1; i <= builder->prefix_count + 1; i++) {
+		starts[i] += starts[i - 1];
+	}
+	index->named_count = starts[1];
+	for (i = 0; i < builder->prefix_count; i++) {
+		builder->prefixes[i].first = starts[i + 1];
+	}
+	for (i = 0; i < builder->count; i++) {
+		grouped[starts[builder->groups[i]]++] = builder->entries[i];
+	}
+	free(starts);
+	free(ranks);
+	free(builder->entries);
+	free(builder->groups);
+	builder->entries = NULL;
+	builder->groups = NULL;
+	index->built_entries = grouped;
+	index->entries = grouped;
+	index->entry_count = builder->count;
+	index->built_prefixes = builder->prefixes;
+	index->prefixes = builder->prefixes;
+	index->prefix_count = builder->prefix_count;
+	builder->prefixes = NULL;
+	index->built_names = builder->names.data;
+	index->names = builder->names.data;
+	index->names_size = builder->names.len;
+	memset(&builder->names, 0, sizeof(builder->names));
+	return true;
+}
+
+/* Fill the hash table. A later entry with the same identifier replaces an earlier one. */
+static bool index_hash(fastaindex *index)
+{
+	size_t slot_count = 16;
+	size_t prefix = 0;
+	size_t i;
+	while (slot_count < index->entry_count + index->entry_count / 3 + 1) {
+		slot_count *= 2;
+	}
+	index->built_slots = calloc(slot_count, sizeof(uint32_t));
+	if (index->built_slots == NULL) {
+		return false;
+	}
+	index->slots = index->built_slots;
+	index->slot_count = slot_count;
+	index->count = 0;
+	for (i = 0; i < index->entry_count; i++) {
+		const indexentry *entry = &index->entries[i];
+		indexkey key;
+		size_t slot;
+		key.numbered = i >= index->named_count;
+		if (key.numbered) {
+			while (i >= prefix_end(index, prefix)) {
+				prefix++;
+			}
+			key.prefix = prefix;
+			key.number = entry->key;
+			key.hash = hash_number(key.prefix, key.number);
+		} else {
+			key.id = index->names + entry->key;
+			key.hash = hash_name(key.id, strlen(key.id));
+		}
+		slot = index_probe(index, &key);
+		if (index->built_slots[slot] == 0) {
+			index->count++;
+		}
+		index->built_slots[slot] = i + 1;
+	}
+	return true;
+}
+
+/* Count the bases on a line, up to but not including last, noting whether there is whitespace among them. */
+static size_t line_bases(const char *pos, const char *last, bool *gaps)
+{
+	size_t spaces = 0;
+	const char *c;
+	for (c = pos; c < last; c++) {
+		if (isspace((unsigned char)*c)) {
+			spaces++;
+		}
+	}
+	if (spaces > 0) {
+		*gaps = true;
+	}
+	return (last - pos) - spaces;
+}
+
+/* Scan the FASTA file for headers. Returns false and sets errno on failure. */
+static bool index_build(fastaindex *index)
+{
+	const char *pos = index->data;
+	const char *end = index->data + index->data_size;
+	indexentry *current = NULL;
+	indexbuilder builder;
+	bool ok = true;
+	memset(&builder, 0, sizeof(builder));
+	while (ok && pos < end) {
+		const char *newline = memchr(pos, '\n', end - pos);
+		const char *line_end = newline == NULL ? end : newline;
+		if (*pos == '>') {
+			const char *id_end = pos + 1;
+			if (newline == NULL) {
+				/* A header without a line break has no sequence. */
+				break;
+			}
+			while (id_end < line_end && !isspace((unsigned char)*id_end)) {
+				id_end++;
+			}
+			current =
+			    builder_add(&builder, pos + 1, id_end - pos - 1,
+					newline + 1 - index->data);
+			if (current == NULL) {
+				ok = false;
+			} else if (builder.count % 1000000 == 0) {
+				fprintf(stderr, "Indexed %ld sequences...\n",
+					(long)builder.count);
+			}
+		} else if (current != NULL) {
+			const char *last = line_end;
+			size_t length = current->length & LENGTH_MASK;
+			bool gaps = false;
+			size_t bases;
+			if (last > pos && last[-1] == '\r') {
+				last--;
+			}
+			bases = line_bases(pos, last, &gaps);
+			if (bases > 0) {
+				if (bases > LENGTH_MASK - length) {
+					errno = EFBIG;
+					ok = false;
+				} else if (gaps
+					   || pos != index->data + current->offset) {
+					current->length |= SCATTERED;
+				}
+				current->length += bases;
+			}
+		}
+		pos = newline == NULL ? end : newline + 1;
+	}
+	if (ok) {
+		fprintf(stderr, "Indexed %ld sequences...\n", (long)builder.count);
+		if (!builder_group(&builder, index) || !index_hash(index)) {
+			errno = ENOMEM;
+			ok = false;
+		}
+	}
+	textbuf_free(&builder.names);
+	free(builder.entries);
+	free(builder.groups);
+	free(builder.prefixes);
+	free(builder.prefix_slots);
+	return ok;
+}
+
+/* Write the index beside the FASTA file. This is only a cache, so failure is not fatal. */
+static void index_save(const fastaindex *index, const char *filename,
+		       const struct stat *fasta)
+{
+	indexheader header;
+	size_t len = strlen(filename);
+	char *temporary = malloc(len + 8);
+	FILE *file;
+	int fd;
+	mode_t mask;
+	bool ok;
+	if (temporary == NULL) {
+		return;
+	}
+	memcpy(temporary, filename, len);
+	memcpy(temporary + len, ".XXXXXX", 8);
+	fd = mkstemp(temporary);
+	if (fd == -1 || (file = fdopen(fd, "w")) == NULL) {
+		fprintf(stderr, "Could not save index %s: %s\n", filename,
+			strerror(errno));
+		if (fd != -1) {
+			close(fd);
+			unlink(temporary);
+		}
+		free(temporary);
+		return;
+	}
+	/* mkstemp makes a private file; this is as shareable as the FASTA file. */
+	mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FASTAINDEX_MAGIC, sizeof(header.magic));
+	header.fasta_size = fasta->st_size;
+	header.fasta_mtime = fasta->st_mtime;
+	header.fasta_mtime_nsec = modification_nsec(fasta);
+	header.count = index->count;
+	header.entry_count = index->entry_count;
+	header.named_count = index->named_count;
+	header.prefix_count = index->prefix_count;
+	header.slot_count = index->slot_count;
+	header.names_size = index->names_size;
+	ok = fwrite(&header, sizeof(header), 1, file) == 1
+	    && fwrite(index->entries, sizeof(indexentry), index->entry_count,
+		      file) == index->entry_count
+	    && fwrite(index->prefixes, sizeof(indexprefix), index->prefix_count,
+		      file) == index->prefix_count
+	    && fwrite(index->slots, sizeof(uint32_t), index->slot_count,
+		      file) == index->slot_count
+	    && fwrite(index->names, 1, index->names_size,
+		      file) == index->names_size;
+	ok = fclose(file) == 0 && ok;
+	if (!ok || rename(temporary, filename) != 0) {
+		fprintf(stderr, "Could not save index %s: %s\n", filename,
+			strerror(errno));
+		unlink(temporary);
+	}
+	free(temporary);
+}
+
+fastaindex *fastaindex_open(const char *filename)
+{
+	fastaindex *index;
+	struct stat info;
+	char *index_filename;
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	index = calloc(1, sizeof(fastaindex));
+	index_filename = malloc(strlen(filename) + sizeof(FASTAINDEX_SUFFIX));
+	if (index == NULL || index_filename == NULL || fstat(fd, &info) != 0) {
+		int error = errno;
+		close(fd);
+		free(index);
+		free(index_filename);
+		errno = error;
+		return NULL;
+	}
+	if (info.st_size > 0) {
+		index->data =
+		    mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (index->data == MAP_FAILED) {
+			int error = errno;
+			close(fd);
+			free(index);
+			free(index_filename);
+			errno = error;
+			return NULL;
+		}
+		index->data_size = info.st_size;
+	}
+	close(fd);
+	strcpy(index_filename, filename);
+	strcat(index_filename, FASTAINDEX_SUFFIX);
+
+	if (!index_load(index, index_filename, &info)) {
+		if (!index_build(index)) {
+			int error = errno;
+			free(index_filename);
+			fastaindex_free(index);
+			errno = error;
+			return NULL;
+		}
+		index_save(index, index_filename, &info);
+	}
+	free(index_filename);
+	return index;
+}
+
+size_t fastaindex_count(const fastaindex *index)
+{
+	return index->count;
+}
+
+/* Point a slice at a sequence, or copy it to dest, without whitespace, if its bases are scattered. Returns true if it was copied. */
+static bool entry_slice(const fastaindex *index, const indexentry *entry,
+			fastaslice *slice, char *dest)
+{
+	const char *pos = index->data + entry->offset;
+	const char *end = index->data + index->data_size;
+	size_t length = entry->length & LENGTH_MASK;
+	size_t len = 0;
+	if ((entry->length & SCATTERED) == 0) {
+		slice->seq = pos;
+		slice->len = length;
+		return false;
+	}
+	/* The scan counted everything but whitespace, so that is what is taken. */
+	for (; len < length && pos < end; pos++) {
+		if (!isspace((unsigned char)*pos)) {
+			dest[len++] = *pos;
+		}
+	}
+	slice->seq = dest;
+	slice->len = len;
+	return true;
+}
+
+char *fastaindex_get(const fastaindex *index, const char *id)
+{
+	const indexentry *entry = fastaindex_find(index, id);
+	fastaslice slice;
+	char *sequence;
+	if (entry == NULL) {
+		return NULL;
+	}
+	sequence = malloc((entry->length & LENGTH_MASK) + 1);
+	if (sequence == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (!entry_slice(index, entry, &slice, sequence)) {
+		memcpy(sequence, slice.seq, slice.len);
+	}
+	sequence[slice.len] = '\0';
+	return sequence;
+}
+
+bool fastaindex_slice(const fastaindex *index, const char *id,
+		      fastaslice *slice, fastascratch *scratch)
+{
+	const indexentry *entry = fastaindex_find(index, id);
+	if (entry == NULL) {
+		return false;
+	}
+	scratch->copies.len = 0;
+	if (!textbuf_reserve(&scratch->copies, entry->length & LENGTH_MASK)) {
+		errno = ENOMEM;
+		return false;
+	}
+	entry_slice(index, entry, slice, scratch->copies.data);
+	return true;
+}
+
+typedef struct {
+	indexentry entry;
+	size_t position;
+} lookup;
+
+static int compare_lookups(const void *a, const void *b)
+{
+	const lookup *x = a;
+	const lookup *y = b;
+	return x->entry.offset < y->entry.offset ? -1 : x->entry.offset >
+	    y->entry.offset;
+}
+
+static bool lookups_reserve(fastascratch *scratch, size_t count)
+{
+	if (scratch->lookup_size < count) {
+		free(scratch->lookups);
+		scratch->lookups = malloc(count * sizeof(lookup));
+		scratch->lookup_size = scratch->lookups == NULL ? 0 : count;
+		if (scratch->lookups == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Sort the lookups into file order and fill in their slices. */
+static bool lookups_sweep(const fastaindex *index, lookup *lookups,
+			  size_t found, size_t needed, fastaslice *slices,
+			  fastascratch *scratch)
+{
+	size_t i;
+	/* Reserve everything up front so the copies do not move. */
+	scratch->copies.len = 0;
+	if (!textbuf_reserve(&scratch->copies, needed)) {
+		return false;
+	}
+	qsort(lookups, found, sizeof(lookup), compare_lookups);
+	for (i = 0; i < found; i++) {
+		fastaslice *slice = &slices[lookups[i].position];
+		if (entry_slice(index, &lookups[i].entry, slice,
+				scratch->copies.data + scratch->copies.len)) {
+			scratch->copies.len += slice->len;
+		}
+	}
+	return true;
+}
+
+bool fastaindex_fetch(const fastaindex *index, const char *const *ids,
+		      size_t count, fastaslice *slices, fastascratch *scratch)
+{
+	lookup *lookups;
+	size_t found = 0;
+	size_t needed = 0;
+	size_t i;
+	if (!lookups_reserve(scratch, count)) {
+		return false;
+	}
+	lookups = scratch->lookups;
+	for (i = 0; i < count; i++) {
+		const indexentry *entry = fastaindex_find(index, ids[i]);
+		slices[i].seq = NULL;
+		slices[i].len = 0;
+		if (entry != NULL) {
+			lookups[found].entry = *entry;
+			lookups[found].position = i;
+			found++;
+			needed += entry->length & LENGTH_MASK;
+		}
+	}
+	return lookups_sweep(index, lookups, found, needed, slices, scratch);
+}
+
+bool fastaindex_locate(const fastaindex *index, const char *id,
+		       uint64_t *place)
+{
+	const indexentry *entry = fastaindex_find(index, id);
+	if (entry == NULL) {
+		return false;
+	}
+	*place = entry->offset;
+	return true;
+}
+
+/* Measure the sequence at an offset as the scan does, by reading up to the next header. */
+static void entry_measure(const fastaindex *index, indexentry *entry)
+{
+	const char *start = index->data + entry->offset;
+	const char *pos = start;
+	const char *end = index->data + index->data_size;
+	entry->length = 0;
+	while (pos < end && *pos != '>') {
+		const char *newline = memchr(pos, '\n', end - pos);
+		const char *last = newline == NULL ? end : newline;
+		bool gaps = false;
+		size_t bases;
+		if (last > pos && last[-1] == '\r') {
+			last--;
+		}
+		bases = line_bases(pos, last, &gaps);
+		if (bases > 0) {
+			if (gaps || pos != start) {
+				entry->length |= SCATTERED;
+			}
+			entry->length += bases;
+		}
+		pos = newline == NULL ? end : newline + 1;
+	}
+}
+
+bool fastaindex_fetch_at(const fastaindex *index, const uint64_t *places,
+			 size_t count, fastaslice *slices,
+			 fastascratch *scratch)
+{
+	lookup *lookups;
+	size_t needed = 0;
+	size_t i;
+	if (!lookups_reserve(scratch, count)) {
+		return false;
+	}
+	lookups = scratch->lookups;
+	for (i = 0; i < count; i++) {
+		lookups[i].entry.offset = places[i];
+		lookups[i].position = i;
+		entry_measure(index, &lookups[i].entry);
+		needed += lookups[i].entry.length & LENGTH_MASK;
+	}
+	return lookups_sweep(index, lookups, count, needed, slices, scratch);
+}
+
+void fastascratch_free(fastascratch *scratch)
+{
+	textbuf_free(&scratch->copies);
+	free(scratch->lookups);
+}
+
+void fastaindex_free(fastaindex *index)
+{
+	if (index->data != NULL) {
+		munmap((void *)index->data, index->data_size);
+	}
+	if (index->saved != NULL) {
+		munmap(index->saved, index->saved_size);
+	}
+	free(index->built_entries);
+	free(index->built_prefixes);
+	free(index->built_slots);
+	free(index->built_names);
+	free(index);
+}
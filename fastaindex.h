@@ -0,0 +1,60 @@
+/* Random access to the sequences in a FASTA file by identifier */
+#ifndef AXIOME_FASTAINDEX_H
+#define AXIOME_FASTAINDEX_H
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include "textbuf.h"
+
+/* The index is kept next to the FASTA file, with this added to its name. */
+#define FASTAINDEX_SUFFIX ".idx"
+
+/*
+ * An index of a FASTA file. The identifier of a sequence is its header up to the first space.
+ *
+ * The index is saved beside the FASTA file, along with the file's size and modification time, and is memory mapped when the file is opened again, so repeatedly opening a large file is quick. If the FASTA file has changed, or the saved index cannot be read, it is rebuilt; if it cannot be saved, it is only kept in memory.
+ *
+ * Each sequence costs about 22 bytes in a hash table plus its identifier, which is stored once. Identifiers of the form <prefix>_<number>, as prepare_sequences makes, cost nothing beyond the table, since only the number is kept.
+ */
+typedef struct fastaindex fastaindex;
+
+/* Open a FASTA file, building its index if needed. Returns NULL and sets errno on failure. */
+fastaindex *fastaindex_open(const char *filename);
+/* The number of sequences indexed. If an identifier appears more than once, only the last sequence is kept. */
+size_t fastaindex_count(const fastaindex *index);
+/* Copy a sequence, without line breaks or other whitespace, into a new NUL-terminated string, which the caller must free. Returns NULL if there is no such sequence, or if memory runs out (setting errno to ENOMEM). */
+char *fastaindex_get(const fastaindex *index, const char *id);
+
+/* A sequence, which is not NUL-terminated. */
+typedef struct {
+	const char *seq;
+	size_t len;
+} fastaslice;
+
+/* Working space for fetching sequences. A zero-filled one is ready to use. */
+typedef struct {
+	textbuf copies;
+	void *lookups;
+	size_t lookup_size;
+} fastascratch;
+
+/*
+ * Find a sequence without copying it, if possible. A sequence on a single line is returned in place, in the mapped file; one split across lines, or with whitespace in it, is copied into the scratch space, without the whitespace. Either way, it is valid until the scratch space is used again. Returns false if there is no such sequence, or if memory runs out (setting errno to ENOMEM).
+ */
+bool fastaindex_slice(const fastaindex *index, const char *id,
+		      fastaslice *slice, fastascratch *scratch);
+/*
+ * Find many sequences at once, as fastaindex_slice does. The sequences are visited in file order, so the file is swept forward once rather than read at random. slices[i] is the sequence for ids[i], or has a NULL seq if there is none. Returns false if memory runs out.
+ */
+bool fastaindex_fetch(const fastaindex *index, const char *const *ids,
+		      size_t count, fastaslice *slices, fastascratch *scratch);
+/* Find where a sequence is in the file. Sorting these puts sequences in file order. Returns false if there is no such sequence. */
+bool fastaindex_locate(const fastaindex *index, const char *id,
+		       uint64_t *place);
+/* Find many sequences by where fastaindex_locate put them, as fastaindex_fetch does. Returns false if memory runs out. */
+bool fastaindex_fetch_at(const fastaindex *index, const uint64_t *places,
+			 size_t count, fastaslice *slices,
+			 fastascratch *scratch);
+void fastascratch_free(fastascratch *scratch);
+void fastaindex_free(fastaindex *index);
+#endif
@@ -0,0 +1,152 @@
+/* Zero-copy FASTQ record reader */
+#include<stdlib.h>
+#include<string.h>
+#include "fastq.h"
+
+/* A batch holds at most this many records, or stops once it holds this much data. */
+#define FASTQ_BATCH_RECORDS 8192
+#define FASTQ_BATCH_DATA (2 * 1024 * 1024)
+
+/* Length of a line, not counting a DOS line ending. */
+static size_t line_length(const char *start, const char *newline)
+{
+	if (newline > start && newline[-1] == '\r') {
+		newline--;
+	}
+	return newline - start;
+}
+
+int fastq_read(inputfile *file, fastqrecord *record)
+{
+	char *lines[4];
+	int found;
+	for (;;) {
+		char *start;
+		/* Skip any blank lines between records. */
+		while (file->pos < file->end
+		       && (*file->pos == '\n' || *file->pos == '\r')) {
+			file->pos++;
+		}
+		start = file->pos;
+		/* memchr is vectorised by the C library, so let it find the line endings. */
+		for (found = 0; found < 4; found++) {
+			lines[found] = memchr(start, '\n', file->end - start);
+			if (lines[found] == NULL) {
+				break;
+			}
+			start = lines[found] + 1;
+		}
+		if (found == 4) {
+			break;
+		}
+		if (file->eof) {
+			if (file->pos == file->end) {
+				return file->error ? -2 : -1;
+			}
+			if (found == 3) {
+				/* The quality line has no trailing newline. */
+				lines[3] = file->end;
+				break;
+			}
+			return -2;
+		}
+		if (input_refill(file) < 0) {
+			return -2;
+		}
+	}
+	if (*file->pos != '@' || lines[1][1] != '+') {
+		file->pos = lines[3] == file->end ? file->end : lines[3] + 1;
+		return -2;
+	}
+	record->name = file->pos + 1;
+	record->name_len = line_length(record->name, lines[0]);
+	record->seq = lines[0] + 1;
+	record->seq_len = line_length(record->seq, lines[1]);
+	record->qual = lines[2] + 1;
+	record->qual_len = line_length(record->qual, lines[3]);
+	file->pos = lines[3] == file->end ? file->end : lines[3] + 1;
+	if (record->qual_len != record->seq_len) {
+		return -2;
+	}
+	return (int)record->seq_len;
+}
+
+fastqbatch *fastq_batch_new(void)
+{
+	fastqbatch *batch = calloc(1, sizeof(fastqbatch));
+	if (batch == NULL) {
+		return NULL;
+	}
+	batch->capacity = FASTQ_BATCH_RECORDS;
+	batch->records = malloc(batch->capacity * sizeof(fastqrecord));
+	batch->data_size = FASTQ_BATCH_DATA;
+	batch->data = malloc(batch->data_size);
+	if (batch->records == NULL || batch->data == NULL) {
+		fastq_batch_free(batch);
+		return NULL;
+	}
+	return batch;
+}
+
+/* Copy a field into the batch's storage. */
+static const char *batch_copy(fastqbatch *batch, const char *field, size_t len)
+{
+	char *copy = batch->data + batch->data_len;
+	memcpy(copy, field, len);
+	copy[len] = '\0';
+	batch->data_len += len + 1;
+	return copy;
+}
+
+size_t fastq_batch_read(inputfile *file, fastqbatch *batch)
+{
+	fastqrecord record;
+	int len;
+	batch->count = 0;
+	batch->data_len = 0;
+	batch->truncated = false;
+	while (batch->count < batch->capacity
+	       && batch->data_len < FASTQ_BATCH_DATA) {
+		fastqrecord *copy;
+		size_t needed;
+		if ((len = fastq_read(file, &record)) < 0) {
+			batch->truncated = len != -1;
+			break;
+		}
+		needed = record.name_len + record.seq_len + record.qual_len + 3;
+		if (batch->data_size - batch->data_len < needed) {
+			size_t i;
+			size_t size = 2 * batch->data_size + needed;
+			char *bigger = realloc(batch->data, size);
+			if (bigger == NULL) {
+				batch->truncated = true;
+				break;
+			}
+			for (i = 0; i < batch->count; i++) {
+				batch->records[i].name =
+				    bigger + (batch->records[i].name - batch->data);
+				batch->records[i].seq =
+				    bigger + (batch->records[i].seq - batch->data);
+				batch->records[i].qual =
+				    bigger + (batch->records[i].qual - batch->data);
+			}
+			batch->data = bigger;
+			batch->data_size = size;
+		}
+		copy = &batch->records[batch->count++];
+		copy->name_len = record.name_len;
+		copy->name = batch_copy(batch, record.name, record.name_len);
+		copy->seq_len = record.seq_len;
+		copy->seq = batch_copy(batch, record.seq, record.seq_len);
+		copy->qual_len = record.qual_len;
+		copy->qual = batch_copy(batch, record.qual, record.qual_len);
+	}
+	return batch->count;
+}
+
+void fastq_batch_free(fastqbatch *batch)
+{
+	free(batch->records);
+	free(batch->data);
+	free(batch);
+}
@@ -0,0 +1,54 @@
+/* Zero-copy FASTQ record reader */
+#ifndef AXIOME_FASTQ_H
+#define AXIOME_FASTQ_H
+#include<stdbool.h>
+#include<stddef.h>
+#include "input.h"
+
+/*
+ * A FASTQ record. The fields point into the input window and are not NUL-terminated; they are only valid until the next call to fastq_read. The header is always followed by a newline, so it may be handed to seqid_parse directly.
+ */
+typedef struct {
+	const char *name;
+	size_t name_len;
+	const char *seq;
+	size_t seq_len;
+	const char *qual;
+	size_t qual_len;
+} fastqrecord;
+
+/*
+ * Read the next four-line FASTQ record.
+ *
+ * Return value:
+ *   >=0  length of the sequence
+ *   -1   end-of-file
+ *   -2   malformed record or read error
+ */
+int fastq_read(inputfile *file, fastqrecord *record);
+
+/*
+ * A batch of records copied out of the input so they can be handed to another thread. The copies are NUL-terminated.
+ */
+typedef struct {
+	fastqrecord *records;
+	size_t count;
+	/* The number of records read before this batch. */
+	size_t first;
+	/* A malformed record or read error stopped the batch early. */
+	bool truncated;
+	/* For the use of whatever is processing the batch. */
+	void *state;
+
+	/* Private. */
+	size_t capacity;
+	char *data;
+	size_t data_len;
+	size_t data_size;
+} fastqbatch;
+
+fastqbatch *fastq_batch_new(void);
+/* Fill a batch with the next records. Returns the number of records read, which is 0 at end of file. */
+size_t fastq_batch_read(inputfile *file, fastqbatch *batch);
+void fastq_batch_free(fastqbatch *batch);
+#endif
@@ -1,64 +1,146 @@
 /* Filter reads based on sequence similarity to know sequence. */
-#include<bzlib.h>
 #include<ctype.h>
 #include<errno.h>
 #if !defined(__APPLE__)
 #include<error.h>
 #endif
 #include<fcntl.h>
+#include<stdbool.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 #include<sys/stat.h>
 #include<time.h>
 #include<unistd.h>
-#include<zlib.h>
-#include "kseq.h"
+#include "fastq.h"
+#include "pipeline.h"
+#include "reference.h"
+#include "textbuf.h"
 
-/* Function pointers for file I/O such that we can deal with compressed files. */
-void *(*fileopen) (char *, char *) = (void *(*)(char *, char *))gzopen;
-int (*fileread) (void *, void *, int) = (int (*)(void *, void *, int))gzread;
-int (*fileclose) (void *) = (int (*)(void *))gzclose;
+typedef struct {
+	referenceset *references;
+	bool failed;
+} filter;
 
-/* Compatibility function to make BZ2_bzRead look like gzread. */
-int bzread(BZFILE * file, void *buf, int len)
+/* The matching reads of a batch, ready to write. */
+typedef struct {
+	referencescratch *scratch;
+	textbuf output;
+	bool failed;
+} filterbatch;
+
+static bool write_record(textbuf *buf, const fastqrecord *seq)
+{
+	return textbuf_putc(buf, '@')
+	    && textbuf_append(buf, seq->name, seq->name_len)
+	    && textbuf_putc(buf, '\n')
+	    && textbuf_append(buf, seq->seq, seq->seq_len)
+	    && textbuf_append(buf, "\n+", 2)
+	    && textbuf_append(buf, seq->name, seq->name_len)
+	    && textbuf_putc(buf, '\n')
+	    && textbuf_append(buf, seq->qual, seq->qual_len)
+	    && textbuf_putc(buf, '\n');
+}
+
+static void filter_release(void *state)
 {
-	int bzerror = BZ_OK;
-	int retval = BZ2_bzRead(&bzerror, file, buf, len);
-	if (bzerror == BZ_OK || bzerror == BZ_STREAM_END) {
-		return retval;
-	} else {
-		fprintf(stderr, "bzip error %d\n", bzerror);
-		return -1;
+	filterbatch *output = state;
+	if (output->scratch != NULL) {
+		reference_scratch_free(output->scratch);
+	}
+	textbuf_free(&output->output);
+	free(output);
+}
+
+static void filter_work(fastqbatch *batch, void *context)
+{
+	filter *f = context;
+	filterbatch *output = batch->state;
+	size_t i;
+	if (output == NULL) {
+		output = calloc(1, sizeof(filterbatch));
+		if (output == NULL) {
+			return;
+		}
+		batch->state = output;
+	}
+	output->output.len = 0;
+	output->failed = false;
+	if (output->scratch == NULL) {
+		output->scratch = reference_scratch_new();
+		if (output->scratch == NULL) {
+			output->failed = true;
+			return;
+		}
+	}
+	for (i = 0; i < batch->count; i++) {
+		fastqrecord *seq = &batch->records[i];
+		bool matched;
+		if (!reference_match(f->references, output->scratch, seq->seq,
+				     seq->seq_len, &matched)
+		    || (matched && !write_record(&output->output, seq))) {
+			output->failed = true;
+			return;
+		}
 	}
 }
 
-KSEQ_INIT(void *, fileread)
+static void filter_commit(fastqbatch *batch, void *context)
+{
+	filter *f = context;
+	filterbatch *output = batch->state;
+	if (output == NULL || output->failed) {
+		f->failed = true;
+		return;
+	}
+	fwrite(output->output.data, 1, output->output.len, stdout);
+}
 
 int main(int argc, char **argv)
 {
 	int c;
 	int bzip = 0;
+	int threads = 1;
 	char *filename = NULL;
-	void *file;
-	kseq_t *seq;
-	int len;
-	char **seqlist = malloc(sizeof(char *) * 1024);
-	int seqlistlen = 1024;
+	char **reference_files = NULL;
+	int reference_file_count = 0;
+	double rate = 0.03;
+	referencemode mode = REFERENCE_SUBSTITUTION;
+	inputfile *file;
+	filter f;
+	pipelinestages stages = { filter_work, filter_commit, filter_release };
+	bool ok;
 
+	memset(&f, 0, sizeof(f));
+	reference_files = malloc(argc * sizeof(char *));
+	if (reference_files == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
 	/* Process command line arguments. */
-	while ((c = getopt(argc, argv, "jf:")) != -1) {
+	while ((c = getopt(argc, argv, "e:ijf:r:t:")) != -1) {
 		switch (c) {
+		case 'e':
+			rate = atof(optarg);
+			break;
+		case 'i':
+			mode = REFERENCE_EDIT;
+			break;
 		case 'j':
-			fileopen = (void *(*)(char *, char *))BZ2_bzopen;
-			fileread = (int (*)(void *, void *, int))bzread;
-			fileclose = (int (*)(void *))BZ2_bzclose;
 			bzip = 1;
 			break;
 		case 'f':
 			filename = optarg;
 			break;
+		case 'r':
+			reference_files[reference_file_count++] = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
 		case '?':
-			if (optopt == (int)'f') {
+			if (optopt == (int)'e' || optopt == (int)'f'
+			    || optopt == (int)'r' || optopt == (int)'t') {
 				fprintf(stderr,
 					"Option -%c requires an argument.\n",
 					optopt);
@@ -76,46 +158,59 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (filename == NULL || optind == argc - 1) {
+	if (filename == NULL || rate < 0 || rate > 1
+	    || (optind == argc && reference_file_count == 0)) {
 		fprintf(stderr,
-			"Usage: %s [-j] -f file.fastq sequence1 sequence2 ...\n\t-j\tInput files are bzipped.\n",
+			"Usage: %s [-j] [-t threads] [-i] [-e rate] [-r references.fasta ...] -f file.fastq [sequence1 sequence2 ...]\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use.\n\t-i\tCount insertions and deletions as errors, rather than only substitutions.\n\t-e\tThe error rate below which reads are kept (default 0.03).\n\t-r\tCompare with the sequences in a FASTA file. May be given more than once.\n",
 			argv[0]);
 		return 1;
 	}
 
-	/* Open files and initialise FASTQ reader. */
-	file = fileopen(filename, "r");
-	if (file == NULL) {
-		perror(filename);
+	f.references = reference_new(rate, mode);
+	if (f.references == NULL) {
+		perror(argv[0]);
 		return 1;
 	}
-	seq = kseq_init(file);
-	while ((len = kseq_read(seq)) >= 0) {
-		int i;
-
-		for (i = optind; i < argc; i++) {
-			int err = 0;
-			int count = 0;
-			char *master = argv[i];
-
-			while (*master != '\0' && count < seq->seq.l) {
-				if (seq->seq.s[count] != *master) {
-					err++;
-				}
-				master++;
-				count++;
-			}
-
-			if (err < (count * 0.03)) {
-				printf("@%s\n%s\n+%s\n%s\n", seq->name.s,
-				       seq->seq.s, seq->name.s, seq->qual.s);
-				break;
+	for (c = 0; c < reference_file_count; c++) {
+		if (!reference_load(f.references, reference_files[c])) {
+			if (errno == EINVAL) {
+				fprintf(stderr, "%s: Not a FASTA file.\n",
+					reference_files[c]);
+			} else {
+				perror(reference_files[c]);
 			}
+			return 1;
 		}
 	}
-	kseq_destroy(seq);
-	if (fileclose(file) != Z_OK && bzip == 0) {
+	for (c = optind; c < argc; c++) {
+		if (!reference_add(f.references, argv[c], strlen(argv[c]))) {
+			perror(argv[0]);
+			return 1;
+		}
+	}
+	free(reference_files);
+	if (!reference_index(f.references)) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	/* Open files and initialise FASTQ reader. */
+	file = input_open(filename, bzip, threads);
+	if (file == NULL) {
 		perror(filename);
+		return 1;
+	}
+	ok = pipeline_run(file, threads, &stages, &f);
+	if (!input_close(file)) {
+		perror(filename);
+		ok = false;
+	} else if (!ok) {
+		fprintf(stderr, "%s: Malformed FASTQ record.\n", filename);
+	}
+	if (f.failed) {
+		fprintf(stderr, "Out of memory.\n");
+		ok = false;
 	}
-	return 0;
+	reference_free(f.references);
+	return ok ? 0 : 1;
 }
@@ -0,0 +1,252 @@
+/* Buffered access to plain, gzip and bzip2 compressed input files */
+#include<bzlib.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include<zlib.h>
+#include "decompress.h"
+#include "input.h"
+
+/* Decompressed data is read in chunks of this size. The buffer grows if a consumer needs a larger window. */
+#define INPUT_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* A bzip2 stream that continues through concatenated streams, as produced by parallel compressors. */
+typedef struct {
+	FILE *file;
+	BZFILE *bz;
+	bool done;
+} bzstream;
+
+/* The stream owns the descriptor, and closes it if the stream cannot be opened. */
+static bzstream *bzopen(int fd)
+{
+	int bzerror;
+	bzstream *stream = calloc(1, sizeof(bzstream));
+	if (stream == NULL) {
+		close(fd);
+		return NULL;
+	}
+	stream->file = fdopen(fd, "r");
+	if (stream->file == NULL) {
+		close(fd);
+		free(stream);
+		return NULL;
+	}
+	stream->bz = BZ2_bzReadOpen(&bzerror, stream->file, 0, 0, NULL, 0);
+	if (bzerror != BZ_OK) {
+		fclose(stream->file);
+		free(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+/* Compatibility function to make BZ2_bzRead look like gzread. */
+static int bzread(bzstream *stream, void *buf, int len)
+{
+	int bzerror = BZ_OK;
+	int retval;
+	if (stream->done) {
+		return 0;
+	}
+	retval = BZ2_bzRead(&bzerror, stream->bz, buf, len);
+	if (bzerror == BZ_OK) {
+		return retval;
+	} else if (bzerror == BZ_STREAM_END) {
+		void *unused;
+		int unused_len;
+		char leftover[BZ_MAX_UNUSED];
+		BZ2_bzReadGetUnused(&bzerror, stream->bz, &unused, &unused_len);
+		memcpy(leftover, unused, unused_len);
+		BZ2_bzReadClose(&bzerror, stream->bz);
+		stream->bz = NULL;
+		if (unused_len == 0) {
+			int next = getc(stream->file);
+			if (next == EOF) {
+				stream->done = true;
+				return retval;
+			}
+			ungetc(next, stream->file);
+		}
+		stream->bz = BZ2_bzReadOpen(&bzerror, stream->file, 0, 0, leftover, unused_len);
+		if (bzerror != BZ_OK) {
+			fprintf(stderr, "bzip error %d\n", bzerror);
+			return -1;
+		}
+		return retval;
+	} else {
+		fprintf(stderr, "bzip error %d\n", bzerror);
+		return -1;
+	}
+}
+
+static int bzclose(bzstream *stream)
+{
+	int bzerror;
+	if (stream->bz != NULL) {
+		BZ2_bzReadClose(&bzerror, stream->bz);
+	}
+	fclose(stream->file);
+	free(stream);
+	return Z_OK;
+}
+
+/* Map a regular, uncompressed file. Returns false if the file should be read through zlib instead. */
+static bool input_map(inputfile *file, int fd)
+{
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size < 2) {
+		return false;
+	}
+	file->map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file->map == MAP_FAILED) {
+		file->map = NULL;
+		return false;
+	}
+	if ((unsigned char)file->map[0] == 0x1f
+	    && (unsigned char)file->map[1] == 0x8b) {
+		munmap(file->map, info.st_size);
+		file->map = NULL;
+		return false;
+	}
+	file->map_size = info.st_size;
+	madvise(file->map, file->map_size, MADV_SEQUENTIAL);
+	file->pos = file->map;
+	file->end = file->map + file->map_size;
+	file->eof = true;
+	close(fd);
+	return true;
+}
+
+inputfile *input_open(const char *filename, bool bzip, int threads)
+{
+	inputfile *file;
+	int fd = strcmp(filename, "-") == 0 ? dup(STDIN_FILENO) :
+	    open(filename, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	file = calloc(1, sizeof(inputfile));
+	if (file == NULL) {
+		close(fd);
+		return NULL;
+	}
+	if (!bzip && input_map(file, fd)) {
+		return file;
+	}
+	if (threads > 1
+	    && (file->handle =
+		bzip ? decompress_bzip_open(fd, threads) :
+		decompress_gzip_open(fd, threads)) != NULL) {
+		file->read = decompress_read;
+		file->close = decompress_close;
+	} else if (bzip) {
+		file->handle = bzopen(fd);
+		fd = -1;
+		file->read = (int (*)(void *, void *, int))bzread;
+		file->close = (int (*)(void *))bzclose;
+	} else {
+		file->handle = gzdopen(fd, "r");
+		file->read = (int (*)(void *, void *, int))gzread;
+		file->close = (int (*)(void *))gzclose;
+	}
+	if (file->handle == NULL) {
+		if (fd != -1) {
+			close(fd);
+		}
+		free(file);
+		return NULL;
+	}
+	file->buffer_size = INPUT_BUFFER_SIZE;
+	file->buffer = malloc(file->buffer_size);
+	if (file->buffer == NULL) {
+		file->close(file->handle);
+		free(file);
+		return NULL;
+	}
+	file->pos = file->buffer;
+	file->end = file->buffer;
+	return file;
+}
+
+int input_refill(inputfile *file)
+{
+	size_t keep;
+	int len;
+	if (file->eof) {
+		return file->error ? -1 : 0;
+	}
+	keep = file->end - file->pos;
+	if (file->pos != file->buffer) {
+		memmove(file->buffer, file->pos, keep);
+		file->pos = file->buffer;
+		file->end = file->buffer + keep;
+	}
+	if (keep == file->buffer_size) {
+		char *bigger = realloc(file->buffer, 2 * file->buffer_size);
+		if (bigger == NULL) {
+			file->eof = true;
+			file->error = true;
+			return -1;
+		}
+		file->buffer = bigger;
+		file->buffer_size *= 2;
+		file->pos = file->buffer;
+		file->end = file->buffer + keep;
+	}
+	len = file->read(file->handle, file->end, file->buffer_size - keep);
+	if (len < 0) {
+		file->eof = true;
+		file->error = true;
+		return -1;
+	}
+	if (len == 0) {
+		file->eof = true;
+	}
+	file->end += len;
+	return len;
+}
+
+int input_line(inputfile *file, const char **line, size_t *len)
+{
+	char *newline;
+	size_t length;
+	while ((newline = memchr(file->pos, '\n', file->end - file->pos)) == NULL) {
+		if (file->eof) {
+			if (file->pos == file->end) {
+				return file->error ? -1 : 0;
+			}
+			newline = file->end;
+			break;
+		}
+		if (input_refill(file) < 0) {
+			return -1;
+		}
+	}
+	length = newline - file->pos;
+	if (length > 0 && file->pos[length - 1] == '\r') {
+		length--;
+	}
+	*line = file->pos;
+	*len = length;
+	file->pos = newline == file->end ? file->end : newline + 1;
+	return 1;
+}
+
+bool input_close(inputfile *file)
+{
+	bool ok = !file->error;
+	if (file->map != NULL) {
+		munmap(file->map, file->map_size);
+	} else {
+		ok = file->close(file->handle) == Z_OK && ok;
+		free(file->buffer);
+	}
+	free(file);
+	return ok;
+}
@@ -0,0 +1,43 @@
+/* Buffered access to plain, gzip and bzip2 compressed input files */
+#ifndef AXIOME_INPUT_H
+#define AXIOME_INPUT_H
+#include<stdbool.h>
+#include<stddef.h>
+
+/*
+ * An input file presents its contents as a window of bytes, [pos, end).
+ *
+ * Uncompressed files are memory mapped, so the window is the whole file. Compressed files are decompressed into a large buffer which is refilled on demand. Consumers should parse directly out of the window and advance pos past whatever they have finished with; anything after pos is preserved across a refill, though it may move.
+ */
+typedef struct {
+	char *pos;
+	char *end;
+	bool eof;
+	bool error;
+
+	/* Private. */
+	char *buffer;
+	size_t buffer_size;
+	char *map;
+	size_t map_size;
+	void *handle;
+	int (*read) (void *, void *, int);
+	int (*close) (void *);
+} inputfile;
+
+/* Open a file. If bzip is false, gzip and plain files are detected automatically. Compressed files are decoded using the given number of threads. A filename of - is standard input. Returns NULL and sets errno on failure. */
+inputfile *input_open(const char *filename, bool bzip, int threads);
+/* Append more data to the window. Returns the number of bytes added, 0 at end of file, or -1 on error. */
+int input_refill(inputfile *file);
+/*
+ * Read the next line, which is left in the window and is valid until the next read. The newline (and any carriage return before it) is not included in the length. The last line need not end with a newline.
+ *
+ * Return value:
+ *   1   a line was read
+ *   0   end of file
+ *   -1  read error
+ */
+int input_line(inputfile *file, const char **line, size_t *len);
+/* Close the file. Returns false if any error occurred while reading. */
+bool input_close(inputfile *file);
+#endif
@@ -0,0 +1,461 @@
+/* Join text files on a shared key column */
+#include<ctype.h>
+#include<errno.h>
+#include<limits.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "mapped.h"
+
+typedef struct {
+	const char *text;
+	size_t len;
+	const char *key;
+	size_t key_len;
+	long number;
+	/* The next line with the same key, plus one, or 0. */
+	size_t next;
+} joinline;
+
+/* The first line with a key, and the first one not yet matched, both plus one. */
+typedef struct {
+	size_t first;
+	size_t cursor;
+} joinslot;
+
+typedef struct {
+	const char *filename;
+	mappedfile file;
+	joinline *lines;
+	size_t count;
+	bool sorted;
+	/* While merging, the next line that might match. */
+	size_t position;
+	joinslot *slots;
+	size_t slot_count;
+} joinfile;
+
+/* A range of columns to write from one file. Columns count from 1; negative ones count back from the last. */
+typedef struct {
+	size_t file;
+	long first;
+	long last;
+} joincolumns;
+
+/* Read a number from the start of a key, as atol would. */
+static long parse_number(const char *key, size_t len)
+{
+	const char *end = key + len;
+	bool negative = false;
+	long number = 0;
+	while (key < end && isspace(*key)) {
+		key++;
+	}
+	if (key < end && (*key == '-' || *key == '+')) {
+		negative = *key == '-';
+		key++;
+	}
+	for (; key < end && isdigit(*key); key++) {
+		if (number > (LONG_MAX - (*key - '0')) / 10) {
+			return negative ? LONG_MIN : LONG_MAX;
+		}
+		number = number * 10 + (*key - '0');
+	}
+	return negative ? -number : number;
+}
+
+static int compare_keys(const joinline *a, const joinline *b, bool text)
+{
+	int result;
+	if (!text) {
+		return a->number < b->number ? -1 : a->number > b->number;
+	}
+	result = memcmp(a->key, b->key, a->key_len < b->key_len ? a->key_len :
+			b->key_len);
+	if (result != 0) {
+		return result;
+	}
+	return a->key_len < b->key_len ? -1 : a->key_len > b->key_len;
+}
+
+static uint64_t hash_key(const joinline *line, bool text)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	if (!text) {
+		hash = (uint64_t) line->number * 0x9E3779B97F4A7C15ULL;
+		return hash ^ (hash >> 32);
+	}
+	for (i = 0; i < line->key_len; i++) {
+		hash = (hash ^ (unsigned char)line->key[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* Split a file into lines, skipping the header, and find each one's key. */
+static bool joinfile_scan(joinfile *f, size_t column, size_t header,
+			  bool text)
+{
+	const char *pos = f->file.data;
+	const char *end = f->file.data + f->file.size;
+	size_t size = 0;
+	size_t skipped = 0;
+	f->sorted = true;
+	while (pos < end) {
+		const char *newline = memchr(pos, '\n', end - pos);
+		const char *line_end = newline == NULL ? end : newline;
+		joinline *line;
+		size_t i;
+		if (skipped < header) {
+			skipped++;
+			pos = newline == NULL ? end : newline + 1;
+			continue;
+		}
+		if (f->count == size) {
+			joinline *bigger;
+			size = size == 0 ? 1024 : 2 * size;
+			bigger = realloc(f->lines, size * sizeof(joinline));
+			if (bigger == NULL) {
+				return false;
+			}
+			f->lines = bigger;
+		}
+		line = &f->lines[f->count++];
+		line->text = pos;
+		line->len = line_end - pos;
+		line->key = pos;
+		for (i = 1; i < column && line->key < line_end; i++) {
+			const char *tab =
+			    memchr(line->key, '\t', line_end - line->key);
+			line->key = tab == NULL ? line_end : tab + 1;
+		}
+		line->key_len = line_end - line->key;
+		if (line->key_len > 0) {
+			const char *tab = memchr(line->key, '\t', line->key_len);
+			if (tab != NULL) {
+				line->key_len = tab - line->key;
+			}
+		}
+		line->number = text ? 0 : parse_number(line->key, line->key_len);
+		line->next = 0;
+		if (f->count > 1 && compare_keys(line - 1, line, text) > 0) {
+			f->sorted = false;
+		}
+		pos = newline == NULL ? end : newline + 1;
+	}
+	return true;
+}
+
+/* Find the slot for a key, or the empty one where it belongs. */
+static joinslot *joinfile_probe(const joinfile *f, const joinline *line,
+				bool text)
+{
+	size_t mask = f->slot_count - 1;
+	size_t slot = hash_key(line, text) & mask;
+	while (f->slots[slot].first != 0
+	       && compare_keys(&f->lines[f->slots[slot].first - 1], line,
+			       text) != 0) {
+		slot = (slot + 1) & mask;
+	}
+	return &f->slots[slot];
+}
+
+/* Build a hash table of the lines by key. Lines are added from the end, so each key's lines are chained in file order. */
+static bool joinfile_hash(joinfile *f, bool text)
+{
+	size_t i;
+	f->slot_count = 16;
+	while (f->slot_count < 2 * f->count) {
+		f->slot_count *= 2;
+	}
+	f->slots = calloc(f->slot_count, sizeof(joinslot));
+	if (f->slots == NULL) {
+		return false;
+	}
+	for (i = f->count; i-- > 0;) {
+		joinslot *slot = joinfile_probe(f, &f->lines[i], text);
+		f->lines[i].next = slot->first;
+		slot->first = i + 1;
+		slot->cursor = i + 1;
+	}
+	return true;
+}
+
+/* Find the line matching a key, if there is one left. */
+static bool joinfile_match(joinfile *f, const joinline *line, bool text,
+			   bool merge, size_t *match)
+{
+	if (merge) {
+		while (f->position < f->count
+		       && compare_keys(&f->lines[f->position], line, text) < 0) {
+			f->position++;
+		}
+		*match = f->position;
+		return f->position < f->count
+		    && compare_keys(&f->lines[f->position], line, text) == 0;
+	} else {
+		joinslot *slot = joinfile_probe(f, line, text);
+		*match = slot->cursor - 1;
+		return slot->cursor != 0;
+	}
+}
+
+/* Mark a matched line as used, so a repeated key matches the next one. */
+static void joinfile_use(joinfile *f, const joinline *line, bool text,
+			 bool merge)
+{
+	if (merge) {
+		f->position++;
+	} else {
+		joinslot *slot = joinfile_probe(f, line, text);
+		slot->cursor = f->lines[slot->cursor - 1].next;
+	}
+}
+
+/* Parse a list of columns such as 1.1-,2.3,2.-1. */
+static joincolumns *parse_columns(const char *list, size_t file_count,
+				  size_t *count)
+{
+	joincolumns *columns;
+	const char *pos;
+	size_t i = 0;
+	*count = 1;
+	for (pos = list; *pos != '\0'; pos++) {
+		if (*pos == ',') {
+			(*count)++;
+		}
+	}
+	columns = malloc(*count * sizeof(joincolumns));
+	if (columns == NULL) {
+		return NULL;
+	}
+	for (pos = list; i < *count; i++) {
+		char *end;
+		long file = strtol(pos, &end, 10);
+		if (end == pos || *end != '.' || file < 1
+		    || (size_t)file > file_count) {
+			free(columns);
+			return NULL;
+		}
+		columns[i].file = file - 1;
+		pos = end + 1;
+		columns[i].first = strtol(pos, &end, 10);
+		if (end == pos || columns[i].first == 0) {
+			free(columns);
+			return NULL;
+		}
+		columns[i].last = columns[i].first;
+		if (columns[i].first > 0 && *end == '-') {
+			pos = end + 1;
+			if (isdigit(*pos)) {
+				columns[i].last = strtol(pos, &end, 10);
+			} else {
+				columns[i].last = -1;
+				end = (char *)pos;
+			}
+			if (columns[i].last == 0) {
+				free(columns);
+				return NULL;
+			}
+		}
+		if (*end != (i + 1 == *count ? '\0' : ',')) {
+			free(columns);
+			return NULL;
+		}
+		pos = end + 1;
+	}
+	return columns;
+}
+
+/* Write the chosen columns of a line. Returns whether any have been written, including these. */
+static bool write_columns(const joinline *line, const joincolumns *columns,
+			  bool written)
+{
+	const char *end = line->text + line->len;
+	const char *pos = line->text;
+	long fields = 1;
+	long first;
+	long last;
+	long i;
+	for (i = 0; i < (long)line->len; i++) {
+		if (line->text[i] == '\t') {
+			fields++;
+		}
+	}
+	first = columns->first > 0 ? columns->first : fields + 1 + columns->first;
+	last = columns->last > 0 ? columns->last : fields + 1 + columns->last;
+	if (first < 1) {
+		first = 1;
+	}
+	if (last > fields) {
+		last = fields;
+	}
+	for (i = 1; i <= last && pos <= end; i++) {
+		const char *tab = memchr(pos, '\t', end - pos);
+		const char *field_end = tab == NULL ? end : tab;
+		if (i >= first) {
+			if (written) {
+				putchar('\t');
+			}
+			fwrite(pos, 1, field_end - pos, stdout);
+			written = true;
+		}
+		pos = field_end + 1;
+	}
+	return written;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	bool text = false;
+	long column = 1;
+	long header = 0;
+	const char *column_list = NULL;
+	joincolumns *columns = NULL;
+	size_t column_count = 0;
+	joinfile *files;
+	size_t file_count;
+	size_t *matches;
+	bool merge = true;
+	size_t i;
+	size_t j;
+	int result = 0;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "ak:H:o:")) != -1) {
+		switch (c) {
+		case 'a':
+			text = true;
+			break;
+		case 'k':
+			column = atol(optarg);
+			break;
+		case 'H':
+			header = atol(optarg);
+			break;
+		case 'o':
+			column_list = optarg;
+			break;
+		case '?':
+			if (optopt == (int)'k' || optopt == (int)'H'
+			    || optopt == (int)'o') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+	if (argc - optind < 2 || column < 1 || header < 0) {
+		fprintf(stderr,
+			"Usage: %s [-a] [-k column] [-H lines] [-o columns] file1 file2 [file3 ...]\n\t-a\tCompare keys as text rather than numbers.\n\t-k\tThe column holding the key, counting from 1. The default is 1.\n\t-H\tCopy this many header lines from the first file and skip them in the others.\n\t-o\tThe columns to write, as a comma-separated list of file.column, file.first-last, file.first- or file.-n, which counts back from the last column. The default is every column of every file.\n",
+			argv[0]);
+		return 1;
+	}
+	file_count = argc - optind;
+	if (column_list != NULL) {
+		columns = parse_columns(column_list, file_count, &column_count);
+		if (columns == NULL) {
+			fprintf(stderr, "Bad column list `%s'.\n", column_list);
+			return 1;
+		}
+	}
+
+	files = calloc(file_count, sizeof(joinfile));
+	matches = calloc(file_count, sizeof(size_t));
+	if (files == NULL || matches == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (i = 0; i < file_count; i++) {
+		files[i].filename = argv[optind + i];
+		if (!mapped_open(&files[i].file, files[i].filename)) {
+			perror(files[i].filename);
+			return 1;
+		}
+		if (!joinfile_scan(&files[i], column, header, text)) {
+			perror(argv[0]);
+			return 1;
+		}
+		merge = merge && files[i].sorted;
+	}
+	/* Sorted files can be merged as they are; otherwise, every file but the first is hashed. */
+	for (i = 1; !merge && i < file_count; i++) {
+		if (!joinfile_hash(&files[i], text)) {
+			perror(argv[0]);
+			return 1;
+		}
+	}
+
+	/* The header is copied verbatim. */
+	for (i = 0, j = 0; i < (size_t)header && j < files[0].file.size; i++) {
+		const char *newline =
+		    memchr(files[0].file.data + j, '\n', files[0].file.size - j);
+		size_t end =
+		    newline == NULL ? files[0].file.size : (size_t)(newline -
+								  files[0].file.data);
+		fwrite(files[0].file.data + j, 1, end - j, stdout);
+		putchar('\n');
+		j = end + 1;
+	}
+	for (i = 0; i < files[0].count; i++) {
+		const joinline *line = &files[0].lines[i];
+		bool found = true;
+		bool written = false;
+		matches[0] = i;
+		for (j = 1; found && j < file_count; j++) {
+			found =
+			    joinfile_match(&files[j], line, text, merge, &matches[j]);
+		}
+		if (!found) {
+			continue;
+		}
+		for (j = 1; j < file_count; j++) {
+			joinfile_use(&files[j], line, text, merge);
+		}
+		if (columns == NULL) {
+			for (j = 0; j < file_count; j++) {
+				const joinline *match = &files[j].lines[matches[j]];
+				if (j > 0) {
+					putchar('\t');
+				}
+				fwrite(match->text, 1, match->len, stdout);
+			}
+		} else {
+			for (j = 0; j < column_count; j++) {
+				written =
+				    write_columns(&files[columns[j].file].
+						  lines[matches[columns[j].file]],
+						  &columns[j], written);
+			}
+		}
+		putchar('\n');
+	}
+	if (fflush(stdout) != 0) {
+		perror(argv[0]);
+		result = 1;
+	}
+
+	for (i = 0; i < file_count; i++) {
+		mapped_close(&files[i].file);
+		free(files[i].lines);
+		free(files[i].slots);
+	}
+	free(files);
+	free(matches);
+	free(columns);
+	return result;
+}
@@ -0,0 +1,96 @@
+/* Whole files in memory, mapped where possible */
+#include<errno.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include "mapped.h"
+
+/* Read everything from a descriptor that cannot be mapped. */
+static bool mapped_read(mappedfile *file, int fd)
+{
+	char *data = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	for (;;) {
+		ssize_t got;
+		if (size == capacity) {
+			char *bigger;
+			capacity = capacity == 0 ? 65536 : 2 * capacity;
+			bigger = realloc(data, capacity);
+			if (bigger == NULL) {
+				free(data);
+				return false;
+			}
+			data = bigger;
+		}
+		got = read(fd, data + size, capacity - size);
+		if (got < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			free(data);
+			return false;
+		} else if (got == 0) {
+			break;
+		}
+		size += got;
+	}
+	file->data = data;
+	file->size = size;
+	file->mapped = false;
+	return true;
+}
+
+bool mapped_open(mappedfile *file, const char *filename)
+{
+	struct stat info;
+	bool ok;
+	int fd = strcmp(filename, "-") == 0 ? dup(STDIN_FILENO) :
+	    open(filename, O_RDONLY);
+	memset(file, 0, sizeof(mappedfile));
+	if (fd == -1) {
+		return false;
+	}
+	if (fstat(fd, &info) != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return false;
+	}
+	if (S_ISREG(info.st_mode)) {
+		ok = true;
+		if (info.st_size > 0) {
+			void *data =
+			    mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			ok = data != MAP_FAILED;
+			if (ok) {
+				file->data = data;
+				file->size = info.st_size;
+				file->mapped = true;
+			}
+		}
+	} else {
+		ok = mapped_read(file, fd);
+	}
+	if (!ok) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+void mapped_close(mappedfile *file)
+{
+	if (file->mapped) {
+		munmap((void *)file->data, file->size);
+	} else {
+		free((void *)file->data);
+	}
+	memset(file, 0, sizeof(mappedfile));
+}
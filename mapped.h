@@ -0,0 +1,17 @@
+/* Whole files in memory, mapped where possible */
+#ifndef AXIOME_MAPPED_H
+#define AXIOME_MAPPED_H
+#include<stdbool.h>
+#include<stddef.h>
+
+/* A regular file is memory mapped; anything else, such as a pipe, is read into memory. */
+typedef struct {
+	const char *data;
+	size_t size;
+	bool mapped;
+} mappedfile;
+
+/* Open a file, where "-" means standard input. Returns false and sets errno on failure. */
+bool mapped_open(mappedfile *file, const char *filename);
+void mapped_close(mappedfile *file);
+#endif
@@ -1,68 +1,95 @@
 /* Stick indicies on CASAVA 1.8 runs */
-#include<bzlib.h>
 #include<ctype.h>
 #include<errno.h>
-#if !defined(__APPLE__)
-#include<error.h>
-#endif
-#include<fcntl.h>
+#include<stdbool.h>
 #include<stdio.h>
 #include<stdlib.h>
-#include<sys/stat.h>
-#include<time.h>
+#include<string.h>
 #include<unistd.h>
-#include<zlib.h>
-#include "kseq.h"
+#include "mates.h"
+#include "output.h"
+#include "textbuf.h"
 
-/* Function pointers for file I/O such that we can deal with compressed files. */
-void *(*fileopen) (char *, char *) = (void *(*)(char *, char *))gzopen;
-int (*fileread) (void *, void *, int) = (int (*)(void *, void *, int))gzread;
-int (*fileclose) (void *) = (int (*)(void *))gzclose;
-
-/* Compatibility function to make BZ2_bzRead look like gzread. */
-int bzread(BZFILE * file, void *buf, int len)
-{
-	int bzerror = BZ_OK;
-	int retval = BZ2_bzRead(&bzerror, file, buf, len);
-	if (bzerror == BZ_OK || bzerror == BZ_STREAM_END) {
-		return retval;
-	} else {
-		fprintf(stderr, "bzip error %d\n", bzerror);
-		return -1;
-	}
-}
-
-KSEQ_INIT(void *, fileread)
+/* Each read file may have one or two index files. */
+#define MAX_READS 2
+#define MAX_INDICES 2
 
 int main(int argc, char **argv)
 {
 	int c;
-	int bzip = 0;
-	char *indexfilename = NULL;
-	char *filename = NULL;
-	void *indexfile;
-	void *file;
-	kseq_t *seq;
-	kseq_t *indexseq;
-	int len;
+	bool bzip = false;
+	int threads = 1;
+	outputformat format = OUTPUT_PLAIN;
+	const char *filenames[MATES_MAX_FILES];
+	const char *reads[MAX_READS];
+	size_t read_count = 0;
+	const char *indices[MAX_INDICES];
+	size_t index_count = 0;
+	const char *outputnames[MAX_READS];
+	size_t output_count = 0;
+	outputfile *outputs[MAX_READS];
+	outputset *set;
+	matesreader *reader;
+	fastqrecord records[MATES_MAX_FILES];
+	textbuf record;
+	matesstatus status;
+	size_t file;
+	size_t i;
+	size_t j;
+	bool ok = true;
 
 	/* Process command line arguments. */
-	while ((c = getopt(argc, argv, "ji:f:")) != -1) {
+	while ((c = getopt(argc, argv, "c:ji:f:o:t:")) != -1) {
 		switch (c) {
+		case 'c':
+			if (strcmp(optarg, "gzip") == 0) {
+				format = OUTPUT_GZIP;
+			} else if (strcmp(optarg, "bzip2") == 0) {
+				format = OUTPUT_BZIP;
+			} else {
+				fprintf(stderr,
+					"Unknown compression `%s'.\n",
+					optarg);
+				return 1;
+			}
+			break;
 		case 'j':
-			fileopen = (void *(*)(char *, char *))BZ2_bzopen;
-			fileread = (int (*)(void *, void *, int))bzread;
-			fileclose = (int (*)(void *))BZ2_bzclose;
-			bzip = 1;
+			bzip = true;
 			break;
 		case 'f':
-			filename = optarg;
+			if (read_count == MAX_READS) {
+				fprintf(stderr,
+					"At most %d read files may be given.\n",
+					MAX_READS);
+				return 1;
+			}
+			reads[read_count++] = optarg;
+			break;
+		case 'o':
+			if (output_count == MAX_READS) {
+				fprintf(stderr,
+					"At most %d output files may be given.\n",
+					MAX_READS);
+				return 1;
+			}
+			outputnames[output_count++] = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
 			break;
 		case 'i':
-			indexfilename = optarg;
+			if (index_count == MAX_INDICES) {
+				fprintf(stderr,
+					"At most %d index files may be given.\n",
+					MAX_INDICES);
+				return 1;
+			}
+			indices[index_count++] = optarg;
 			break;
 		case '?':
-			if (optopt == (int)'i' || optopt == (int)'f') {
+			if (optopt == (int)'c' || optopt == (int)'i'
+			    || optopt == (int)'f' || optopt == (int)'o'
+			    || optopt == (int)'t') {
 				fprintf(stderr,
 					"Option -%c requires an argument.\n",
 					optopt);
@@ -80,36 +107,92 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (filename == NULL || indexfilename == NULL) {
+	if (read_count == 1 && output_count == 0) {
+		outputnames[output_count++] = "-";
+	}
+	if (read_count == 0 || index_count == 0 || output_count != read_count) {
 		fprintf(stderr,
-			"Usage: %s [-j] -i indices.fastq -f read.fastq\n\t-j\tInput files are bzipped.\n",
+			"Usage: %s [-j] [-t threads] [-c gzip|bzip2] -i indices.fastq [-i indices2.fastq] -f read.fastq [-o output.fastq] [-f read2.fastq -o output2.fastq]\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use for decompression.\n\t-c\tCompress the output files.\n\t-o\tWhere to write each read, in the same order. With one read, the default is standard output.\n",
 			argv[0]);
 		return 1;
 	}
 
 	/* Open files and initialise FASTQ reader. */
-	file = fileopen(filename, "r");
-	if (file == NULL) {
-		perror(filename);
+	for (i = 0; i < read_count; i++) {
+		filenames[i] = reads[i];
+	}
+	for (i = 0; i < index_count; i++) {
+		filenames[read_count + i] = indices[i];
+	}
+	reader =
+	    mates_open(filenames, read_count + index_count, bzip, threads, &file);
+	if (reader == NULL) {
+		perror(filenames[file]);
 		return 1;
 	}
-	indexfile = fileopen(indexfilename, "r");
-	if (indexfile == NULL) {
-		perror(indexfilename);
+	set = output_set_new(format, threads, read_count);
+	if (set == NULL) {
+		perror(argv[0]);
 		return 1;
 	}
-	seq = kseq_init(file);
-	indexseq = kseq_init(indexfile);
-	while ((len = kseq_read(seq)) >= 0 && (len = kseq_read(indexseq)) >= 0) {
-		printf("@%s%s\n%s\n+\n%s\n", seq->name.s, indexseq->seq.s, seq->seq.s, seq->qual.s);
+	for (i = 0; i < read_count; i++) {
+		outputs[i] = output_open(set, outputnames[i]);
+		if (outputs[i] == NULL) {
+			perror(outputnames[i]);
+			return 1;
+		}
 	}
-	kseq_destroy(seq);
-	kseq_destroy(indexseq);
-	if (fileclose(file) != Z_OK && bzip == 0) {
-		perror(filename);
+
+	memset(&record, 0, sizeof(record));
+	while (ok
+	       && (status = mates_next(reader, records, &file)) == MATES_OK) {
+		for (i = 0; i < read_count; i++) {
+			const fastqrecord *seq = &records[i];
+			record.len = 0;
+			ok = textbuf_putc(&record, '@')
+			    && textbuf_append(&record, seq->name, seq->name_len);
+			for (j = 0; ok && j < index_count; j++) {
+				const fastqrecord *index = &records[read_count + j];
+				ok = (j == 0 || textbuf_putc(&record, '+'))
+				    && textbuf_append(&record, index->seq,
+						      index->seq_len);
+			}
+			ok = ok && textbuf_putc(&record, '\n')
+			    && textbuf_append(&record, seq->seq, seq->seq_len)
+			    && textbuf_append(&record, "\n+\n", 3)
+			    && textbuf_append(&record, seq->qual, seq->qual_len)
+			    && textbuf_putc(&record, '\n');
+			if (!ok) {
+				perror(argv[0]);
+			} else if (!output_write(outputs[i], record.data, record.len)) {
+				perror(outputnames[i]);
+				ok = false;
+			}
+		}
 	}
-	if (fileclose(indexfile) != Z_OK && bzip == 0) {
-		perror(indexfilename);
+	if (ok && status != MATES_END) {
+		fprintf(stderr, "%s: %s at record %lu.\n", filenames[file],
+			mates_strerror(status),
+			(unsigned long)mates_position(reader) + 1);
+		if (status == MATES_EMISMATCH) {
+			fprintf(stderr, "\t%.*s\n\t%.*s\n",
+				(int)records[0].name_len, records[0].name,
+				(int)records[file].name_len,
+				records[file].name);
+		}
+		ok = false;
+	}
+	if (!mates_close(reader)) {
+		perror(argv[0]);
+		ok = false;
+	}
+	for (i = 0; i < read_count; i++) {
+		if (!output_close(outputs[i])) {
+			perror(outputnames[i]);
+			ok = false;
+		}
 	}
-	return 0;
+	output_set_free(set);
+	textbuf_free(&record);
+	return ok ? 0 : 1;
 }
@@ -0,0 +1,319 @@
+/* Read the mate and index files of a run in lockstep */
+#include<errno.h>
+#include<pthread.h>
+#include<stdlib.h>
+#include<string.h>
+#include "mates.h"
+#include "parser.h"
+
+/* How many batches each file's thread may read ahead of the consumer. */
+#define MATES_DEPTH 3
+
+typedef struct {
+	fastqbatch *batch;
+	seqheader *headers;
+	seqiderror *errors;
+} matesbatch;
+
+typedef struct {
+	struct matesreader *owner;
+	inputfile *file;
+	pthread_t thread;
+	bool started;
+	/* A ring of batches, filled by the thread and emptied by the consumer. */
+	matesbatch batches[MATES_DEPTH];
+	size_t head;
+	size_t ready;
+	/* The consumer's position in the batch at the head. */
+	size_t pos;
+	/* The thread has stopped reading. */
+	bool done;
+	bool truncated;
+} matestream;
+
+struct matesreader {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	matestream streams[MATES_MAX_FILES];
+	size_t count;
+	size_t position;
+	bool stopping;
+};
+
+static void *mates_read(void *data)
+{
+	matestream *stream = data;
+	matesreader *reader = stream->owner;
+	size_t tail = 0;
+	for (;;) {
+		matesbatch *slot;
+		pthread_mutex_lock(&reader->lock);
+		while (stream->ready == MATES_DEPTH && !reader->stopping) {
+			pthread_cond_wait(&reader->changed, &reader->lock);
+		}
+		if (reader->stopping) {
+			stream->done = true;
+			pthread_mutex_unlock(&reader->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&reader->lock);
+
+		slot = &stream->batches[tail];
+		if (fastq_batch_read(stream->file, slot->batch) > 0) {
+			seqheader_parse_batch(slot->batch->records,
+					      slot->batch->count, slot->headers,
+					      slot->errors);
+		}
+		pthread_mutex_lock(&reader->lock);
+		if (slot->batch->count > 0) {
+			stream->ready++;
+			tail = (tail + 1) % MATES_DEPTH;
+		}
+		if (slot->batch->count == 0 || slot->batch->truncated) {
+			stream->truncated = slot->batch->truncated;
+			stream->done = true;
+		}
+		pthread_cond_broadcast(&reader->changed);
+		pthread_mutex_unlock(&reader->lock);
+		if (stream->done) {
+			return NULL;
+		}
+	}
+}
+
+/* Move to the next record in a file. Returns false if the file has ended. The caller must hold the lock. */
+static bool mates_advance(matesreader *reader, matestream *stream)
+{
+	if (stream->ready > 0
+	    && stream->pos == stream->batches[stream->head].batch->count) {
+		stream->head = (stream->head + 1) % MATES_DEPTH;
+		stream->ready--;
+		stream->pos = 0;
+		pthread_cond_broadcast(&reader->changed);
+	}
+	while (stream->ready == 0 && !stream->done) {
+		pthread_cond_wait(&reader->changed, &reader->lock);
+	}
+	return stream->ready > 0;
+}
+
+/* The name up to the first space, without any mate suffix. */
+static size_t name_stem(const fastqrecord *record)
+{
+	size_t len = 0;
+	while (len < record->name_len && record->name[len] != ' '
+	       && record->name[len] != '\t') {
+		len++;
+	}
+	if (len > 2 && record->name[len - 2] == '/') {
+		len -= 2;
+	}
+	return len;
+}
+
+static bool field_equal(const fastqrecord *a, seqfield fa,
+			const fastqrecord *b, seqfield fb)
+{
+	return fa.length == fb.length
+	    && memcmp(a->name + fa.offset, b->name + fb.offset, fa.length) == 0;
+}
+
+static bool mates_same(const fastqrecord *a, const seqheader *ha,
+		       seqiderror ea, const fastqrecord *b,
+		       const seqheader *hb, seqiderror eb)
+{
+	size_t len;
+	if (ea == SEQID_OK && eb == SEQID_OK) {
+		return ha->x == hb->x && ha->y == hb->y && ha->tile == hb->tile
+		    && ha->lane == hb->lane && ha->run == hb->run
+		    && field_equal(a, ha->instrument, b, hb->instrument)
+		    && field_equal(a, ha->flowcell, b, hb->flowcell);
+	}
+	len = name_stem(a);
+	return len == name_stem(b) && memcmp(a->name, b->name, len) == 0;
+}
+
+matesstatus mates_next(matesreader *reader, fastqrecord *records, size_t *file)
+{
+	const matesbatch *first = NULL;
+	size_t first_pos = 0;
+	size_t ended = 0;
+	size_t i;
+	matesstatus status = MATES_OK;
+
+	pthread_mutex_lock(&reader->lock);
+	for (i = 0; i < reader->count; i++) {
+		matestream *stream = &reader->streams[i];
+		if (!mates_advance(reader, stream)) {
+			if (stream->truncated) {
+				status = MATES_EMALFORMED;
+				*file = i;
+				break;
+			}
+			ended++;
+			continue;
+		}
+		records[i] =
+		    stream->batches[stream->head].batch->records[stream->pos];
+	}
+	if (status == MATES_OK && ended > 0) {
+		if (ended == reader->count) {
+			status = MATES_END;
+		} else {
+			status = MATES_ESHORT;
+			for (i = 0; i < reader->count; i++) {
+				if (reader->streams[i].ready == 0) {
+					*file = i;
+					break;
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&reader->lock);
+	if (status != MATES_OK) {
+		return status;
+	}
+
+	/* The batches at the head cannot be recycled until the consumer moves past them, so they can be read without the lock. */
+	for (i = 0; i < reader->count; i++) {
+		matestream *stream = &reader->streams[i];
+		const matesbatch *current = &stream->batches[stream->head];
+		if (i == 0) {
+			first = current;
+			first_pos = stream->pos;
+		} else if (!mates_same(&records[0], &first->headers[first_pos],
+				       first->errors[first_pos], &records[i],
+				       &current->headers[stream->pos],
+				       current->errors[stream->pos])) {
+			*file = i;
+			return MATES_EMISMATCH;
+		}
+	}
+	for (i = 0; i < reader->count; i++) {
+		reader->streams[i].pos++;
+	}
+	reader->position++;
+	return MATES_OK;
+}
+
+size_t mates_position(const matesreader *reader)
+{
+	return reader->position;
+}
+
+const char *mates_strerror(matesstatus status)
+{
+	switch (status) {
+	case MATES_OK:
+		return "Success";
+	case MATES_END:
+		return "End of file";
+	case MATES_EMALFORMED:
+		return "Malformed FASTQ record";
+	case MATES_ESHORT:
+		return "File has fewer records than the others";
+	case MATES_EMISMATCH:
+		return "Record does not match the first file";
+	default:
+		return "Unknown error";
+	}
+}
+
+static bool mates_batch_new(matesbatch *slot)
+{
+	slot->batch = fastq_batch_new();
+	if (slot->batch == NULL) {
+		return false;
+	}
+	slot->headers = malloc(slot->batch->capacity * sizeof(seqheader));
+	slot->errors = malloc(slot->batch->capacity * sizeof(seqiderror));
+	return slot->headers != NULL && slot->errors != NULL;
+}
+
+matesreader *mates_open(const char *const *filenames, size_t count, bool bzip,
+			int threads, size_t *failed)
+{
+	matesreader *reader;
+	size_t i;
+	size_t j;
+	if (count < 1 || count > MATES_MAX_FILES) {
+		*failed = 0;
+		errno = EINVAL;
+		return NULL;
+	}
+	reader = calloc(1, sizeof(matesreader));
+	if (reader == NULL) {
+		*failed = 0;
+		return NULL;
+	}
+	pthread_mutex_init(&reader->lock, NULL);
+	pthread_cond_init(&reader->changed, NULL);
+	for (i = 0; i < count; i++) {
+		matestream *stream = &reader->streams[i];
+		reader->count++;
+		stream->owner = reader;
+		stream->file = input_open(filenames[i], bzip, threads);
+		if (stream->file == NULL) {
+			break;
+		}
+		for (j = 0; j < MATES_DEPTH; j++) {
+			if (!mates_batch_new(&stream->batches[j])) {
+				errno = ENOMEM;
+				break;
+			}
+		}
+		if (j < MATES_DEPTH) {
+			break;
+		}
+	}
+	for (j = 0; i == count && j < count; j++) {
+		matestream *stream = &reader->streams[j];
+		int error = pthread_create(&stream->thread, NULL, mates_read,
+					   stream);
+		if (error != 0) {
+			errno = error;
+			i = j;
+			break;
+		}
+		stream->started = true;
+	}
+	if (i < count) {
+		int error = errno;
+		*failed = i;
+		mates_close(reader);
+		errno = error;
+		return NULL;
+	}
+	return reader;
+}
+
+bool mates_close(matesreader *reader)
+{
+	size_t i;
+	size_t j;
+	bool ok = true;
+	pthread_mutex_lock(&reader->lock);
+	reader->stopping = true;
+	pthread_cond_broadcast(&reader->changed);
+	pthread_mutex_unlock(&reader->lock);
+	for (i = 0; i < reader->count; i++) {
+		matestream *stream = &reader->streams[i];
+		if (stream->started) {
+			pthread_join(stream->thread, NULL);
+		}
+		if (stream->file != NULL && !input_close(stream->file)) {
+			ok = false;
+		}
+		for (j = 0; j < MATES_DEPTH; j++) {
+			if (stream->batches[j].batch != NULL) {
+				fastq_batch_free(stream->batches[j].batch);
+			}
+			free(stream->batches[j].headers);
+			free(stream->batches[j].errors);
+		}
+	}
+	pthread_mutex_destroy(&reader->lock);
+	pthread_cond_destroy(&reader->changed);
+	free(reader);
+	return ok;
+}
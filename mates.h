@@ -0,0 +1,40 @@
+/* Read the mate and index files of a run in lockstep */
+#ifndef AXIOME_MATES_H
+#define AXIOME_MATES_H
+#include<stdbool.h>
+#include<stddef.h>
+#include "fastq.h"
+
+/* At most this many files can be read together (e.g., R1, R2, I1 and I2). */
+#define MATES_MAX_FILES 4
+
+typedef enum {
+	MATES_OK = 0,
+	/* Every file ended at the same record. */
+	MATES_END,
+	/* A record is malformed, or the file could not be read or decompressed. */
+	MATES_EMALFORMED,
+	/* The file ended before the others. */
+	MATES_ESHORT,
+	/* The record is not from the same cluster as the one in the first file. */
+	MATES_EMISMATCH
+} matesstatus;
+
+/*
+ * Each file is read and its headers parsed on its own thread, which keeps a few batches ahead of the consumer, so several compressed files are decoded at once.
+ *
+ * Records are matched up by position. Each tuple is checked by comparing the parsed headers: the instrument, run, flowcell, lane, tile and coordinates must agree, while the mate and tag may differ. If a header cannot be parsed, the names are compared up to the first space or mate suffix (/1) instead.
+ */
+typedef struct matesreader matesreader;
+
+/* Open the files, decompressing each with the given number of threads. Returns NULL and sets errno on failure, storing the index of the file that failed in failed. */
+matesreader *mates_open(const char *const *filenames, size_t count, bool bzip,
+			int threads, size_t *failed);
+/* Fetch the next record from every file; records[i] is from file i. The records are valid until the next call. If anything but MATES_OK or MATES_END is returned, the index of the offending file is stored in file and reading should stop. */
+matesstatus mates_next(matesreader *reader, fastqrecord *records, size_t *file);
+/* The number of tuples returned so far. */
+size_t mates_position(const matesreader *reader);
+const char *mates_strerror(matesstatus status);
+/* Stop the reading threads and close the files. Returns false if any file could not be read. */
+bool mates_close(matesreader *reader);
+#endif
@@ -0,0 +1,701 @@
+/* Pick the most abundant sequence in each OTU as its representative */
+#include<ctype.h>
+#include<errno.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "fastaindex.h"
+#include "extsort.h"
+#include "input.h"
+#include "pool.h"
+#include "textbuf.h"
+
+/* How many batches each worker may have in flight. Once they are all in use, the reader waits for the oldest. */
+#define MKREPSET_DEPTH 3
+/* Cluster lines are handed out in batches of about this many bytes, so small clusters are not a job each. */
+#define BATCH_SIZE 65536
+/* In sequential mode, how many sequences are fetched in one sweep. */
+#define SWEEP_SIZE 65536
+
+/* How many times a distinct sequence appears in a cluster, and where it first appears. A count of 0 is an empty slot. */
+typedef struct {
+	uint64_t hash;
+	uint32_t first;
+	uint32_t count;
+} tally;
+
+/* The members of a cluster, and their sequences. */
+typedef struct {
+	textbuf line;
+	const char **members;
+	size_t member_size;
+	fastaslice *slices;
+	size_t slice_size;
+	tally *tallies;
+	size_t tally_size;
+	fastascratch scratch;
+} cluster;
+
+typedef struct {
+	/* The cluster lines, each NUL-terminated. */
+	textbuf lines;
+	size_t line_count;
+	textbuf output;
+	textbuf messages;
+	size_t clusters;
+	bool failed;
+	bool busy;
+	bool done;
+	cluster work;
+	struct repset *owner;
+} batch;
+
+typedef struct repset {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	const fastaindex *sequences;
+} repset;
+
+/* Hash a sequence eight bases at a time. Different seeds give unrelated hashes. */
+static uint64_t hash_sequence(const char *seq, size_t len, uint64_t seed)
+{
+	uint64_t hash = (len + seed) * 0x9E3779B97F4A7C15ULL;
+	uint64_t word;
+	size_t i;
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&word, seq + i, 8);
+		hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 32;
+	}
+	word = 0;
+	memcpy(&word, seq + i, len - i);
+	hash = (hash ^ word) * 0xC4CEB9FE1A85EC53ULL;
+	return hash ^ (hash >> 29);
+}
+
+/* Split a line on tabs. Returns false if memory runs out. */
+static bool cluster_split(cluster *c, const char *text, size_t len,
+			  size_t *count)
+{
+	size_t i;
+	c->line.len = 0;
+	if (!textbuf_append(&c->line, text, len)
+	    || !textbuf_putc(&c->line, '\0')) {
+		return false;
+	}
+	*count = 0;
+	for (i = 0; i < c->line.len; i++) {
+		if (i == 0 || c->line.data[i - 1] == '\0') {
+			if (*count == c->member_size) {
+				size_t size =
+				    c->member_size == 0 ? 64 : 2 * c->member_size;
+				const char **bigger =
+				    realloc(c->members, size * sizeof(char *));
+				if (bigger == NULL) {
+					return false;
+				}
+				c->members = bigger;
+				c->member_size = size;
+			}
+			c->members[(*count)++] = c->line.data + i;
+		}
+		if (c->line.data[i] == '\t') {
+			c->line.data[i] = '\0';
+		}
+	}
+	return true;
+}
+
+/*
+ * Find the most common sequence; among equally common ones, the one that appears first. Sequences are counted in a hash table by their hashes, checking the sequences themselves on a match, so each member is compared once rather than sorted.
+ */
+static bool cluster_pick(cluster *c, const fastaindex *sequences,
+			 size_t count, fastaslice *best, textbuf *messages)
+{
+	size_t best_count = 0;
+	size_t best_first = 0;
+	size_t slots = 16;
+	size_t mask;
+	size_t i;
+	if (count > c->slice_size) {
+		free(c->slices);
+		c->slices = malloc(count * sizeof(fastaslice));
+		c->slice_size = c->slices == NULL ? 0 : count;
+		if (c->slices == NULL) {
+			return false;
+		}
+	}
+	while (slots < 2 * count) {
+		slots *= 2;
+	}
+	if (slots > c->tally_size) {
+		free(c->tallies);
+		c->tallies = malloc(slots * sizeof(tally));
+		c->tally_size = c->tallies == NULL ? 0 : slots;
+		if (c->tallies == NULL) {
+			return false;
+		}
+	}
+	memset(c->tallies, 0, slots * sizeof(tally));
+	mask = slots - 1;
+	if (!fastaindex_fetch(sequences, c->members + 1, count, c->slices,
+			      &c->scratch)) {
+		return false;
+	}
+	best->seq = "";
+	best->len = 0;
+	for (i = 0; i < count; i++) {
+		const fastaslice *slice = &c->slices[i];
+		uint64_t hash;
+		tally *t;
+		if (slice->seq == NULL) {
+			if (!textbuf_printf(messages, "Missing sequence: %s\n",
+					    c->members[i + 1])) {
+				return false;
+			}
+			continue;
+		}
+		hash = hash_sequence(slice->seq, slice->len, 0);
+		t = &c->tallies[hash & mask];
+		while (t->count != 0
+		       && (t->hash != hash
+			   || c->slices[t->first].len != slice->len
+			   || memcmp(c->slices[t->first].seq, slice->seq,
+				     slice->len) != 0)) {
+			t = &c->tallies[(t - c->tallies + 1) & mask];
+		}
+		if (t->count == 0) {
+			t->hash = hash;
+			t->first = i;
+		}
+		t->count++;
+		/* Counts only grow, so whichever wins at the end wins here at its last increase. */
+		if (t->count > best_count
+		    || (t->count == best_count && t->first < best_first)) {
+			best_count = t->count;
+			best_first = t->first;
+			*best = c->slices[t->first];
+		}
+	}
+	return true;
+}
+
+static void batch_work(void *data)
+{
+	batch *b = data;
+	const char *line = b->lines.data;
+	size_t i;
+	for (i = 0; i < b->line_count && !b->failed; i++) {
+		size_t len = strlen(line);
+		size_t members;
+		fastaslice best;
+		if (!cluster_split(&b->work, line, len, &members)
+		    || (members >= 2
+			&& !cluster_pick(&b->work, b->owner->sequences,
+					 members - 1, &best, &b->messages))) {
+			b->failed = true;
+		} else if (members < 2) {
+			b->failed =
+			    !textbuf_printf(&b->messages, "Malformed line: %s\n",
+					    b->work.line.data);
+		} else {
+			b->failed =
+			    !textbuf_printf(&b->output, ">%s ;size=%d\n",
+					    b->work.members[0], (int)(members - 1))
+			    || !textbuf_append(&b->output, best.seq, best.len)
+			    || !textbuf_putc(&b->output, '\n');
+			b->clusters++;
+		}
+		line += len + 1;
+	}
+	pthread_mutex_lock(&b->owner->lock);
+	b->done = true;
+	pthread_cond_broadcast(&b->owner->changed);
+	pthread_mutex_unlock(&b->owner->lock);
+}
+
+/* Wait for a batch, then write out what it found. Returns false if it ran out of memory. */
+static bool batch_commit(batch *b, long *count)
+{
+	long before = *count;
+	pthread_mutex_lock(&b->owner->lock);
+	while (!b->done) {
+		pthread_cond_wait(&b->owner->changed, &b->owner->lock);
+	}
+	pthread_mutex_unlock(&b->owner->lock);
+	fwrite(b->messages.data, 1, b->messages.len, stderr);
+	fwrite(b->output.data, 1, b->output.len, stdout);
+	*count += b->clusters;
+	if (*count / 100000 != before / 100000) {
+		fprintf(stderr, "Summarized %ld clusters...\n", *count);
+	}
+	b->busy = false;
+	b->done = false;
+	return !b->failed;
+}
+
+static void batch_free(batch *b)
+{
+	textbuf_free(&b->lines);
+	textbuf_free(&b->output);
+	textbuf_free(&b->messages);
+	fastascratch_free(&b->work.scratch);
+	textbuf_free(&b->work.line);
+	free(b->work.members);
+	free(b->work.slices);
+	free(b->work.tallies);
+}
+
+/* A member of a cluster, by where its sequence is in the FASTA file. */
+typedef struct {
+	uint64_t place;
+	uint32_t cluster;
+	uint32_t position;
+} membership;
+
+/* A member of a cluster, with its sequence reduced to a pair of hashes. */
+typedef struct {
+	uint64_t hash[2];
+	uint64_t place;
+	uint32_t cluster;
+	uint32_t position;
+} fingerprint;
+
+/* No sequence was found for any member of a cluster. */
+#define NO_SEQUENCE UINT64_MAX
+
+static int compare_memberships(const void *a, const void *b)
+{
+	const membership *x = a;
+	const membership *y = b;
+	if (x->place != y->place) {
+		return x->place < y->place ? -1 : 1;
+	}
+	if (x->cluster != y->cluster) {
+		return x->cluster < y->cluster ? -1 : 1;
+	}
+	return x->position < y->position ? -1 : x->position > y->position;
+}
+
+/* Order by cluster, then by sequence, so equal sequences are together and in the order they appear. */
+static int compare_fingerprints(const void *a, const void *b)
+{
+	const fingerprint *x = a;
+	const fingerprint *y = b;
+	if (x->cluster != y->cluster) {
+		return x->cluster < y->cluster ? -1 : 1;
+	}
+	if (x->hash[0] != y->hash[0]) {
+		return x->hash[0] < y->hash[0] ? -1 : 1;
+	}
+	if (x->hash[1] != y->hash[1]) {
+		return x->hash[1] < y->hash[1] ? -1 : 1;
+	}
+	return x->position < y->position ? -1 : x->position > y->position;
+}
+
+/* The clusters, without their members. */
+typedef struct {
+	textbuf names;
+	size_t *name_starts;
+	uint32_t *sizes;
+	uint64_t *best;
+	size_t count;
+	size_t size;
+} clusterlist;
+
+static bool clusterlist_add(clusterlist *list, const char *name,
+			    uint32_t size)
+{
+	if (list->count == list->size) {
+		size_t bigger = list->size == 0 ? 1024 : 2 * list->size;
+		size_t *name_starts =
+		    realloc(list->name_starts, bigger * sizeof(size_t));
+		uint32_t *sizes;
+		uint64_t *best;
+		if (name_starts == NULL) {
+			return false;
+		}
+		list->name_starts = name_starts;
+		sizes = realloc(list->sizes, bigger * sizeof(uint32_t));
+		if (sizes == NULL) {
+			return false;
+		}
+		list->sizes = sizes;
+		best = realloc(list->best, bigger * sizeof(uint64_t));
+		if (best == NULL) {
+			return false;
+		}
+		list->best = best;
+		list->size = bigger;
+	}
+	list->name_starts[list->count] = list->names.len;
+	list->sizes[list->count] = size;
+	list->best[list->count] = NO_SEQUENCE;
+	if (!textbuf_append(&list->names, name, strlen(name) + 1)) {
+		return false;
+	}
+	list->count++;
+	return true;
+}
+
+/*
+ * Pick representatives without reading the FASTA file at random. The clusters are turned inside out into one record per member, which are sorted into file order, so the sequences are read in one forward sweep and reduced to hashes. Those are sorted again by cluster and sequence, which leaves counting the runs of equal hashes. Both sorts spill to disk beyond the memory budget. Only the representatives themselves are then fetched, again in file order.
+ */
+static bool pick_sequential(const fastaindex *sequences, inputfile *clusters,
+			    const char *filename, size_t budget,
+			    const char *directory, long *count)
+{
+	extsort *members =
+	    extsort_new(sizeof(membership), compare_memberships, budget / 2,
+			directory);
+	extsort *fingerprints =
+	    extsort_new(sizeof(fingerprint), compare_fingerprints, budget / 2,
+			directory);
+	membership *sweep = malloc(SWEEP_SIZE * sizeof(membership));
+	uint64_t *places = malloc(SWEEP_SIZE * sizeof(uint64_t));
+	fastaslice *slices = malloc(SWEEP_SIZE * sizeof(fastaslice));
+	fastascratch scratch;
+	clusterlist list;
+	cluster c;
+	fingerprint f;
+	const char *line;
+	size_t len;
+	size_t start;
+	size_t i;
+	int result;
+	bool ok = members != NULL && fingerprints != NULL && sweep != NULL
+	    && places != NULL && slices != NULL;
+	memset(&scratch, 0, sizeof(scratch));
+	memset(&list, 0, sizeof(list));
+	memset(&c, 0, sizeof(c));
+	if (!ok) {
+		fprintf(stderr, "Out of memory.\n");
+		goto done;
+	}
+
+	while (ok && (result = input_line(clusters, &line, &len)) > 0) {
+		size_t fields;
+		membership m;
+		if (!cluster_split(&c, line, len, &fields)) {
+			fprintf(stderr, "Out of memory.\n");
+			ok = false;
+			break;
+		}
+		if (fields < 2) {
+			fprintf(stderr, "Malformed line: %s\n", c.line.data);
+			continue;
+		}
+		if (!clusterlist_add(&list, c.members[0], fields - 1)) {
+			fprintf(stderr, "Out of memory.\n");
+			ok = false;
+			break;
+		}
+		m.cluster = list.count - 1;
+		for (i = 1; ok && i < fields; i++) {
+			m.position = i - 1;
+			if (!fastaindex_locate(sequences, c.members[i], &m.place)) {
+				fprintf(stderr, "Missing sequence: %s\n",
+					c.members[i]);
+			} else if (!extsort_add(members, &m)) {
+				fprintf(stderr, "%s: %s\n", directory,
+					strerror(errno));
+				ok = false;
+			}
+		}
+	}
+	if (ok && result < 0) {
+		fprintf(stderr, "Could not read %s.\n", filename);
+		ok = false;
+	}
+	if (ok && !extsort_finish(members)) {
+		fprintf(stderr, "%s: %s\n", directory, strerror(errno));
+		ok = false;
+	}
+
+	/* Sweep through the FASTA file, hashing each member's sequence. */
+	while (ok) {
+		size_t n = 0;
+		while (n < SWEEP_SIZE
+		       && (result = extsort_next(members, &sweep[n])) > 0) {
+			places[n] = sweep[n].place;
+			n++;
+		}
+		if (result < 0) {
+			fprintf(stderr, "%s: %s\n", directory, strerror(errno));
+			ok = false;
+		} else if (n == 0) {
+			break;
+		} else if (!fastaindex_fetch_at(sequences, places, n, slices,
+						&scratch)) {
+			fprintf(stderr, "Out of memory.\n");
+			ok = false;
+		}
+		for (i = 0; ok && i < n; i++) {
+			f.hash[0] = hash_sequence(slices[i].seq, slices[i].len, 0);
+			f.hash[1] = hash_sequence(slices[i].seq, slices[i].len, 1);
+			f.place = sweep[i].place;
+			f.cluster = sweep[i].cluster;
+			f.position = sweep[i].position;
+			if (!extsort_add(fingerprints, &f)) {
+				fprintf(stderr, "%s: %s\n", directory,
+					strerror(errno));
+				ok = false;
+			}
+		}
+	}
+	extsort_free(members);
+	members = NULL;
+	if (ok && !extsort_finish(fingerprints)) {
+		fprintf(stderr, "%s: %s\n", directory, strerror(errno));
+		ok = false;
+	}
+
+	/* Count the runs of equal sequences in each cluster. As the members are in order within a run, its first is where the sequence first appears. */
+	result = ok ? extsort_next(fingerprints, &f) : 0;
+	while (result > 0) {
+		uint32_t current = f.cluster;
+		size_t best_count = 0;
+		uint32_t best_first = 0;
+		while (result > 0 && f.cluster == current) {
+			fingerprint first = f;
+			size_t run = 0;
+			while (result > 0 && f.cluster == current
+			       && f.hash[0] == first.hash[0]
+			       && f.hash[1] == first.hash[1]) {
+				run++;
+				result = extsort_next(fingerprints, &f);
+			}
+			if (run > best_count
+			    || (run == best_count && first.position < best_first)) {
+				best_count = run;
+				best_first = first.position;
+				list.best[current] = first.place;
+			}
+		}
+	}
+	if (result < 0) {
+		fprintf(stderr, "%s: %s\n", directory, strerror(errno));
+		ok = false;
+	}
+
+	/* Write the clusters in order, fetching their representatives a sweep at a time. */
+	for (start = 0; ok && start < list.count; start += SWEEP_SIZE) {
+		size_t end =
+		    list.count - start < SWEEP_SIZE ? list.count : start + SWEEP_SIZE;
+		size_t n = 0;
+		for (i = start; i < end; i++) {
+			if (list.best[i] != NO_SEQUENCE) {
+				places[n++] = list.best[i];
+			}
+		}
+		if (!fastaindex_fetch_at(sequences, places, n, slices, &scratch)) {
+			fprintf(stderr, "Out of memory.\n");
+			ok = false;
+			break;
+		}
+		for (i = start, n = 0; i < end; i++) {
+			fastaslice best = { "", 0 };
+			if (list.best[i] != NO_SEQUENCE) {
+				best = slices[n++];
+			}
+			printf(">%s ;size=%d\n%.*s\n",
+			       list.names.data + list.name_starts[i],
+			       (int)list.sizes[i], (int)best.len, best.seq);
+			if (++*count % 100000 == 0) {
+				fprintf(stderr, "Summarized %ld clusters...\n",
+					*count);
+			}
+		}
+	}
+ done:
+	if (members != NULL) {
+		extsort_free(members);
+	}
+	if (fingerprints != NULL) {
+		extsort_free(fingerprints);
+	}
+	free(sweep);
+	free(places);
+	free(slices);
+	fastascratch_free(&scratch);
+	textbuf_free(&list.names);
+	free(list.name_starts);
+	free(list.sizes);
+	free(list.best);
+	textbuf_free(&c.line);
+	free(c.members);
+	return ok;
+}
+
+/* Pick representatives one batch of clusters at a time on a pool of threads. */
+static bool pick_parallel(const fastaindex *sequences, inputfile *clusters,
+			  const char *filename, int threads, long *count)
+{
+	repset r;
+	pool *workers;
+	batch *batches;
+	size_t batch_count;
+	size_t next = 0;
+	const char *line;
+	size_t len;
+	int result = 0;
+	size_t i;
+	bool ok = true;
+
+	batch_count = MKREPSET_DEPTH * threads;
+	batches = calloc(batch_count, sizeof(batch));
+	if (batches == NULL || (workers = pool_new(threads)) == NULL) {
+		free(batches);
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	r.sequences = sequences;
+	pthread_mutex_init(&r.lock, NULL);
+	pthread_cond_init(&r.changed, NULL);
+	for (i = 0; i < batch_count; i++) {
+		batches[i].owner = &r;
+	}
+
+	/* The batches are used in turn, so the next one to fill is always the oldest to write. */
+	while (ok) {
+		batch *b = &batches[next % batch_count];
+		if (b->busy && !batch_commit(b, count)) {
+			fprintf(stderr, "Out of memory.\n");
+			ok = false;
+			break;
+		}
+		b->lines.len = 0;
+		b->line_count = 0;
+		b->output.len = 0;
+		b->messages.len = 0;
+		b->clusters = 0;
+		while (b->lines.len < BATCH_SIZE
+		       && (result = input_line(clusters, &line, &len)) > 0) {
+			if (!textbuf_append(&b->lines, line, len)
+			    || !textbuf_putc(&b->lines, '\0')) {
+				fprintf(stderr, "Out of memory.\n");
+				ok = false;
+				break;
+			}
+			b->line_count++;
+		}
+		if (!ok || b->line_count == 0) {
+			break;
+		}
+		b->busy = true;
+		pool_submit(workers, batch_work, b);
+		next++;
+	}
+	for (i = 0; i < batch_count; i++) {
+		batch *b = &batches[(next + i) % batch_count];
+		if (b->busy && !batch_commit(b, count) && ok) {
+			fprintf(stderr, "Out of memory.\n");
+			ok = false;
+		}
+	}
+	pool_free(workers);
+	if (ok && result < 0) {
+		fprintf(stderr, "Could not read %s.\n", filename);
+		ok = false;
+	}
+	for (i = 0; i < batch_count; i++) {
+		batch_free(&batches[i]);
+	}
+	free(batches);
+	pthread_mutex_destroy(&r.lock);
+	pthread_cond_destroy(&r.changed);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int threads = 1;
+	bool sequential = false;
+	long budget = 1024;
+	const char *directory = getenv("TMPDIR");
+	fastaindex *sequences;
+	inputfile *clusters;
+	long count = 0;
+	bool ok;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "m:st:T:")) != -1) {
+		switch (c) {
+		case 'm':
+			budget = atol(optarg);
+			break;
+		case 's':
+			sequential = true;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'T':
+			directory = optarg;
+			break;
+		case '?':
+			if (optopt == (int)'m' || optopt == (int)'t'
+			    || optopt == (int)'T') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr,
+			"Usage: %s [-t threads] [-s [-m megabytes] [-T directory]] seq.fasta otu_seqs.txt\n\t-t\tNumber of threads to use.\n\t-s\tRead the FASTA file sequentially, sorting the members on disk, rather than at random.\n\t-m\tMemory to use for sorting, in megabytes. The default is 1024.\n\t-T\tWhere to put temporary files. The default is $TMPDIR or /tmp.\n",
+			argv[0]);
+		return 1;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (budget < 1) {
+		budget = 1;
+	}
+	if (directory == NULL || *directory == '\0') {
+		directory = "/tmp";
+	}
+	fprintf(stderr, "Opening FASTA...\n");
+	sequences = fastaindex_open(argv[optind]);
+	if (sequences == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n", argv[optind],
+			strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "Opening Clusters...\n");
+	clusters = input_open(argv[optind + 1], false, 1);
+	if (clusters == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n", argv[optind + 1],
+			strerror(errno));
+		return 1;
+	}
+
+	if (sequential) {
+		ok = pick_sequential(sequences, clusters, argv[optind + 1],
+				     (size_t)budget << 20, directory, &count);
+	} else {
+		ok = pick_parallel(sequences, clusters, argv[optind + 1],
+				   threads, &count);
+	}
+	fprintf(stderr, "Summarized %ld clusters...\n", count);
+	input_close(clusters);
+	fastaindex_free(sequences);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/* Convert CASAVA 1.3 files, one read per line, into FASTQ */
+#include<ctype.h>
+#include<errno.h>
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "input.h"
+#include "output.h"
+#include "textbuf.h"
+
+/* The name is instrument:lane:tile:x:y#tag/mate, followed by the sequence and the quality scores. */
+#define NAME_FIELDS 5
+
+/* Split a line into name, sequence and quality. The quality scores may themselves contain colons. */
+static bool split_line(const char *line, size_t len, size_t *name_len,
+		       size_t *seq_len)
+{
+	const char *end = line + len;
+	const char *pos = line;
+	const char *colon;
+	int fields;
+	for (fields = 0; fields < NAME_FIELDS; fields++) {
+		colon = memchr(pos, ':', end - pos);
+		if (colon == NULL) {
+			return false;
+		}
+		pos = colon + 1;
+	}
+	*name_len = pos - 1 - line;
+	colon = memchr(pos, ':', end - pos);
+	if (colon == NULL) {
+		return false;
+	}
+	*seq_len = colon - pos;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	bool bzip = false;
+	int threads = 1;
+	outputformat format = OUTPUT_PLAIN;
+	const char *filename = "-";
+	const char *outputname = "-";
+	inputfile *file;
+	outputset *set;
+	outputfile *output;
+	textbuf record;
+	const char *line;
+	size_t len;
+	unsigned long line_number = 0;
+	int result;
+	bool ok = true;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "c:jf:o:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			if (strcmp(optarg, "gzip") == 0) {
+				format = OUTPUT_GZIP;
+			} else if (strcmp(optarg, "bzip2") == 0) {
+				format = OUTPUT_BZIP;
+			} else {
+				fprintf(stderr,
+					"Unknown compression `%s'.\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'j':
+			bzip = true;
+			break;
+		case 'f':
+			filename = optarg;
+			break;
+		case 'o':
+			outputname = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case '?':
+			if (optopt == (int)'c' || optopt == (int)'f'
+			    || optopt == (int)'o' || optopt == (int)'t') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+
+	if (optind < argc) {
+		fprintf(stderr,
+			"Usage: %s [-j] [-t threads] [-c gzip|bzip2] [-f file.txt] [-o output.fastq]\n\t-j\tInput file is bzipped.\n\t-t\tNumber of threads to use for decompression and compression.\n\t-c\tCompress the output file.\n\t-f\tThe CASAVA 1.3 file to convert. The default is standard input.\n\t-o\tWhere to write the FASTQ file. The default is standard output.\n",
+			argv[0]);
+		return 1;
+	}
+
+	/* Open files. */
+	file = input_open(filename, bzip, threads);
+	if (file == NULL) {
+		perror(filename);
+		return 1;
+	}
+	set = output_set_new(format, threads, 1);
+	if (set == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	output = output_open(set, outputname);
+	if (output == NULL) {
+		perror(outputname);
+		return 1;
+	}
+
+	memset(&record, 0, sizeof(record));
+	while (ok && (result = input_line(file, &line, &len)) > 0) {
+		size_t name_len;
+		size_t seq_len;
+		const char *seq;
+		const char *qual;
+		line_number++;
+		if (len == 0) {
+			continue;
+		}
+		if (!split_line(line, len, &name_len, &seq_len)) {
+			fprintf(stderr, "%s:%lu: Malformed record.\n", filename,
+				line_number);
+			ok = false;
+			break;
+		}
+		seq = line + name_len + 1;
+		qual = seq + seq_len + 1;
+		record.len = 0;
+		if (!textbuf_putc(&record, '@')
+		    || !textbuf_append(&record, line, name_len)
+		    || !textbuf_putc(&record, '\n')
+		    || !textbuf_append(&record, seq, seq_len)
+		    || !textbuf_append(&record, "\n+", 2)
+		    || !textbuf_append(&record, line, name_len)
+		    || !textbuf_putc(&record, '\n')
+		    || !textbuf_append(&record, qual, line + len - qual)
+		    || !textbuf_putc(&record, '\n')) {
+			perror(argv[0]);
+			ok = false;
+		} else if (!output_write(output, record.data, record.len)) {
+			perror(outputname);
+			ok = false;
+		}
+	}
+	if (ok && result < 0) {
+		perror(filename);
+		ok = false;
+	}
+	if (!input_close(file) && ok) {
+		perror(filename);
+		ok = false;
+	}
+	if (!output_close(output)) {
+		perror(outputname);
+		ok = false;
+	}
+	output_set_free(set);
+	textbuf_free(&record);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+/* Convert a text OTU table to binary */
+#include<errno.h>
+#include<stdio.h>
+#include "otutable.h"
+
+int main(int argc, char **argv)
+{
+	unsigned long line;
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s otu_table.tab otu_table.aqotu\n",
+			argv[0]);
+		return 1;
+	}
+	if (!otutable_convert(argv[1], argv[2], &line)) {
+		if (errno == EINVAL && line > 0) {
+			fprintf(stderr, "%s:%lu: Malformed OTU table.\n",
+				argv[1], line);
+		} else if (errno == EINVAL) {
+			fprintf(stderr, "%s: Malformed OTU table.\n", argv[1]);
+		} else {
+			perror(argv[0]);
+		}
+		return 1;
+	}
+	return 0;
+}
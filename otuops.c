@@ -0,0 +1,819 @@
+/* Derive sums, rankings, bins and transforms from an OTU table in one pass */
+#include<ctype.h>
+#include<errno.h>
+#include<math.h>
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "mapped.h"
+#include "otutable.h"
+
+/* An OTU table being read, either binary or text. */
+typedef struct {
+	otutable *table;
+	mappedfile text;
+	/* For text, the comment lines and the line naming the columns come before the first OTU. */
+	const char *header;
+	size_t header_len;
+	const char *body;
+	const char *pos;
+	const char **fields;
+	size_t *lengths;
+	size_t field_count;
+	unsigned long line;
+	size_t sample_count;
+	size_t otu_count;
+	bool lineage;
+	/* The counts of the current OTU, including the zeros. */
+	double *counts;
+} otusource;
+
+/* An OTU, as it was visited. */
+typedef struct {
+	size_t index;
+	/* For text tables, the OTU's line. */
+	const char *text;
+	size_t len;
+	double sum;
+} oturow;
+
+/* Read a count, returning false if the field is not a number, as a lineage is not. */
+static bool parse_count(const char *text, size_t len, double *count)
+{
+	char buffer[64];
+	char *end;
+	if (len == 0 || len >= sizeof(buffer)) {
+		return false;
+	}
+	memcpy(buffer, text, len);
+	buffer[len] = '\0';
+	*count = strtod(buffer, &end);
+	return *end == '\0';
+}
+
+static bool is_named(const char *text, size_t len, const char *name)
+{
+	return len == strlen(name) && memcmp(text, name, len) == 0;
+}
+
+/* Split a line at tabs into the source's fields, returning how many there are, even if there is not room for them all. */
+static size_t source_split(otusource *source, const char *line, size_t len)
+{
+	const char *end = line + len;
+	size_t count = 0;
+	for (;;) {
+		const char *tab = memchr(line, '\t', end - line);
+		const char *field_end = tab == NULL ? end : tab;
+		if (count < source->field_count) {
+			source->fields[count] = line;
+			source->lengths[count] = field_end - line;
+		}
+		count++;
+		if (tab == NULL) {
+			return count;
+		}
+		line = tab + 1;
+	}
+}
+
+static const char *line_end(const char *pos, const char *end,
+			    const char **next)
+{
+	const char *newline = memchr(pos, '\n', end - pos);
+	if (newline == NULL) {
+		*next = end;
+		return end;
+	}
+	*next = newline + 1;
+	return newline;
+}
+
+/* Read the lines before the first OTU of a text table. */
+static bool source_header(otusource *source)
+{
+	const char *end = source->text.data + source->text.size;
+	const char *pos = source->text.data;
+	const char *header = NULL;
+	const char *header_end = NULL;
+	const char *next;
+	size_t count;
+	double count_value;
+	while (pos < end && *pos == '#') {
+		header = pos;
+		header_end = line_end(pos, end, &next);
+		pos = next;
+		source->line++;
+	}
+	source->body = pos;
+	source->pos = pos;
+	if (header == NULL) {
+		source->line = 1;
+		errno = EINVAL;
+		return false;
+	}
+	source->header = header;
+	source->header_len = header_end - header;
+	source->field_count = source_split(source, header, header_end - header);
+	source->fields = malloc(source->field_count * sizeof(char *));
+	source->lengths = malloc(source->field_count * sizeof(size_t));
+	if (source->fields == NULL || source->lengths == NULL) {
+		return false;
+	}
+
+	/* The table has lineages if the first OTU ends in one. With no OTUs, go by the name of the last column. */
+	while (pos < end && line_end(pos, end, &next) == pos) {
+		pos = next;
+	}
+	if (pos < end) {
+		count = source_split(source, pos, line_end(pos, end, &next) - pos);
+		if (count > source->field_count) {
+			count = source->field_count;
+		}
+		source->lineage = count > 1
+		    && !parse_count(source->fields[count - 1],
+				    source->lengths[count - 1], &count_value);
+	} else {
+		count = source_split(source, header, header_end - header);
+		source->lineage = count > 1
+		    && (is_named(source->fields[count - 1],
+				 source->lengths[count - 1], "Consensus Lineage")
+			|| is_named(source->fields[count - 1],
+				    source->lengths[count - 1], "taxonomy"));
+	}
+	if (source->field_count < 1 + (size_t)source->lineage) {
+		errno = EINVAL;
+		return false;
+	}
+	source->sample_count = source->field_count - 1 - source->lineage;
+	return true;
+}
+
+static bool source_open(otusource *source, const char *filename)
+{
+	memset(source, 0, sizeof(otusource));
+	if (strcmp(filename, "-") != 0) {
+		source->table = otutable_open(filename);
+		if (source->table == NULL && errno != EINVAL) {
+			return false;
+		}
+	}
+	if (source->table != NULL) {
+		source->sample_count = otutable_sample_count(source->table);
+		source->otu_count = otutable_otu_count(source->table);
+	} else if (!mapped_open(&source->text, filename)
+		   || !source_header(source)) {
+		return false;
+	}
+	source->counts = malloc((source->sample_count + 1) * sizeof(double));
+	return source->counts != NULL;
+}
+
+static void source_close(otusource *source)
+{
+	if (source->table != NULL) {
+		otutable_free(source->table);
+	} else {
+		mapped_close(&source->text);
+	}
+	free(source->fields);
+	free(source->lengths);
+	free(source->counts);
+}
+
+/* Read the next OTU, and its counts. Returns 1 if there is one, 0 at the end, or -1, setting errno to EINVAL, if the table is malformed. */
+static int source_next(otusource *source, oturow *row)
+{
+	size_t i;
+	row->sum = 0;
+	if (source->table != NULL) {
+		const uint32_t *samples;
+		const double *counts;
+		size_t count;
+		if (row->index >= source->otu_count) {
+			return 0;
+		}
+		count = otutable_row(source->table, row->index, &samples, &counts);
+		memset(source->counts, 0, source->sample_count * sizeof(double));
+		for (i = 0; i < count; i++) {
+			source->counts[samples[i]] = counts[i];
+			row->sum += counts[i];
+		}
+		return 1;
+	} else {
+		const char *end = source->text.data + source->text.size;
+		const char *next;
+		const char *text_end;
+		do {
+			if (source->pos >= end) {
+				return 0;
+			}
+			row->text = source->pos;
+			text_end = line_end(source->pos, end, &next);
+			source->pos = next;
+			source->line++;
+		} while (text_end == row->text);
+		row->len = text_end - row->text;
+		if (source_split(source, row->text, row->len) !=
+		    source->field_count) {
+			errno = EINVAL;
+			return -1;
+		}
+		for (i = 0; i < source->sample_count; i++) {
+			if (!parse_count(source->fields[i + 1],
+					 source->lengths[i + 1],
+					 &source->counts[i])) {
+				errno = EINVAL;
+				return -1;
+			}
+			row->sum += source->counts[i];
+		}
+		return 1;
+	}
+}
+
+/* The name and lineage of the OTU just read. */
+static void source_name(const otusource *source, const oturow *row,
+			const char **name, size_t *name_len,
+			const char **lineage, size_t *lineage_len)
+{
+	if (source->table != NULL) {
+		*name = otutable_otu(source->table, row->index);
+		*name_len = strlen(*name);
+		*lineage = otutable_lineage(source->table, row->index);
+		*lineage_len = *lineage == NULL ? 0 : strlen(*lineage);
+	} else {
+		*name = source->fields[0];
+		*name_len = source->lengths[0];
+		*lineage =
+		    source->lineage ? source->fields[source->field_count - 1] :
+		    NULL;
+		*lineage_len =
+		    source->lineage ? source->lengths[source->field_count - 1] : 0;
+	}
+}
+
+static void source_write_header(const otusource *source, FILE *file)
+{
+	if (source->table != NULL) {
+		otutable_write_header(source->table, file);
+	} else {
+		fwrite(source->text.data, 1, source->body - source->text.data,
+		       file);
+		if (source->body[-1] != '\n') {
+			fputc('\n', file);
+		}
+	}
+}
+
+static void source_write_row(const otusource *source, const oturow *row,
+			     FILE *file)
+{
+	if (source->table != NULL) {
+		otutable_write_row(source->table, row->index, file);
+	} else {
+		fwrite(row->text, 1, row->len, file);
+		fputc('\n', file);
+	}
+}
+
+/* Write a number as awk would. */
+static void print_number(FILE *file, double number)
+{
+	if (number == floor(number) && fabs(number) < 1e15) {
+		fprintf(file, "%.0f", number);
+	} else {
+		fprintf(file, "%.6g", number);
+	}
+}
+
+typedef enum {
+	OTUOP_SUM,
+	OTUOP_TOP,
+	OTUOP_BIN,
+	OTUOP_HISTOGRAM,
+	OTUOP_LN,
+	OTUOP_PCORD
+} otuopkind;
+
+/* One thing to make from the table. */
+typedef struct {
+	otuopkind kind;
+	const char *filename;
+	FILE *file;
+	/* For bins, the lower bound of every bin but the first, and a file for each bin. */
+	double *bounds;
+	size_t bound_count;
+	FILE **bins;
+	/* For rankings, the best OTUs so far, in a heap with the worst on top. */
+	size_t limit;
+	oturow *heap;
+	size_t heap_count;
+	/* For histograms, every OTU's sum. */
+	double *sums;
+	size_t sum_count;
+	size_t sum_size;
+} otuop;
+
+static FILE *open_output(const char *filename)
+{
+	FILE *file = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+	if (file == NULL) {
+		perror(filename);
+	}
+	return file;
+}
+
+static bool close_output(FILE *file, const char *filename)
+{
+	if ((file == stdout ? fflush(file) : fclose(file)) != 0) {
+		perror(filename);
+		return false;
+	}
+	return true;
+}
+
+/* Parse “n:file” for a ranking. */
+static bool parse_ranking(otuop *op, const char *arg)
+{
+	char *end;
+	errno = 0;
+	op->limit = strtoul(arg, &end, 10);
+	if (errno != 0 || end == arg || (*end != ':' && *end != '\0')) {
+		return false;
+	}
+	op->filename = *end == ':' ? end + 1 : "-";
+	op->heap = malloc((op->limit + 1) * sizeof(oturow));
+	return op->heap != NULL;
+}
+
+/* Parse “b1,b2,...:prefix” for bins. */
+static bool parse_bins(otuop *op, const char *arg, const char *input)
+{
+	const char *pos = arg;
+	size_t size = 1;
+	const char *c;
+	for (c = arg; *c != '\0' && *c != ':'; c++) {
+		if (*c == ',') {
+			size++;
+		}
+	}
+	op->bounds = malloc(size * sizeof(double));
+	if (op->bounds == NULL) {
+		return false;
+	}
+	for (;;) {
+		char *end;
+		op->bounds[op->bound_count] = strtod(pos, &end);
+		if (end == pos || (op->bound_count > 0
+				   && op->bounds[op->bound_count] <=
+				   op->bounds[op->bound_count - 1])) {
+			return false;
+		}
+		op->bound_count++;
+		if (*end == ',') {
+			pos = end + 1;
+		} else if (*end == ':' || *end == '\0') {
+			op->filename = *end == ':' ? end + 1 : input;
+			return true;
+		} else {
+			return false;
+		}
+	}
+}
+
+static bool op_start(otuop *op, const otusource *source)
+{
+	size_t i;
+	switch (op->kind) {
+	case OTUOP_BIN:
+		op->bins = calloc(op->bound_count + 1, sizeof(FILE *));
+		if (op->bins == NULL) {
+			perror(op->filename);
+			return false;
+		}
+		for (i = 0; i <= op->bound_count; i++) {
+			char *name = malloc(strlen(op->filename) + 32);
+			if (name == NULL) {
+				perror(op->filename);
+				return false;
+			}
+			sprintf(name, "%s.bin%zu", op->filename, i + 1);
+			op->bins[i] = fopen(name, "w");
+			if (op->bins[i] == NULL) {
+				perror(name);
+				free(name);
+				return false;
+			}
+			free(name);
+			source_write_header(source, op->bins[i]);
+		}
+		return true;
+	case OTUOP_LN:
+		op->file = open_output(op->filename);
+		if (op->file != NULL) {
+			source_write_header(source, op->file);
+		}
+		return op->file != NULL;
+	default:
+		op->file = open_output(op->filename);
+		return op->file != NULL;
+	}
+}
+
+/* Is one OTU worse than another? Ties go to the OTU that came first. */
+static bool worse(const oturow *a, const oturow *b)
+{
+	return a->sum < b->sum || (a->sum == b->sum && a->index > b->index);
+}
+
+static void heap_down(oturow *heap, size_t count, size_t i)
+{
+	for (;;) {
+		size_t worst = i;
+		size_t child;
+		oturow swap;
+		for (child = 2 * i + 1; child <= 2 * i + 2 && child < count;
+		     child++) {
+			if (worse(&heap[child], &heap[worst])) {
+				worst = child;
+			}
+		}
+		if (worst == i) {
+			return;
+		}
+		swap = heap[i];
+		heap[i] = heap[worst];
+		heap[worst] = swap;
+		i = worst;
+	}
+}
+
+static void heap_add(otuop *op, const oturow *row)
+{
+	size_t i;
+	if (op->limit == 0) {
+		return;
+	}
+	if (op->heap_count == op->limit) {
+		if (!worse(&op->heap[0], row)) {
+			return;
+		}
+		op->heap[0] = *row;
+		heap_down(op->heap, op->heap_count, 0);
+		return;
+	}
+	i = op->heap_count++;
+	op->heap[i] = *row;
+	while (i > 0 && worse(&op->heap[i], &op->heap[(i - 1) / 2])) {
+		oturow swap = op->heap[i];
+		op->heap[i] = op->heap[(i - 1) / 2];
+		op->heap[(i - 1) / 2] = swap;
+		i = (i - 1) / 2;
+	}
+}
+
+/* Take the heap apart, leaving the best OTU first. */
+static void heap_sort(otuop *op)
+{
+	size_t count;
+	for (count = op->heap_count; count > 1; count--) {
+		oturow swap = op->heap[0];
+		op->heap[0] = op->heap[count - 1];
+		op->heap[count - 1] = swap;
+		heap_down(op->heap, count - 1, 0);
+	}
+}
+
+static bool op_visit(otuop *op, const otusource *source, const oturow *row)
+{
+	const char *name;
+	const char *lineage;
+	size_t name_len;
+	size_t lineage_len;
+	size_t low;
+	size_t high;
+	size_t i;
+	switch (op->kind) {
+	case OTUOP_SUM:
+		source_name(source, row, &name, &name_len, &lineage,
+			    &lineage_len);
+		fwrite(name, 1, name_len, op->file);
+		fputc(' ', op->file);
+		print_number(op->file, row->sum);
+		fputc('\n', op->file);
+		break;
+	case OTUOP_TOP:
+	case OTUOP_PCORD:
+		heap_add(op, row);
+		break;
+	case OTUOP_BIN:
+		/* The bin is the number of lower bounds at or below the sum. */
+		low = 0;
+		high = op->bound_count;
+		while (low < high) {
+			size_t mid = low + (high - low) / 2;
+			if (op->bounds[mid] <= row->sum) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		source_write_row(source, row, op->bins[low]);
+		break;
+	case OTUOP_HISTOGRAM:
+		if (op->sum_count == op->sum_size) {
+			size_t size = op->sum_size == 0 ? 1024 : 2 * op->sum_size;
+			double *bigger = realloc(op->sums, size * sizeof(double));
+			if (bigger == NULL) {
+				return false;
+			}
+			op->sums = bigger;
+			op->sum_size = size;
+		}
+		op->sums[op->sum_count++] = row->sum;
+		break;
+	case OTUOP_LN:
+		source_name(source, row, &name, &name_len, &lineage,
+			    &lineage_len);
+		fwrite(name, 1, name_len, op->file);
+		for (i = 0; i < source->sample_count; i++) {
+			fprintf(op->file, "\t%.0f",
+				floor(log(source->counts[i] + 1) + 0.5));
+		}
+		if (lineage != NULL) {
+			fputc('\t', op->file);
+			fwrite(lineage, 1, lineage_len, op->file);
+		}
+		fputc('\n', op->file);
+		break;
+	}
+	return true;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Write the table in the form PC-ORD reads: samples as rows and OTUs as columns. */
+static bool write_pcord(otuop *op, otusource *source)
+{
+	const char **cells = NULL;
+	size_t *cell_lengths = NULL;
+	char number[OTUTABLE_NUMBER_SIZE];
+	size_t i;
+	size_t j;
+	fprintf(op->file, "%zu,samples", source->sample_count);
+	for (i = 2; i < op->heap_count; i++) {
+		fputc(',', op->file);
+	}
+	fprintf(op->file, "\n%zu,OTUs", op->heap_count);
+	for (i = 2; i < op->heap_count; i++) {
+		fputc(',', op->file);
+	}
+	fputc('\n', op->file);
+	for (i = 0; i < op->heap_count; i++) {
+		fputs(",Q", op->file);
+	}
+	fputc('\n', op->file);
+
+	/* Counts from a text table are copied as they were written. */
+	if (source->table == NULL) {
+		cells =
+		    malloc(op->heap_count * source->sample_count * sizeof(char *));
+		cell_lengths =
+		    malloc(op->heap_count * source->sample_count *
+			   sizeof(size_t));
+		if (cells == NULL || cell_lengths == NULL) {
+			free(cells);
+			free(cell_lengths);
+			return false;
+		}
+	}
+	for (i = 0; i < op->heap_count; i++) {
+		const char *name;
+		const char *lineage;
+		size_t name_len;
+		size_t lineage_len;
+		if (source->table == NULL) {
+			source_split(source, op->heap[i].text, op->heap[i].len);
+			for (j = 0; j < source->sample_count; j++) {
+				cells[j * op->heap_count + i] = source->fields[j + 1];
+				cell_lengths[j * op->heap_count + i] =
+				    source->lengths[j + 1];
+			}
+		}
+		source_name(source, &op->heap[i], &name, &name_len, &lineage,
+			    &lineage_len);
+		fputc(',', op->file);
+		fwrite(name, 1, name_len, op->file);
+	}
+	fputc('\n', op->file);
+	if (source->table == NULL) {
+		source_split(source, source->header, source->header_len);
+	}
+	for (j = 0; j < source->sample_count; j++) {
+		if (source->table == NULL) {
+			fwrite(source->fields[j + 1], 1, source->lengths[j + 1],
+			       op->file);
+		} else {
+			fputs(otutable_sample(source->table, j), op->file);
+		}
+		fputc(' ', op->file);
+		for (i = 0; i < op->heap_count; i++) {
+			fputc(',', op->file);
+			if (source->table == NULL) {
+				fwrite(cells[j * op->heap_count + i], 1,
+				       cell_lengths[j * op->heap_count + i],
+				       op->file);
+			} else {
+				otutable_format(source->table,
+						otutable_get(source->table,
+							     op->heap[i].index,
+							     j), number);
+				fputs(number, op->file);
+			}
+		}
+		fputc('\n', op->file);
+	}
+	free(cells);
+	free(cell_lengths);
+	return true;
+}
+
+static bool op_finish(otuop *op, otusource *source)
+{
+	bool ok = true;
+	size_t i;
+	size_t j;
+	switch (op->kind) {
+	case OTUOP_TOP:
+		heap_sort(op);
+		source_write_header(source, op->file);
+		for (i = 0; i < op->heap_count; i++) {
+			source_write_row(source, &op->heap[i], op->file);
+		}
+		break;
+	case OTUOP_PCORD:
+		heap_sort(op);
+		if (!write_pcord(op, source)) {
+			perror(op->filename);
+			ok = false;
+		}
+		break;
+	case OTUOP_HISTOGRAM:
+		qsort(op->sums, op->sum_count, sizeof(double), compare_double);
+		fputs("#value occurences\n", op->file);
+		for (i = 0; i < op->sum_count; i = j) {
+			for (j = i + 1; j < op->sum_count && op->sums[j] == op->sums[i];
+			     j++) ;
+			print_number(op->file, op->sums[i]);
+			fprintf(op->file, " %zu\n", j - i);
+		}
+		break;
+	default:
+		break;
+	}
+	if (op->kind == OTUOP_BIN) {
+		for (i = 0; i <= op->bound_count; i++) {
+			ok = close_output(op->bins[i], op->filename) && ok;
+		}
+	} else {
+		ok = close_output(op->file, op->filename) && ok;
+	}
+	return ok;
+}
+
+static void op_free(otuop *op)
+{
+	free(op->bounds);
+	free(op->bins);
+	free(op->heap);
+	free(op->sums);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	otuop *ops;
+	size_t op_count = 0;
+	otusource source;
+	oturow row;
+	const char *input;
+	int result = 0;
+	int status;
+	size_t i;
+
+	ops = calloc(argc, sizeof(otuop));
+	if (ops == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	/* The bins are named after the input, if not told otherwise, so find it first. */
+	input = argc > 1 ? argv[argc - 1] : "-";
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "b:h:l:p:s:t:")) != -1) {
+		otuop *op = &ops[op_count];
+		switch (c) {
+		case 'b':
+			op->kind = OTUOP_BIN;
+			if (!parse_bins(op, optarg, input)) {
+				fprintf(stderr, "Bad bin boundaries `%s'. They must be in ascending order.\n", optarg);
+				return 1;
+			}
+			break;
+		case 'h':
+			op->kind = OTUOP_HISTOGRAM;
+			op->filename = optarg;
+			break;
+		case 'l':
+			op->kind = OTUOP_LN;
+			op->filename = optarg;
+			break;
+		case 'p':
+		case 't':
+			op->kind = c == 'p' ? OTUOP_PCORD : OTUOP_TOP;
+			if (!parse_ranking(op, optarg)) {
+				fprintf(stderr, "Bad OTU count `%s'.\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			op->kind = OTUOP_SUM;
+			op->filename = optarg;
+			break;
+		case '?':
+			if (optopt == (int)'b' || optopt == (int)'h'
+			    || optopt == (int)'l' || optopt == (int)'p'
+			    || optopt == (int)'s' || optopt == (int)'t') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+		op_count++;
+	}
+	if (argc - optind != 1 || op_count == 0) {
+		fprintf(stderr,
+			"Usage: %s [-s sums] [-t n:top] [-p n:pcord] [-b b1,b2,...[:prefix]] [-h histogram] [-l ln] otu_table\n\t-s\tWrite the total of each OTU.\n\t-t\tWrite the table with only the n most abundant OTUs.\n\t-p\tWrite the n most abundant OTUs in PC-ORD format.\n\t-b\tSplit the table by OTU total at each boundary, writing prefix.bin1, prefix.bin2 and so on. The prefix is the table's name if not given.\n\t-h\tWrite a histogram of OTU totals.\n\t-l\tWrite the table with each count c replaced by ln(c + 1), rounded.\n",
+			argv[0]);
+		return 1;
+	}
+	input = argv[optind];
+
+	if (!source_open(&source, input)) {
+		if (errno == EINVAL && source.line > 0) {
+			fprintf(stderr, "%s:%lu: Malformed OTU table.\n", input,
+				source.line);
+		} else {
+			perror(input);
+		}
+		return 1;
+	}
+	for (i = 0; i < op_count; i++) {
+		if (!op_start(&ops[i], &source)) {
+			return 1;
+		}
+	}
+
+	/* Every operation sees each OTU once, as it is read. */
+	memset(&row, 0, sizeof(row));
+	while ((status = source_next(&source, &row)) == 1) {
+		for (i = 0; i < op_count; i++) {
+			if (!op_visit(&ops[i], &source, &row)) {
+				perror(argv[0]);
+				return 1;
+			}
+		}
+		row.index++;
+	}
+	if (status < 0) {
+		fprintf(stderr, "%s:%lu: Malformed OTU table.\n", input,
+			source.line);
+		result = 1;
+	}
+	for (i = 0; i < op_count; i++) {
+		if (!op_finish(&ops[i], &source)) {
+			result = 1;
+		}
+		op_free(&ops[i]);
+	}
+	free(ops);
+	source_close(&source);
+	return result;
+}
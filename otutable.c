@@ -0,0 +1,1271 @@
+/* OTU tables in a compact binary form that can be memory mapped */
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include "mapped.h"
+#include "otutable.h"
+#include "textbuf.h"
+
+#define OTUTABLE_MAGIC "AQOTUTB2"
+/* Set if the last column of the table is the lineage. */
+#define OTUTABLE_LINEAGE 1
+/* Set if the last line of the text had no line break. */
+#define OTUTABLE_UNTERMINATED 2
+/* The precision when counts are not all written with the same number of decimal places. */
+#define PRECISION_SHORTEST -1
+
+/*
+ * The file is this header followed by each part, at the given offsets, each aligned to 8 bytes. The counts are stored by row, as the start of each row in the sample and count arrays, then again by column. A string table is an array of n + 1 offsets followed by the strings they point into, each NUL-terminated. Each distinct lineage is stored once, and each OTU has the number of its lineage. The extra strings are the names of the first and last columns, then the comment lines.
+ *
+ * So that the text comes back exactly, any count that the table's precision would not write back the same, zero or not, is kept as it was written, with its cell (the OTU times the number of samples, plus the sample) in increasing order. Each blank line is kept as the OTU it comes before, or the number of OTUs if it comes after them all.
+ */
+typedef struct {
+	char magic[8];
+	uint64_t otu_count;
+	uint64_t sample_count;
+	uint64_t entry_count;
+	uint64_t lineage_count;
+	uint64_t extra_count;
+	uint32_t flags;
+	int32_t precision;
+	uint64_t row_starts;
+	uint64_t row_samples;
+	uint64_t row_counts;
+	uint64_t column_starts;
+	uint64_t column_otus;
+	uint64_t column_counts;
+	uint64_t otu_names;
+	uint64_t sample_names;
+	uint64_t otu_lineages;
+	uint64_t lineages;
+	uint64_t extras;
+	uint64_t exception_count;
+	uint64_t exception_cells;
+	uint64_t exceptions;
+	uint64_t blank_count;
+	uint64_t blanks;
+	uint64_t size;
+} otuheader;
+
+typedef struct {
+	const uint64_t *offsets;
+	const char *data;
+} stringtable;
+
+struct otutable {
+	mappedfile file;
+	const otuheader *header;
+	const uint64_t *row_starts;
+	const uint32_t *row_samples;
+	const double *row_counts;
+	const uint64_t *column_starts;
+	const uint32_t *column_otus;
+	const double *column_counts;
+	stringtable otus;
+	stringtable samples;
+	const uint32_t *otu_lineages;
+	stringtable lineages;
+	stringtable extras;
+	const uint64_t *exception_cells;
+	stringtable exceptions;
+	const uint32_t *blanks;
+};
+
+/* Check that a part of the file fits, and find it. */
+static const void *section(const otutable *table, uint64_t offset,
+			   uint64_t count, size_t size)
+{
+	if (offset % 8 != 0 || offset > table->file.size
+	    || count > (table->file.size - offset) / size) {
+		return NULL;
+	}
+	return table->file.data + offset;
+}
+
+static bool strings_open(const otutable *table, uint64_t offset,
+			 uint64_t count, stringtable *strings)
+{
+	uint64_t i;
+	strings->offsets = section(table, offset, count + 1, sizeof(uint64_t));
+	if (strings->offsets == NULL) {
+		return false;
+	}
+	strings->data = (const char *)(strings->offsets + count + 1);
+	if (section(table, offset + (count + 1) * sizeof(uint64_t),
+		    strings->offsets[count], 1) == NULL) {
+		return false;
+	}
+	/* Every string must start inside the block, and the block must end with a NUL, so that none runs off the end. */
+	for (i = 0; i < count; i++) {
+		if (strings->offsets[i] >= strings->offsets[count]) {
+			return false;
+		}
+	}
+	return count == 0
+	    || strings->data[strings->offsets[count] - 1] == '\0';
+}
+
+/* Check that each of count runs starts where the last ended, that they cover all the entries, and that the indices in each are below limit and increasing. */
+static bool starts_check(const uint64_t *starts, uint64_t count,
+			 uint64_t entries, const uint32_t *indices,
+			 uint64_t limit)
+{
+	uint64_t run;
+	uint64_t i;
+	if (starts[0] != 0 || starts[count] != entries) {
+		return false;
+	}
+	for (run = 0; run < count; run++) {
+		if (starts[run + 1] < starts[run]
+		    || starts[run + 1] > entries) {
+			return false;
+		}
+		for (i = starts[run]; i < starts[run + 1]; i++) {
+			if (indices[i] >= limit
+			    || (i > starts[run] && indices[i] <= indices[i - 1])) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* Check a table read into memory, freeing it if it is not valid. Everything an accessor might follow is checked, so a corrupt file is rejected here rather than read out of bounds later. */
+static otutable *table_check(otutable *table)
+{
+	const otuheader *header = (const otuheader *)table->file.data;
+	size_t otu;
+	uint64_t i;
+	table->header = header;
+	if (table->file.size < sizeof(otuheader)
+	    || memcmp(header->magic, OTUTABLE_MAGIC, sizeof(header->magic)) != 0
+	    || header->size != table->file.size
+	    || header->otu_count >= UINT32_MAX
+	    || header->sample_count >= UINT32_MAX
+	    || header->precision < PRECISION_SHORTEST
+	    || header->precision >= OTUTABLE_NUMBER_SIZE
+	    || (table->row_starts =
+		section(table, header->row_starts, header->otu_count + 1,
+			sizeof(uint64_t))) == NULL
+	    || (table->row_samples =
+		section(table, header->row_samples, header->entry_count,
+			sizeof(uint32_t))) == NULL
+	    || (table->row_counts =
+		section(table, header->row_counts, header->entry_count,
+			sizeof(double))) == NULL
+	    || (table->column_starts =
+		section(table, header->column_starts, header->sample_count + 1,
+			sizeof(uint64_t))) == NULL
+	    || (table->column_otus =
+		section(table, header->column_otus, header->entry_count,
+			sizeof(uint32_t))) == NULL
+	    || (table->column_counts =
+		section(table, header->column_counts, header->entry_count,
+			sizeof(double))) == NULL
+	    || !strings_open(table, header->otu_names, header->otu_count,
+			     &table->otus)
+	    || !strings_open(table, header->sample_names, header->sample_count,
+			     &table->samples)
+	    || (table->otu_lineages =
+		section(table, header->otu_lineages,
+			(header->flags & OTUTABLE_LINEAGE) ? header->otu_count : 0,
+			sizeof(uint32_t))) == NULL
+	    || !strings_open(table, header->lineages, header->lineage_count,
+			     &table->lineages)
+	    || !strings_open(table, header->extras, header->extra_count,
+			     &table->extras)
+	    || (table->exception_cells =
+		section(table, header->exception_cells,
+			header->exception_count, sizeof(uint64_t))) == NULL
+	    || !strings_open(table, header->exceptions,
+			     header->exception_count, &table->exceptions)
+	    || (table->blanks =
+		section(table, header->blanks, header->blank_count,
+			sizeof(uint32_t))) == NULL
+	    || header->extra_count < 2
+	    || !starts_check(table->row_starts, header->otu_count,
+			     header->entry_count, table->row_samples,
+			     header->sample_count)
+	    || !starts_check(table->column_starts, header->sample_count,
+			     header->entry_count, table->column_otus,
+			     header->otu_count)) {
+		otutable_free(table);
+		errno = EINVAL;
+		return NULL;
+	}
+	for (otu = 0; (header->flags & OTUTABLE_LINEAGE)
+	     && otu < header->otu_count; otu++) {
+		if (table->otu_lineages[otu] >= header->lineage_count) {
+			otutable_free(table);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	for (i = 0; i < header->exception_count; i++) {
+		if (header->sample_count == 0
+		    || table->exception_cells[i] / header->sample_count >=
+		    header->otu_count
+		    || (i > 0
+			&& table->exception_cells[i] <=
+			table->exception_cells[i - 1])) {
+			otutable_free(table);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	for (i = 0; i < header->blank_count; i++) {
+		if (table->blanks[i] > header->otu_count
+		    || (i > 0 && table->blanks[i] < table->blanks[i - 1])) {
+			otutable_free(table);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	return table;
+}
+
+/* Does a file start as a binary table does? */
+static bool is_binary(const mappedfile *file)
+{
+	return file->size >= sizeof(otuheader)
+	    && memcmp(file->data, OTUTABLE_MAGIC, strlen(OTUTABLE_MAGIC)) == 0;
+}
+
+otutable *otutable_open(const char *filename)
+{
+	otutable *table = calloc(1, sizeof(otutable));
+	if (table == NULL) {
+		return NULL;
+	}
+	if (!mapped_open(&table->file, filename)) {
+		int error = errno;
+		free(table);
+		errno = error;
+		return NULL;
+	}
+	return table_check(table);
+}
+
+void otutable_free(otutable *table)
+{
+	mapped_close(&table->file);
+	free(table);
+}
+
+size_t otutable_otu_count(const otutable *table)
+{
+	return table->header->otu_count;
+}
+
+size_t otutable_sample_count(const otutable *table)
+{
+	return table->header->sample_count;
+}
+
+const char *otutable_otu(const otutable *table, size_t otu)
+{
+	return table->otus.data + table->otus.offsets[otu];
+}
+
+const char *otutable_sample(const otutable *table, size_t sample)
+{
+	return table->samples.data + table->samples.offsets[sample];
+}
+
+const char *otutable_lineage(const otutable *table, size_t otu)
+{
+	if ((table->header->flags & OTUTABLE_LINEAGE) == 0) {
+		return NULL;
+	}
+	return table->lineages.data +
+	    table->lineages.offsets[table->otu_lineages[otu]];
+}
+
+size_t otutable_comment_count(const otutable *table)
+{
+	return table->header->extra_count - 2;
+}
+
+const char *otutable_comment(const otutable *table, size_t comment)
+{
+	return table->extras.data + table->extras.offsets[comment + 2];
+}
+
+const char *otutable_id_column(const otutable *table)
+{
+	return table->extras.data + table->extras.offsets[0];
+}
+
+const char *otutable_lineage_column(const otutable *table)
+{
+	if ((table->header->flags & OTUTABLE_LINEAGE) == 0) {
+		return NULL;
+	}
+	return table->extras.data + table->extras.offsets[1];
+}
+
+size_t otutable_row(const otutable *table, size_t otu,
+		    const uint32_t **samples, const double **counts)
+{
+	uint64_t start = table->row_starts[otu];
+	*samples = table->row_samples + start;
+	*counts = table->row_counts + start;
+	return table->row_starts[otu + 1] - start;
+}
+
+size_t otutable_column(const otutable *table, size_t sample,
+		       const uint32_t **otus, const double **counts)
+{
+	uint64_t start = table->column_starts[sample];
+	*otus = table->column_otus + start;
+	*counts = table->column_counts + start;
+	return table->column_starts[sample + 1] - start;
+}
+
+double otutable_get(const otutable *table, size_t otu, size_t sample)
+{
+	const uint32_t *samples;
+	const double *counts;
+	size_t low = 0;
+	size_t high = otutable_row(table, otu, &samples, &counts);
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (samples[mid] == sample) {
+			return counts[mid];
+		} else if (samples[mid] < sample) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return 0;
+}
+
+/* Write a number in the fewest digits that read back the same, without an exponent if it fits. */
+static void format_shortest(double count, char *buffer)
+{
+	int digits;
+	for (digits = 0; digits <= 15; digits++) {
+		if (snprintf(buffer, OTUTABLE_NUMBER_SIZE, "%.*f", digits, count)
+		    >= OTUTABLE_NUMBER_SIZE) {
+			break;
+		}
+		if (strtod(buffer, NULL) == count) {
+			return;
+		}
+	}
+	for (digits = 1; digits < 17; digits++) {
+		snprintf(buffer, OTUTABLE_NUMBER_SIZE, "%.*g", digits, count);
+		if (strtod(buffer, NULL) == count) {
+			return;
+		}
+	}
+	snprintf(buffer, OTUTABLE_NUMBER_SIZE, "%.17g", count);
+}
+
+static void format_count(int precision, double count, char *buffer)
+{
+	if (precision == PRECISION_SHORTEST) {
+		format_shortest(count, buffer);
+	} else {
+		snprintf(buffer, OTUTABLE_NUMBER_SIZE, "%.*f", precision, count);
+	}
+}
+
+void otutable_format(const otutable *table, double count, char *buffer)
+{
+	format_count(table->header->precision, count, buffer);
+}
+
+/* Write the comment lines and the line naming the columns, ending that with end. */
+static bool write_header(const otutable *table, FILE *file, const char *end)
+{
+	const otuheader *header = table->header;
+	size_t i;
+	for (i = 0; i < otutable_comment_count(table); i++) {
+		fprintf(file, "%s\n", otutable_comment(table, i));
+	}
+	fputs(otutable_id_column(table), file);
+	for (i = 0; i < header->sample_count; i++) {
+		fprintf(file, "\t%s", otutable_sample(table, i));
+	}
+	if (header->flags & OTUTABLE_LINEAGE) {
+		fprintf(file, "\t%s", otutable_lineage_column(table));
+	}
+	fputs(end, file);
+	return !ferror(file);
+}
+
+bool otutable_write_header(const otutable *table, FILE *file)
+{
+	return write_header(table, file, "\n");
+}
+
+/* Find the first count kept as written at or after a cell. */
+static uint64_t exception_find(const otutable *table, uint64_t cell)
+{
+	uint64_t low = 0;
+	uint64_t high = table->header->exception_count;
+	while (low < high) {
+		uint64_t mid = low + (high - low) / 2;
+		if (table->exception_cells[mid] < cell) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/* Write one OTU's line, ending it with end. */
+static bool write_row(const otutable *table, size_t otu, FILE *file,
+		      const char *end)
+{
+	char number[OTUTABLE_NUMBER_SIZE];
+	const uint32_t *samples;
+	const double *counts;
+	size_t count = otutable_row(table, otu, &samples, &counts);
+	uint64_t first = (uint64_t)otu * table->header->sample_count;
+	uint64_t exception = exception_find(table, first);
+	size_t next = 0;
+	size_t i;
+	fputs(otutable_otu(table, otu), file);
+	for (i = 0; i < table->header->sample_count; i++) {
+		double value = next < count
+		    && samples[next] == i ? counts[next++] : 0;
+		if (exception < table->header->exception_count
+		    && table->exception_cells[exception] == first + i) {
+			fprintf(file, "\t%s",
+				table->exceptions.data +
+				table->exceptions.offsets[exception++]);
+		} else {
+			otutable_format(table, value, number);
+			fprintf(file, "\t%s", number);
+		}
+	}
+	if (table->header->flags & OTUTABLE_LINEAGE) {
+		fprintf(file, "\t%s", otutable_lineage(table, otu));
+	}
+	fputs(end, file);
+	return !ferror(file);
+}
+
+bool otutable_write_row(const otutable *table, size_t otu, FILE *file)
+{
+	return write_row(table, otu, file, "\n");
+}
+
+bool otutable_write_text(const otutable *table, FILE *file)
+{
+	const otuheader *header = table->header;
+	size_t blank = 0;
+	size_t otu;
+	if (!write_header(table, file,
+			  (header->flags & OTUTABLE_UNTERMINATED)
+			  && header->otu_count == 0 ? "" : "\n")) {
+		return false;
+	}
+	for (otu = 0; otu < header->otu_count; otu++) {
+		for (; blank < header->blank_count
+		     && table->blanks[blank] == otu; blank++) {
+			fputc('\n', file);
+		}
+		if (!write_row(table, otu, file,
+			       (header->flags & OTUTABLE_UNTERMINATED)
+			       && otu + 1 == header->otu_count
+			       && blank == header->blank_count ? "" : "\n")) {
+			return false;
+		}
+	}
+	for (; blank < header->blank_count; blank++) {
+		fputc('\n', file);
+	}
+	return !ferror(file);
+}
+
+/* A string table being built. */
+typedef struct {
+	uint64_t *offsets;
+	size_t count;
+	size_t size;
+	textbuf data;
+} stringbuilder;
+
+static bool strings_add(stringbuilder *strings, const char *text, size_t len)
+{
+	if (strings->count + 1 >= strings->size) {
+		size_t size = strings->size == 0 ? 1024 : 2 * strings->size;
+		uint64_t *bigger =
+		    realloc(strings->offsets, size * sizeof(uint64_t));
+		if (bigger == NULL) {
+			return false;
+		}
+		strings->offsets = bigger;
+		strings->size = size;
+	}
+	strings->offsets[strings->count++] = strings->data.len;
+	if (!textbuf_append(&strings->data, text, len)
+	    || !textbuf_putc(&strings->data, '\0')) {
+		errno = ENOMEM;
+		return false;
+	}
+	strings->offsets[strings->count] = strings->data.len;
+	return true;
+}
+
+static void strings_free(stringbuilder *strings)
+{
+	free(strings->offsets);
+	textbuf_free(&strings->data);
+}
+
+static bool strings_write(const stringbuilder *strings, textbuf *image)
+{
+	static const uint64_t empty = 0;
+	const uint64_t *offsets = strings->count == 0 ? &empty : strings->offsets;
+	return textbuf_append(image, (const char *)offsets,
+			      (strings->count + 1) * sizeof(uint64_t))
+	    && (strings->data.len == 0
+		|| textbuf_append(image, strings->data.data,
+				  strings->data.len));
+}
+
+static uint64_t strings_size(const stringbuilder *strings)
+{
+	return (strings->count + 1) * sizeof(uint64_t) + strings->data.len;
+}
+
+/* Everything read from the text table. */
+typedef struct {
+	stringbuilder otus;
+	stringbuilder samples;
+	stringbuilder lineages;
+	stringbuilder extras;
+	uint32_t *otu_lineages;
+	size_t otu_lineage_size;
+	/* The lineages seen so far, by hash, as their numbers plus one. */
+	uint32_t *lineage_slots;
+	size_t slot_count;
+	uint64_t *row_starts;
+	size_t row_size;
+	uint32_t *row_samples;
+	double *row_counts;
+	size_t entry_count;
+	size_t entry_size;
+	uint64_t *column_starts;
+	uint32_t *column_otus;
+	double *column_counts;
+	const char **fields;
+	size_t *lengths;
+	size_t field_count;
+	bool lineage;
+	int precision;
+	bool fixed;
+	uint64_t *exception_cells;
+	size_t exception_size;
+	stringbuilder exceptions;
+	uint32_t *blanks;
+	size_t blank_count;
+	size_t blank_size;
+	bool unterminated;
+} otubuilder;
+
+static void builder_free(otubuilder *builder)
+{
+	strings_free(&builder->otus);
+	strings_free(&builder->samples);
+	strings_free(&builder->lineages);
+	strings_free(&builder->extras);
+	free(builder->otu_lineages);
+	free(builder->lineage_slots);
+	free(builder->row_starts);
+	free(builder->row_samples);
+	free(builder->row_counts);
+	free(builder->column_starts);
+	free(builder->column_otus);
+	free(builder->column_counts);
+	free(builder->fields);
+	free(builder->lengths);
+	free(builder->exception_cells);
+	strings_free(&builder->exceptions);
+	free(builder->blanks);
+}
+
+/*
+ * Read a count written plainly: digits, with no leading zeros, and perhaps a point and more digits. With at most 15 digits, the nearest double is printed back the same way, so there is no need to check.
+ */
+static bool parse_plain(const char *text, size_t len, int *decimals,
+			double *count)
+{
+	static const double powers[] = {
+		1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+		1e13, 1e14, 1e15
+	};
+	uint64_t digits = 0;
+	size_t digit_count = 0;
+	size_t dot = len;
+	size_t i;
+	if (len == 0 || (len > 1 && text[0] == '0' && text[1] != '.')) {
+		return false;
+	}
+	for (i = 0; i < len; i++) {
+		if (text[i] >= '0' && text[i] <= '9') {
+			digits = 10 * digits + (text[i] - '0');
+			digit_count++;
+		} else if (text[i] == '.' && dot == len && i > 0 && i + 1 < len) {
+			dot = i;
+		} else {
+			return false;
+		}
+	}
+	if (digit_count > 15) {
+		return false;
+	}
+	*decimals = dot == len ? 0 : (int)(len - dot - 1);
+	*count = (double)digits / powers[*decimals];
+	return true;
+}
+
+static bool builder_parse(otubuilder *builder, const char *text, size_t len,
+			  double *count)
+{
+	char buffer[OTUTABLE_NUMBER_SIZE];
+	char formatted[OTUTABLE_NUMBER_SIZE];
+	const char *dot;
+	char *end;
+	int decimals;
+	if (parse_plain(text, len, &decimals, count)) {
+		if (builder->precision == PRECISION_SHORTEST) {
+			builder->precision = decimals;
+		}
+		builder->fixed = builder->fixed && decimals == builder->precision;
+		return true;
+	}
+	if (len == 0 || len >= sizeof(buffer)) {
+		return false;
+	}
+	memcpy(buffer, text, len);
+	buffer[len] = '\0';
+	*count = strtod(buffer, &end);
+	if (*end != '\0') {
+		return false;
+	}
+	/* A negative zero is not stored, so it is written back as zero. */
+	if (*count == 0) {
+		*count = 0;
+	}
+	if (builder->fixed) {
+		dot = memchr(buffer, '.', len);
+		decimals = dot == NULL ? 0 : (int)(buffer + len - dot - 1);
+		if (builder->precision == PRECISION_SHORTEST) {
+			builder->precision = decimals;
+		}
+		format_count(builder->precision, *count, formatted);
+		builder->fixed = decimals == builder->precision
+		    && strcmp(formatted, buffer) == 0;
+	}
+	return true;
+}
+
+static bool builder_add(otubuilder *builder, uint32_t sample, double count)
+{
+	if (count == 0) {
+		return true;
+	}
+	if (builder->entry_count == builder->entry_size) {
+		size_t size =
+		    builder->entry_size == 0 ? 65536 : 2 * builder->entry_size;
+		uint32_t *samples;
+		double *counts;
+		samples = realloc(builder->row_samples, size * sizeof(uint32_t));
+		if (samples == NULL) {
+			return false;
+		}
+		builder->row_samples = samples;
+		counts = realloc(builder->row_counts, size * sizeof(double));
+		if (counts == NULL) {
+			return false;
+		}
+		builder->row_counts = counts;
+		builder->entry_size = size;
+	}
+	builder->row_samples[builder->entry_count] = sample;
+	builder->row_counts[builder->entry_count] = count;
+	builder->entry_count++;
+	return true;
+}
+
+/* Note a blank line before the OTU about to be read. */
+static bool builder_blank(otubuilder *builder)
+{
+	if (builder->blank_count == builder->blank_size) {
+		size_t size =
+		    builder->blank_size == 0 ? 16 : 2 * builder->blank_size;
+		uint32_t *bigger =
+		    realloc(builder->blanks, size * sizeof(uint32_t));
+		if (bigger == NULL) {
+			return false;
+		}
+		builder->blanks = bigger;
+		builder->blank_size = size;
+	}
+	builder->blanks[builder->blank_count++] = builder->otus.count;
+	return true;
+}
+
+/* Split a line at tabs into the builder's fields, returning how many there are, even if there is not room for them all. */
+static size_t builder_split(otubuilder *builder, const char *line, size_t len)
+{
+	const char *end = line + len;
+	size_t count = 0;
+	for (;;) {
+		const char *tab = memchr(line, '\t', end - line);
+		const char *field_end = tab == NULL ? end : tab;
+		if (count < builder->field_count) {
+			builder->fields[count] = line;
+			builder->lengths[count] = field_end - line;
+		}
+		count++;
+		if (tab == NULL) {
+			return count;
+		}
+		line = tab + 1;
+	}
+}
+
+static uint64_t hash_text(const char *text, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool builder_rehash(otubuilder *builder, size_t slot_count)
+{
+	uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+	size_t i;
+	if (slots == NULL) {
+		return false;
+	}
+	for (i = 0; i < builder->lineages.count; i++) {
+		const stringbuilder *lineages = &builder->lineages;
+		size_t slot =
+		    hash_text(lineages->data.data + lineages->offsets[i],
+			      lineages->offsets[i + 1] - lineages->offsets[i] -
+			      1) & (slot_count - 1);
+		while (slots[slot] != 0) {
+			slot = (slot + 1) & (slot_count - 1);
+		}
+		slots[slot] = i + 1;
+	}
+	free(builder->lineage_slots);
+	builder->lineage_slots = slots;
+	builder->slot_count = slot_count;
+	return true;
+}
+
+/* Give an OTU a lineage, storing it if it has not been seen before. */
+static bool builder_lineage(otubuilder *builder, const char *text, size_t len)
+{
+	stringbuilder *lineages = &builder->lineages;
+	size_t otu = builder->otus.count - 1;
+	size_t slot;
+	if (otu >= builder->otu_lineage_size) {
+		size_t size =
+		    builder->otu_lineage_size ==
+		    0 ? 1024 : 2 * builder->otu_lineage_size;
+		uint32_t *bigger =
+		    realloc(builder->otu_lineages, size * sizeof(uint32_t));
+		if (bigger == NULL) {
+			return false;
+		}
+		builder->otu_lineages = bigger;
+		builder->otu_lineage_size = size;
+	}
+	if (4 * (lineages->count + 1) > 3 * builder->slot_count
+	    && !builder_rehash(builder,
+			       builder->slot_count ==
+			       0 ? 1024 : 2 * builder->slot_count)) {
+		return false;
+	}
+	for (slot = hash_text(text, len) & (builder->slot_count - 1);
+	     builder->lineage_slots[slot] != 0;
+	     slot = (slot + 1) & (builder->slot_count - 1)) {
+		size_t i = builder->lineage_slots[slot] - 1;
+		if (lineages->offsets[i + 1] - lineages->offsets[i] == len + 1
+		    && memcmp(lineages->data.data + lineages->offsets[i], text,
+			      len) == 0) {
+			builder->otu_lineages[otu] = i;
+			return true;
+		}
+	}
+	builder->otu_lineages[otu] = lineages->count;
+	builder->lineage_slots[slot] = lineages->count + 1;
+	return strings_add(lineages, text, len);
+}
+
+/* Does a field hold a number, rather than a lineage? */
+static bool is_count(const char *text, size_t len)
+{
+	char buffer[OTUTABLE_NUMBER_SIZE];
+	char *end;
+	if (len == 0 || len >= sizeof(buffer)) {
+		return false;
+	}
+	memcpy(buffer, text, len);
+	buffer[len] = '\0';
+	strtod(buffer, &end);
+	return *end == '\0';
+}
+
+static bool is_named(const char *text, size_t len, const char *name)
+{
+	return len == strlen(name) && memcmp(text, name, len) == 0;
+}
+
+/* Find the end of a line and the start of the next one. */
+static const char *line_end(const char *pos, const char *end,
+			    const char **next)
+{
+	const char *newline = memchr(pos, '\n', end - pos);
+	if (newline == NULL) {
+		*next = end;
+		return end;
+	}
+	*next = newline + 1;
+	return newline;
+}
+
+/* Read the header lines, up to the one naming the columns. */
+static bool builder_header(otubuilder *builder, const char *data,
+			   const char *end, const char **body,
+			   unsigned long *line)
+{
+	const char *header = NULL;
+	const char *header_end = NULL;
+	const char *pos = data;
+	const char *next;
+	const char *first = NULL;
+	const char *first_end = NULL;
+	size_t count;
+	size_t i;
+	while (pos < end && *pos == '#') {
+		header = pos;
+		header_end = line_end(pos, end, &next);
+		pos = next;
+		(*line)++;
+	}
+	*body = pos;
+	if (header == NULL) {
+		*line = 1;
+		errno = EINVAL;
+		return false;
+	}
+	builder->field_count = builder_split(builder, header, header_end - header);
+	builder->fields = malloc(builder->field_count * sizeof(char *));
+	builder->lengths = malloc(builder->field_count * sizeof(size_t));
+	if (builder->fields == NULL || builder->lengths == NULL) {
+		return false;
+	}
+
+	/* The table has lineages if the first row ends in one. With no rows, go by the name of the last column. */
+	while (pos < end && first == NULL) {
+		first_end = line_end(pos, end, &next);
+		if (first_end > pos) {
+			first = pos;
+		}
+		pos = next;
+	}
+	if (first != NULL) {
+		count = builder_split(builder, first, first_end - first);
+		if (count > builder->field_count) {
+			count = builder->field_count;
+		}
+		builder->lineage = count > 1
+		    && !is_count(builder->fields[count - 1],
+				 builder->lengths[count - 1]);
+	}
+	count = builder_split(builder, header, header_end - header);
+	if (first == NULL) {
+		builder->lineage = count > 1
+		    && (is_named(builder->fields[count - 1],
+				 builder->lengths[count - 1], "Consensus Lineage")
+			|| is_named(builder->fields[count - 1],
+				    builder->lengths[count - 1], "taxonomy"));
+	}
+	if (!strings_add(&builder->extras, builder->fields[0],
+			 builder->lengths[0])
+	    || !strings_add(&builder->extras,
+			    builder->lineage ? builder->fields[count - 1] : "",
+			    builder->lineage ? builder->lengths[count - 1] : 0)) {
+		return false;
+	}
+	for (i = 1; i < count - builder->lineage; i++) {
+		if (!strings_add(&builder->samples, builder->fields[i],
+				 builder->lengths[i])) {
+			return false;
+		}
+	}
+	for (pos = data; pos < header; pos = next) {
+		const char *comment_end = line_end(pos, end, &next);
+		if (!strings_add(&builder->extras, pos, comment_end - pos)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Read each OTU. */
+static bool builder_rows(otubuilder *builder, const char *pos,
+			 const char *end, unsigned long *line)
+{
+	const char *next;
+	size_t samples = builder->samples.count;
+	builder->row_starts = malloc(1024 * sizeof(uint64_t));
+	if (builder->row_starts == NULL) {
+		return false;
+	}
+	builder->row_size = 1024;
+	builder->row_starts[0] = 0;
+	for (; pos < end; pos = next) {
+		const char *row_end = line_end(pos, end, &next);
+		size_t i;
+		(*line)++;
+		if (row_end == pos) {
+			if (!builder_blank(builder)) {
+				return false;
+			}
+			continue;
+		}
+		if (builder_split(builder, pos, row_end - pos) !=
+		    builder->field_count) {
+			errno = EINVAL;
+			return false;
+		}
+		if (!strings_add(&builder->otus, builder->fields[0],
+				 builder->lengths[0])
+		    || (builder->lineage
+			&& !builder_lineage(builder,
+					    builder->fields[samples + 1],
+					    builder->lengths[samples + 1]))) {
+			return false;
+		}
+		for (i = 0; i < samples; i++) {
+			double count;
+			if (!builder_parse(builder, builder->fields[i + 1],
+					   builder->lengths[i + 1], &count)) {
+				errno = EINVAL;
+				return false;
+			}
+			if (!builder_add(builder, i, count)) {
+				return false;
+			}
+		}
+		if (builder->otus.count == builder->row_size) {
+			uint64_t *bigger = realloc(builder->row_starts,
+						   2 * builder->row_size *
+						   sizeof(uint64_t));
+			if (bigger == NULL) {
+				return false;
+			}
+			builder->row_starts = bigger;
+			builder->row_size *= 2;
+		}
+		builder->row_starts[builder->otus.count] = builder->entry_count;
+	}
+	*line = 0;
+	if (builder->otus.count >= UINT32_MAX) {
+		errno = EFBIG;
+		return false;
+	}
+	if (!builder->fixed) {
+		builder->precision = PRECISION_SHORTEST;
+	} else if (builder->precision == PRECISION_SHORTEST) {
+		builder->precision = 0;
+	}
+	return true;
+}
+
+/* Would a count be written back the same with no fixed precision? */
+static bool matches_shortest(const char *text, size_t len)
+{
+	char buffer[OTUTABLE_NUMBER_SIZE];
+	char formatted[OTUTABLE_NUMBER_SIZE];
+	double count;
+	int decimals;
+	if (parse_plain(text, len, &decimals, &count)) {
+		/* The fewest decimal places that give the same value are the ones written, unless the last is a zero. */
+		return decimals == 0 || text[len - 1] != '0';
+	}
+	memcpy(buffer, text, len);
+	buffer[len] = '\0';
+	count = strtod(buffer, NULL);
+	format_shortest(count == 0 ? 0 : count, formatted);
+	return strcmp(formatted, buffer) == 0;
+}
+
+/* Keep any count written in a way the shortest form would not give back. This is only needed, and the rows only read again, if the counts were not all written to the same precision. */
+static bool builder_exceptions(otubuilder *builder, const char *pos,
+			       const char *end)
+{
+	const char *next;
+	size_t samples = builder->samples.count;
+	uint64_t otu = 0;
+	size_t count = 0;
+	for (; pos < end; pos = next) {
+		const char *row_end = line_end(pos, end, &next);
+		size_t i;
+		if (row_end == pos) {
+			continue;
+		}
+		builder_split(builder, pos, row_end - pos);
+		for (i = 0; i < samples; i++) {
+			if (matches_shortest(builder->fields[i + 1],
+					     builder->lengths[i + 1])) {
+				continue;
+			}
+			if (count == builder->exception_size) {
+				size_t size = builder->exception_size ==
+				    0 ? 1024 : 2 * builder->exception_size;
+				uint64_t *bigger =
+				    realloc(builder->exception_cells,
+					    size * sizeof(uint64_t));
+				if (bigger == NULL) {
+					return false;
+				}
+				builder->exception_cells = bigger;
+				builder->exception_size = size;
+			}
+			builder->exception_cells[count++] = otu * samples + i;
+			if (!strings_add(&builder->exceptions,
+					 builder->fields[i + 1],
+					 builder->lengths[i + 1])) {
+				return false;
+			}
+		}
+		otu++;
+	}
+	return true;
+}
+
+/* Sort the counts by sample, keeping them in OTU order within each. */
+static bool builder_columns(otubuilder *builder)
+{
+	size_t samples = builder->samples.count;
+	size_t entries = builder->entry_count;
+	size_t otu;
+	size_t i;
+	builder->column_starts = calloc(samples + 1, sizeof(uint64_t));
+	builder->column_otus = malloc((entries + 1) * sizeof(uint32_t));
+	builder->column_counts = malloc((entries + 1) * sizeof(double));
+	if (builder->column_starts == NULL || builder->column_otus == NULL
+	    || builder->column_counts == NULL) {
+		return false;
+	}
+	for (i = 0; i < entries; i++) {
+		builder->column_starts[builder->row_samples[i] + 1]++;
+	}
+	for (i = 0; i < samples; i++) {
+		builder->column_starts[i + 1] += builder->column_starts[i];
+	}
+	for (otu = 0; otu < builder->otus.count; otu++) {
+		for (i = builder->row_starts[otu];
+		     i < builder->row_starts[otu + 1]; i++) {
+			uint64_t place =
+			    builder->column_starts[builder->row_samples[i]]++;
+			builder->column_otus[place] = otu;
+			builder->column_counts[place] = builder->row_counts[i];
+		}
+	}
+	/* Filling each column moved its start to the next one's. */
+	memmove(builder->column_starts + 1, builder->column_starts,
+		samples * sizeof(uint64_t));
+	builder->column_starts[0] = 0;
+	return true;
+}
+
+/* Choose where a part goes, after the last, and move past it. */
+static uint64_t place(uint64_t *offset, uint64_t size)
+{
+	uint64_t start = *offset;
+	*offset = (start + size + 7) & ~(uint64_t) 7;
+	return start;
+}
+
+/* Add a part, padded to 8 bytes. */
+static bool write_part(textbuf *image, const void *data, size_t size)
+{
+	static const char padding[8];
+	return (size == 0 || textbuf_append(image, data, size))
+	    && textbuf_append(image, padding, (8 - size % 8) % 8);
+}
+
+static bool write_strings(textbuf *image, const stringbuilder *strings)
+{
+	static const char padding[8];
+	return strings_write(strings, image)
+	    && textbuf_append(image, padding,
+			      (8 - strings_size(strings) % 8) % 8);
+}
+
+/* Lay the table out as it is in a file. */
+static bool builder_write(const otubuilder *builder, textbuf *image)
+{
+	otuheader header;
+	uint64_t offset = sizeof(otuheader);
+	uint64_t otus = builder->otus.count;
+	uint64_t samples = builder->samples.count;
+	uint64_t entries = builder->entry_count;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OTUTABLE_MAGIC, sizeof(header.magic));
+	header.otu_count = otus;
+	header.sample_count = samples;
+	header.entry_count = entries;
+	header.lineage_count = builder->lineages.count;
+	header.extra_count = builder->extras.count;
+	header.flags = (builder->lineage ? OTUTABLE_LINEAGE : 0)
+	    | (builder->unterminated ? OTUTABLE_UNTERMINATED : 0);
+	header.precision = builder->precision;
+	header.row_starts = place(&offset, (otus + 1) * sizeof(uint64_t));
+	header.row_samples = place(&offset, entries * sizeof(uint32_t));
+	header.row_counts = place(&offset, entries * sizeof(double));
+	header.column_starts = place(&offset, (samples + 1) * sizeof(uint64_t));
+	header.column_otus = place(&offset, entries * sizeof(uint32_t));
+	header.column_counts = place(&offset, entries * sizeof(double));
+	header.otu_names = place(&offset, strings_size(&builder->otus));
+	header.sample_names = place(&offset, strings_size(&builder->samples));
+	header.otu_lineages =
+	    place(&offset, (builder->lineage ? otus : 0) * sizeof(uint32_t));
+	header.lineages = place(&offset, strings_size(&builder->lineages));
+	header.extras = place(&offset, strings_size(&builder->extras));
+	header.exception_count = builder->exceptions.count;
+	header.exception_cells =
+	    place(&offset, builder->exceptions.count * sizeof(uint64_t));
+	header.exceptions = place(&offset, strings_size(&builder->exceptions));
+	header.blank_count = builder->blank_count;
+	header.blanks = place(&offset, builder->blank_count * sizeof(uint32_t));
+	header.size = offset;
+	if (!textbuf_reserve(image, offset)) {
+		errno = ENOMEM;
+		return false;
+	}
+	return write_part(image, &header, sizeof(header))
+	    && write_part(image, builder->row_starts,
+			  (otus + 1) * sizeof(uint64_t))
+	    && write_part(image, builder->row_samples, entries * sizeof(uint32_t))
+	    && write_part(image, builder->row_counts, entries * sizeof(double))
+	    && write_part(image, builder->column_starts,
+			  (samples + 1) * sizeof(uint64_t))
+	    && write_part(image, builder->column_otus, entries * sizeof(uint32_t))
+	    && write_part(image, builder->column_counts, entries * sizeof(double))
+	    && write_strings(image, &builder->otus)
+	    && write_strings(image, &builder->samples)
+	    && write_part(image, builder->otu_lineages,
+			  (builder->lineage ? otus : 0) * sizeof(uint32_t))
+	    && write_strings(image, &builder->lineages)
+	    && write_strings(image, &builder->extras)
+	    && write_part(image, builder->exception_cells,
+			  builder->exceptions.count * sizeof(uint64_t))
+	    && write_strings(image, &builder->exceptions)
+	    && write_part(image, builder->blanks,
+			  builder->blank_count * sizeof(uint32_t));
+}
+
+/* Read a text table into the form it has in a file. */
+static bool build_image(const mappedfile *text, textbuf *image,
+			unsigned long *line)
+{
+	otubuilder builder;
+	const char *body;
+	bool ok;
+	int error;
+	memset(&builder, 0, sizeof(builder));
+	builder.precision = PRECISION_SHORTEST;
+	builder.fixed = true;
+	builder.unterminated = text->size > 0
+	    && text->data[text->size - 1] != '\n';
+	ok = builder_header(&builder, text->data, text->data + text->size,
+			    &body, line)
+	    && builder_rows(&builder, body, text->data + text->size, line)
+	    && (builder.precision != PRECISION_SHORTEST
+		|| builder_exceptions(&builder, body,
+				      text->data + text->size))
+	    && builder_columns(&builder)
+	    && builder_write(&builder, image);
+	error = errno;
+	builder_free(&builder);
+	errno = error;
+	return ok;
+}
+
+bool otutable_convert(const char *input, const char *output,
+		      unsigned long *line)
+{
+	mappedfile text;
+	textbuf image;
+	FILE *file;
+	bool ok;
+	int error;
+	*line = 0;
+	if (!mapped_open(&text, input)) {
+		return false;
+	}
+	memset(&image, 0, sizeof(image));
+	ok = build_image(&text, &image, line);
+	mapped_close(&text);
+	if (ok) {
+		file = strcmp(output, "-") == 0 ? stdout : fopen(output, "wb");
+		ok = file != NULL;
+		if (ok) {
+			ok = fwrite(image.data, 1, image.len, file) == image.len;
+			if (file == stdout) {
+				ok = fflush(file) == 0 && ok;
+			} else {
+				ok = fclose(file) == 0 && ok;
+			}
+		}
+	}
+	error = errno;
+	textbuf_free(&image);
+	errno = error;
+	return ok;
+}
+
+otutable *otutable_load(const char *filename, unsigned long *line)
+{
+	otutable *table = calloc(1, sizeof(otutable));
+	mappedfile text;
+	textbuf image;
+	int error;
+	*line = 0;
+	if (table == NULL) {
+		return NULL;
+	}
+	if (!mapped_open(&text, filename)) {
+		error = errno;
+		free(table);
+		errno = error;
+		return NULL;
+	}
+	if (is_binary(&text)) {
+		table->file = text;
+		return table_check(table);
+	}
+	memset(&image, 0, sizeof(image));
+	if (!build_image(&text, &image, line)) {
+		error = errno;
+		mapped_close(&text);
+		textbuf_free(&image);
+		free(table);
+		errno = error;
+		return NULL;
+	}
+	mapped_close(&text);
+	table->file.data = image.data;
+	table->file.size = image.len;
+	table->file.mapped = false;
+	return table_check(table);
+}
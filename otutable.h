@@ -0,0 +1,56 @@
+/* OTU tables in a compact binary form that can be memory mapped */
+#ifndef AXIOME_OTUTABLE_H
+#define AXIOME_OTUTABLE_H
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<stdio.h>
+
+/*
+ * An OTU table holds a count for each OTU in each sample, and usually a lineage for each OTU. Most counts are zero, so only the others are stored, both by OTU (each row) and by sample (each column), along with the names, lineages and header lines of the text table it came from. Counts are written back to the precision of the text table or, if it mixed precisions, in the fewest digits that give the same value; any count that would not come back as it was written is kept as text, as are blank lines, so converting back gives exactly the same text.
+ */
+typedef struct otutable otutable;
+
+/* Map a binary OTU table. Returns NULL and sets errno on failure. */
+otutable *otutable_open(const char *filename);
+/* Open an OTU table that may be binary or text. A text table is converted in memory; if it is malformed, errno is EINVAL and line is set to where. */
+otutable *otutable_load(const char *filename, unsigned long *line);
+void otutable_free(otutable *table);
+
+size_t otutable_otu_count(const otutable *table);
+size_t otutable_sample_count(const otutable *table);
+const char *otutable_otu(const otutable *table, size_t otu);
+const char *otutable_sample(const otutable *table, size_t sample);
+/* The lineage of an OTU, or NULL if the table has none. */
+const char *otutable_lineage(const otutable *table, size_t otu);
+/* The lines before the one naming the columns, without their line breaks. */
+size_t otutable_comment_count(const otutable *table);
+const char *otutable_comment(const otutable *table, size_t comment);
+/* The names of the first column and of the lineage column, which is NULL if the table has none. */
+const char *otutable_id_column(const otutable *table);
+const char *otutable_lineage_column(const otutable *table);
+
+/* Get the non-zero counts of an OTU, in sample order, returning how many there are. */
+size_t otutable_row(const otutable *table, size_t otu,
+		    const uint32_t **samples, const double **counts);
+/* Get the non-zero counts in a sample, in OTU order, returning how many there are. */
+size_t otutable_column(const otutable *table, size_t sample,
+		       const uint32_t **otus, const double **counts);
+double otutable_get(const otutable *table, size_t otu, size_t sample);
+
+/* Write a count to the precision of the text table, or in the fewest digits that give the same value if it had none. The buffer must hold at least OTUTABLE_NUMBER_SIZE bytes. */
+#define OTUTABLE_NUMBER_SIZE 32
+void otutable_format(const otutable *table, double count, char *buffer);
+/* Write the table out as tab-separated text. Returns false if writing failed. */
+bool otutable_write_text(const otutable *table, FILE *file);
+/* Write only the comment lines and the line naming the columns. */
+bool otutable_write_header(const otutable *table, FILE *file);
+/* Write one OTU's line. */
+bool otutable_write_row(const otutable *table, size_t otu, FILE *file);
+
+/*
+ * Convert a tab-separated OTU table to binary. The text table starts with lines beginning with #, the last of which names the columns; each row is an OTU name, its counts and, if the table has them, a lineage. Returns false and sets errno on failure; if the text is malformed, errno is EINVAL and line is set to where.
+ */
+bool otutable_convert(const char *input, const char *output,
+		      unsigned long *line);
+#endif
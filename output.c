@@ -0,0 +1,371 @@
+/* Buffered, optionally compressed, output to many files at once */
+#include<bzlib.h>
+#include<errno.h>
+#include<pthread.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<zlib.h>
+#include "output.h"
+#include "pool.h"
+#include "textbuf.h"
+
+/* Data is compressed in chunks of this size; at most OUTPUT_PENDING of them may be in flight per file. */
+#define OUTPUT_CHUNK (256 * 1024)
+#define OUTPUT_PENDING 2
+
+typedef struct outputchunk {
+	outputfile *file;
+	textbuf data;
+	textbuf compressed;
+	bool done;
+	bool failed;
+	struct outputchunk *next;
+} outputchunk;
+
+struct outputfile {
+	outputset *set;
+	char *filename;
+	FILE *stream;
+	bool created;
+	int error;
+	unsigned long last_used;
+	textbuf buffer;
+	/* Chunks being compressed, in file order. */
+	outputchunk *first;
+	outputchunk *last;
+	size_t pending;
+};
+
+struct outputset {
+	outputformat format;
+	pool *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	size_t max_open;
+	size_t open;
+	unsigned long clock;
+	outputfile **files;
+	size_t file_count;
+	size_t file_size;
+};
+
+static bool compress_gzip(const textbuf *data, textbuf *compressed)
+{
+	z_stream stream;
+	bool ok;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		return false;
+	}
+	compressed->len = 0;
+	if (!textbuf_reserve(compressed, deflateBound(&stream, data->len))) {
+		deflateEnd(&stream);
+		return false;
+	}
+	stream.next_in = (Bytef *) data->data;
+	stream.avail_in = data->len;
+	stream.next_out = (Bytef *) compressed->data;
+	stream.avail_out = compressed->size;
+	ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+	compressed->len = stream.total_out;
+	deflateEnd(&stream);
+	return ok;
+}
+
+static bool compress_bzip(const textbuf *data, textbuf *compressed)
+{
+	unsigned int len = data->len + data->len / 100 + 600;
+	/* libbz2 rejects a NULL source, even if it is empty. */
+	char empty = '\0';
+	compressed->len = 0;
+	if (!textbuf_reserve(compressed, len)) {
+		return false;
+	}
+	if (BZ2_bzBuffToBuffCompress
+	    (compressed->data, &len, data->data == NULL ? &empty : data->data,
+	     data->len, 9, 0, 0) != BZ_OK) {
+		return false;
+	}
+	compressed->len = len;
+	return true;
+}
+
+static void output_compress(void *data)
+{
+	outputchunk *chunk = data;
+	outputset *set = chunk->file->set;
+	bool ok;
+	if (set->format == OUTPUT_GZIP) {
+		ok = compress_gzip(&chunk->data, &chunk->compressed);
+	} else {
+		ok = compress_bzip(&chunk->data, &chunk->compressed);
+	}
+	pthread_mutex_lock(&set->lock);
+	chunk->failed = !ok;
+	chunk->done = true;
+	pthread_cond_broadcast(&set->done);
+	pthread_mutex_unlock(&set->lock);
+}
+
+outputset *output_set_new(outputformat format, int threads, size_t max_open)
+{
+	outputset *set = calloc(1, sizeof(outputset));
+	if (set == NULL) {
+		return NULL;
+	}
+	set->format = format;
+	set->max_open = max_open < 1 ? 1 : max_open;
+	if (format != OUTPUT_PLAIN
+	    && (set->workers = pool_new(threads)) == NULL) {
+		free(set);
+		return NULL;
+	}
+	pthread_mutex_init(&set->lock, NULL);
+	pthread_cond_init(&set->done, NULL);
+	return set;
+}
+
+const char *output_suffix(outputformat format)
+{
+	switch (format) {
+	case OUTPUT_GZIP:
+		return ".gz";
+	case OUTPUT_BZIP:
+		return ".bz2";
+	default:
+		return "";
+	}
+}
+
+outputfile *output_open(outputset *set, const char *filename)
+{
+	outputfile *file;
+	if (set->file_count == set->file_size) {
+		size_t size = set->file_size == 0 ? 16 : 2 * set->file_size;
+		outputfile **files =
+		    realloc(set->files, size * sizeof(outputfile *));
+		if (files == NULL) {
+			return NULL;
+		}
+		set->files = files;
+		set->file_size = size;
+	}
+	file = calloc(1, sizeof(outputfile));
+	if (file == NULL) {
+		return NULL;
+	}
+	file->filename = strdup(filename);
+	if (file->filename == NULL) {
+		free(file);
+		return NULL;
+	}
+	file->set = set;
+	set->files[set->file_count++] = file;
+	return file;
+}
+
+/* Make sure the file is open, closing the least recently used one if too many are. */
+static bool output_stream(outputfile *file)
+{
+	outputset *set = file->set;
+	if (file->stream == NULL && strcmp(file->filename, "-") == 0) {
+		file->stream = stdout;
+		file->created = true;
+	} else if (file->stream == NULL) {
+		if (set->open >= set->max_open) {
+			outputfile *oldest = NULL;
+			size_t i;
+			for (i = 0; i < set->file_count; i++) {
+				if (set->files[i]->stream != NULL
+				    && set->files[i]->stream != stdout
+				    && (oldest == NULL
+					|| set->files[i]->last_used <
+					oldest->last_used)) {
+					oldest = set->files[i];
+				}
+			}
+			if (oldest != NULL) {
+				if (fclose(oldest->stream) != 0
+				    && oldest->error == 0) {
+					oldest->error = errno;
+				}
+				oldest->stream = NULL;
+				set->open--;
+			}
+		}
+		file->stream = fopen(file->filename, file->created ? "a" : "w");
+		if (file->stream == NULL) {
+			file->error = errno;
+			return false;
+		}
+		file->created = true;
+		set->open++;
+	}
+	file->last_used = ++set->clock;
+	return true;
+}
+
+static bool output_emit(outputfile *file, const char *data, size_t len)
+{
+	if (file->error != 0) {
+		return false;
+	}
+	if (len == 0) {
+		return true;
+	}
+	if (!output_stream(file)) {
+		return false;
+	}
+	if (fwrite(data, 1, len, file->stream) != len) {
+		file->error = errno == 0 ? EIO : errno;
+		return false;
+	}
+	return true;
+}
+
+/* Write out any compressed chunks at the head of the queue. If wait is set, block until at least one is written. */
+static void output_drain(outputfile *file, bool wait)
+{
+	outputset *set = file->set;
+	outputchunk *chunk;
+	while ((chunk = file->first) != NULL) {
+		bool done;
+		pthread_mutex_lock(&set->lock);
+		while (wait && !chunk->done) {
+			pthread_cond_wait(&set->done, &set->lock);
+		}
+		done = chunk->done;
+		pthread_mutex_unlock(&set->lock);
+		if (!done) {
+			return;
+		}
+		if (chunk->failed) {
+			if (file->error == 0) {
+				file->error = ENOMEM;
+			}
+		} else {
+			output_emit(file, chunk->compressed.data,
+				    chunk->compressed.len);
+		}
+		file->first = chunk->next;
+		if (file->first == NULL) {
+			file->last = NULL;
+		}
+		file->pending--;
+		textbuf_free(&chunk->data);
+		textbuf_free(&chunk->compressed);
+		free(chunk);
+		wait = false;
+	}
+}
+
+/* Pass the buffered data on to be written or compressed. */
+static void output_flush(outputfile *file)
+{
+	outputchunk *chunk;
+	if (file->buffer.len == 0) {
+		return;
+	}
+	if (file->set->format == OUTPUT_PLAIN) {
+		output_emit(file, file->buffer.data, file->buffer.len);
+		file->buffer.len = 0;
+		return;
+	}
+	output_drain(file, file->pending >= OUTPUT_PENDING);
+	chunk = calloc(1, sizeof(outputchunk));
+	if (chunk == NULL) {
+		file->error = ENOMEM;
+		file->buffer.len = 0;
+		return;
+	}
+	chunk->file = file;
+	chunk->data = file->buffer;
+	memset(&file->buffer, 0, sizeof(textbuf));
+	if (file->last == NULL) {
+		file->first = chunk;
+	} else {
+		file->last->next = chunk;
+	}
+	file->last = chunk;
+	file->pending++;
+	pool_submit(file->set->workers, output_compress, chunk);
+}
+
+bool output_write(outputfile *file, const char *data, size_t len)
+{
+	if (file->error == 0 && !textbuf_append(&file->buffer, data, len)) {
+		file->error = ENOMEM;
+	}
+	if (file->buffer.len >= OUTPUT_CHUNK) {
+		output_flush(file);
+	}
+	if (file->error != 0) {
+		errno = file->error;
+		return false;
+	}
+	return true;
+}
+
+bool output_close(outputfile *file)
+{
+	outputset *set = file->set;
+	size_t i;
+	int error;
+	output_flush(file);
+	while (file->first != NULL) {
+		output_drain(file, true);
+	}
+	/* A file that was never written to should still exist and, if compressed, be valid. */
+	if (file->error == 0 && !file->created) {
+		if (set->format == OUTPUT_PLAIN) {
+			output_stream(file);
+		} else {
+			outputchunk empty;
+			memset(&empty, 0, sizeof(empty));
+			empty.file = file;
+			output_compress(&empty);
+			if (empty.failed) {
+				file->error = ENOMEM;
+			} else {
+				output_emit(file, empty.compressed.data,
+					    empty.compressed.len);
+			}
+			textbuf_free(&empty.compressed);
+		}
+	}
+	if (file->stream == stdout) {
+		if (fflush(file->stream) != 0 && file->error == 0) {
+			file->error = errno;
+		}
+	} else if (file->stream != NULL) {
+		if (fclose(file->stream) != 0 && file->error == 0) {
+			file->error = errno;
+		}
+		set->open--;
+	}
+	for (i = 0; i < set->file_count; i++) {
+		if (set->files[i] == file) {
+			set->files[i] = set->files[--set->file_count];
+			break;
+		}
+	}
+	error = file->error;
+	textbuf_free(&file->buffer);
+	free(file->filename);
+	free(file);
+	errno = error;
+	return error == 0;
+}
+
+void output_set_free(outputset *set)
+{
+	if (set->workers != NULL) {
+		pool_free(set->workers);
+	}
+	pthread_mutex_destroy(&set->lock);
+	pthread_cond_destroy(&set->done);
+	free(set->files);
+	free(set);
+}
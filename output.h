@@ -0,0 +1,36 @@
+/* Buffered, optionally compressed, output to many files at once */
+#ifndef AXIOME_OUTPUT_H
+#define AXIOME_OUTPUT_H
+#include<stdbool.h>
+#include<stddef.h>
+
+typedef enum {
+	OUTPUT_PLAIN,
+	OUTPUT_GZIP,
+	OUTPUT_BZIP
+} outputformat;
+
+typedef struct outputset outputset;
+typedef struct outputfile outputfile;
+
+/*
+ * A set of output files sharing a compression pool and a limit on open descriptors.
+ *
+ * Data written to each file is collected into chunks. For compressed formats, each chunk is compressed on the pool as an independent gzip member or bzip2 stream; concatenated, these are a valid file for gzip(1), bzip2(1) and input_open. Chunks are always written in order, and only a couple may be waiting per file, so memory is bounded per file.
+ *
+ * Once max_open files are open, the least recently written one is closed and later reopened for appending.
+ *
+ * The files must all be written from one thread.
+ */
+outputset *output_set_new(outputformat format, int threads, size_t max_open);
+/* The suffix conventionally added to file names in this format, e.g., ".gz". */
+const char *output_suffix(outputformat format);
+/* Create a file, truncating it. The file is not actually opened until the first chunk is written. A filename of - is standard output, which is flushed rather than closed. */
+outputfile *output_open(outputset *set, const char *filename);
+/* Returns false and sets errno if an error has occurred writing this file. */
+bool output_write(outputfile *file, const char *data, size_t len);
+/* Flush and close a file. Returns false and sets errno if any error occurred. */
+bool output_close(outputfile *file);
+/* Free the set. All its files must be closed first. */
+void output_set_free(outputset *set);
+#endif
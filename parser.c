@@ -21,14 +21,25 @@
 #include<string.h>
 #include "parser.h"
 
-#define PARSE_CHUNK if (*input == '\0') return 0; for(;*input != '\0' && *input != ':' && *input != '#' && *input != '/' && *input != ' '; input++)
+/* Headers may be NUL-terminated or sit in a FASTQ buffer followed by a line ending. */
+#define IS_END(c) ((c) == '\0' || (c) == '\n' || (c) == '\r')
+#define PARSE_CHUNK if (IS_END(*input)) return 0; for(;!IS_END(*input) && *input != ':' && *input != '#' && *input != '/' && *input != ' '; input++)
 #define PARSE_INT do { value = 0; PARSE_CHUNK { if (*input >= '0' && *input <= '9') { value = 10*value + (*input - '0'); } else { return 0; } } } while(0)
 
-int seqid_parse(seqidentifier * id, char *input)
+static int has_hash(const char *input)
+{
+	for (; !IS_END(*input); input++) {
+		if (*input == '#')
+			return 1;
+	}
+	return 0;
+}
+
+int seqid_parse(seqidentifier * id, const char *input)
 {
 	char *dest;
 	int value;
-	if (strchr(input, '#') != NULL) {
+	if (has_hash(input)) {
 		/* Old CASAVA 1.4-1.6 format */
 		id->run = 0;
 		id->flowcell[0] = '\0';
@@ -134,3 +145,168 @@ int seqid_equal(seqidentifier * one, seqidentifier * two)
 	    && strcmp(one->tag, two->tag) == 0;
 	;
 }
+
+/* Field separators for the header scanner. */
+#define SEP_NONE 0
+#define SEP_FIELD 1
+#define SEP_HASH 2
+#define SEP_END 3
+static const unsigned char separators[256] = {
+	[':'] = SEP_FIELD,
+	['/'] = SEP_FIELD,
+	[' '] = SEP_FIELD,
+	['#'] = SEP_HASH,
+	['\0'] = SEP_END,
+	['\n'] = SEP_END,
+	['\r'] = SEP_END,
+};
+
+/* The new format has the most fields: seven in the read name, then mate, filtered, control bits and tag. */
+#define SEQID_FIELDS 11
+
+/* A field found by the scanner, with its value, should it be numeric. */
+typedef struct {
+	seqfield field;
+	unsigned char end;
+	bool numeric;
+	uint64_t value;
+} scannedfield;
+
+static seqiderror field_number(const scannedfield *scanned, uint32_t max,
+			       uint32_t *value)
+{
+	if (!scanned->numeric) {
+		return SEQID_ENUMBER;
+	}
+	/* Anything longer may have overflowed the accumulator. */
+	if (scanned->field.length > 10 || scanned->value > max) {
+		return SEQID_ERANGE;
+	}
+	*value = (uint32_t) scanned->value;
+	return SEQID_OK;
+}
+
+seqiderror seqheader_parse(seqheader *header, const char *text, size_t len)
+{
+	scannedfield fields[SEQID_FIELDS];
+	const int *layout;
+	/* Positions of lane, tile, x, y, mate and, if present, run. */
+	static const int old_layout[] = { 1, 2, 3, 4, 6, -1 };
+	static const int new_layout[] = { 3, 4, 5, 6, 7, 1 };
+	int count = 0;
+	int tag;
+	size_t pos = 0;
+	uint32_t lane;
+	uint32_t mate;
+	seqiderror error;
+
+	if (len > UINT16_MAX) {
+		return SEQID_ELENGTH;
+	}
+	/* Split the header and convert every field to a number on the way past, rather than working out which fields are numeric first; the old format is the one with a # after the fifth field. */
+	while (count < SEQID_FIELDS) {
+		scannedfield *current = &fields[count++];
+		uint64_t value = 0;
+		unsigned int bad = 0;
+		size_t start = pos;
+		unsigned char sep = SEP_END;
+		for (; pos < len; pos++) {
+			unsigned char c = text[pos];
+			unsigned int digit = c - '0';
+			if ((sep = separators[c]) != SEP_NONE) {
+				break;
+			}
+			bad |= digit > 9;
+			value = 10 * value + digit;
+		}
+		if (pos == len) {
+			sep = SEP_END;
+		}
+		current->field.offset = start;
+		current->field.length = pos - start;
+		current->end = sep;
+		current->numeric = !bad && pos > start;
+		current->value = value;
+		if (sep == SEP_END || (count == 7 && fields[4].end == SEP_HASH)) {
+			break;
+		}
+		pos++;
+	}
+	header->old_format = count > 4 && fields[4].end == SEP_HASH;
+	layout = header->old_format ? old_layout : new_layout;
+	tag = header->old_format ? 5 : 10;
+	if (count < (header->old_format ? 7 : SEQID_FIELDS)) {
+		return SEQID_EFIELDS;
+	}
+
+	header->instrument = fields[0].field;
+	if (header->old_format) {
+		header->flowcell.offset = 0;
+		header->flowcell.length = 0;
+		header->run = 0;
+	} else {
+		header->flowcell = fields[2].field;
+		if ((error =
+		     field_number(&fields[layout[5]], UINT32_MAX,
+				  &header->run)) != SEQID_OK) {
+			return error;
+		}
+	}
+	if ((error =
+	     field_number(&fields[layout[0]], UINT8_MAX, &lane)) != SEQID_OK
+	    || (error =
+		field_number(&fields[layout[1]], UINT32_MAX,
+			     &header->tile)) != SEQID_OK
+	    || (error =
+		field_number(&fields[layout[2]], UINT32_MAX,
+			     &header->x)) != SEQID_OK
+	    || (error =
+		field_number(&fields[layout[3]], UINT32_MAX,
+			     &header->y)) != SEQID_OK
+	    || (error =
+		field_number(&fields[layout[4]], UINT8_MAX,
+			     &mate)) != SEQID_OK) {
+		return error;
+	}
+	header->lane = lane;
+	header->mate = mate;
+	header->tag = fields[tag].field;
+	if (header->tag.length == 0) {
+		return SEQID_ETAG;
+	}
+	return SEQID_OK;
+}
+
+size_t seqheader_parse_batch(const fastqrecord *records, size_t count,
+			     seqheader *headers, seqiderror *errors)
+{
+	size_t i;
+	size_t parsed = 0;
+	for (i = 0; i < count; i++) {
+		errors[i] =
+		    seqheader_parse(&headers[i], records[i].name,
+				    records[i].name_len);
+		parsed += errors[i] == SEQID_OK;
+	}
+	return parsed;
+}
+
+const char *seqheader_strerror(seqiderror error)
+{
+	switch (error) {
+	case SEQID_OK:
+		return "Success";
+	case SEQID_EFIELDS:
+		return "Too few fields";
+	case SEQID_ENUMBER:
+		return "Non-numeric value";
+	case SEQID_ERANGE:
+		return "Numeric value too large";
+	case SEQID_ETAG:
+		return "Missing tag";
+	case SEQID_ELENGTH:
+		return "Header too long";
+	default:
+		return "Unknown error";
+	}
+}
@@ -18,6 +18,10 @@
 
 #ifndef PANDASEQ_PARSER_H
 #define PANDASEQ_PARSER_H
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include "fastq.h"
 typedef struct {
 	char instrument[100];
 	int run;
@@ -29,7 +33,57 @@ typedef struct {
 	char tag[10];
 } seqidentifier;
 
-int seqid_parse(seqidentifier * id, char *input);
+int seqid_parse(seqidentifier * id, const char *input);
 void seqid_print(seqidentifier * id);
 int seqid_equal(seqidentifier * one, seqidentifier * two);
+
+/*
+ * Copy-free header parsing
+ *
+ * Text fields are views (offset and length) into the header, which the caller keeps; numeric fields are stored as packed fixed-width integers. Both the CASAVA 1.4-1.6 format
+ *   instrument:lane:tile:x:y#tag/mate
+ * and the CASAVA 1.7+ format
+ *   instrument:run:flowcell:lane:tile:x:y mate:filtered:control:tag
+ * are recognised by one scan over the header. Anything after the tag is ignored.
+ */
+typedef struct {
+	uint16_t offset;
+	uint16_t length;
+} seqfield;
+
+typedef struct {
+	seqfield instrument;
+	/* Empty in the old format. */
+	seqfield flowcell;
+	seqfield tag;
+	/* Zero in the old format. */
+	uint32_t run;
+	uint32_t x;
+	uint32_t y;
+	uint32_t tile;
+	uint8_t lane;
+	uint8_t mate;
+	bool old_format;
+} seqheader;
+
+typedef enum {
+	SEQID_OK = 0,
+	/* The header has too few fields. */
+	SEQID_EFIELDS,
+	/* A numeric field is empty or contains something other than digits. */
+	SEQID_ENUMBER,
+	/* A numeric field is too large. */
+	SEQID_ERANGE,
+	/* The tag is empty. */
+	SEQID_ETAG,
+	/* The header is longer than a field offset can describe. */
+	SEQID_ELENGTH
+} seqiderror;
+
+/* Parse a header of the given length; it need not be NUL-terminated. */
+seqiderror seqheader_parse(seqheader *header, const char *text, size_t len);
+/* Parse the name of each record. Returns the number parsed successfully; the status of each is stored in errors. */
+size_t seqheader_parse_batch(const fastqrecord *records, size_t count,
+			     seqheader *headers, seqiderror *errors);
+const char *seqheader_strerror(seqiderror error);
 #endif
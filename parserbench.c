@@ -0,0 +1,224 @@
+/* Measure how many Illumina headers per second each header parser handles */
+#include<ctype.h>
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include "fastq.h"
+#include "parser.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Make up headers, alternating between the old and new formats. */
+static char *synthesize(size_t count, fastqrecord *records)
+{
+	static const char *tags[] = { "ACGTAC", "TTGACC", "GGCATA", "CATGCA" };
+	char *data = malloc(count * 80);
+	char *pos = data;
+	size_t i;
+	if (data == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		int len;
+		if (i % 2 == 0) {
+			len = sprintf(pos, "HWI-EAS209_0006_FC706VJ:%d:%d:%d:%d#%s/%d",
+				      (int)(i % 8) + 1, (int)(i % 120) + 1,
+				      rand() % 20000, rand() % 200000,
+				      tags[i % 4], (int)(i % 2) + 1);
+		} else {
+			len = sprintf(pos, "M00123:42:000000000-A1B2C:%d:%d:%d:%d %d:N:0:%s",
+				      (int)(i % 8) + 1, 1101 + (int)(i % 19),
+				      rand() % 30000, rand() % 30000,
+				      (int)(i % 2) + 1, tags[i % 4]);
+		}
+		records[i].name = pos;
+		records[i].name_len = len;
+		pos += len + 1;
+	}
+	return data;
+}
+
+/* Copy the headers out of a FASTQ file. */
+static char *load(const char *filename, bool bzip, int threads, size_t *count,
+		  fastqrecord **records)
+{
+	inputfile *file;
+	fastqrecord seq;
+	size_t size = 1024;
+	size_t data_size = 1024 * 1024;
+	size_t data_len = 0;
+	char *data;
+	size_t i;
+	file = input_open(filename, bzip, threads);
+	if (file == NULL) {
+		return NULL;
+	}
+	*count = 0;
+	*records = malloc(size * sizeof(fastqrecord));
+	data = malloc(data_size);
+	while (*records != NULL && data != NULL && fastq_read(file, &seq) >= 0) {
+		if (*count == size) {
+			size *= 2;
+			*records = realloc(*records, size * sizeof(fastqrecord));
+		}
+		while (data_size - data_len <= seq.name_len) {
+			data_size *= 2;
+			data = realloc(data, data_size);
+		}
+		if (*records == NULL || data == NULL) {
+			break;
+		}
+		memcpy(data + data_len, seq.name, seq.name_len);
+		data[data_len + seq.name_len] = '\0';
+		/* Store offsets until the data stops moving. */
+		(*records)[*count].name = (const char *)data_len;
+		(*records)[(*count)++].name_len = seq.name_len;
+		data_len += seq.name_len + 1;
+	}
+	input_close(file);
+	if (*records == NULL || data == NULL) {
+		free(*records);
+		free(data);
+		return NULL;
+	}
+	for (i = 0; i < *count; i++) {
+		(*records)[i].name = data + (size_t)(*records)[i].name;
+	}
+	return data;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	bool bzip = false;
+	int threads = 1;
+	int repeats = 10;
+	char *filename = NULL;
+	fastqrecord *records;
+	seqheader *headers;
+	seqiderror *errors;
+	seqidentifier id;
+	char *data;
+	size_t count = 1000000;
+	size_t i;
+	size_t disagree = 0;
+	double start;
+	double old_time;
+	double new_time;
+	int r;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "jf:r:t:")) != -1) {
+		switch (c) {
+		case 'j':
+			bzip = true;
+			break;
+		case 'f':
+			filename = optarg;
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case '?':
+			if (optopt == (int)'f' || optopt == (int)'r'
+			    || optopt == (int)'t') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			fprintf(stderr,
+				"Usage: %s [-j] [-t threads] [-r repeats] [-f file.fastq]\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use for decompression.\n\t-r\tNumber of passes over the headers; the fastest is reported.\n\t-f\tRead headers from this file rather than making them up.\n",
+				argv[0]);
+			return 1;
+		default:
+			abort();
+		}
+	}
+	if (repeats < 1) {
+		repeats = 1;
+	}
+
+	if (filename == NULL) {
+		records = malloc(count * sizeof(fastqrecord));
+		data = records == NULL ? NULL : synthesize(count, records);
+	} else {
+		data = load(filename, bzip, threads, &count, &records);
+	}
+	if (data == NULL) {
+		perror(filename == NULL ? argv[0] : filename);
+		return 1;
+	}
+	headers = calloc(count, sizeof(seqheader));
+	errors = calloc(count, sizeof(seqiderror));
+	if (headers == NULL || errors == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	/* Report the fastest pass of each, which is the least disturbed by whatever else the machine is doing. */
+	old_time = new_time = 0;
+	for (r = 0; r < repeats; r++) {
+		double elapsed;
+		start = now();
+		for (i = 0; i < count; i++) {
+			seqid_parse(&id, records[i].name);
+		}
+		elapsed = now() - start;
+		if (r == 0 || elapsed < old_time) {
+			old_time = elapsed;
+		}
+		start = now();
+		seqheader_parse_batch(records, count, headers, errors);
+		elapsed = now() - start;
+		if (r == 0 || elapsed < new_time) {
+			new_time = elapsed;
+		}
+	}
+
+	/* Check that the two agree on the fields they both understand. */
+	for (i = 0; i < count; i++) {
+		bool old_ok = seqid_parse(&id, records[i].name) != 0;
+		if (old_ok != (errors[i] == SEQID_OK)
+		    || (old_ok
+			&& ((uint32_t) id.x != headers[i].x
+			    || (uint32_t) id.y != headers[i].y
+			    || id.lane != headers[i].lane
+			    || (uint32_t) id.tile != headers[i].tile
+			    || strlen(id.tag) != headers[i].tag.length
+			    || strncmp(id.tag,
+				       records[i].name + headers[i].tag.offset,
+				       headers[i].tag.length) != 0))) {
+			disagree++;
+		}
+	}
+
+	printf("headers\t%zu\n", count);
+	printf("seqid_parse\t%.0f headers/s\n",
+	       old_time > 0 ? count / old_time : 0);
+	printf("seqheader_parse_batch\t%.0f headers/s\n",
+	       new_time > 0 ? count / new_time : 0);
+	printf("disagreements\t%zu\n", disagree);
+	free(headers);
+	free(errors);
+	free(records);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,171 @@
+/* Process FASTQ records in batches across a pool of threads */
+#include<pthread.h>
+#include<stdlib.h>
+#include "pipeline.h"
+#include "pool.h"
+
+/* How many batches each worker may have in flight. Once they are all in use, the reader waits. */
+#define PIPELINE_DEPTH 3
+
+typedef struct {
+	fastqbatch *batch;
+	size_t sequence;
+	bool done;
+	struct pipeline *owner;
+} pipelineslot;
+
+typedef struct pipeline {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	const pipelinestages *stages;
+	void *context;
+	pipelineslot *slots;
+	size_t slot_count;
+	/* Slots that are not being read, worked or committed. */
+	pipelineslot **idle;
+	size_t idle_count;
+	/* The next batch to be committed and the total, once reading has stopped. */
+	size_t next;
+	size_t total;
+	bool finished;
+} pipeline;
+
+static void pipeline_work(void *data)
+{
+	pipelineslot *slot = data;
+	pipeline *p = slot->owner;
+	if (p->stages->work != NULL) {
+		p->stages->work(slot->batch, p->context);
+	}
+	pthread_mutex_lock(&p->lock);
+	slot->done = true;
+	pthread_cond_broadcast(&p->changed);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void *pipeline_writer(void *data)
+{
+	pipeline *p = data;
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		pipelineslot *slot = NULL;
+		size_t i;
+		while (slot == NULL) {
+			if (p->finished && p->next == p->total) {
+				pthread_mutex_unlock(&p->lock);
+				return NULL;
+			}
+			for (i = 0; i < p->slot_count; i++) {
+				if (p->slots[i].done
+				    && p->slots[i].sequence == p->next) {
+					slot = &p->slots[i];
+					break;
+				}
+			}
+			if (slot == NULL) {
+				pthread_cond_wait(&p->changed, &p->lock);
+			}
+		}
+		pthread_mutex_unlock(&p->lock);
+		if (p->stages->commit != NULL) {
+			p->stages->commit(slot->batch, p->context);
+		}
+		pthread_mutex_lock(&p->lock);
+		slot->done = false;
+		p->idle[p->idle_count++] = slot;
+		p->next++;
+		pthread_cond_broadcast(&p->changed);
+	}
+}
+
+bool pipeline_run(inputfile *file, int threads, const pipelinestages *stages,
+		  void *context)
+{
+	pipeline p = { 0 };
+	pool *workers;
+	pthread_t writer;
+	size_t sequence = 0;
+	size_t records = 0;
+	size_t i;
+	bool ok = true;
+
+	if (threads < 1) {
+		threads = 1;
+	}
+	p.stages = stages;
+	p.context = context;
+	p.slot_count = PIPELINE_DEPTH * threads;
+	p.slots = calloc(p.slot_count, sizeof(pipelineslot));
+	p.idle = calloc(p.slot_count, sizeof(pipelineslot *));
+	if (p.slots == NULL || p.idle == NULL) {
+		free(p.slots);
+		free(p.idle);
+		return false;
+	}
+	for (i = 0; i < p.slot_count; i++) {
+		p.slots[i].owner = &p;
+		p.slots[i].batch = fastq_batch_new();
+		if (p.slots[i].batch == NULL) {
+			break;
+		}
+		p.idle[p.idle_count++] = &p.slots[i];
+	}
+	p.slot_count = i;
+	if (p.slot_count == 0 || (workers = pool_new(threads)) == NULL) {
+		free(p.slots);
+		free(p.idle);
+		return false;
+	}
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.changed, NULL);
+	if (pthread_create(&writer, NULL, pipeline_writer, &p) != 0) {
+		ok = false;
+		goto done;
+	}
+
+	for (;;) {
+		pipelineslot *slot;
+		pthread_mutex_lock(&p.lock);
+		while (p.idle_count == 0) {
+			pthread_cond_wait(&p.changed, &p.lock);
+		}
+		slot = p.idle[--p.idle_count];
+		pthread_mutex_unlock(&p.lock);
+
+		slot->batch->first = records;
+		if (fastq_batch_read(file, slot->batch) == 0) {
+			ok = !slot->batch->truncated;
+			pthread_mutex_lock(&p.lock);
+			p.idle[p.idle_count++] = slot;
+			pthread_mutex_unlock(&p.lock);
+			break;
+		}
+		records += slot->batch->count;
+		slot->sequence = sequence++;
+		pool_submit(workers, pipeline_work, slot);
+		if (slot->batch->truncated) {
+			ok = false;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&p.lock);
+	p.total = sequence;
+	p.finished = true;
+	pthread_cond_broadcast(&p.changed);
+	pthread_mutex_unlock(&p.lock);
+	pthread_join(writer, NULL);
+ done:
+	pool_free(workers);
+	for (i = 0; i < p.slot_count; i++) {
+		if (stages->release != NULL && p.slots[i].batch->state != NULL) {
+			stages->release(p.slots[i].batch->state);
+		}
+		fastq_batch_free(p.slots[i].batch);
+	}
+	pthread_mutex_destroy(&p.lock);
+	pthread_cond_destroy(&p.changed);
+	free(p.slots);
+	free(p.idle);
+	return ok;
+}
@@ -0,0 +1,21 @@
+/* Process FASTQ records in batches across a pool of threads */
+#ifndef AXIOME_PIPELINE_H
+#define AXIOME_PIPELINE_H
+#include<stdbool.h>
+#include "fastq.h"
+
+/*
+ * The calling thread reads batches of records from the input and hands each to a worker, which calls work. A separate writer thread then calls commit on each finished batch in input order, so output written there comes out in the same order as a serial pass.
+ *
+ * Batches are recycled, so anything a stage wants to keep with a batch (e.g., output buffers) can be hung off batch->state; release is called on each one at the end. Any of the functions may be NULL.
+ */
+typedef struct {
+	void (*work) (fastqbatch *batch, void *context);
+	void (*commit) (fastqbatch *batch, void *context);
+	void (*release) (void *state);
+} pipelinestages;
+
+/* Run the whole file through the stages using the given number of worker threads. Returns false if the input was malformed, could not be read, or memory ran out. */
+bool pipeline_run(inputfile *file, int threads, const pipelinestages *stages,
+		  void *context);
+#endif
@@ -21,16 +21,18 @@ class AXIOME.Analyses.PrincipalCoordinateAnalysis : RuleProcessor {
 	}
 	public override bool process(Xml.Node *definition, Output output) {
 		var method = definition->get_prop("method");
-		string[] methods = {"manhattan", "euclidean", "canberra",	"bray", "kulczynski", "jaccard", "gower", "altGower", "morisita", "horn",	"mountford", "raup", "binomial", "chao", "cao"};
+		string[] methods = {"manhattan", "euclidean", "canberra",	"bray", "kulczynski", "jaccard", "hellinger", "gower", "altGower", "morisita", "horn",	"mountford", "raup", "binomial", "chao", "cao"};
 
 		if ( method != null ) {
 			if ( ! ( method in methods ) ) {
-				definition_error(definition, "Unrecognized PCoA dissimilarity method. Choose one of: manhattan, euclidean, canberra, bray, kulczynski, jaccard, gower, altGower, morisita, horn, mountford, raup , binomial, chao, cao.\n");
+				definition_error(definition, "Unrecognized PCoA dissimilarity method. Choose one of: manhattan, euclidean, canberra, bray, kulczynski, jaccard, hellinger, gower, altGower, morisita, horn, mountford, raup , binomial, chao, cao.\n");
 				return false;
 			}
 		} else {
 			method = "bray";
 		}
+		string matrix;
+		var matrix_flag = output.distance_matrix_option(method, "_auto", out matrix);
 
 		var ellipsoid_conf = definition->get_prop("ellipsoid-confidence");
 		double e;
@@ -52,9 +54,9 @@ class AXIOME.Analyses.PrincipalCoordinateAnalysis : RuleProcessor {
 
 		output.add_target("pcoa/pcoa-%s-biplot.pdf".printf(method));
 		if ( is_version_at_least(1,5) || output.pipeline.to_string() == "mothur" ) {
-			output.add_rulef("pcoa/pcoa-%s-biplot.pdf: mapping.txt otu_table_auto.tab headers.txt\n\t@echo Computing PCoA analysis using method '%s'\n\t$(V)aq-pcoa -i otu_table_auto.tab -o pcoa -m mapping.txt -e mapping.extra -t headers.txt -d %s", method, method, method);
+			output.add_rulef("pcoa/pcoa-%s-biplot.pdf: mapping.txt otu_table_auto.tab headers.txt%s\n\t@echo Computing PCoA analysis using method '%s'\n\t$(V)aq-pcoa -i otu_table_auto.tab -o pcoa -m mapping.txt -e mapping.extra -t headers.txt -d %s%s", method, matrix, method, method, matrix_flag);
 		} else {
-				output.add_rulef("pcoa/pcoa-%s-biplot.pdf: mapping.txt otu_table_auto.txt headers.txt\n\t@echo Computing PCoA analysis using method '%s'\n\t$(V)aq-pcoa -i otu_table_auto.txt -o pcoa -m mapping.txt -e mapping.extra -t headers.txt -d %s", method, method, method);
+				output.add_rulef("pcoa/pcoa-%s-biplot.pdf: mapping.txt otu_table_auto.txt headers.txt%s\n\t@echo Computing PCoA analysis using method '%s'\n\t$(V)aq-pcoa -i otu_table_auto.txt -o pcoa -m mapping.txt -e mapping.extra -t headers.txt -d %s%s", method, matrix, method, method, matrix_flag);
 		}
 		if (ellipsoid_conf != null) {
 				output.add_rulef(" -p %s", ellipsoid_conf);
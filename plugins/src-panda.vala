@@ -47,6 +47,7 @@ class AXIOME.Sources.PandaSource : BaseSource {
 		}
 
 		bool dashj = false;
+		bool streaming = false;
 		bool dashsix;
 		bool domagic;
 		bool convert;
@@ -73,22 +74,38 @@ class AXIOME.Sources.PandaSource : BaseSource {
 			return false;
 		}
 
+		var oldforward = forward;
+		var oldreverse = reverse;
 		if (convert) {
-			var oldforward = forward;
-			var oldreverse = reverse;
-			forward = "pandaseq/converted%x_1.fastq.bz2".printf(oldforward.hash());
-			reverse = "pandaseq/converted%x_2.fastq.bz2".printf(oldreverse.hash());
-			output.add_rule(@"$(forward): $(oldforward)\n\t@echo Coverting Illumina 1.3 file $(forward)...\n\t@test -d pandaseq || mkdir pandaseq\n\t$$(V)$(FileCompression.for_file(oldforward).get_cat()) $(oldforward) | aq-oldillumina2fastq > $(forward)\n\n$(reverse): $(oldreverse)\n\t@echo Coverting Illumina 1.3 file $(forward)...\n\t$$(V)$(FileCompression.for_file(oldreverse).get_cat()) $(oldreverse) | aq-oldillumina2fastq > $(reverse)\n\n");
+			/* Normally, the converted reads are streamed into PANDAseq through named pipes so nothing is written to disk. If the converted files are to be kept, they are compressed in parallel. */
+			var keep = definition-> get_prop("convert") == "keep";
+			forward = "pandaseq/converted%x_1.fastq%s".printf(oldforward.hash(), keep ? ".bz2" : "");
+			reverse = "pandaseq/converted%x_2.fastq%s".printf(oldreverse.hash(), keep ? ".bz2" : "");
+			var forwardconvert = "aq-oldillumina2fastq%s -f %s".printf(FileCompression.for_file(oldforward) == FileCompression.BZIP ? " -j" : "", Shell.quote(oldforward));
+			var reverseconvert = "aq-oldillumina2fastq%s -f %s".printf(FileCompression.for_file(oldreverse) == FileCompression.BZIP ? " -j" : "", Shell.quote(oldreverse));
+			if (keep) {
+				output.add_rule(@"$(forward): $(oldforward)\n\t@echo Coverting Illumina 1.3 file $(oldforward)...\n\t@test -d pandaseq || mkdir pandaseq\n\t$$(V)$(forwardconvert) -c bzip2 -t $$(or $$(NUM_CORES),1) -o $(forward)\n\n$(reverse): $(oldreverse)\n\t@echo Coverting Illumina 1.3 file $(oldreverse)...\n\t@test -d pandaseq || mkdir pandaseq\n\t$$(V)$(reverseconvert) -c bzip2 -t $$(or $$(NUM_CORES),1) -o $(reverse)\n\n");
+				dashj = true;
+			} else {
+				/* The pipes are made as part of the command, rather than by rules, so that they are not prerequisites of seq.fasta whose times make would compare. */
+				command.append_printf("{ test -d pandaseq || mkdir pandaseq; } && rm -f %s %s && mkfifo %s %s || exit 1; ", Shell.quote(forward), Shell.quote(reverse), Shell.quote(forward), Shell.quote(reverse));
+				command.append_printf("%s > %s & forwardpid=$$!; %s > %s & reversepid=$$!; ", forwardconvert, Shell.quote(forward), reverseconvert, Shell.quote(reverse));
+				streaming = true;
+			}
 			domagic = false;
-			dashj = true;
 		}
 
 		if (domagic) {
 			dashj = FileCompression.for_file(forward) == FileCompression.BZIP;
 		}
 
-		output.add_sequence_source(forward);
-		output.add_sequence_source(reverse);
+		if (streaming) {
+			output.add_sequence_source(oldforward);
+			output.add_sequence_source(oldreverse);
+		} else {
+			output.add_sequence_source(forward);
+			output.add_sequence_source(reverse);
+		}
 		command.append_printf("pandaseq $(PANDA_FLAGS) -N -f %s -r %s", Shell.quote(forward), Shell.quote(reverse));
 
 		if (dashj) {
@@ -122,6 +139,10 @@ class AXIOME.Sources.PandaSource : BaseSource {
 			}
 			first = false;
 		}
+		if (streaming) {
+			/* If PANDAseq fails, the converters may never have their pipes opened, so stop them rather than wait forever. The command fails if any of the three does. */
+			command.append("; status=$$?; test $$status -eq 0 || kill $$forwardpid $$reversepid 2> /dev/null; wait $$forwardpid || status=1; wait $$reversepid || status=1; exit $$status");
+		}
 		return true;
 	}
 	void add_primer(StringBuilder command, Xml.Node *definition, string name, char arg) {
@@ -0,0 +1,116 @@
+/* A fixed set of worker threads that run queued jobs */
+#include<pthread.h>
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include "pool.h"
+
+typedef struct pooljob {
+	void (*func) (void *);
+	void *data;
+	struct pooljob *next;
+} pooljob;
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pooljob *first;
+	pooljob *last;
+	bool shutdown;
+	int threads;
+	pthread_t *workers;
+};
+
+static void *pool_worker(void *data)
+{
+	pool *p = data;
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		pooljob *job;
+		while (p->first == NULL && !p->shutdown) {
+			pthread_cond_wait(&p->ready, &p->lock);
+		}
+		if (p->first == NULL) {
+			break;
+		}
+		job = p->first;
+		p->first = job->next;
+		if (p->first == NULL) {
+			p->last = NULL;
+		}
+		pthread_mutex_unlock(&p->lock);
+		job->func(job->data);
+		free(job);
+		pthread_mutex_lock(&p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+pool *pool_new(int threads)
+{
+	int i;
+	pool *p = calloc(1, sizeof(pool));
+	if (p == NULL) {
+		return NULL;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	p->workers = calloc(threads, sizeof(pthread_t));
+	if (p->workers == NULL) {
+		free(p);
+		return NULL;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->ready, NULL);
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&p->workers[i], NULL, pool_worker, p) != 0) {
+			break;
+		}
+	}
+	p->threads = i;
+	if (p->threads == 0) {
+		pool_free(p);
+		return NULL;
+	}
+	return p;
+}
+
+void pool_submit(pool *p, void (*func) (void *), void *data)
+{
+	pooljob *job = malloc(sizeof(pooljob));
+	if (job == NULL) {
+		/* Running it here is slower, but still correct. */
+		func(data);
+		return;
+	}
+	job->func = func;
+	job->data = data;
+	job->next = NULL;
+	pthread_mutex_lock(&p->lock);
+	if (p->last == NULL) {
+		p->first = job;
+	} else {
+		p->last->next = job;
+	}
+	p->last = job;
+	pthread_cond_signal(&p->ready);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pool_free(pool *p)
+{
+	int i;
+	pthread_mutex_lock(&p->lock);
+	p->shutdown = true;
+	pthread_cond_broadcast(&p->ready);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->threads; i++) {
+		pthread_join(p->workers[i], NULL);
+	}
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->ready);
+	free(p->workers);
+	free(p);
+}
@@ -0,0 +1,13 @@
+/* A fixed set of worker threads that run queued jobs */
+#ifndef AXIOME_POOL_H
+#define AXIOME_POOL_H
+
+typedef struct pool pool;
+
+/* Start a pool with the given number of worker threads. */
+pool *pool_new(int threads);
+/* Queue a job. Jobs are started in the order they are submitted. Callers are responsible for noticing when their jobs are done. */
+void pool_submit(pool *p, void (*func) (void *), void *data);
+/* Run any queued jobs, then stop the workers and free the pool. */
+void pool_free(pool *p);
+#endif
@@ -0,0 +1,411 @@
+/* Run several quality analyses on an Illumina FASTQ read in a single pass */
+#include<ctype.h>
+#include<errno.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "bases.h"
+#include "fastq.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "qualstats.h"
+#include "tagerror.h"
+#include "textbuf.h"
+
+/* Counts of reads by number of uncalled bases. */
+typedef struct {
+	unsigned long *counts;
+	size_t length;
+	size_t size;
+} nhistogram;
+
+/*
+ * Each analysis writes exactly what the stand-alone tool does:
+ *   N histogram: aq-count-n's standard output
+ *   position statistics: aq-qualhisto's standard error
+ *   read statistics: aq-qualhisto's standard output
+ *   flow cell matrices: aq-qualhisto -m
+ *   tag error estimate: aq-estimateq's standard output
+ */
+typedef struct {
+	FILE *nhist;
+	FILE *positions;
+	FILE *xystat;
+	const char *matrix_prefix;
+	FILE *estimate;
+	tagmatcher *matcher;
+
+	/* Totals, only touched by the writer. */
+	nhistogram nhist_counts;
+	qualstats stats;
+	flowcellgrid grid;
+	tagerrors errors;
+	bool failed;
+} qc;
+
+typedef struct {
+	uint32_t x;
+	uint32_t y;
+	qualread read;
+} qcread;
+
+typedef struct {
+	nhistogram nhist_counts;
+	qualstats stats;
+	textbuf xystat;
+	qcread *reads;
+	size_t read_count;
+	size_t read_size;
+	textbuf estimate_log;
+	tagerrors errors;
+	bool failed;
+} qcbatch;
+
+/* Add to a bucket, growing the histogram as needed. */
+static bool histogram_add(nhistogram *histogram, size_t bucket,
+			  unsigned long count)
+{
+	if (bucket >= histogram->size) {
+		size_t size = histogram->size < 64 ? 64 : histogram->size;
+		unsigned long *bigger;
+		while (size <= bucket) {
+			size *= 2;
+		}
+		bigger = realloc(histogram->counts, size * sizeof(unsigned long));
+		if (bigger == NULL) {
+			return false;
+		}
+		memset(bigger + histogram->size, 0,
+		       (size - histogram->size) * sizeof(unsigned long));
+		histogram->counts = bigger;
+		histogram->size = size;
+	}
+	if (bucket >= histogram->length) {
+		histogram->length = bucket + 1;
+	}
+	histogram->counts[bucket] += count;
+	return true;
+}
+
+static bool qc_record(qc *q, qcbatch *output, const fastqrecord *seq)
+{
+	seqheader id;
+	qualread read;
+	if (q->nhist != NULL) {
+		size_t count = bases_count(seq->seq, seq->qual_len, 'N');
+		if (!histogram_add(&output->nhist_counts, count, 1)) {
+			return false;
+		}
+	}
+	if (q->positions == NULL && q->xystat == NULL
+	    && q->matrix_prefix == NULL && q->estimate == NULL) {
+		return true;
+	}
+	if (seqheader_parse(&id, seq->name, seq->name_len) != SEQID_OK) {
+		return true;
+	}
+	if (q->positions != NULL || q->xystat != NULL
+	    || q->matrix_prefix != NULL) {
+		if (!qualstats_add(&output->stats, seq, &read)) {
+			return false;
+		}
+		if (q->xystat != NULL
+		    && !textbuf_printf(&output->xystat,
+				       "%u\t%u\t%d\t%d\t%f\t%f\t%d\n", id.x,
+				       id.y, read.uncalled, read.length,
+				       read.mean, read.variance, read.bcliff)) {
+			return false;
+		}
+		if (q->matrix_prefix != NULL) {
+			qcread *placed = &output->reads[output->read_count++];
+			placed->x = id.x;
+			placed->y = id.y;
+			placed->read = read;
+		}
+	}
+	if (q->estimate != NULL) {
+		size_t taglen = tagmatcher_length(q->matcher);
+		size_t t;
+		/* As in aq-estimateq, a tag of the wrong length is reported once for each tag. */
+		for (t = 0; id.tag.length != taglen
+		     && t < tagmatcher_count(q->matcher); t++) {
+			if (!textbuf_printf(&output->estimate_log,
+					    "Tags specified are of length %d, but tag in file has length %d. Skipping.\n",
+					    (int)taglen, (int)id.tag.length)) {
+				return false;
+			}
+		}
+		if (!tagerrors_add(&output->errors, q->matcher, &id, seq->name)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void qc_release(void *state)
+{
+	qcbatch *output = state;
+	free(output->nhist_counts.counts);
+	qualstats_free(&output->stats);
+	textbuf_free(&output->xystat);
+	free(output->reads);
+	textbuf_free(&output->estimate_log);
+	tagerrors_free(&output->errors);
+	free(output);
+}
+
+static void qc_work(fastqbatch *batch, void *context)
+{
+	qc *q = context;
+	qcbatch *output = batch->state;
+	size_t i;
+	if (output == NULL) {
+		output = calloc(1, sizeof(qcbatch));
+		if (output == NULL) {
+			return;
+		}
+		batch->state = output;
+	}
+	if (output->nhist_counts.length > 0) {
+		memset(output->nhist_counts.counts, 0,
+		       output->nhist_counts.length * sizeof(unsigned long));
+		output->nhist_counts.length = 0;
+	}
+	qualstats_clear(&output->stats);
+	output->xystat.len = 0;
+	output->read_count = 0;
+	output->estimate_log.len = 0;
+	tagerrors_clear(&output->errors);
+	output->failed = false;
+	if (q->matrix_prefix != NULL && output->read_size < batch->count) {
+		free(output->reads);
+		output->reads = calloc(batch->count, sizeof(qcread));
+		output->read_size = output->reads == NULL ? 0 : batch->count;
+		if (output->reads == NULL) {
+			output->failed = true;
+			return;
+		}
+	}
+	for (i = 0; i < batch->count; i++) {
+		if (!qc_record(q, output, &batch->records[i])) {
+			output->failed = true;
+			return;
+		}
+	}
+}
+
+static void qc_commit(fastqbatch *batch, void *context)
+{
+	qc *q = context;
+	qcbatch *output = batch->state;
+	size_t i;
+	if (output == NULL || output->failed
+	    || !qualstats_merge(&q->stats, &output->stats)
+	    || !tagerrors_merge(&q->errors, &output->errors)) {
+		q->failed = true;
+		return;
+	}
+	for (i = 0; i < output->nhist_counts.length; i++) {
+		if (output->nhist_counts.counts[i] > 0
+		    && !histogram_add(&q->nhist_counts, i,
+				      output->nhist_counts.counts[i])) {
+			q->failed = true;
+			return;
+		}
+	}
+	for (i = 0; i < output->read_count; i++) {
+		if (!flowcell_add(&q->grid, output->reads[i].x,
+				  output->reads[i].y, &output->reads[i].read)) {
+			q->failed = true;
+			return;
+		}
+	}
+	if (q->xystat != NULL) {
+		fwrite(output->xystat.data, 1, output->xystat.len, q->xystat);
+	}
+	if (q->estimate != NULL) {
+		fwrite(output->estimate_log.data, 1, output->estimate_log.len,
+		       q->estimate);
+	}
+}
+
+/* Open an output file; - is standard output. */
+static FILE *qc_open(const char *filename)
+{
+	FILE *f;
+	if (strcmp(filename, "-") == 0) {
+		return stdout;
+	}
+	f = fopen(filename, "w");
+	if (f == NULL) {
+		perror(filename);
+		exit(1);
+	}
+	return f;
+}
+
+static bool qc_close(FILE *f)
+{
+	if (f == NULL) {
+		return true;
+	}
+	if (f == stdout) {
+		return fflush(f) == 0;
+	}
+	return fclose(f) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	bool bzip = false;
+	int threads = 1;
+	char *filename = NULL;
+	inputfile *file;
+	qc q;
+	pipelinestages stages = { qc_work, qc_commit, qc_release };
+	size_t i;
+	bool ok;
+
+	memset(&q, 0, sizeof(q));
+	q.grid.bin_size = 100;
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "b:e:f:jm:n:p:t:x:")) != -1) {
+		switch (c) {
+		case 'b':
+			q.grid.bin_size = atoi(optarg);
+			break;
+		case 'e':
+			q.estimate = qc_open(optarg);
+			break;
+		case 'f':
+			filename = optarg;
+			break;
+		case 'j':
+			bzip = true;
+			break;
+		case 'm':
+			q.matrix_prefix = optarg;
+			break;
+		case 'n':
+			q.nhist = qc_open(optarg);
+			break;
+		case 'p':
+			q.positions = qc_open(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'x':
+			q.xystat = qc_open(optarg);
+			break;
+		case '?':
+			if (strchr("befmnptx", optopt) != NULL) {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+
+	if (filename == NULL || q.grid.bin_size < 1
+	    || (q.estimate != NULL && optind == argc)) {
+		fprintf(stderr,
+			"Usage: %s [-j] [-t threads] [-n nhist] [-p posnhist] [-x xystat] [-m prefix [-b binsize]] [-e estimate tag1 tag2 ...] -f file.fastq\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use.\n\t-n\tWrite the histogram of uncalled bases per read, as aq-count-n.\n\t-p\tWrite the statistics per position, as aq-qualhisto does to standard error.\n\t-x\tWrite the statistics per read, as aq-qualhisto does to standard output.\n\t-m\tWrite flow cell matrices, as aq-qualhisto -m.\n\t-b\tSize of the flow cell matrix bins (default 100).\n\t-e\tEstimate the error rate from the tags given, as aq-estimateq.\nAn output of - is standard output.\n",
+			argv[0]);
+		return 1;
+	}
+
+	if (q.estimate != NULL) {
+		for (c = optind + 1; c < argc; c++) {
+			if (strlen(argv[c]) != strlen(argv[optind])) {
+				fprintf(stderr,
+					"Primer %s is not of the same length.\n",
+					argv[c]);
+				return 1;
+			}
+		}
+		q.matcher =
+		    tagmatcher_new((const char *const *)argv + optind,
+				   argc - optind);
+		if (q.matcher == NULL) {
+			if (errno == EINVAL) {
+				fprintf(stderr,
+					"Tags must be at most %d long.\n",
+					TAGMATCH_MAX_LENGTH);
+			} else {
+				perror(argv[0]);
+			}
+			return 1;
+		}
+		fprintf(q.estimate, "PRIMERS = %d\nTAGLEN = %d\n",
+			argc - optind, (int)tagmatcher_length(q.matcher));
+	}
+	if (q.xystat != NULL) {
+		fprintf(q.xystat, "#x	y	n	len	qbar	qsd	bcliff\n");
+	}
+
+	/* Open files and initialise FASTQ reader. */
+	file = input_open(filename, bzip, threads);
+	if (file == NULL) {
+		perror(filename);
+		return 1;
+	}
+	ok = pipeline_run(file, threads, &stages, &q);
+	if (!input_close(file)) {
+		perror(filename);
+		ok = false;
+	} else if (!ok) {
+		fprintf(stderr, "%s: Malformed FASTQ record.\n", filename);
+	}
+	if (q.failed) {
+		fprintf(stderr, "Out of memory.\n");
+		ok = false;
+	}
+
+	if (q.nhist != NULL) {
+		for (i = 0; i < q.nhist_counts.length; i++) {
+			fprintf(q.nhist, "%d	%lu\n", (int)i,
+				q.nhist_counts.counts[i]);
+		}
+	}
+	if (q.positions != NULL) {
+		qualstats_print(&q.stats, q.positions);
+	}
+	if (q.matrix_prefix != NULL && !q.failed
+	    && !flowcell_write(&q.grid, q.matrix_prefix)) {
+		perror(q.matrix_prefix);
+		ok = false;
+	}
+	if (q.estimate != NULL) {
+		tagerrors_print(&q.errors, q.matcher, q.estimate);
+	}
+	/* Every file is closed, even if an earlier one fails. */
+	if (!(qc_close(q.nhist) & qc_close(q.positions)
+	      & qc_close(q.xystat) & qc_close(q.estimate))) {
+		perror(argv[0]);
+		ok = false;
+	}
+
+	free(q.nhist_counts.counts);
+	qualstats_free(&q.stats);
+	flowcell_free(&q.grid);
+	tagerrors_free(&q.errors);
+	if (q.matcher != NULL) {
+		tagmatcher_free(q.matcher);
+	}
+	return ok ? 0 : 1;
+}
@@ -1,71 +1,224 @@
 /* Produce a sumary of quality information per site in an Illumina FASTQ read */
-#include<bzlib.h>
 #include<ctype.h>
 #include<errno.h>
 #if !defined(__APPLE__)
 #include<error.h>
 #endif
 #include<fcntl.h>
+#include<stdbool.h>
+#include<stdint.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 #include<sys/stat.h>
 #include<time.h>
 #include<unistd.h>
-#include<zlib.h>
-#include "kseq.h"
+#include "fastq.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "qualstats.h"
+#include "textbuf.h"
 
-/* Function pointers for file I/O such that we can deal with compressed files. */
-void *(*fileopen) (char *, char *) = (void *(*)(char *, char *))gzopen;
-int (*fileread) (void *, void *, int) = (int (*)(void *, void *, int))gzread;
-int (*fileclose) (void *) = (int (*)(void *))gzclose;
+/* Binary per-read statistics start with this, followed by records of seven little-endian 32-bit values: x, y, uncalled bases, length, mean quality (float), quality variance (float) and masked length. */
+#define XYSTAT_MAGIC "AQXYSTA1"
 
-/* Compatibility function to make BZ2_bzRead look like gzread. */
-int bzread(BZFILE * file, void *buf, int len)
+typedef enum {
+	XYSTAT_TEXT,
+	XYSTAT_BINARY,
+	XYSTAT_NONE
+} xystatformat;
+
+typedef struct {
+	xystatformat format;
+	qualstats total;
+	/* Only kept if matrix_prefix is set. */
+	const char *matrix_prefix;
+	flowcellgrid grid;
+	bool failed;
+} qualhisto;
+
+typedef struct {
+	uint32_t x;
+	uint32_t y;
+	qualread read;
+} flowcellread;
+
+/* Each batch gets its own statistics, which are folded into the total in input order, so the results do not depend on how many threads there are. */
+typedef struct {
+	qualstats stats;
+	textbuf xystat;
+	/* The reads to place on the flow cell; binning them is cheap enough to leave to the writer. */
+	flowcellread *reads;
+	size_t read_count;
+	size_t read_size;
+	bool failed;
+} qualbatch;
+
+/* Append a 32-bit value in little-endian order. */
+static bool put_uint32(textbuf *buf, uint32_t value)
+{
+	char bytes[4];
+	bytes[0] = value & 0xFF;
+	bytes[1] = (value >> 8) & 0xFF;
+	bytes[2] = (value >> 16) & 0xFF;
+	bytes[3] = (value >> 24) & 0xFF;
+	return textbuf_append(buf, bytes, 4);
+}
+
+static bool put_float(textbuf *buf, double value)
+{
+	float f = value;
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return put_uint32(buf, bits);
+}
+
+static bool write_xystat(qualhisto *q, textbuf *buf, const seqheader *id,
+			 const qualread *read)
+{
+	switch (q->format) {
+	case XYSTAT_TEXT:
+		return textbuf_printf(buf, "%u\t%u\t%d\t%d\t%f\t%f\t%d\n",
+				      id->x, id->y, read->uncalled,
+				      read->length, read->mean,
+				      read->variance, read->bcliff);
+	case XYSTAT_BINARY:
+		return put_uint32(buf, id->x) && put_uint32(buf, id->y)
+		    && put_uint32(buf, read->uncalled)
+		    && put_uint32(buf, read->length)
+		    && put_float(buf, read->mean)
+		    && put_float(buf, read->variance)
+		    && put_uint32(buf, read->bcliff);
+	default:
+		return true;
+	}
+}
+
+static void qualhisto_release(void *state)
+{
+	qualbatch *output = state;
+	qualstats_free(&output->stats);
+	textbuf_free(&output->xystat);
+	free(output->reads);
+	free(output);
+}
+
+static void qualhisto_work(fastqbatch *batch, void *context)
 {
-	int bzerror = BZ_OK;
-	int retval = BZ2_bzRead(&bzerror, file, buf, len);
-	if (bzerror == BZ_OK || bzerror == BZ_STREAM_END) {
-		return retval;
-	} else {
-		fprintf(stderr, "bzip error %d\n", bzerror);
-		return -1;
+	qualhisto *q = context;
+	qualbatch *output = batch->state;
+	size_t i;
+	if (output == NULL) {
+		output = calloc(1, sizeof(qualbatch));
+		if (output == NULL) {
+			return;
+		}
+		batch->state = output;
+	}
+	qualstats_clear(&output->stats);
+	output->xystat.len = 0;
+	output->read_count = 0;
+	output->failed = false;
+	if (q->matrix_prefix != NULL && output->read_size < batch->count) {
+		free(output->reads);
+		output->reads = calloc(batch->count, sizeof(flowcellread));
+		output->read_size = output->reads == NULL ? 0 : batch->count;
+		if (output->reads == NULL) {
+			output->failed = true;
+			return;
+		}
+	}
+	for (i = 0; i < batch->count; i++) {
+		fastqrecord *seq = &batch->records[i];
+		seqheader id;
+		qualread read;
+		if (seqheader_parse(&id, seq->name, seq->name_len) != SEQID_OK)
+			continue;
+		if (!qualstats_add(&output->stats, seq, &read)
+		    || !write_xystat(q, &output->xystat, &id, &read)) {
+			output->failed = true;
+			return;
+		}
+		if (q->matrix_prefix != NULL) {
+			flowcellread *placed =
+			    &output->reads[output->read_count++];
+			placed->x = id.x;
+			placed->y = id.y;
+			placed->read = read;
+		}
 	}
 }
 
-KSEQ_INIT(void *, fileread)
-#define MAXNT 512
-int degen_c[MAXNT];
-int degen_n[MAXNT];
-int n[MAXNT];
-double mean[MAXNT];
-double m2[MAXNT];
+static void qualhisto_commit(fastqbatch *batch, void *context)
+{
+	qualhisto *q = context;
+	qualbatch *output = batch->state;
+	size_t i;
+	if (output == NULL || output->failed
+	    || !qualstats_merge(&q->total, &output->stats)) {
+		q->failed = true;
+		return;
+	}
+	for (i = 0; i < output->read_count; i++) {
+		if (!flowcell_add(&q->grid, output->reads[i].x,
+				  output->reads[i].y, &output->reads[i].read)) {
+			q->failed = true;
+			return;
+		}
+	}
+	fwrite(output->xystat.data, 1, output->xystat.len, stdout);
+}
 
 int main(int argc, char **argv)
 {
 	int c;
 	int bzip = 0;
+	int threads = 1;
 	char *filename = NULL;
-	void *file;
-	kseq_t *seq;
-	int len;
-	int i;
-	int maxn;
+	inputfile *file;
+	qualhisto q;
+	pipelinestages stages =
+	    { qualhisto_work, qualhisto_commit, qualhisto_release };
+	bool ok;
 
+	memset(&q, 0, sizeof(q));
+	q.format = XYSTAT_TEXT;
+	q.grid.bin_size = 100;
 	/* Process command line arguments. */
-	while ((c = getopt(argc, argv, "jf:")) != -1) {
+	while ((c = getopt(argc, argv, "b:jf:m:t:x:")) != -1) {
 		switch (c) {
+		case 'b':
+			q.grid.bin_size = atoi(optarg);
+			break;
 		case 'j':
-			fileopen = (void *(*)(char *, char *))BZ2_bzopen;
-			fileread = (int (*)(void *, void *, int))bzread;
-			fileclose = (int (*)(void *))BZ2_bzclose;
 			bzip = 1;
 			break;
+		case 'm':
+			q.matrix_prefix = optarg;
+			break;
 		case 'f':
 			filename = optarg;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'x':
+			if (strcmp(optarg, "text") == 0) {
+				q.format = XYSTAT_TEXT;
+			} else if (strcmp(optarg, "binary") == 0) {
+				q.format = XYSTAT_BINARY;
+			} else if (strcmp(optarg, "none") == 0) {
+				q.format = XYSTAT_NONE;
+			} else {
+				fprintf(stderr, "Unknown format `%s'.\n",
+					optarg);
+				return 1;
+			}
+			break;
 		case '?':
-			if (optopt == (int)'f') {
+			if (optopt == (int)'b' || optopt == (int)'f'
+			    || optopt == (int)'m' || optopt == (int)'t'
+			    || optopt == (int)'x') {
 				fprintf(stderr,
 					"Option -%c requires an argument.\n",
 					optopt);
@@ -83,73 +236,43 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (filename == NULL) {
+	if (filename == NULL || q.grid.bin_size < 1) {
 		fprintf(stderr,
-			"Usage: %s [-j] -f file.fastq\n\t-j\tInput files are bzipped.\n",
+			"Usage: %s [-j] [-t threads] [-x text|binary|none] [-m prefix [-b binsize]] -f file.fastq\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use.\n\t-x\tFormat of the per-read statistics on standard output.\n\t-m\tWrite flow cell matrices to prefix.nmatrix, prefix.bmatrix, prefix.qmatrix and prefix.cntmatrix.\n\t-b\tSize of the flow cell matrix bins (default 100).\n",
 			argv[0]);
 		return 1;
 	}
 
 	/* Open files and initialise FASTQ reader. */
-	file = fileopen(filename, "r");
+	file = input_open(filename, bzip, threads);
 	if (file == NULL) {
 		perror(filename);
 		return 1;
 	}
-	seq = kseq_init(file);
-
-	for (i = 0; i < MAXNT; i++) {
-		degen_n[i] = 0;
-		degen_c[i] = 0;
-		n[i] = 0;
-		mean[i] = 0;
-		m2[i] = 0;
-	}
 
-	printf("#x	y	n	len	qbar	qsd	bcliff\n");
-	while ((len = kseq_read(seq)) >= 0) {
-		int ncnt = 0;
-		double seqmean = 0;
-		double seqm2 = 0;
-		int bclifflen = 0;
-		seqidentifier id;
-
-		if (seqid_parse(&id, seq->name.s) == 0)
-			continue;
-
-		for (i = 0; i < seq->seq.l; i++) {
-			degen_n[i]++;
-			if (seq->seq.s[i] == 'N') {
-				ncnt++;
-				degen_c[i]++;
-			}
-		}
-
-		for (i = (seq->qual.l > MAXNT ? MAXNT : seq->qual.l) - 1; i > 0 && (seq->qual.s[i] == 'B' || seq->qual.s[i] == '#'); i--) bclifflen++;
-		for (; i > 0; i--) {
-			double delta;
-			double seqdelta;
-			n[i]++;
-
-			delta = seq->qual.s[i] - '@' - mean[i];
-			seqdelta = seq->qual.s[i] - '@' - seqmean;
-			mean[i] += delta / n[i];
-			seqmean += seqdelta / (i + 1);
-			m2[i] += delta * (seq->qual.s[i] - '@' - mean[i]);
-			seqm2 += seqdelta * (seq->qual.s[i] - '@' - seqmean);
-		}
-		printf("%d\t%d\t%d\t%d\t%f\t%f\t%d\n", id.x, id.y, ncnt, (int)seq->seq.l, seqmean, seqm2 / (seq->seq.l - 1), bclifflen);
-	}
-	kseq_destroy(seq);
-
-	for (maxn = MAXNT; maxn > 0 && n[maxn-1] == 0; maxn--);
-
-	for (i = 0; i < maxn; i++) {
-		double variance_n = m2[i] / n[i];
-		fprintf(stderr, "%d\t%f\t%f\t%f\n", i, mean[i], m2[i] / (n[i] - 1), degen_c[i]*1.0 / degen_n[i]);
+	if (q.format == XYSTAT_TEXT) {
+		printf("#x	y	n	len	qbar	qsd	bcliff\n");
+	} else if (q.format == XYSTAT_BINARY) {
+		fwrite(XYSTAT_MAGIC, 1, strlen(XYSTAT_MAGIC), stdout);
 	}
-	if (fileclose(file) != Z_OK && bzip == 0) {
+	ok = pipeline_run(file, threads, &stages, &q);
+	if (!input_close(file)) {
 		perror(filename);
+		ok = false;
+	} else if (!ok) {
+		fprintf(stderr, "%s: Malformed FASTQ record.\n", filename);
+	}
+	if (q.failed) {
+		fprintf(stderr, "Out of memory.\n");
+		ok = false;
+	}
+	qualstats_print(&q.total, stderr);
+	qualstats_free(&q.total);
+	if (q.matrix_prefix != NULL && !q.failed
+	    && !flowcell_write(&q.grid, q.matrix_prefix)) {
+		perror(q.matrix_prefix);
+		ok = false;
 	}
-	return 0;
+	flowcell_free(&q.grid);
+	return ok ? 0 : 1;
 }
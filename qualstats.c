@@ -0,0 +1,270 @@
+/* Per-position quality statistics for Illumina reads */
+#include<stdlib.h>
+#include<string.h>
+#include "bases.h"
+#include "qualstats.h"
+
+static bool qualstats_reserve(qualstats *stats, size_t length)
+{
+	qualposition *bigger;
+	size_t size;
+	if (length <= stats->size) {
+		return true;
+	}
+	size = stats->size < 256 ? 256 : stats->size;
+	while (size < length) {
+		size *= 2;
+	}
+	bigger = realloc(stats->positions, size * sizeof(qualposition));
+	if (bigger == NULL) {
+		return false;
+	}
+	memset(bigger + stats->size, 0,
+	       (size - stats->size) * sizeof(qualposition));
+	stats->positions = bigger;
+	stats->size = size;
+	return true;
+}
+
+bool qualstats_add(qualstats *stats, const fastqrecord *record,
+		   qualread *read)
+{
+	const char *seq = record->seq;
+	const char *qual = record->qual;
+	double seqmean = 0;
+	double seqm2 = 0;
+	int i;
+
+	if (!qualstats_reserve(stats, record->seq_len)
+	    || !qualstats_reserve(stats, record->qual_len)) {
+		return false;
+	}
+	read->uncalled = 0;
+	read->length = record->seq_len;
+	read->bcliff = 0;
+	if (record->seq_len > 0) {
+		stats->positions[record->seq_len - 1].ending++;
+	}
+	/* Uncalled bases are rare, so find them a block at a time and only touch the positions that have one. */
+	for (i = 0; i < record->seq_len; i += 64) {
+		uint64_t mask = bases_mask(seq + i, record->seq_len - i, 'N');
+		read->uncalled += __builtin_popcountll(mask);
+		while (mask != 0) {
+			stats->positions[i + __builtin_ctzll(mask)].uncalled++;
+			mask &= mask - 1;
+		}
+	}
+
+	/* Position 0 is never counted and the per-read mean is weighted by position, as aq-qualhisto always has; the heat maps depend on it. */
+	for (i = (int)record->qual_len - 1;
+	     i > 0 && (qual[i] == 'B' || qual[i] == '#'); i--)
+		read->bcliff++;
+	for (; i > 0; i--) {
+		qualposition *position = &stats->positions[i];
+		double value = qual[i] - '@';
+		double delta;
+		double seqdelta;
+		position->count++;
+
+		delta = value - position->mean;
+		seqdelta = value - seqmean;
+		position->mean += delta / position->count;
+		seqmean += seqdelta / (i + 1);
+		position->m2 += delta * (value - position->mean);
+		seqm2 += seqdelta * (value - seqmean);
+	}
+	read->mean = seqmean;
+	read->variance = seqm2 / (read->length - 1);
+	if (record->seq_len > stats->length) {
+		stats->length = record->seq_len;
+	}
+	if (record->qual_len > stats->length) {
+		stats->length = record->qual_len;
+	}
+	return true;
+}
+
+bool qualstats_merge(qualstats *into, const qualstats *from)
+{
+	size_t i;
+	if (!qualstats_reserve(into, from->length)) {
+		return false;
+	}
+	for (i = 0; i < from->length; i++) {
+		qualposition *a = &into->positions[i];
+		const qualposition *b = &from->positions[i];
+		a->ending += b->ending;
+		a->uncalled += b->uncalled;
+		if (b->count == 0) {
+			continue;
+		}
+		if (a->count == 0) {
+			a->count = b->count;
+			a->mean = b->mean;
+			a->m2 = b->m2;
+		} else {
+			uint64_t count = a->count + b->count;
+			double delta = b->mean - a->mean;
+			a->mean += delta * b->count / count;
+			a->m2 +=
+			    b->m2 +
+			    delta * delta * ((double)a->count * b->count) /
+			    count;
+			a->count = count;
+		}
+	}
+	if (from->length > into->length) {
+		into->length = from->length;
+	}
+	return true;
+}
+
+void qualstats_clear(qualstats *stats)
+{
+	if (stats->positions != NULL) {
+		memset(stats->positions, 0,
+		       stats->length * sizeof(qualposition));
+	}
+	stats->length = 0;
+}
+
+void qualstats_print(const qualstats *stats, FILE *output)
+{
+	size_t length;
+	size_t i;
+	uint64_t bases = 0;
+	/* Positions past the last quality seen are left off. */
+	for (length = stats->length;
+	     length > 0 && stats->positions[length - 1].count == 0; length--) ;
+	/* The number of bases at a position is the number of reads that end there or later. */
+	for (i = 0; i < stats->length; i++) {
+		bases += stats->positions[i].ending;
+	}
+	for (i = 0; i < length; i++) {
+		const qualposition *position = &stats->positions[i];
+		fprintf(output, "%d\t%f\t%f\t%f\n", (int)i, position->mean,
+			position->m2 / ((double)position->count - 1),
+			position->uncalled * 1.0 / bases);
+		bases -= position->ending;
+	}
+}
+
+void qualstats_free(qualstats *stats)
+{
+	free(stats->positions);
+	stats->positions = NULL;
+	stats->length = 0;
+	stats->size = 0;
+}
+
+/* Make room for the bin (x, y), moving the existing rows if the grid gets taller. */
+static bool flowcell_reserve(flowcellgrid *grid, size_t x, size_t y)
+{
+	flowcellbin *bins;
+	size_t width_size = grid->width_size < 64 ? 64 : grid->width_size;
+	size_t height_size = grid->height_size < 64 ? 64 : grid->height_size;
+	size_t row;
+	if (x < grid->width_size && y < grid->height_size) {
+		return true;
+	}
+	while (width_size <= x) {
+		width_size *= 2;
+	}
+	while (height_size <= y) {
+		height_size *= 2;
+	}
+	bins = calloc(width_size * height_size, sizeof(flowcellbin));
+	if (bins == NULL) {
+		return false;
+	}
+	for (row = 0; row < grid->width; row++) {
+		memcpy(bins + row * height_size,
+		       grid->bins + row * grid->height_size,
+		       grid->height * sizeof(flowcellbin));
+	}
+	free(grid->bins);
+	grid->bins = bins;
+	grid->width_size = width_size;
+	grid->height_size = height_size;
+	return true;
+}
+
+bool flowcell_add(flowcellgrid *grid, uint32_t x, uint32_t y,
+		  const qualread *read)
+{
+	size_t bx = x / grid->bin_size;
+	size_t by = y / grid->bin_size;
+	flowcellbin *bin;
+	if (!flowcell_reserve(grid, bx, by)) {
+		return false;
+	}
+	if (bx >= grid->width) {
+		grid->width = bx + 1;
+	}
+	if (by >= grid->height) {
+		grid->height = by + 1;
+	}
+	bin = &grid->bins[bx * grid->height_size + by];
+	bin->reads++;
+	bin->uncalled += read->uncalled;
+	bin->bcliff += read->bcliff;
+	bin->quality += read->mean;
+	return true;
+}
+
+bool flowcell_write(const flowcellgrid *grid, const char *prefix)
+{
+	static const char *suffixes[] =
+	    { ".nmatrix", ".bmatrix", ".qmatrix", ".cntmatrix" };
+	int matrix;
+	for (matrix = 0; matrix < 4; matrix++) {
+		char filename[FILENAME_MAX];
+		FILE *f;
+		size_t x, y;
+		snprintf(filename, FILENAME_MAX, "%s%s", prefix,
+			 suffixes[matrix]);
+		f = fopen(filename, "w");
+		if (f == NULL) {
+			return false;
+		}
+		for (x = 0; x < grid->width; x++) {
+			for (y = 0; y < grid->height; y++) {
+				const flowcellbin *bin =
+				    &grid->bins[x * grid->height_size + y];
+				double value;
+				switch (matrix) {
+				case 0:
+					value = bin->uncalled;
+					break;
+				case 1:
+					value = bin->bcliff;
+					break;
+				case 2:
+					value = bin->quality;
+					break;
+				default:
+					fprintf(f, " %llu",
+						(unsigned long long)bin->reads);
+					continue;
+				}
+				fprintf(f, " %f",
+					bin->reads == 0 ? 0 : value / bin->reads);
+			}
+			fprintf(f, "\n");
+		}
+		if (fclose(f) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void flowcell_free(flowcellgrid *grid)
+{
+	free(grid->bins);
+	grid->bins = NULL;
+	grid->width = 0;
+	grid->height = 0;
+	grid->width_size = 0;
+	grid->height_size = 0;
+}
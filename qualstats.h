@@ -0,0 +1,72 @@
+/* Per-position quality statistics for Illumina reads */
+#ifndef AXIOME_QUALSTATS_H
+#define AXIOME_QUALSTATS_H
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include "fastq.h"
+
+/* Running statistics for one position in the reads. Qualities are tracked with Welford's method, so separate accumulators can be merged. */
+typedef struct {
+	uint64_t count;
+	double mean;
+	double m2;
+	/* Reads whose sequence ends here. */
+	uint64_t ending;
+	uint64_t uncalled;
+} qualposition;
+
+/* A zero-filled qualstats is empty and ready to use. It grows to fit the longest read seen. */
+typedef struct {
+	qualposition *positions;
+	size_t length;
+	size_t size;
+} qualstats;
+
+/* Summary of a single read. */
+typedef struct {
+	int uncalled;
+	int length;
+	double mean;
+	double variance;
+	/* Length of the quality-masked (B or #) region at the end of the read. */
+	int bcliff;
+} qualread;
+
+/* Add a read's qualities to the statistics and summarise it. Returns false if memory runs out. */
+bool qualstats_add(qualstats *stats, const fastqrecord *record,
+		   qualread *read);
+/* Combine the statistics in from into into, using Chan et al.'s pairwise update. */
+bool qualstats_merge(qualstats *into, const qualstats *from);
+/* Empty the statistics without freeing them. */
+void qualstats_clear(qualstats *stats);
+/* Write one line per position: position, mean quality, quality variance and fraction of uncalled bases. */
+void qualstats_print(const qualstats *stats, FILE *output);
+void qualstats_free(qualstats *stats);
+
+/* Reads pooled over all tiles into bin_size by bin_size squares of the flow cell. */
+typedef struct {
+	uint64_t reads;
+	double uncalled;
+	double bcliff;
+	double quality;
+} flowcellbin;
+
+/* Set bin_size and zero the rest to get an empty grid. It grows to fit the largest coordinates seen. */
+typedef struct {
+	unsigned int bin_size;
+	flowcellbin *bins;
+	size_t width;
+	size_t height;
+	size_t width_size;
+	size_t height_size;
+} flowcellgrid;
+
+bool flowcell_add(flowcellgrid *grid, uint32_t x, uint32_t y,
+		  const qualread *read);
+/*
+ * Write the mean uncalled bases, mean masked length, mean quality and read count of each bin to prefix.nmatrix, prefix.bmatrix, prefix.qmatrix and prefix.cntmatrix, respectively, one row per x bin. Returns false and sets errno on failure.
+ */
+bool flowcell_write(const flowcellgrid *grid, const char *prefix);
+void flowcell_free(flowcellgrid *grid);
+#endif
@@ -0,0 +1,534 @@
+/* Subsample an OTU table to even library sizes */
+#include<ctype.h>
+#include<errno.h>
+#include<math.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "otutable.h"
+#include "pool.h"
+#include "textbuf.h"
+
+/* A table to write: the number of sequences to keep in each sample and where to put the result. */
+typedef struct {
+	uint64_t depth;
+	/* Use the smallest library as the depth. */
+	bool automatic;
+	const char *pattern;
+} rarefytarget;
+
+/* The OTUs drawn from one sample for one target and replicate. */
+typedef struct {
+	uint32_t *otus;
+	uint64_t *counts;
+	size_t count;
+	/* Samples with fewer sequences than the depth are left out. */
+	bool present;
+} rarefydraw;
+
+/* The work of subsampling one sample to every depth. */
+typedef struct {
+	const otutable *table;
+	size_t sample;
+	uint64_t seed;
+	const rarefytarget *targets;
+	size_t target_count;
+	size_t replicates;
+	/* For each target, each replicate's draw. */
+	rarefydraw *draws;
+	bool ok;
+} samplejob;
+
+/* The finishing step of splitmix64, which scrambles a number well. */
+static uint64_t mix(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/* A uniform number in [0, 1). */
+static double uniform(uint64_t *state)
+{
+	*state += 0x9E3779B97F4A7C15ULL;
+	return (mix(*state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double lchoose(double n, double k)
+{
+	return lgamma(n + 1) - lgamma(k + 1) - lgamma(n - k + 1);
+}
+
+/*
+ * Draw how many of the good items are picked when picking draws items, without replacement, from good + bad items. This inverts the distribution searching outwards from the mode, so it takes time in proportion to the spread of the distribution, not the number of items.
+ */
+static uint64_t hypergeometric(uint64_t *state, uint64_t good, uint64_t bad,
+			       uint64_t draws)
+{
+	uint64_t low = draws > bad ? draws - bad : 0;
+	uint64_t high = draws < good ? draws : good;
+	uint64_t mode;
+	uint64_t up;
+	uint64_t down;
+	double p_up;
+	double p_down;
+	double u;
+	if (low == high) {
+		return low;
+	}
+	mode =
+	    (uint64_t) (((double)draws + 1) * ((double)good + 1) /
+			((double)good + (double)bad + 2));
+	if (mode < low) {
+		mode = low;
+	} else if (mode > high) {
+		mode = high;
+	}
+	p_up = p_down =
+	    exp(lchoose(good, mode) + lchoose(bad, draws - mode) -
+		lchoose((double)good + bad, draws));
+	u = uniform(state) - p_up;
+	if (u <= 0) {
+		return mode;
+	}
+	up = down = mode;
+	for (;;) {
+		bool moved = false;
+		if (up < high) {
+			p_up *=
+			    ((double)good - up) * ((double)draws - up) /
+			    (((double)up + 1) * ((double)bad - draws + up + 1));
+			up++;
+			u -= p_up;
+			if (u <= 0) {
+				return up;
+			}
+			moved = true;
+		}
+		if (down > low) {
+			p_down *=
+			    (double)down * ((double)bad - draws + down) /
+			    (((double)good - down + 1) * ((double)draws - down + 1));
+			down--;
+			u -= p_down;
+			if (u <= 0) {
+				return down;
+			}
+			moved = true;
+		}
+		/* Rounding can leave a little probability unaccounted for. */
+		if (!moved) {
+			return mode;
+		}
+	}
+}
+
+/* Counts are whole numbers, but may have been written with decimal places. */
+static uint64_t whole(double count)
+{
+	return count <= 0 ? 0 : (uint64_t) (count + 0.5);
+}
+
+static uint64_t library_size(const otutable *table, size_t sample)
+{
+	const uint32_t *otus;
+	const double *counts;
+	size_t count = otutable_column(table, sample, &otus, &counts);
+	uint64_t total = 0;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		total += whole(counts[i]);
+	}
+	return total;
+}
+
+/*
+ * Draw each OTU's share in turn: the first OTU's is hypergeometric, given the whole library; the next is hypergeometric, given what is left; and so on. This is the same as picking sequences one at a time, without making a list of them.
+ */
+static void sample_work(void *data)
+{
+	samplejob *job = data;
+	const uint32_t *otus;
+	const double *counts;
+	size_t count = otutable_column(job->table, job->sample, &otus, &counts);
+	uint64_t library = library_size(job->table, job->sample);
+	size_t t;
+	size_t r;
+	size_t i;
+	for (t = 0; t < job->target_count; t++) {
+		for (r = 0; r < job->replicates; r++) {
+			rarefydraw *draw = &job->draws[t * job->replicates + r];
+			uint64_t remaining = library;
+			uint64_t wanted = job->targets[t].depth;
+			uint64_t state;
+			draw->present = library >= wanted;
+			if (!draw->present) {
+				continue;
+			}
+			draw->otus = malloc((count + 1) * sizeof(uint32_t));
+			draw->counts = malloc((count + 1) * sizeof(uint64_t));
+			if (draw->otus == NULL || draw->counts == NULL) {
+				job->ok = false;
+				return;
+			}
+			/* Each sample, depth and replicate gets its own stream, so the result does not depend on the threads or on the other targets. */
+			state =
+			    mix(mix(mix(job->seed ^ wanted) ^ (r + 1)) ^ job->sample);
+			for (i = 0; i < count && wanted > 0; i++) {
+				uint64_t good = whole(counts[i]);
+				uint64_t drawn =
+				    hypergeometric(&state, good, remaining - good,
+						   wanted);
+				if (drawn > 0) {
+					draw->otus[draw->count] = otus[i];
+					draw->counts[draw->count] = drawn;
+					draw->count++;
+				}
+				remaining -= good;
+				wanted -= drawn;
+			}
+		}
+	}
+	job->ok = true;
+}
+
+/* Fill in %d with the depth and %r with the replicate. */
+static char *expand_pattern(const char *pattern, uint64_t depth,
+			    size_t replicate)
+{
+	size_t len = strlen(pattern) + 1;
+	const char *c;
+	char *name;
+	char *pos;
+	for (c = pattern; *c != '\0'; c++) {
+		if (*c == '%') {
+			len += 3 * sizeof(uint64_t);
+		}
+	}
+	name = malloc(len);
+	if (name == NULL) {
+		return NULL;
+	}
+	for (c = pattern, pos = name; *c != '\0'; c++) {
+		if (c[0] == '%' && c[1] == 'd') {
+			pos += sprintf(pos, "%llu", (unsigned long long)depth);
+			c++;
+		} else if (c[0] == '%' && c[1] == 'r') {
+			pos += sprintf(pos, "%zu", replicate);
+			c++;
+		} else if (c[0] == '%' && c[1] == '%') {
+			*pos++ = '%';
+			c++;
+		} else {
+			*pos++ = *c;
+		}
+	}
+	*pos = '\0';
+	return name;
+}
+
+/* Write the rarefied table for one target and replicate, with only the samples that had enough sequences. */
+static bool write_table(const otutable *table, const samplejob *jobs,
+			size_t index, bool keep_empty, FILE *file)
+{
+	size_t otu_count = otutable_otu_count(table);
+	size_t sample_count = otutable_sample_count(table);
+	size_t *row_starts;
+	uint32_t *row_samples;
+	uint64_t *row_counts;
+	size_t *kept;
+	size_t kept_count = 0;
+	size_t entries = 0;
+	char zero[OTUTABLE_NUMBER_SIZE];
+	char number[OTUTABLE_NUMBER_SIZE];
+	size_t zero_len;
+	textbuf line;
+	bool ok = true;
+	size_t otu;
+	size_t s;
+	size_t i;
+
+	/* Turn the draws, which are by sample, into rows. Each OTU is counted two places along, so that filling the rows moves each start into place. */
+	row_starts = calloc(otu_count + 2, sizeof(size_t));
+	kept = malloc((sample_count + 1) * sizeof(size_t));
+	if (row_starts == NULL || kept == NULL) {
+		free(row_starts);
+		free(kept);
+		return false;
+	}
+	for (s = 0; s < sample_count; s++) {
+		const rarefydraw *draw = &jobs[s].draws[index];
+		if (!draw->present) {
+			continue;
+		}
+		kept[kept_count++] = s;
+		for (i = 0; i < draw->count; i++) {
+			row_starts[draw->otus[i] + 2]++;
+		}
+		entries += draw->count;
+	}
+	for (otu = 0; otu < otu_count; otu++) {
+		row_starts[otu + 2] += row_starts[otu + 1];
+	}
+	row_samples = malloc((entries + 1) * sizeof(uint32_t));
+	row_counts = malloc((entries + 1) * sizeof(uint64_t));
+	if (row_samples == NULL || row_counts == NULL) {
+		free(row_starts);
+		free(kept);
+		free(row_samples);
+		free(row_counts);
+		return false;
+	}
+	for (s = 0; s < kept_count; s++) {
+		const rarefydraw *draw = &jobs[kept[s]].draws[index];
+		for (i = 0; i < draw->count; i++) {
+			size_t place = row_starts[draw->otus[i] + 1]++;
+			row_samples[place] = s;
+			row_counts[place] = draw->counts[i];
+		}
+	}
+
+	memset(&line, 0, sizeof(line));
+	otutable_format(table, 0, zero);
+	for (i = 0; i < otutable_comment_count(table); i++) {
+		fprintf(file, "%s\n", otutable_comment(table, i));
+	}
+	fputs(otutable_id_column(table), file);
+	for (s = 0; s < kept_count; s++) {
+		fprintf(file, "\t%s", otutable_sample(table, kept[s]));
+	}
+	if (otutable_lineage_column(table) != NULL) {
+		fprintf(file, "\t%s", otutable_lineage_column(table));
+	}
+	fputc('\n', file);
+	/* Most counts are zero, so each line is built up in memory rather than printed piece by piece. */
+	zero_len = strlen(zero);
+	for (otu = 0; ok && otu < otu_count; otu++) {
+		size_t next = row_starts[otu];
+		const char *lineage = otutable_lineage(table, otu);
+		if (next == row_starts[otu + 1] && !keep_empty) {
+			continue;
+		}
+		line.len = 0;
+		ok = textbuf_append(&line, otutable_otu(table, otu),
+				    strlen(otutable_otu(table, otu)));
+		for (s = 0; ok && s < kept_count; s++) {
+			if (next < row_starts[otu + 1] && row_samples[next] == s) {
+				otutable_format(table, row_counts[next++], number);
+				ok = textbuf_putc(&line, '\t')
+				    && textbuf_append(&line, number, strlen(number));
+			} else {
+				ok = textbuf_putc(&line, '\t')
+				    && textbuf_append(&line, zero, zero_len);
+			}
+		}
+		ok = ok && (lineage == NULL || (textbuf_putc(&line, '\t')
+						&& textbuf_append(&line, lineage,
+								  strlen
+								  (lineage))))
+		    && textbuf_putc(&line, '\n');
+		if (ok) {
+			fwrite(line.data, 1, line.len, file);
+		} else {
+			errno = ENOMEM;
+		}
+	}
+	textbuf_free(&line);
+	free(row_starts);
+	free(kept);
+	free(row_samples);
+	free(row_counts);
+	return ok && !ferror(file);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int threads = 1;
+	uint64_t seed = 1;
+	long replicates = 1;
+	bool keep_empty = false;
+	const char *input;
+	otutable *table;
+	unsigned long line;
+	rarefytarget *targets;
+	size_t target_count;
+	size_t sample_count;
+	samplejob *jobs;
+	pool *workers;
+	int result = 0;
+	size_t s;
+	size_t t;
+	long r;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "kr:s:t:")) != -1) {
+		switch (c) {
+		case 'k':
+			keep_empty = true;
+			break;
+		case 'r':
+			replicates = atol(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case '?':
+			if (optopt == (int)'r' || optopt == (int)'s'
+			    || optopt == (int)'t') {
+				fprintf(stderr,
+					"Option -%c requires an argument.\n",
+					optopt);
+			} else if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+	if (argc - optind < 2 || threads < 1 || replicates < 1) {
+		fprintf(stderr,
+			"Usage: %s [-k] [-r replicates] [-s seed] [-t threads] otu_table depth:output [depth:output ...]\n\t-k\tKeep OTUs that have no sequences left.\n\t-r\tThe number of tables to make at each depth. The default is 1.\n\t-s\tThe seed for the random numbers. The default is 1.\n\t-t\tThe number of threads to use.\n\tThe depth may be `auto' for the smallest library. In the output name, %%d is replaced by the depth and %%r by the replicate number.\n",
+			argv[0]);
+		return 1;
+	}
+	input = argv[optind];
+	target_count = argc - optind - 1;
+	targets = calloc(target_count, sizeof(rarefytarget));
+	if (targets == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	for (t = 0; t < target_count; t++) {
+		const char *arg = argv[optind + 1 + t];
+		const char *colon = strchr(arg, ':');
+		char *end;
+		if (colon == NULL || colon[1] == '\0') {
+			fprintf(stderr, "Bad target `%s'. It must be depth:output.\n",
+				arg);
+			return 1;
+		}
+		targets[t].pattern = colon + 1;
+		if (strncmp(arg, "auto:", 5) == 0) {
+			targets[t].automatic = true;
+		} else {
+			targets[t].depth = strtoull(arg, &end, 10);
+			if (end != colon || !isdigit(*arg)) {
+				fprintf(stderr, "Bad depth in `%s'.\n", arg);
+				return 1;
+			}
+		}
+		if (replicates > 1 && strstr(targets[t].pattern, "%r") == NULL) {
+			fprintf(stderr,
+				"The output `%s' must include %%r to hold more than one replicate.\n",
+				targets[t].pattern);
+			return 1;
+		}
+	}
+
+	table = otutable_load(input, &line);
+	if (table == NULL) {
+		if (errno == EINVAL && line > 0) {
+			fprintf(stderr, "%s:%lu: Malformed OTU table.\n", input,
+				line);
+		} else {
+			perror(input);
+		}
+		return 1;
+	}
+	sample_count = otutable_sample_count(table);
+	/* The smallest library, so no sample is left out. */
+	for (t = 0; t < target_count; t++) {
+		if (!targets[t].automatic) {
+			continue;
+		}
+		targets[t].depth = sample_count == 0 ? 0 : UINT64_MAX;
+		for (s = 0; s < sample_count; s++) {
+			uint64_t size = library_size(table, s);
+			if (size < targets[t].depth) {
+				targets[t].depth = size;
+			}
+		}
+	}
+
+	/* Every sample is drawn at every depth at once, spread over the threads. */
+	jobs = calloc(sample_count + 1, sizeof(samplejob));
+	workers = pool_new(threads);
+	if (jobs == NULL || workers == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (s = 0; s < sample_count; s++) {
+		jobs[s].table = table;
+		jobs[s].sample = s;
+		jobs[s].seed = seed;
+		jobs[s].targets = targets;
+		jobs[s].target_count = target_count;
+		jobs[s].replicates = replicates;
+		jobs[s].draws =
+		    calloc(target_count * replicates, sizeof(rarefydraw));
+		if (jobs[s].draws == NULL) {
+			perror(argv[0]);
+			return 1;
+		}
+		pool_submit(workers, sample_work, &jobs[s]);
+	}
+	pool_free(workers);
+	for (s = 0; s < sample_count; s++) {
+		if (!jobs[s].ok) {
+			errno = ENOMEM;
+			perror(argv[0]);
+			return 1;
+		}
+	}
+
+	for (t = 0; t < target_count; t++) {
+		for (r = 0; r < replicates; r++) {
+			char *name =
+			    expand_pattern(targets[t].pattern, targets[t].depth,
+					   r + 1);
+			FILE *file;
+			if (name == NULL) {
+				perror(argv[0]);
+				return 1;
+			}
+			file = strcmp(name, "-") == 0 ? stdout : fopen(name, "w");
+			if (file == NULL) {
+				perror(name);
+				result = 1;
+			} else if (!write_table(table, jobs, t * replicates + r,
+					       keep_empty, file)
+				   | ((file == stdout ? fflush(file) :
+				       fclose(file)) != 0)) {
+				perror(name);
+				result = 1;
+			}
+			free(name);
+		}
+	}
+
+	for (s = 0; s < sample_count; s++) {
+		for (t = 0; t < target_count * replicates; t++) {
+			free(jobs[s].draws[t].otus);
+			free(jobs[s].draws[t].counts);
+		}
+		free(jobs[s].draws);
+	}
+	free(jobs);
+	free(targets);
+	otutable_free(table);
+	return result;
+}
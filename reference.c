@@ -0,0 +1,807 @@
+/* Find reads that closely match any of a set of reference sequences */
+#include<ctype.h>
+#include<errno.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include "input.h"
+#include "reference.h"
+
+#define WORD_MASK ((UINT32_C(1) << (2 * REFERENCE_KMER)) - 1)
+/* The index is bucketed by the first eight bases of each word. */
+#define BUCKET_SHIFT (2 * REFERENCE_KMER - 16)
+
+typedef struct {
+	uint32_t start;
+	uint32_t length;
+} refentry;
+
+/* A word of a reference, found at slot * REFERENCE_KMER. */
+typedef struct {
+	uint32_t word;
+	uint32_t slot;
+	uint32_t ref;
+} slotentry;
+
+/* All the references are stored end to end in data, upper-cased; a position is an offset into it. */
+struct referenceset {
+	double rate;
+	referencemode mode;
+	char *data;
+	size_t data_len;
+	size_t data_size;
+	refentry *refs;
+	size_t count;
+	size_t size;
+	/* The same references, shortest first. */
+	refentry *by_length;
+	/* Every word in the references, as word << 32 | position, sorted. */
+	uint64_t *words;
+	size_t word_count;
+	/* Where each bucket of words starts. */
+	uint32_t *buckets;
+	/* References shorter than a read must match its start, so their words are also indexed by where they fall in the reference, sorted by word then slot. */
+	slotentry *slots;
+	size_t slot_count;
+	/* A bit for every word, set if it is in slots, since most are not. */
+	uint8_t *slot_words;
+	/* References with too few whole words to be found that way, shortest first. */
+	refentry *unseeded;
+	size_t unseeded_count;
+	/* Some reference has something other than A, C, G or T. */
+	bool ambiguous;
+};
+
+/* A place a read might align: its first base against position diagonal of reference ref. */
+typedef struct {
+	int64_t diagonal;
+	uint32_t ref;
+} candidate;
+
+/* A word of the read, at offset, and the range of the index where it occurs. */
+typedef struct {
+	size_t offset;
+	size_t first;
+	size_t count;
+} seed;
+
+struct referencescratch {
+	candidate *candidates;
+	size_t candidate_size;
+	uint32_t *hits;
+	size_t hit_size;
+	seed *seeds;
+	size_t seed_size;
+	/* For Myers' algorithm: a bit vector per character of where it occurs in the pattern, and the vertical deltas of the current column. */
+	uint64_t *peq;
+	uint64_t *pv;
+	uint64_t *mv;
+	size_t words;
+};
+
+static int word_code(char c)
+{
+	switch (c) {
+	case 'A':
+		return 0;
+	case 'C':
+		return 1;
+	case 'G':
+		return 2;
+	case 'T':
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+/* Pack the word at the start of seq. Returns false if it has anything other than A, C, G or T. */
+static bool word_pack(const char *seq, uint32_t *word)
+{
+	size_t i;
+	*word = 0;
+	for (i = 0; i < REFERENCE_KMER; i++) {
+		int code = word_code(seq[i]);
+		if (code < 0) {
+			return false;
+		}
+		*word = (*word << 2) | code;
+	}
+	return true;
+}
+
+/* The largest whole number of errors that is fewer than bound. */
+static int error_limit(double bound)
+{
+	int limit = (int)bound;
+	return limit < bound ? limit : limit - 1;
+}
+
+referenceset *reference_new(double rate, referencemode mode)
+{
+	referenceset *set = calloc(1, sizeof(referenceset));
+	if (set == NULL) {
+		return NULL;
+	}
+	set->rate = rate;
+	set->mode = mode;
+	return set;
+}
+
+/* Start a new, empty reference. */
+static bool reference_begin(referenceset *set)
+{
+	if (set->count == set->size) {
+		size_t size = set->size < 64 ? 64 : 2 * set->size;
+		refentry *bigger = realloc(set->refs, size * sizeof(refentry));
+		if (bigger == NULL) {
+			return false;
+		}
+		set->refs = bigger;
+		set->size = size;
+	}
+	set->refs[set->count].start = set->data_len;
+	set->refs[set->count].length = 0;
+	set->count++;
+	return true;
+}
+
+/* Append bases to the last reference. */
+static bool reference_extend(referenceset *set, const char *seq, size_t len)
+{
+	size_t i;
+	if (len > UINT32_MAX - set->data_len) {
+		errno = EFBIG;
+		return false;
+	}
+	if (set->data_size - set->data_len < len) {
+		size_t size = set->data_size < 65536 ? 65536 : set->data_size;
+		char *bigger;
+		while (size - set->data_len < len) {
+			size *= 2;
+		}
+		bigger = realloc(set->data, size);
+		if (bigger == NULL) {
+			return false;
+		}
+		set->data = bigger;
+		set->data_size = size;
+	}
+	for (i = 0; i < len; i++) {
+		set->data[set->data_len++] = toupper((unsigned char)seq[i]);
+	}
+	set->refs[set->count - 1].length += len;
+	return true;
+}
+
+bool reference_add(referenceset *set, const char *seq, size_t len)
+{
+	return reference_begin(set) && reference_extend(set, seq, len);
+}
+
+bool reference_load(referenceset *set, const char *filename)
+{
+	inputfile *file = input_open(filename, false, 1);
+	const char *line;
+	size_t len;
+	int result = 0;
+	bool in_sequence = false;
+	bool ok = true;
+	if (file == NULL) {
+		return false;
+	}
+	while (ok && (result = input_line(file, &line, &len)) > 0) {
+		if (len > 0 && *line == '>') {
+			ok = in_sequence = reference_begin(set);
+		} else if (len > 0) {
+			if (in_sequence) {
+				ok = reference_extend(set, line, len);
+			} else {
+				errno = EINVAL;
+				ok = false;
+			}
+		}
+	}
+	if (ok && result < 0) {
+		errno = EIO;
+		ok = false;
+	}
+	if (!input_close(file) && ok) {
+		errno = EIO;
+		ok = false;
+	}
+	return ok;
+}
+
+/* The reference containing a position. */
+static uint32_t reference_at(const referenceset *set, uint32_t position)
+{
+	size_t low = 0;
+	size_t high = set->count;
+	while (high - low > 1) {
+		size_t mid = low + (high - low) / 2;
+		if (set->refs[mid].start <= position) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+static int compare_words(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int compare_lengths(const void *a, const void *b)
+{
+	const refentry *x = a;
+	const refentry *y = b;
+	return x->length < y->length ? -1 : x->length > y->length;
+}
+
+static int compare_slots(const void *a, const void *b)
+{
+	const slotentry *x = a;
+	const slotentry *y = b;
+	if (x->word != y->word) {
+		return x->word < y->word ? -1 : 1;
+	}
+	return x->slot < y->slot ? -1 : x->slot > y->slot;
+}
+
+bool reference_index(referenceset *set)
+{
+	size_t r;
+	size_t i;
+	set->by_length = malloc((set->count + 1) * sizeof(refentry));
+	set->words = malloc((set->data_len + 1) * sizeof(uint64_t));
+	if (set->by_length == NULL || set->words == NULL) {
+		return false;
+	}
+	memcpy(set->by_length, set->refs, set->count * sizeof(refentry));
+	qsort(set->by_length, set->count, sizeof(refentry), compare_lengths);
+
+	set->word_count = 0;
+	for (r = 0; r < set->count; r++) {
+		const char *seq = set->data + set->refs[r].start;
+		uint32_t word = 0;
+		size_t valid = 0;
+		for (i = 0; i < set->refs[r].length; i++) {
+			int code = word_code(seq[i]);
+			if (code < 0) {
+				set->ambiguous = true;
+				valid = 0;
+				continue;
+			}
+			word = ((word << 2) | code) & WORD_MASK;
+			if (++valid >= REFERENCE_KMER) {
+				set->words[set->word_count++] =
+				    (uint64_t) word << 32 | (set->refs[r].start +
+							     i + 1 -
+							     REFERENCE_KMER);
+			}
+		}
+	}
+	qsort(set->words, set->word_count, sizeof(uint64_t), compare_words);
+	/* One spare bucket past the end, so the word after the last one has somewhere to look. */
+	set->buckets =
+	    malloc(((WORD_MASK >> BUCKET_SHIFT) + 3) * sizeof(uint32_t));
+	if (set->buckets == NULL) {
+		return false;
+	}
+	for (r = 0, i = 0; r <= (WORD_MASK >> BUCKET_SHIFT) + 2; r++) {
+		while (i < set->word_count
+		       && (set->words[i] >> 32 >> BUCKET_SHIFT) < r) {
+			i++;
+		}
+		set->buckets[r] = i;
+	}
+
+	/* Each error spoils at most one whole word, so a reference with more words than it may have errors always has one that matches the read exactly. */
+	set->slots =
+	    malloc((set->data_len / REFERENCE_KMER + 1) * sizeof(slotentry));
+	set->slot_words = calloc((WORD_MASK + 1) / 8, 1);
+	set->unseeded = malloc((set->count + 1) * sizeof(refentry));
+	if (set->slots == NULL || set->slot_words == NULL
+	    || set->unseeded == NULL) {
+		return false;
+	}
+	set->slot_count = 0;
+	set->unseeded_count = 0;
+	for (r = 0; r < set->count; r++) {
+		const refentry *ref = &set->refs[r];
+		size_t first = set->slot_count;
+		int limit = error_limit(set->rate * ref->length);
+		uint32_t slot;
+		for (slot = 0; (slot + 1) * REFERENCE_KMER <= ref->length; slot++) {
+			slotentry *entry = &set->slots[set->slot_count];
+			if (word_pack(set->data + ref->start + slot * REFERENCE_KMER,
+				      &entry->word)) {
+				entry->slot = slot;
+				entry->ref = r;
+				set->slot_count++;
+				set->slot_words[entry->word / 8] |=
+				    1 << (entry->word % 8);
+			}
+		}
+		/* Any bits set for its words are left; they only cost a search. */
+		if (limit >= 0 && set->slot_count - first <= (size_t)limit) {
+			set->slot_count = first;
+			set->unseeded[set->unseeded_count++] = *ref;
+		}
+	}
+	qsort(set->unseeded, set->unseeded_count, sizeof(refentry),
+	      compare_lengths);
+	qsort(set->slots, set->slot_count, sizeof(slotentry), compare_slots);
+	return true;
+}
+
+size_t reference_count(const referenceset *set)
+{
+	return set->count;
+}
+
+/* The first entry in the index at or after the word. */
+static size_t word_find(const referenceset *set, uint32_t word)
+{
+	uint64_t key = (uint64_t) word << 32;
+	size_t low = set->buckets[word >> BUCKET_SHIFT];
+	size_t high = set->buckets[(word >> BUCKET_SHIFT) + 1];
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (set->words[mid] < key) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/* Whether a and b, both len long, differ at no more than limit places. */
+static bool within_substitutions(const char *a, const char *b, size_t len,
+				 int limit)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (a[i] != b[i] && --limit < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool scratch_reserve(referencescratch *scratch, size_t words)
+{
+	uint64_t *peq;
+	if (words <= scratch->words) {
+		return true;
+	}
+	peq = calloc(256 * words, sizeof(uint64_t));
+	if (peq == NULL) {
+		return false;
+	}
+	free(scratch->peq);
+	free(scratch->pv);
+	free(scratch->mv);
+	scratch->peq = peq;
+	scratch->pv = malloc(words * sizeof(uint64_t));
+	scratch->mv = malloc(words * sizeof(uint64_t));
+	scratch->words = scratch->pv == NULL
+	    || scratch->mv == NULL ? 0 : words;
+	return scratch->words > 0;
+}
+
+/*
+ * Myers' bit-parallel edit distance, with the pattern split into 64-base blocks as described by Hyyrö. Returns the smallest edit distance between the whole pattern and any stretch of the text or, if anchored, any prefix of it, stopping as soon as one no more than limit is seen.
+ */
+static int myers(referencescratch *scratch, const char *pattern, size_t m,
+		 const char *text, size_t n, bool anchored, int limit)
+{
+	size_t words = (m + 63) / 64;
+	uint64_t last = UINT64_C(1) << ((m - 1) % 64);
+	int score = m;
+	int best = m;
+	size_t i;
+	size_t j;
+	size_t b;
+
+	for (i = 0; i < m; i++) {
+		scratch->peq[(unsigned char)pattern[i] * words + i / 64] |=
+		    UINT64_C(1) << (i % 64);
+	}
+	for (b = 0; b < words; b++) {
+		scratch->pv[b] = ~UINT64_C(0);
+		scratch->mv[b] = 0;
+	}
+	for (j = 0; j < n && best > limit; j++) {
+		const uint64_t *eq = scratch->peq + (unsigned char)text[j] * words;
+		/* The top row is 0 everywhere for a local match, or the column number for an anchored one. */
+		int hin = anchored;
+		for (b = 0; b < words; b++) {
+			uint64_t pv = scratch->pv[b];
+			uint64_t mv = scratch->mv[b];
+			uint64_t hneg = hin < 0;
+			uint64_t top = b + 1 == words ? last : UINT64_C(1) << 63;
+			uint64_t e = eq[b] | hneg;
+			uint64_t xv = eq[b] | mv;
+			uint64_t xh = (((e & pv) + pv) ^ pv) | e;
+			uint64_t ph = mv | ~(xh | pv);
+			uint64_t mh = pv & xh;
+			int hout = ((ph & top) != 0) - ((mh & top) != 0);
+			ph = (ph << 1) | (uint64_t) (hin > 0);
+			mh = (mh << 1) | hneg;
+			scratch->pv[b] = mh | ~(xv | ph);
+			scratch->mv[b] = ph & xv;
+			hin = hout;
+		}
+		score += hin;
+		if (score < best) {
+			best = score;
+		}
+	}
+	for (i = 0; i < m; i++) {
+		scratch->peq[(unsigned char)pattern[i] * words + i / 64] = 0;
+	}
+	return best;
+}
+
+static bool scratch_candidates(referencescratch *scratch, size_t count)
+{
+	candidate *bigger;
+	size_t size;
+	if (count <= scratch->candidate_size) {
+		return true;
+	}
+	size = scratch->candidate_size < 256 ? 256 : scratch->candidate_size;
+	while (size < count) {
+		size *= 2;
+	}
+	bigger = realloc(scratch->candidates, size * sizeof(candidate));
+	if (bigger == NULL) {
+		return false;
+	}
+	scratch->candidates = bigger;
+	scratch->candidate_size = size;
+	return true;
+}
+
+static int compare_seeds(const void *a, const void *b)
+{
+	const seed *x = a;
+	const seed *y = b;
+	return x->count < y->count ? -1 : x->count > y->count;
+}
+
+static int compare_candidates(const void *a, const void *b)
+{
+	const candidate *x = a;
+	const candidate *y = b;
+	if (x->ref != y->ref) {
+		return x->ref < y->ref ? -1 : 1;
+	}
+	return x->diagonal < y->diagonal ? -1 : x->diagonal > y->diagonal;
+}
+
+/* Whether the read lies within one of the references at least as long as it, checking every placement. */
+static bool match_all(const referenceset *set, referencescratch *scratch,
+		      const char *seq, size_t len, size_t first, int limit)
+{
+	size_t r;
+	for (r = first; r < set->count; r++) {
+		const refentry *ref = &set->by_length[r];
+		const char *text = set->data + ref->start;
+		size_t i;
+		if (set->mode == REFERENCE_EDIT) {
+			if (myers(scratch, seq, len, text, ref->length, false,
+				  limit) <= limit) {
+				return true;
+			}
+			continue;
+		}
+		for (i = 0; i + len <= ref->length; i++) {
+			if (within_substitutions(seq, text + i, len, limit)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/* Check the placements suggested by the seeds. */
+static bool match_candidates(const referenceset *set,
+			     referencescratch *scratch, const char *seq,
+			     size_t len, size_t count, int limit)
+{
+	size_t i;
+	qsort(scratch->candidates, count, sizeof(candidate),
+	      compare_candidates);
+	for (i = 0; i < count; i++) {
+		const candidate *c = &scratch->candidates[i];
+		const refentry *ref = &set->refs[c->ref];
+		int64_t start = ref->start;
+		int64_t end = start + ref->length;
+		/* Shorter references have already been compared with the start of the read. */
+		if (ref->length < len || (i > 0 && c->ref == c[-1].ref
+					  && c->diagonal == c[-1].diagonal)) {
+			continue;
+		}
+		if (set->mode == REFERENCE_EDIT) {
+			/* An exact word is out of place by at most one base per error, so the alignment starts within limit of the diagonal and ends within limit of where the read would without errors. */
+			int64_t low = c->diagonal - limit;
+			int64_t high = c->diagonal + (int64_t) len + 2 * limit;
+			if (low < start) {
+				low = start;
+			}
+			if (high > end) {
+				high = end;
+			}
+			if (myers(scratch, seq, len, set->data + low, high - low,
+				  false, limit) <= limit) {
+				return true;
+			}
+		} else if (c->diagonal >= start
+			   && c->diagonal + (int64_t) len <= end
+			   && within_substitutions(seq,
+						   set->data + c->diagonal,
+						   len, limit)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* The first of the references, sorted by length, at least len long. */
+static size_t first_length(const refentry *refs, size_t count, size_t len)
+{
+	size_t low = 0;
+	size_t high = count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (refs[mid].length < len) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/* The first slot entry at or after word and slot. */
+static size_t slot_find(const referenceset *set, uint32_t word, uint32_t slot)
+{
+	size_t low = 0;
+	size_t high = set->slot_count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		const slotentry *entry = &set->slots[mid];
+		if (entry->word < word
+		    || (entry->word == word && entry->slot < slot)) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/* Whether a reference shorter than the read matches its start. */
+static bool short_matches(const referenceset *set, referencescratch *scratch,
+			  const refentry *ref, const char *seq, size_t len)
+{
+	const char *text = set->data + ref->start;
+	int limit = error_limit(set->rate * ref->length);
+	if (limit < 0) {
+		return false;
+	}
+	if (set->mode == REFERENCE_EDIT) {
+		/* The reference cannot reach further into the read than it would with every error an insertion. */
+		if (len > ref->length + limit) {
+			len = ref->length + limit;
+		}
+		return myers(scratch, text, ref->length, seq, len, true,
+			     limit) <= limit;
+	}
+	return within_substitutions(text, seq, ref->length, limit);
+}
+
+static int compare_hits(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Check the references shorter than the read. Any of them with no more errors than it may have has a word in the same place in the read or, allowing for insertions and deletions, no more than that many bases away.
+ */
+static bool match_short(const referenceset *set, referencescratch *scratch,
+			const char *seq, size_t len, bool *matched)
+{
+	int limit = error_limit(set->rate * len);
+	size_t hits = 0;
+	size_t step = set->mode == REFERENCE_EDIT ? 1 : REFERENCE_KMER;
+	size_t position;
+	size_t e;
+	size_t i;
+
+	for (i = 0; i < set->unseeded_count && set->unseeded[i].length < len;
+	     i++) {
+		if (short_matches(set, scratch, &set->unseeded[i], seq, len)) {
+			*matched = true;
+			return true;
+		}
+	}
+	if (limit < 0) {
+		limit = 0;
+	}
+	for (position = 0; position + REFERENCE_KMER <= len; position += step) {
+		uint32_t word;
+		uint32_t slot;
+		uint32_t last;
+		if (!word_pack(seq + position, &word)) {
+			continue;
+		}
+		if (set->mode == REFERENCE_EDIT) {
+			slot = position < (size_t)limit ? 0 :
+			    (position - limit + REFERENCE_KMER -
+			     1) / REFERENCE_KMER;
+			last = (position + limit) / REFERENCE_KMER;
+		} else {
+			slot = last = position / REFERENCE_KMER;
+		}
+		if ((set->slot_words[word / 8] & (1 << (word % 8))) == 0) {
+			continue;
+		}
+		for (e = slot_find(set, word, slot);
+		     e < set->slot_count && set->slots[e].word == word
+		     && set->slots[e].slot <= last; e++) {
+			uint32_t ref = set->slots[e].ref;
+			if (set->refs[ref].length >= len) {
+				continue;
+			}
+			if (hits == scratch->hit_size) {
+				size_t size = hits < 64 ? 64 : 2 * hits;
+				uint32_t *bigger = realloc(scratch->hits,
+							   size *
+							   sizeof(uint32_t));
+				if (bigger == NULL) {
+					return false;
+				}
+				scratch->hits = bigger;
+				scratch->hit_size = size;
+			}
+			scratch->hits[hits++] = ref;
+		}
+	}
+	qsort(scratch->hits, hits, sizeof(uint32_t), compare_hits);
+	for (i = 0; i < hits; i++) {
+		if ((i == 0 || scratch->hits[i] != scratch->hits[i - 1])
+		    && short_matches(set, scratch,
+				     &set->refs[scratch->hits[i]], seq, len)) {
+			*matched = true;
+			return true;
+		}
+	}
+	return true;
+}
+
+bool reference_match(const referenceset *set, referencescratch *scratch,
+		     const char *seq, size_t len, bool *matched)
+{
+	size_t words = len / REFERENCE_KMER;
+	size_t searchable = 0;
+	size_t needed;
+	size_t candidates = 0;
+	size_t r;
+	size_t s;
+	int limit;
+
+	*matched = false;
+	if (len == 0) {
+		return true;
+	}
+	if (set->mode == REFERENCE_EDIT && !scratch_reserve(scratch,
+							     (len + 63) /
+							     64)) {
+		return false;
+	}
+	if (!match_short(set, scratch, seq, len, matched)) {
+		return false;
+	}
+	limit = error_limit(set->rate * len);
+	r = first_length(set->by_length, set->count, len);
+	if (*matched || r == set->count || limit < 0) {
+		return true;
+	}
+
+	/*
+	 * Split the read into words. Each error spoils at most one of them, so if the read has no more than limit errors, any limit + 1 of the words include one that occurs exactly in the reference. If the references are all plain bases, a word with anything else in it must already hold an error, which leaves fewer errors for the rest.
+	 */
+	if (scratch->seed_size < words) {
+		seed *bigger = realloc(scratch->seeds, words * sizeof(seed));
+		if (bigger == NULL) {
+			return false;
+		}
+		scratch->seeds = bigger;
+		scratch->seed_size = words;
+	}
+	for (s = 0; s < words; s++) {
+		uint32_t word;
+		seed *sd = &scratch->seeds[searchable];
+		if (!word_pack(seq + s * REFERENCE_KMER, &word)) {
+			continue;
+		}
+		sd->offset = s * REFERENCE_KMER;
+		sd->first = word_find(set, word);
+		sd->count = word_find(set, word + 1) - sd->first;
+		searchable++;
+	}
+	if (set->ambiguous) {
+		needed = limit + 1;
+	} else if (words - searchable > (size_t)limit) {
+		return true;
+	} else {
+		needed = limit + 1 - (words - searchable);
+	}
+	if (needed > searchable) {
+		*matched = match_all(set, scratch, seq, len, r, limit);
+		return true;
+	}
+
+	/* Use the rarest words, to keep the placements to check down. */
+	qsort(scratch->seeds, searchable, sizeof(seed), compare_seeds);
+	for (s = 0; s < needed; s++) {
+		candidates += scratch->seeds[s].count;
+	}
+	if (!scratch_candidates(scratch, candidates)) {
+		return false;
+	}
+	candidates = 0;
+	for (s = 0; s < needed; s++) {
+		const seed *sd = &scratch->seeds[s];
+		size_t i;
+		for (i = sd->first; i < sd->first + sd->count; i++) {
+			uint32_t position = set->words[i] & UINT32_MAX;
+			candidate *c = &scratch->candidates[candidates++];
+			c->ref = reference_at(set, position);
+			c->diagonal = (int64_t) position - (int64_t) sd->offset;
+		}
+	}
+	*matched =
+	    match_candidates(set, scratch, seq, len, candidates, limit);
+	return true;
+}
+
+void reference_free(referenceset *set)
+{
+	free(set->data);
+	free(set->refs);
+	free(set->by_length);
+	free(set->words);
+	free(set->buckets);
+	free(set->slots);
+	free(set->slot_words);
+	free(set->unseeded);
+	free(set);
+}
+
+referencescratch *reference_scratch_new(void)
+{
+	return calloc(1, sizeof(referencescratch));
+}
+
+void reference_scratch_free(referencescratch *scratch)
+{
+	free(scratch->candidates);
+	free(scratch->hits);
+	free(scratch->seeds);
+	free(scratch->peq);
+	free(scratch->pv);
+	free(scratch->mv);
+	free(scratch);
+}
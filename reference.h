@@ -0,0 +1,39 @@
+/* Find reads that closely match any of a set of reference sequences */
+#ifndef AXIOME_REFERENCE_H
+#define AXIOME_REFERENCE_H
+#include<stdbool.h>
+#include<stddef.h>
+
+/* Reference sequences are indexed by words of this many bases. */
+#define REFERENCE_KMER 12
+
+typedef enum {
+	/* Reads are compared base for base. */
+	REFERENCE_SUBSTITUTION,
+	/* Insertions and deletions count as one error each. */
+	REFERENCE_EDIT
+} referencemode;
+
+typedef struct referenceset referenceset;
+/* Working space for matching; each thread needs its own. */
+typedef struct referencescratch referencescratch;
+
+/*
+ * A read matches a reference if it has fewer than rate times its length errors against some stretch of the reference. A reference shorter than the read must instead match the start of the read, with fewer than rate times the reference's length errors.
+ */
+referenceset *reference_new(double rate, referencemode mode);
+/* Add one sequence. Returns false and sets errno if memory runs out or the references exceed 4 gigabases. */
+bool reference_add(referenceset *set, const char *seq, size_t len);
+/* Add every sequence in a FASTA file, which may be compressed with gzip. Returns false and sets errno on failure; EINVAL means the file is not FASTA. */
+bool reference_load(referenceset *set, const char *filename);
+/* Build the index. This must be called after the last sequence is added and before the first match. */
+bool reference_index(referenceset *set);
+size_t reference_count(const referenceset *set);
+/* Check a read against the references. Returns false if memory runs out. */
+bool reference_match(const referenceset *set, referencescratch *scratch,
+		     const char *seq, size_t len, bool *matched);
+void reference_free(referenceset *set);
+
+referencescratch *reference_scratch_new(void);
+void reference_scratch_free(referencescratch *scratch);
+#endif
@@ -0,0 +1,387 @@
+/* Summarize an OTU table by taxonomic level */
+#include<ctype.h>
+#include<errno.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "otutable.h"
+#include "textbuf.h"
+
+/* A table to write: how many names of each lineage to keep and where to put the result. */
+typedef struct {
+	size_t level;
+	const char *output;
+} summarytarget;
+
+/* One name in a lineage, under the names before it. */
+typedef struct {
+	/* The taxon above, plus one, or zero at the top. */
+	size_t parent;
+	const char *name;
+	size_t name_len;
+	size_t depth;
+	/* The totals for each sample, only kept at the levels being written. */
+	double *counts;
+} taxon;
+
+/* Every lineage in the table, with lineages sharing the taxa they have in common. */
+typedef struct {
+	taxon *taxa;
+	size_t count;
+	size_t size;
+	/* The taxa, by hash of their parent and name, as their numbers plus one. */
+	size_t *slots;
+	size_t slot_count;
+	size_t sample_count;
+	/* Which depths have totals. */
+	const bool *wanted;
+} lineagetrie;
+
+/* Lineages shorter than the level asked for are filled out with this, as QIIME does. */
+static const char other[] = "Other";
+
+static uint64_t hash_taxon(size_t parent, const char *name, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL ^ parent;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)name[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool trie_rehash(lineagetrie *trie, size_t slot_count)
+{
+	size_t *slots = calloc(slot_count, sizeof(size_t));
+	size_t i;
+	if (slots == NULL) {
+		return false;
+	}
+	for (i = 0; i < trie->count; i++) {
+		const taxon *t = &trie->taxa[i];
+		size_t slot =
+		    hash_taxon(t->parent, t->name, t->name_len) & (slot_count - 1);
+		while (slots[slot] != 0) {
+			slot = (slot + 1) & (slot_count - 1);
+		}
+		slots[slot] = i + 1;
+	}
+	free(trie->slots);
+	trie->slots = slots;
+	trie->slot_count = slot_count;
+	return true;
+}
+
+/* Find a taxon under a parent, adding it if it is new. Returns the taxon's number plus one, or zero if memory ran out. */
+static size_t trie_child(lineagetrie *trie, size_t parent, const char *name,
+			 size_t len)
+{
+	taxon *t;
+	size_t slot;
+	if (4 * (trie->count + 1) > 3 * trie->slot_count
+	    && !trie_rehash(trie,
+			    trie->slot_count == 0 ? 1024 : 2 * trie->slot_count)) {
+		return 0;
+	}
+	for (slot = hash_taxon(parent, name, len) & (trie->slot_count - 1);
+	     trie->slots[slot] != 0; slot = (slot + 1) & (trie->slot_count - 1)) {
+		t = &trie->taxa[trie->slots[slot] - 1];
+		if (t->parent == parent && t->name_len == len
+		    && memcmp(t->name, name, len) == 0) {
+			return trie->slots[slot];
+		}
+	}
+	if (trie->count == trie->size) {
+		size_t size = trie->size == 0 ? 1024 : 2 * trie->size;
+		taxon *bigger = realloc(trie->taxa, size * sizeof(taxon));
+		if (bigger == NULL) {
+			return 0;
+		}
+		trie->taxa = bigger;
+		trie->size = size;
+	}
+	t = &trie->taxa[trie->count];
+	t->parent = parent;
+	t->name = name;
+	t->name_len = len;
+	t->depth = parent == 0 ? 1 : trie->taxa[parent - 1].depth + 1;
+	t->counts = NULL;
+	if (trie->wanted[t->depth]) {
+		t->counts = calloc(trie->sample_count + 1, sizeof(double));
+		if (t->counts == NULL) {
+			return 0;
+		}
+	}
+	trie->slots[slot] = ++trie->count;
+	return trie->count;
+}
+
+static void trie_free(lineagetrie *trie)
+{
+	size_t i;
+	for (i = 0; i < trie->count; i++) {
+		free(trie->taxa[i].counts);
+	}
+	free(trie->taxa);
+	free(trie->slots);
+}
+
+/*
+ * Add an OTU's counts to each taxon in its lineage at the levels wanted, going no deeper than the deepest. Names are separated by semicolons and have the spaces around them removed.
+ */
+static bool trie_add(lineagetrie *trie, const char *lineage, size_t depth,
+		     size_t entries, const uint32_t *samples,
+		     const double *counts)
+{
+	size_t parent = 0;
+	size_t level;
+	size_t i;
+	bool more = true;
+	for (level = 1; level <= depth; level++) {
+		const char *name = other;
+		size_t len = sizeof(other) - 1;
+		taxon *t;
+		if (more) {
+			const char *end = strchr(lineage, ';');
+			if (end == NULL) {
+				end = lineage + strlen(lineage);
+				more = false;
+			}
+			name = lineage;
+			lineage = more ? end + 1 : end;
+			while (name < end && isspace(*name)) {
+				name++;
+			}
+			while (end > name && isspace(end[-1])) {
+				end--;
+			}
+			len = end - name;
+		}
+		parent = trie_child(trie, parent, name, len);
+		if (parent == 0) {
+			return false;
+		}
+		t = &trie->taxa[parent - 1];
+		if (t->counts != NULL) {
+			for (i = 0; i < entries; i++) {
+				t->counts[samples[i]] += counts[i];
+			}
+		}
+	}
+	return true;
+}
+
+/* A taxon to write and its whole lineage. */
+typedef struct {
+	size_t taxon;
+	size_t name;
+} summaryrow;
+
+static const char *row_names;
+static int row_compare(const void *a, const void *b)
+{
+	return strcmp(row_names + ((const summaryrow *)a)->name,
+		      row_names + ((const summaryrow *)b)->name);
+}
+
+/* Write the totals of every taxon at a level, in order of lineage, the way summarize_taxa.py does. */
+static bool write_summary(const otutable *table, const lineagetrie *trie,
+			  size_t level, FILE *file)
+{
+	textbuf names;
+	textbuf line;
+	summaryrow *rows;
+	size_t row_count = 0;
+	size_t *path;
+	char number[OTUTABLE_NUMBER_SIZE];
+	bool ok = true;
+	size_t i;
+	size_t s;
+
+	memset(&names, 0, sizeof(names));
+	memset(&line, 0, sizeof(line));
+	rows = malloc((trie->count + 1) * sizeof(summaryrow));
+	path = malloc((level + 1) * sizeof(size_t));
+	if (rows == NULL || path == NULL) {
+		free(rows);
+		free(path);
+		errno = ENOMEM;
+		return false;
+	}
+	for (i = 0; ok && i < trie->count; i++) {
+		size_t depth = 0;
+		size_t t;
+		if (trie->taxa[i].depth != level) {
+			continue;
+		}
+		for (t = i + 1; t != 0; t = trie->taxa[t - 1].parent) {
+			path[depth++] = t - 1;
+		}
+		rows[row_count].taxon = i;
+		rows[row_count].name = names.len;
+		row_count++;
+		while (ok && depth-- > 0) {
+			const taxon *step = &trie->taxa[path[depth]];
+			ok = textbuf_append(&names, step->name, step->name_len)
+			    && textbuf_putc(&names, depth == 0 ? '\0' : ';');
+		}
+	}
+	if (ok) {
+		row_names = names.data;
+		qsort(rows, row_count, sizeof(summaryrow), row_compare);
+	}
+
+	fputs("Taxon", file);
+	for (s = 0; s < trie->sample_count; s++) {
+		fprintf(file, "\t%s", otutable_sample(table, s));
+	}
+	fputc('\n', file);
+	for (i = 0; ok && i < row_count; i++) {
+		const char *name = names.data + rows[i].name;
+		const double *counts = trie->taxa[rows[i].taxon].counts;
+		line.len = 0;
+		ok = textbuf_append(&line, name, strlen(name));
+		for (s = 0; ok && s < trie->sample_count; s++) {
+			otutable_format(table, counts[s], number);
+			ok = textbuf_putc(&line, '\t')
+			    && textbuf_append(&line, number, strlen(number));
+		}
+		ok = ok && textbuf_putc(&line, '\n');
+		if (ok) {
+			fwrite(line.data, 1, line.len, file);
+		}
+	}
+	if (!ok) {
+		errno = ENOMEM;
+	}
+	textbuf_free(&names);
+	textbuf_free(&line);
+	free(rows);
+	free(path);
+	return ok && !ferror(file);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	const char *input;
+	otutable *table;
+	unsigned long line;
+	summarytarget *targets;
+	size_t target_count;
+	size_t depth = 0;
+	bool *wanted;
+	lineagetrie trie;
+	int result = 0;
+	size_t otu;
+	size_t t;
+
+	/* Process command line arguments. */
+	while ((c = getopt(argc, argv, "")) != -1) {
+		switch (c) {
+		case '?':
+			if (isprint(optopt)) {
+				fprintf(stderr,
+					"Unknown option `-%c'.\n", optopt);
+			} else {
+				fprintf(stderr,
+					"Unknown option character `\\x%x'.\n",
+					(unsigned int)optopt);
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+	if (argc - optind < 2) {
+		fprintf(stderr,
+			"Usage: %s otu_table level:output [level:output ...]\n\tThe level is the number of names of each lineage to keep, counting from 1.\n",
+			argv[0]);
+		return 1;
+	}
+	input = argv[optind];
+	target_count = argc - optind - 1;
+	targets = calloc(target_count, sizeof(summarytarget));
+	if (targets == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (t = 0; t < target_count; t++) {
+		const char *arg = argv[optind + 1 + t];
+		const char *colon = strchr(arg, ':');
+		char *end;
+		if (colon == NULL || colon[1] == '\0') {
+			fprintf(stderr, "Bad target `%s'. It must be level:output.\n",
+				arg);
+			return 1;
+		}
+		targets[t].output = colon + 1;
+		targets[t].level = strtoul(arg, &end, 10);
+		if (end != colon || !isdigit(*arg) || targets[t].level < 1) {
+			fprintf(stderr, "Bad level in `%s'.\n", arg);
+			return 1;
+		}
+		if (targets[t].level > depth) {
+			depth = targets[t].level;
+		}
+	}
+	wanted = calloc(depth + 1, sizeof(bool));
+	if (wanted == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (t = 0; t < target_count; t++) {
+		wanted[targets[t].level] = true;
+	}
+
+	table = otutable_load(input, &line);
+	if (table == NULL) {
+		if (errno == EINVAL && line > 0) {
+			fprintf(stderr, "%s:%lu: Malformed OTU table.\n", input,
+				line);
+		} else {
+			perror(input);
+		}
+		return 1;
+	}
+	if (otutable_lineage_column(table) == NULL) {
+		fprintf(stderr, "%s: The OTU table has no lineages.\n", input);
+		return 1;
+	}
+
+	/* Every level is totalled from one walk down each OTU's lineage. */
+	memset(&trie, 0, sizeof(trie));
+	trie.sample_count = otutable_sample_count(table);
+	trie.wanted = wanted;
+	for (otu = 0; otu < otutable_otu_count(table); otu++) {
+		const uint32_t *samples;
+		const double *counts;
+		size_t entries = otutable_row(table, otu, &samples, &counts);
+		if (!trie_add(&trie, otutable_lineage(table, otu), depth, entries,
+			      samples, counts)) {
+			perror(argv[0]);
+			return 1;
+		}
+	}
+
+	for (t = 0; t < target_count; t++) {
+		const char *name = targets[t].output;
+		FILE *file = strcmp(name, "-") == 0 ? stdout : fopen(name, "w");
+		if (file == NULL) {
+			perror(name);
+			result = 1;
+		} else if (!write_summary(table, &trie, targets[t].level, file)
+			   | ((file == stdout ? fflush(file) : fclose(file)) != 0)) {
+			perror(name);
+			result = 1;
+		}
+	}
+	trie_free(&trie);
+	otutable_free(table);
+	free(wanted);
+	free(targets);
+	return result;
+}
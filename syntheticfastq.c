@@ -1,5 +1,4 @@
 /* Apply quality masks from real data onto synthetic data. */
-#include<bzlib.h>
 #include<ctype.h>
 #include<errno.h>
 #if !defined(__APPLE__)
@@ -8,57 +7,38 @@
 #include<fcntl.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 #include<sys/stat.h>
 #include<time.h>
 #include<unistd.h>
-#include<zlib.h>
-#include "kseq.h"
-
-/* Function pointers for file I/O such that we can deal with compressed files. */
-void *(*fileopen) (char *, char *) = (void *(*)(char *, char *))gzopen;
-int (*fileread) (void *, void *, int) = (int (*)(void *, void *, int))gzread;
-int (*fileclose) (void *) = (int (*)(void *))gzclose;
-
-/* Compatibility function to make BZ2_bzRead look like gzread. */
-int bzread(BZFILE * file, void *buf, int len)
-{
-	int bzerror = BZ_OK;
-	int retval = BZ2_bzRead(&bzerror, file, buf, len);
-	if (bzerror == BZ_OK || bzerror == BZ_STREAM_END) {
-		return retval;
-	} else {
-		fprintf(stderr, "bzip error %d\n", bzerror);
-		return -1;
-	}
-}
-
-KSEQ_INIT(void *, fileread)
+#include "fastq.h"
 
 int main(int argc, char **argv)
 {
 	int c;
 	int bzip = 0;
+	int threads = 1;
 	char *filename = NULL;
-	void *file;
-	kseq_t *seq;
+	inputfile *file;
+	fastqrecord seq;
 	int len;
 	char *syn;
 	int synlen;
 
 	/* Process command line arguments. */
-	while ((c = getopt(argc, argv, "jf:")) != -1) {
+	while ((c = getopt(argc, argv, "jf:t:")) != -1) {
 		switch (c) {
 		case 'j':
-			fileopen = (void *(*)(char *, char *))BZ2_bzopen;
-			fileread = (int (*)(void *, void *, int))bzread;
-			fileclose = (int (*)(void *))BZ2_bzclose;
 			bzip = 1;
 			break;
 		case 'f':
 			filename = optarg;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
 		case '?':
-			if (optopt == (int)'f') {
+			if (optopt == (int)'f' || optopt == (int)'t') {
 				fprintf(stderr,
 					"Option -%c requires an argument.\n",
 					optopt);
@@ -78,7 +58,7 @@ int main(int argc, char **argv)
 
 	if (filename == NULL || optind != argc - 1) {
 		fprintf(stderr,
-			"Usage: %s [-j] -f file.fastq sequence\n\t-j\tInput files are bzipped.\n",
+			"Usage: %s [-j] [-t threads] -f file.fastq sequence\n\t-j\tInput files are bzipped.\n\t-t\tNumber of threads to use for decompression.\n",
 			argv[0]);
 		return 1;
 	}
@@ -87,28 +67,26 @@ int main(int argc, char **argv)
 	synlen = strlen(syn);
 
 	/* Open files and initialise FASTQ reader. */
-	file = fileopen(filename, "r");
+	file = input_open(filename, bzip, threads);
 	if (file == NULL) {
 		perror(filename);
 		return 1;
 	}
-	seq = kseq_init(file);
-	while ((len = kseq_read(seq)) >= 0) {
-		int max = seq->qual.l < synlen ? seq->qual.l : synlen;
+	while ((len = fastq_read(file, &seq)) >= 0) {
+		int max = seq.qual_len < synlen ? seq.qual_len : synlen;
 		int i;
 
-		printf("@%s\n", seq->name.s);
+		printf("@%.*s\n", (int)seq.name_len, seq.name);
 		for (i = 0; i < max; i++) {
 			fputc((int) syn[i], stdout);
 		}
-		printf("\n+%s\n", seq->name.s);
+		printf("\n+%.*s\n", (int)seq.name_len, seq.name);
 		for (i = 0; i < max; i++) {
-			fputc((int) seq->qual.s[i], stdout);
+			fputc((int) seq.qual[i], stdout);
 		}
 		fputc((int)'\n', stdout);
 	}
-	kseq_destroy(seq);
-	if (fileclose(file) != Z_OK && bzip == 0) {
+	if (!input_close(file)) {
 		perror(filename);
 	}
 	return 0;
@@ -0,0 +1,331 @@
+/* Estimate the sequencing error rate from the index tags of Illumina reads */
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include "barcode.h"
+#include "tagerror.h"
+
+/* Tags are compared against this many candidates at a time. */
+#define TAGMATCH_BLOCK 256
+
+/*
+ * Each distinct character in the tags gets a small code, and a tag is stored bit-sliced: plane p holds bit p of the code of every position. The positions where two tags differ are then the OR over the planes of the planes XORed, and the distance is the population count of that.
+ *
+ * Characters that appear in no tag get code 0, which no tag uses, so they mismatch everything, just as comparing the characters would.
+ */
+struct tagmatcher {
+	size_t length;
+	size_t count;
+	int planes;
+	unsigned char codes[256];
+	/* Plane-major: plane p of tag t is bits[p * count + t]. */
+	uint64_t *bits;
+	/* Most reads are within a couple of mismatches of some tag, so look them up directly first. NULL if the tags cannot be indexed. */
+	barcodeindex *index;
+};
+
+static void tagmatcher_encode(const tagmatcher *matcher, const char *tag,
+			      uint64_t *planes)
+{
+	size_t i;
+	int p;
+	memset(planes, 0, matcher->planes * sizeof(uint64_t));
+	for (i = 0; i < matcher->length; i++) {
+		unsigned int code = matcher->codes[(unsigned char)tag[i]];
+		for (p = 0; p < matcher->planes; p++) {
+			planes[p] |= (uint64_t) ((code >> p) & 1) << i;
+		}
+	}
+}
+
+tagmatcher *tagmatcher_new(const char *const *tags, size_t count)
+{
+	tagmatcher *matcher;
+	unsigned int symbols = 0;
+	uint64_t planes[8];
+	size_t t;
+	int p;
+
+	if (count == 0 || strlen(tags[0]) > TAGMATCH_MAX_LENGTH) {
+		errno = EINVAL;
+		return NULL;
+	}
+	matcher = calloc(1, sizeof(tagmatcher));
+	if (matcher == NULL) {
+		return NULL;
+	}
+	matcher->length = strlen(tags[0]);
+	matcher->count = count;
+	for (t = 0; t < count; t++) {
+		size_t i;
+		if (strlen(tags[t]) != matcher->length) {
+			tagmatcher_free(matcher);
+			errno = EINVAL;
+			return NULL;
+		}
+		for (i = 0; i < matcher->length; i++) {
+			unsigned char c = tags[t][i];
+			if (matcher->codes[c] == 0) {
+				matcher->codes[c] = ++symbols;
+			}
+		}
+	}
+	for (matcher->planes = 1; (1u << matcher->planes) <= symbols;
+	     matcher->planes++) ;
+
+	matcher->bits = malloc(matcher->planes * count * sizeof(uint64_t));
+	if (matcher->bits == NULL) {
+		tagmatcher_free(matcher);
+		return NULL;
+	}
+	for (t = 0; t < count; t++) {
+		tagmatcher_encode(matcher, tags[t], planes);
+		for (p = 0; p < matcher->planes; p++) {
+			matcher->bits[p * count + t] = planes[p];
+		}
+	}
+	matcher->index = barcode_new(tags, count, 2, NULL, NULL);
+	return matcher;
+}
+
+size_t tagmatcher_length(const tagmatcher *matcher)
+{
+	return matcher->length;
+}
+
+size_t tagmatcher_count(const tagmatcher *matcher)
+{
+	return matcher->count;
+}
+
+static uint64_t tagmatcher_diff(const tagmatcher *matcher, size_t t,
+				const uint64_t *planes)
+{
+	uint64_t diff = 0;
+	int p;
+	for (p = 0; p < matcher->planes; p++) {
+		diff |= matcher->bits[p * matcher->count + t] ^ planes[p];
+	}
+	return diff;
+}
+
+size_t tagmatcher_nearest(const tagmatcher *matcher, const char *tag,
+			  uint64_t *mismatches)
+{
+	uint64_t planes[8];
+	uint64_t diff[TAGMATCH_BLOCK];
+	size_t best = 0;
+	int best_distance = matcher->length + 1;
+	size_t start;
+	int distance;
+	int sample;
+
+	tagmatcher_encode(matcher, tag, planes);
+	if (matcher->index != NULL) {
+		sample =
+		    barcode_nearest(matcher->index, tag, matcher->length,
+				    &distance);
+		if (sample >= 0) {
+			*mismatches = tagmatcher_diff(matcher, sample, planes);
+			return sample;
+		}
+	}
+	/* Work out the differences for a block of tags one plane at a time, which the compiler can vectorise, then pick out the closest. */
+	for (start = 0; start < matcher->count && best_distance > 0;
+	     start += TAGMATCH_BLOCK) {
+		size_t n = matcher->count - start;
+		size_t t;
+		int p;
+		if (n > TAGMATCH_BLOCK) {
+			n = TAGMATCH_BLOCK;
+		}
+		memset(diff, 0, n * sizeof(uint64_t));
+		for (p = 0; p < matcher->planes; p++) {
+			const uint64_t *plane =
+			    matcher->bits + p * matcher->count + start;
+			uint64_t read = planes[p];
+			for (t = 0; t < n; t++) {
+				diff[t] |= plane[t] ^ read;
+			}
+		}
+		for (t = 0; t < n; t++) {
+			distance = __builtin_popcountll(diff[t]);
+			if (distance < best_distance) {
+				best_distance = distance;
+				best = start + t;
+				*mismatches = diff[t];
+			}
+		}
+	}
+	return best;
+}
+
+void tagmatcher_free(tagmatcher *matcher)
+{
+	if (matcher->index != NULL) {
+		barcode_free(matcher->index);
+	}
+	free(matcher->bits);
+	free(matcher);
+}
+
+static tiletally *tagerrors_tile(tagerrors *errors, uint32_t lane,
+				 uint32_t tile)
+{
+	tiletally *tally;
+	size_t i;
+	if (errors->last_tile < errors->tile_count) {
+		tally = &errors->tiles[errors->last_tile];
+		if (tally->lane == lane && tally->tile == tile) {
+			return tally;
+		}
+	}
+	for (i = 0; i < errors->tile_count; i++) {
+		if (errors->tiles[i].lane == lane
+		    && errors->tiles[i].tile == tile) {
+			errors->last_tile = i;
+			return &errors->tiles[i];
+		}
+	}
+	if (errors->tile_count == errors->tile_size) {
+		size_t size = errors->tile_size < 16 ? 16 : 2 * errors->tile_size;
+		tiletally *bigger =
+		    realloc(errors->tiles, size * sizeof(tiletally));
+		if (bigger == NULL) {
+			return NULL;
+		}
+		errors->tiles = bigger;
+		errors->tile_size = size;
+	}
+	errors->last_tile = errors->tile_count++;
+	tally = &errors->tiles[errors->last_tile];
+	tally->lane = lane;
+	tally->tile = tile;
+	tally->reads = 0;
+	tally->mismatches = 0;
+	return tally;
+}
+
+bool tagerrors_add(tagerrors *errors, const tagmatcher *matcher,
+		   const seqheader *id, const char *name)
+{
+	tiletally *tally = tagerrors_tile(errors, id->lane, id->tile);
+	uint64_t mismatches;
+	unsigned long count;
+	size_t i;
+	if (tally == NULL) {
+		return false;
+	}
+	if (id->tag.length != matcher->length) {
+		count = matcher->length;
+		for (i = 0; i < matcher->length; i++) {
+			errors->cycles[i]++;
+		}
+	} else {
+		tagmatcher_nearest(matcher, name + id->tag.offset,
+				   &mismatches);
+		count = __builtin_popcountll(mismatches);
+		while (mismatches != 0) {
+			errors->cycles[__builtin_ctzll(mismatches)]++;
+			mismatches &= mismatches - 1;
+		}
+	}
+	errors->reads++;
+	errors->mismatches += count;
+	tally->reads++;
+	tally->mismatches += count;
+	return true;
+}
+
+bool tagerrors_merge(tagerrors *into, const tagerrors *from)
+{
+	size_t i;
+	into->reads += from->reads;
+	into->mismatches += from->mismatches;
+	for (i = 0; i < TAGMATCH_MAX_LENGTH; i++) {
+		into->cycles[i] += from->cycles[i];
+	}
+	for (i = 0; i < from->tile_count; i++) {
+		tiletally *tally = tagerrors_tile(into, from->tiles[i].lane,
+						  from->tiles[i].tile);
+		if (tally == NULL) {
+			return false;
+		}
+		tally->reads += from->tiles[i].reads;
+		tally->mismatches += from->tiles[i].mismatches;
+	}
+	return true;
+}
+
+void tagerrors_clear(tagerrors *errors)
+{
+	errors->reads = 0;
+	errors->mismatches = 0;
+	memset(errors->cycles, 0, sizeof(errors->cycles));
+	errors->tile_count = 0;
+	errors->last_tile = 0;
+}
+
+void tagerrors_print(const tagerrors *errors, const tagmatcher *matcher,
+		     FILE *output)
+{
+	fprintf(output, "TOTAL = %lu\nMISMATCHES = %lu\nQ = %f\n",
+		errors->reads * matcher->length, errors->mismatches,
+		(1.0 * errors->mismatches) / (errors->reads *
+					      matcher->length));
+}
+
+void tagerrors_print_cycles(const tagerrors *errors,
+			    const tagmatcher *matcher, FILE *output)
+{
+	size_t i;
+	fprintf(output, "#pos\tmismatches\tq\n");
+	for (i = 0; i < matcher->length; i++) {
+		fprintf(output, "%d\t%lu\t%f\n", (int)i, errors->cycles[i],
+			(1.0 * errors->cycles[i]) / errors->reads);
+	}
+}
+
+static int tiletally_compare(const void *a, const void *b)
+{
+	const tiletally *x = a;
+	const tiletally *y = b;
+	if (x->lane != y->lane) {
+		return x->lane < y->lane ? -1 : 1;
+	}
+	if (x->tile != y->tile) {
+		return x->tile < y->tile ? -1 : 1;
+	}
+	return 0;
+}
+
+bool tagerrors_print_tiles(const tagerrors *errors,
+			   const tagmatcher *matcher, FILE *output)
+{
+	tiletally *sorted;
+	size_t i;
+	sorted = malloc((errors->tile_count + 1) * sizeof(tiletally));
+	if (sorted == NULL) {
+		return false;
+	}
+	memcpy(sorted, errors->tiles, errors->tile_count * sizeof(tiletally));
+	qsort(sorted, errors->tile_count, sizeof(tiletally),
+	      tiletally_compare);
+	fprintf(output, "#lane\ttile\treads\tmismatches\tq\n");
+	for (i = 0; i < errors->tile_count; i++) {
+		fprintf(output, "%u\t%u\t%lu\t%lu\t%f\n", sorted[i].lane,
+			sorted[i].tile, sorted[i].reads, sorted[i].mismatches,
+			(1.0 * sorted[i].mismatches) / (sorted[i].reads *
+							matcher->length));
+	}
+	free(sorted);
+	return true;
+}
+
+void tagerrors_free(tagerrors *errors)
+{
+	free(errors->tiles);
+	errors->tiles = NULL;
+	errors->tile_count = 0;
+	errors->tile_size = 0;
+}
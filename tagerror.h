@@ -0,0 +1,58 @@
+/* Estimate the sequencing error rate from the index tags of Illumina reads */
+#ifndef AXIOME_TAGERROR_H
+#define AXIOME_TAGERROR_H
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<stdio.h>
+#include "parser.h"
+
+/* Tags are compared a machine word at a time, so they can be at most this long. */
+#define TAGMATCH_MAX_LENGTH 64
+
+typedef struct tagmatcher tagmatcher;
+
+/* Prepare to compare reads against a set of tags, which must all be the same length. Returns NULL and sets errno if they are not, are too long, or memory runs out. */
+tagmatcher *tagmatcher_new(const char *const *tags, size_t count);
+size_t tagmatcher_length(const tagmatcher *matcher);
+size_t tagmatcher_count(const tagmatcher *matcher);
+/* Find the first of the tags closest to a read's tag, which must be the same length. Returns its index and sets a bit in mismatches for each position where they differ. */
+size_t tagmatcher_nearest(const tagmatcher *matcher, const char *tag,
+			  uint64_t *mismatches);
+void tagmatcher_free(tagmatcher *matcher);
+
+typedef struct {
+	uint32_t lane;
+	uint32_t tile;
+	unsigned long reads;
+	unsigned long mismatches;
+} tiletally;
+
+/* Mismatch counts, overall, by position in the tag, and by tile. A zero-filled tagerrors is empty and ready to use. */
+typedef struct {
+	unsigned long reads;
+	unsigned long mismatches;
+	unsigned long cycles[TAGMATCH_MAX_LENGTH];
+	tiletally *tiles;
+	size_t tile_count;
+	size_t tile_size;
+	/* The tile last added to, since reads come grouped by tile. */
+	size_t last_tile;
+} tagerrors;
+
+/* Count the mismatches between a read's tag and the closest tag. A tag of the wrong length counts as mismatched at every position. Returns false if memory runs out. */
+bool tagerrors_add(tagerrors *errors, const tagmatcher *matcher,
+		   const seqheader *id, const char *name);
+bool tagerrors_merge(tagerrors *into, const tagerrors *from);
+void tagerrors_clear(tagerrors *errors);
+/* Write the totals, as aq-estimateq always has. */
+void tagerrors_print(const tagerrors *errors, const tagmatcher *matcher,
+		     FILE *output);
+/* Write one line per position: position, mismatches and error rate. */
+void tagerrors_print_cycles(const tagerrors *errors,
+			    const tagmatcher *matcher, FILE *output);
+/* Write one line per tile: lane, tile, reads, mismatches and error rate. Returns false if memory runs out. */
+bool tagerrors_print_tiles(const tagerrors *errors,
+			   const tagmatcher *matcher, FILE *output);
+void tagerrors_free(tagerrors *errors);
+#endif
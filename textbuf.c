@@ -0,0 +1,81 @@
+/* Growable buffers for building output text */
+#include<stdarg.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "textbuf.h"
+
+bool textbuf_reserve(textbuf *buf, size_t len)
+{
+	char *bigger;
+	size_t size;
+	if (buf->size - buf->len >= len) {
+		return true;
+	}
+	size = buf->size < 4096 ? 4096 : buf->size;
+	while (size - buf->len < len) {
+		size *= 2;
+	}
+	bigger = realloc(buf->data, size);
+	if (bigger == NULL) {
+		return false;
+	}
+	buf->data = bigger;
+	buf->size = size;
+	return true;
+}
+
+bool textbuf_append(textbuf *buf, const char *data, size_t len)
+{
+	if (!textbuf_reserve(buf, len)) {
+		return false;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return true;
+}
+
+bool textbuf_putc(textbuf *buf, char c)
+{
+	if (!textbuf_reserve(buf, 1)) {
+		return false;
+	}
+	buf->data[buf->len++] = c;
+	return true;
+}
+
+bool textbuf_ulong(textbuf *buf, unsigned long number)
+{
+	char digits[3 * sizeof(unsigned long)];
+	char *pos = digits + sizeof(digits);
+	do {
+		*--pos = '0' + number % 10;
+		number /= 10;
+	} while (number > 0);
+	return textbuf_append(buf, pos, digits + sizeof(digits) - pos);
+}
+
+bool textbuf_printf(textbuf *buf, const char *format, ...)
+{
+	va_list args;
+	int len;
+	va_start(args, format);
+	len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (len < 0 || !textbuf_reserve(buf, len + 1)) {
+		return false;
+	}
+	va_start(args, format);
+	vsnprintf(buf->data + buf->len, len + 1, format, args);
+	va_end(args);
+	buf->len += len;
+	return true;
+}
+
+void textbuf_free(textbuf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->len = 0;
+	buf->size = 0;
+}
@@ -0,0 +1,22 @@
+/* Growable buffers for building output text */
+#ifndef AXIOME_TEXTBUF_H
+#define AXIOME_TEXTBUF_H
+#include<stdbool.h>
+#include<stddef.h>
+
+/* A zero-filled textbuf is empty and ready to use. The contents are not NUL-terminated. */
+typedef struct {
+	char *data;
+	size_t len;
+	size_t size;
+} textbuf;
+
+/* Make room for at least len more bytes after the contents. */
+bool textbuf_reserve(textbuf *buf, size_t len);
+/* Each of these returns false if memory could not be allocated, leaving the buffer as it was. */
+bool textbuf_append(textbuf *buf, const char *data, size_t len);
+bool textbuf_putc(textbuf *buf, char c);
+bool textbuf_ulong(textbuf *buf, unsigned long number);
+bool textbuf_printf(textbuf *buf, const char *format, ...);
+void textbuf_free(textbuf *buf);
+#endif